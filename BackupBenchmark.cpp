@@ -0,0 +1,237 @@
+#include "BackupBenchmark.h"
+#include "BackupEngine.h"
+#include "BenchmarkFolder.h"
+#include "SaveTreeGenerator.h"
+#include "SnapshotCatalog.h"
+#include "SnapshotRestore.h"
+#include "SnapshotTrash.h"
+
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+
+#define NOMINMAX
+#include <Windows.h>
+#include <Psapi.h>
+
+#define BACKUP_BENCHMARK_GAME_NAME "Benchmark"
+#define BACKUP_BENCHMARK_SEED 20240103
+
+//Column left empty, throughput or bytes written don't mean anything for the phase.
+#define NOT_MEASURED UINT64_MAX
+
+namespace
+{
+    //The engine, the store and the catalog all work under ./Backups, so each format runs with its own folder as the
+    // working folder.  Puts the previous one back however the run ends.
+    class ScopedWorkingFolder
+    {
+    public:
+        explicit ScopedWorkingFolder(const std::filesystem::path& folder)
+            : previous_folder(std::filesystem::current_path())
+        {
+            std::filesystem::create_directories(folder);
+            std::filesystem::current_path(folder);
+        }
+
+        ~ScopedWorkingFolder()
+        {
+            std::error_code error;
+            std::filesystem::current_path(previous_folder, error);
+        }
+
+        ScopedWorkingFolder(const ScopedWorkingFolder&) = delete;
+        ScopedWorkingFolder& operator=(const ScopedWorkingFolder&) = delete;
+
+    private:
+        std::filesystem::path previous_folder;
+    };
+
+    uint64_t PeakMemoryUsage()
+    {
+        PROCESS_MEMORY_COUNTERS counters = {};
+        counters.cb = sizeof(counters);
+        if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        {
+            return 0;
+        }
+        return counters.PeakWorkingSetSize;
+    }
+
+    template <typename Function>
+    double TimePhase(Function&& phase)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        phase();
+        const auto end = std::chrono::steady_clock::now();
+
+        return std::chrono::duration<double>(end - start).count();
+    }
+
+    //A fresh engine every time, the same as every run of the command line pays for.
+    GameBackupResult BackupSave(const BackupSettings& settings, const std::filesystem::path& save_path)
+    {
+        BackupEngine backup_engine(settings);
+        const std::vector<GameBackupResult> results = backup_engine.BackupGames({ { BACKUP_BENCHMARK_GAME_NAME, save_path } });
+        if (results.front().status == GameBackupStatus::Failed)
+        {
+            throw std::runtime_error("Backup failed: " + results.front().error);
+        }
+        return results.front();
+    }
+
+    size_t ListSnapshots()
+    {
+        SnapshotCatalog catalog(SNAPSHOT_CATALOG_PATH, BACKUPS_ROOT_PATH);
+        return catalog.Snapshots(BACKUP_BENCHMARK_GAME_NAME).size();
+    }
+
+    void PrintColumn(uint64_t value, double scale)
+    {
+        if (value == NOT_MEASURED)
+        {
+            std::cout << std::setw(12) << "-";
+        }
+        else
+        {
+            std::cout << std::setw(12) << value / scale;
+        }
+    }
+
+    void PrintPhaseRow(const std::string& name, double seconds, uint64_t total_bytes, uint64_t total_files, uint64_t bytes_written)
+    {
+        const double megabyte = 1024.0 * 1024.0;
+
+        std::cout << std::left << std::setw(30) << name << std::right << std::fixed << std::setprecision(3) << std::setw(12) << seconds << std::setprecision(1);
+        PrintColumn(total_bytes, megabyte * seconds);
+        PrintColumn(total_files, seconds);
+        PrintColumn(bytes_written, megabyte);
+        PrintColumn(PeakMemoryUsage(), megabyte);
+        std::cout << std::endl;
+    }
+
+    void PrintPhaseHeader(const std::string& first_column)
+    {
+        std::cout << std::left << std::setw(30) << first_column << std::right << std::setw(12) << "Seconds" << std::setw(12) << "MB/s" << std::setw(12) << "Files/s"
+                  << std::setw(12) << "Written MB" << std::setw(12) << "Peak RSS MB" << std::endl;
+        std::cout << std::string(90, '-') << std::endl;
+    }
+
+    void RunFormatBenchmark(const BackupSettings& settings, SnapshotFormat format, const std::filesystem::path& format_folder)
+    {
+        std::filesystem::remove_all(format_folder);
+        ScopedWorkingFolder working_folder(format_folder);
+
+        //Nothing may rotate out before the prune phase, whatever settings.ini says.
+        BackupSettings format_settings = settings;
+        format_settings.snapshot_format = format;
+        format_settings.retention = RetentionPolicy();
+        format_settings.retention.keep_last = BACKUP_BENCHMARK_ROUNDS + 10;
+        format_settings.game_retention.clear();
+        format_settings.disk_budget_mb = 0;
+
+        SaveTreeGenerator generator(format_folder / "games" / BACKUP_BENCHMARK_GAME_NAME, SaveTreeShape(), BACKUP_BENCHMARK_SEED);
+        generator.Generate();
+
+        std::cout << std::endl << SnapshotFormatName(format) << ": " << generator.FileCount() << " files, " << generator.TotalBytes() / (1024 * 1024) << " MB" << std::endl;
+        PrintPhaseHeader("Phase");
+
+        GameBackupResult backup;
+        double seconds = TimePhase([&] { backup = BackupSave(format_settings, generator.Root()); });
+        PrintPhaseRow("full backup", seconds, generator.TotalBytes(), generator.FileCount(), backup.bytes_written);
+
+        seconds = TimePhase([&] { backup = BackupSave(format_settings, generator.Root()); });
+        if (backup.status != GameBackupStatus::Unchanged)
+        {
+            throw std::runtime_error("An unchanged save was backed up again");
+        }
+        PrintPhaseRow("no-op backup", seconds, generator.TotalBytes(), generator.FileCount(), backup.bytes_written);
+
+        //Changing the tree isn't timed, only the backups after each change.
+        seconds = 0;
+        uint64_t bytes_written = 0;
+        std::string latest_snapshot;
+        for (int round = 0; round < BACKUP_BENCHMARK_ROUNDS; round++)
+        {
+            generator.Mutate();
+            seconds += TimePhase([&] { backup = BackupSave(format_settings, generator.Root()); });
+            bytes_written += backup.bytes_written;
+            latest_snapshot = backup.snapshot_name;
+        }
+        PrintPhaseRow("incremental backup (avg)", seconds / BACKUP_BENCHMARK_ROUNDS, generator.TotalBytes(), generator.FileCount(), bytes_written / BACKUP_BENCHMARK_ROUNDS);
+
+        size_t listed = 0;
+        seconds = TimePhase([&] { listed = ListSnapshots(); });
+        PrintPhaseRow("list", seconds, NOT_MEASURED, NOT_MEASURED, NOT_MEASURED);
+
+        std::filesystem::remove_all(SNAPSHOT_CATALOG_PATH);
+        seconds = TimePhase([&] { listed = ListSnapshots(); });
+        if (listed != BACKUP_BENCHMARK_ROUNDS + 1)
+        {
+            throw std::runtime_error("Catalog lists " + std::to_string(listed) + " snapshots instead of " + std::to_string(BACKUP_BENCHMARK_ROUNDS + 1));
+        }
+        PrintPhaseRow("list, catalog rebuilt", seconds, NOT_MEASURED, NOT_MEASURED, NOT_MEASURED);
+
+        //The last backup was taken right after the last change, so the snapshot holds exactly what the generator knows about.
+        const std::filesystem::path snapshot_path = GameBackupFolder(BACKUP_BENCHMARK_GAME_NAME) / std::filesystem::u8path(latest_snapshot);
+
+        RestoreResult restore;
+        seconds = TimePhase([&] { restore = RestoreSnapshot(snapshot_path, format_folder / "restore" / BACKUP_BENCHMARK_GAME_NAME, false); });
+        PrintPhaseRow("restore, empty folder", seconds, generator.TotalBytes(), generator.FileCount(), restore.bytes_written);
+
+        generator.Mutate();
+        seconds = TimePhase([&] { restore = RestoreSnapshot(snapshot_path, generator.Root(), false); });
+        PrintPhaseRow("restore, changed save", seconds, generator.TotalBytes(), generator.FileCount(), restore.bytes_written);
+
+        seconds = TimePhase([&]
+            {
+                BackupEngine backup_engine(format_settings);
+                backup_engine.PruneSnapshots(BACKUP_BENCHMARK_GAME_NAME, 1);
+                backup_engine.Store().CollectGarbage();
+            });
+        PrintPhaseRow("prune to 1", seconds, NOT_MEASURED, NOT_MEASURED, NOT_MEASURED);
+
+        //Nobody waits on this outside the benchmark, but the format folder is deleted next.
+        seconds = TimePhase([] { WaitForEmptyTrash(); });
+        PrintPhaseRow("empty trash (background)", seconds, NOT_MEASURED, NOT_MEASURED, NOT_MEASURED);
+    }
+}
+
+int RunBackupBenchmark(const BackupSettings& settings, const std::filesystem::path& parent_folder, const std::vector<SnapshotFormat>& formats)
+{
+    //Format folders (and the save trees the generator replaces in them) only ever go inside this one.
+    std::unique_ptr<BenchmarkFolder> benchmark_folder;
+    try
+    {
+        benchmark_folder = std::make_unique<BenchmarkFolder>(parent_folder);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    const std::filesystem::path& absolute_work_folder = benchmark_folder->Path();
+    std::cout << "Benchmarking backups in " << absolute_work_folder << ", " << BACKUP_BENCHMARK_ROUNDS << " incremental rounds per format..." << std::endl;
+
+    int exit_code = 0;
+    for (const auto format : formats)
+    {
+        try
+        {
+            RunFormatBenchmark(settings, format, absolute_work_folder / SnapshotFormatName(format));
+        }
+        catch (const std::exception& e)
+        {
+            std::cout << SnapshotFormatName(format) << " failed: " << e.what() << std::endl;
+            exit_code = 1;
+        }
+    }
+
+    return exit_code;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+//Times the whole backup cycle against a generated save tree, run with "SaveBackupManager.exe benchmark-backup [folder] [format]".
+// For each snapshot format (or just the one given) it backs up a fresh tree, backs it up again unchanged, then changes it
+// the way a game saves and backs it up BACKUP_BENCHMARK_ROUNDS more times.  Listing is timed from the catalog and again with
+// the catalog rebuilt from a scan, restoring into an empty folder and over a changed save, and finally pruning down to one
+// snapshot.  Every format gets the same tree and the same changes, so the rows can be compared across formats and builds.
+// Everything is written to a SaveBackupManager.benchmark folder inside the given one and only that is deleted afterwards,
+// see BenchmarkFolder.h.
+//
+// Peak RSS is the process's peak working set once the phase is done.  Windows never lowers it, so a phase only shows its own
+// peak when it's higher than everything that ran before it.
+
+#include "Settings.h"
+
+#include <filesystem>
+#include <vector>
+
+#define BACKUP_BENCHMARK_DEFAULT_FOLDER "."
+#define BACKUP_BENCHMARK_ROUNDS 5
+
+int RunBackupBenchmark(const BackupSettings& settings, const std::filesystem::path& parent_folder, const std::vector<SnapshotFormat>& formats);
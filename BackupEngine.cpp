@@ -0,0 +1,1112 @@
+#include "BackupEngine.h"
+#include "BatchCopy.h"
+#include "FileCopy.h"
+#include "FileDelta.h"
+#include "FolderTree.h"
+#include "Hashing.h"
+#include "SnapshotArchive.h"
+#include "SnapshotTrash.h"
+#include "SnapshotVerify.h"
+#include "Telemetry.h"
+#include "Timestamps.h"
+
+#include <algorithm>
+#include <atomic>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+
+//Files flushed one after the other by a single task when committing a snapshot.
+#define SNAPSHOT_FLUSH_BATCH_SIZE 64
+//A delta bigger than this share of its file isn't worth keeping, the file is stored whole instead.
+#define DELTA_MAX_SHARE_OF_FILE 4
+
+namespace
+{
+    IndexEntry ListedEntry(const FolderTree& tree, size_t index)
+    {
+        const FolderTreeEntry& entry = tree.Entries()[index];
+
+        IndexEntry index_entry;
+        index_entry.is_directory = entry.is_directory;
+        index_entry.relative_path = tree.RelativePath(index);
+        index_entry.size = entry.size;
+        index_entry.modified_time = entry.modified_time;
+        return index_entry;
+    }
+
+    //For every entry of current_tree, the index of the same entry in listed_tree (whose entries are listed_entries), or
+    // FOLDER_TREE_ROOT if it's new or changed since.  Files have to keep their size and time, folders just have to still be
+    // folders.  unchanged_count is how many matched.
+    std::vector<uint32_t> MatchListing(const std::vector<IndexEntry>& listed_entries, const FolderTree& listed_tree, const FolderTree& current_tree, size_t& unchanged_count)
+    {
+        std::unordered_map<std::string, uint32_t> listed_paths;
+        listed_paths.reserve(listed_entries.size());
+        for (size_t i = 0; i < listed_entries.size(); i++)
+        {
+            listed_paths.emplace(listed_entries[i].relative_path, static_cast<uint32_t>(i));
+        }
+
+        unchanged_count = 0;
+        std::vector<uint32_t> listed_index(current_tree.Entries().size(), FOLDER_TREE_ROOT);
+        for (size_t i = 0; i < current_tree.Entries().size(); i++)
+        {
+            const auto found = listed_paths.find(current_tree.RelativePath(i));
+            if (found == listed_paths.end())
+            {
+                continue;
+            }
+
+            const FolderTreeEntry& current = current_tree.Entries()[i];
+            const FolderTreeEntry& listed = listed_tree.Entries()[found->second];
+            if (current.is_directory == listed.is_directory &&
+                (current.is_directory || (current.size == listed.size && current.modified_time == listed.modified_time)))
+            {
+                listed_index[i] = found->second;
+                unchanged_count++;
+            }
+        }
+        return listed_index;
+    }
+}
+
+std::filesystem::path GameBackupFolder(const std::string& game_name)
+{
+    return std::filesystem::path(BACKUPS_ROOT_PATH) / std::filesystem::u8path(game_name);
+}
+
+BackupEngine::BackupEngine(const BackupSettings& settings)
+    : settings(settings),
+      pool(static_cast<size_t>(std::max(settings.worker_threads, 0))),
+      throttle(settings.volume_concurrency, settings.default_volume_concurrency),
+      chunk_store(CHUNK_STORE_PATH),
+      catalog(SNAPSHOT_CATALOG_PATH, BACKUPS_ROOT_PATH)
+{
+    //Pick up deleting whatever snapshots an earlier run rotated out but didn't get to delete before it exited.
+    EmptyTrashInBackground();
+}
+
+std::vector<GameBackupResult> BackupEngine::BackupGames(const std::vector<std::pair<std::string, std::filesystem::path>>& games)
+{
+    std::vector<GameBackupResult> results(games.size());
+
+    //Chunked backups keep the store locked against other instances until every snapshot is committed and the counts saved,
+    // references they took and haven't written into a manifest yet would otherwise look unused to anyone collecting garbage.
+    std::unique_ptr<ChunkStore::Hold> store_hold;
+    if (settings.snapshot_format == SnapshotFormat::Chunked)
+    {
+        try
+        {
+            store_hold = std::make_unique<ChunkStore::Hold>(chunk_store);
+        }
+        catch (const std::exception& e)
+        {
+            for (size_t i = 0; i < games.size(); i++)
+            {
+                results[i].game_name = games[i].first;
+                results[i].status = GameBackupStatus::Failed;
+                results[i].error = e.what();
+            }
+            last_retention = RetentionResult();
+            return results;
+        }
+    }
+
+    TaskGroup game_tasks(pool);
+
+    //Garbage still queued in the store (all of it, after counts were rebuilt) is swept alongside the backups.  Any error
+    // turns up again in the collection after retention below.
+    game_tasks.Run([this]
+    {
+        try
+        {
+            chunk_store.CollectGarbage();
+        }
+        catch (const std::exception&)
+        {
+        }
+    });
+
+    for (size_t i = 0; i < games.size(); i++)
+    {
+        game_tasks.Run([this, &games, &results, i]
+        {
+            const uint64_t start_time = TelemetryTimestamp();
+            {
+                TelemetryPhase phase("back up game", games[i].first);
+                try
+                {
+                    results[i] = BackupGame(games[i].first, games[i].second);
+                }
+                catch (const std::exception& e)
+                {
+                    results[i].game_name = games[i].first;
+                    results[i].status = GameBackupStatus::Failed;
+                    results[i].error = e.what();
+                }
+            }
+            RecordGameTotals(games[i].first, start_time, results[i].files_stored, results[i].files_reused, results[i].bytes_written);
+        });
+    }
+    game_tasks.Wait();
+
+    //Rotation runs once for everything, the disk budget is shared by every game.
+    last_retention = RetentionResult();
+    const bool any_backed_up = std::any_of(results.begin(), results.end(), [](const GameBackupResult& result) { return result.status == GameBackupStatus::BackedUp; });
+    if (any_backed_up)
+    {
+        last_retention = ApplyRetention();
+        for (const auto& removal : last_retention.removed)
+        {
+            for (auto& result : results)
+            {
+                if (result.game_name == removal.snapshot.game_name)
+                {
+                    result.snapshots_rotated_out = true;
+                }
+            }
+        }
+    }
+    else
+    {
+        //Abandoned snapshots still changed the reference counts.
+        try
+        {
+            last_retention.chunks_removed = chunk_store.CollectGarbage();
+        }
+        catch (const std::exception& e)
+        {
+            last_retention.error = std::string("Error cleaning up unused backup data: ") + e.what();
+        }
+    }
+
+    return results;
+}
+
+RetentionResult BackupEngine::ApplyRetention(const std::vector<std::string>& game_names)
+{
+    TelemetryPhase phase("retention");
+
+    RetentionResult retention;
+    auto remove = [&](SnapshotRemoval& removal)
+    {
+        try
+        {
+            const uint64_t freed_bytes = RemoveSnapshot(removal.snapshot.game_name, removal.snapshot.snapshot_name);
+            retention.removed.push_back(removal);
+            return freed_bytes;
+        }
+        catch (const std::exception& e)
+        {
+            if (retention.error.empty())
+            {
+                retention.error = std::string("Error removing old backup of ") + removal.snapshot.game_name + ": " + e.what();
+            }
+            return static_cast<uint64_t>(0);
+        }
+    };
+    auto selected = [&](const CatalogSnapshot& snapshot)
+    {
+        return game_names.empty() || std::find(game_names.begin(), game_names.end(), snapshot.game_name) != game_names.end();
+    };
+
+    for (auto& removal : PlanRetention(settings, catalog.AllSnapshots(), std::time(nullptr)))
+    {
+        if (selected(removal.snapshot))
+        {
+            remove(removal);
+        }
+    }
+
+    //Disk budget: the oldest snapshots go until what's left fits, counting only what each removal really freed.  Data newer
+    // snapshots still use stays on disk (and in their stored size).
+    const uint64_t budget_bytes = settings.disk_budget_mb * 1024 * 1024;
+    if (settings.disk_budget_mb > 0)
+    {
+        const std::vector<CatalogSnapshot> snapshots = catalog.AllSnapshots();
+        uint64_t used_bytes = 0;
+        for (const auto& snapshot : snapshots)
+        {
+            used_bytes += snapshot.stored_size;
+        }
+
+        for (const auto& candidate : BudgetCandidates(snapshots))
+        {
+            if (used_bytes <= budget_bytes)
+            {
+                break;
+            }
+            if (!selected(candidate))
+            {
+                continue;
+            }
+
+            SnapshotRemoval removal = { candidate, "over disk_budget_mb" };
+            used_bytes -= std::min(remove(removal), used_bytes);
+        }
+    }
+
+    //Removed snapshots may have been the last ones using some chunks, drop those from the store.
+    try
+    {
+        retention.chunks_removed = chunk_store.CollectGarbage();
+    }
+    catch (const std::exception& e)
+    {
+        if (retention.error.empty())
+        {
+            retention.error = std::string("Error cleaning up unused backup data: ") + e.what();
+        }
+    }
+
+    return retention;
+}
+
+GameBackupResult BackupEngine::BackupGame(const std::string& game_name, const std::filesystem::path& save_path)
+{
+    GameBackupResult result;
+    result.game_name = game_name;
+
+    //Get current time and append to the path for our save backup
+    const std::filesystem::path backup_folder = GameBackupFolder(game_name);
+    if (!std::filesystem::exists(backup_folder))
+    {
+        //Create this save game backup folder if doesn't exist
+        std::filesystem::create_directories(backup_folder);
+    }
+
+    //Everything is written into a staging folder next to the snapshots and only renamed to its real name once it's complete
+    // and on disk, so a crash or Ctrl+C part way leaves the existing history alone and no half copied snapshot behind.
+    // Staging folders left over from a run that was cut off are just thrown away.
+    TelemetryPhase cleanup_phase("clean up staging", game_name);
+    std::vector<std::filesystem::path> abandoned_staging_paths;
+    for (const auto& entry : std::filesystem::directory_iterator(backup_folder))
+    {
+        if (IsStagingName(entry.path().filename().u8string()))
+        {
+            abandoned_staging_paths.push_back(entry.path());
+        }
+    }
+    for (const auto& abandoned_staging_path : abandoned_staging_paths)
+    {
+        DiscardFolder(abandoned_staging_path);
+    }
+    cleanup_phase.Stop();
+
+    std::filesystem::path backup_path = backup_folder / std::filesystem::u8path(NewSnapshotName(backup_folder));
+
+    //Skip the game entirely if nothing changed since the last snapshot, so an identical copy doesn't rotate out real history.
+    const std::filesystem::path change_index_path = backup_folder / CHANGE_INDEX_NAME;
+
+    //One listing of the save folder serves both the change check and the snapshot.  Sizes and times come from it, taken before
+    // any file is read, so a write that lands mid-read still shows up as a change next run.
+    TelemetryPhase walk_phase("walk save folder", game_name);
+    FolderTree save_tree(save_path);
+    walk_phase.Stop();
+
+    TelemetryPhase detect_phase("detect changes", game_name);
+    ChangeIndex change_index;
+    if (change_index.Load(change_index_path) && std::filesystem::exists(backup_folder / std::filesystem::u8path(change_index.snapshot_name)))
+    {
+        bool save_changed = true;
+        try
+        {
+            save_changed = change_index.DetectChanges(save_tree);
+        }
+        catch (const std::exception&)
+        {
+            //Can't tell, so back it up anyway.
+        }
+
+        if (!save_changed)
+        {
+            if (change_index.NeedsSave())
+            {
+                change_index.Save(change_index_path);
+            }
+
+            result.status = GameBackupStatus::Unchanged;
+            return result;
+        }
+    }
+
+    detect_phase.Stop();
+
+    std::filesystem::path staging_path = backup_path;
+    staging_path += SNAPSHOT_STAGING_SUFFIX;
+    std::filesystem::create_directories(staging_path);
+
+    //Every entry of the listing gets a fixed slot, the copies below then run in any order.
+    SnapshotJob job;
+    job.game_name = game_name;
+    job.save_path = save_path;
+    job.snapshot_path = staging_path;
+
+    //Root directory of save folder, every snapshot path starts with it so restores land in the same layout
+    job.save_dir = std::filesystem::relative(save_path, save_path.parent_path()).generic_u8string();
+
+    job.entries.reserve(save_tree.Entries().size());
+    job.source_paths.reserve(save_tree.Entries().size());
+    for (size_t i = 0; i < save_tree.Entries().size(); i++)
+    {
+        job.entries.push_back(ListedEntry(save_tree, i));
+        job.source_paths.push_back(save_path / std::filesystem::u8path(job.entries.back().relative_path));
+    }
+
+    //With consistent capture the save folder is listed again after every pass, and files that changed while it ran are
+    // stored again until a pass goes by without changes.  Files only ever change on disk after their listing, so an
+    // unchanged listing means every file was read as it is now.
+    bool snapshot_stored = false;
+    while (true)
+    {
+        TelemetryPhase store_phase("store files", game_name);
+        switch (settings.snapshot_format)
+        {
+        case SnapshotFormat::Chunked:
+            snapshot_stored = StoreChunkedSnapshot(job, result);
+            break;
+        case SnapshotFormat::Linked:
+            snapshot_stored = StoreLinkedSnapshot(job, change_index, result);
+            break;
+        case SnapshotFormat::Archive:
+            snapshot_stored = StoreArchivedSnapshot(job, result);
+            break;
+        }
+        store_phase.Stop();
+        result.capture_passes++;
+
+        if (!snapshot_stored || !settings.consistent_capture)
+        {
+            break;
+        }
+
+        TelemetryPhase recheck_phase("recheck save folder", game_name);
+        FolderTree current_tree(save_path);
+        size_t unchanged_count = 0;
+        const std::vector<uint32_t> listed_index = MatchListing(job.entries, save_tree, current_tree, unchanged_count);
+        if (unchanged_count == job.entries.size() && unchanged_count == current_tree.Entries().size())
+        {
+            break;
+        }
+
+        if (result.capture_passes > settings.capture_retries)
+        {
+            //Out of retries, the snapshot keeps what the passes stored.  Its change index still has the sizes and times
+            // listed before the last pass, so the next backup picks up whatever changed since.
+            result.capture_settled = false;
+            break;
+        }
+
+        PrepareRecapture(job, current_tree, listed_index);
+        save_tree = std::move(current_tree);
+    }
+
+    //Commit: flush what was written, then publish the snapshot under its real name in one rename.
+    if (snapshot_stored && FlushSnapshotFiles(job, result))
+    {
+        try
+        {
+            TelemetryPhase phase("commit", game_name);
+            MoveDurably(staging_path, backup_path);
+        }
+        catch (const std::exception& e)
+        {
+            result.error = std::string("Error committing backup: ") + e.what();
+            snapshot_stored = false;
+        }
+    }
+    else
+    {
+        snapshot_stored = false;
+    }
+
+    if (!snapshot_stored)
+    {
+        //if we failed to do so, remove the backup folder we created and all data we tried to backup there
+        DiscardFolder(staging_path);
+        chunk_store.ReleaseReferences(job.manifest);
+        chunk_store.ReleaseReferences(job.replaced);
+
+        result.status = GameBackupStatus::Failed;
+        return result;
+    }
+
+    //Chunks of file versions an earlier capture pass stored were kept until now, their files had to stay on disk for the flush.
+    chunk_store.ReleaseReferences(job.replaced);
+
+    TelemetryPhase phase("record snapshot", game_name);
+
+    //Remember what this snapshot looked like so the next run can tell if anything changed.
+    ChangeIndex new_change_index;
+    for (const auto& entry : job.entries)
+    {
+        new_change_index.Add(entry);
+    }
+    new_change_index.snapshot_name = backup_path.filename().u8string();
+    new_change_index.Save(change_index_path);
+
+    CatalogSnapshot catalog_entry;
+    catalog_entry.game_name = game_name;
+    catalog_entry.snapshot_name = new_change_index.snapshot_name;
+    catalog_entry.created_time = ParseBackupTimestamp(catalog_entry.snapshot_name);
+    catalog_entry.stored_size = result.bytes_written;
+    catalog_entry.format = settings.snapshot_format;
+
+    //Fingerprint of the whole snapshot, equal for two snapshots holding the same data.
+    Xxh64 fingerprint;
+    for (const auto& entry : job.entries)
+    {
+        if (entry.is_directory)
+        {
+            continue;
+        }
+
+        const uint64_t content = entry.has_content_hash ? entry.content_hash : static_cast<uint64_t>(entry.modified_time);
+        fingerprint.Update(entry.relative_path.data(), entry.relative_path.size() + 1);
+        fingerprint.Update(&entry.size, sizeof(entry.size));
+        fingerprint.Update(&content, sizeof(content));
+
+        catalog_entry.total_size += entry.size;
+        catalog_entry.file_count++;
+    }
+    catalog_entry.fingerprint = fingerprint.Final();
+    catalog.Add(catalog_entry);
+
+    result.snapshot_name = new_change_index.snapshot_name;
+    result.status = GameBackupStatus::BackedUp;
+    return result;
+}
+
+std::vector<std::string> BackupEngine::PruneSnapshots(const std::string& game_name, int keep_count)
+{
+    //The catalog lists this game's snapshots oldest first, no need to scan the backup folder for them.
+    std::vector<CatalogSnapshot> existing_snapshots = catalog.Snapshots(game_name);
+    int count = static_cast<int>(existing_snapshots.size());
+
+    std::vector<std::string> removed_snapshots;
+    for (const auto& snapshot : existing_snapshots)
+    {
+        if (count <= keep_count)
+        {
+            break;
+        }
+
+        RemoveSnapshot(game_name, snapshot.snapshot_name);
+        removed_snapshots.push_back(snapshot.snapshot_name);
+        count--;
+    }
+
+    return removed_snapshots;
+}
+
+uint64_t BackupEngine::RemoveSnapshot(const std::string& game_name, const std::string& snapshot_name)
+{
+    TelemetryPhase phase("remove snapshot", game_name);
+    const std::filesystem::path snapshot_path = GameBackupFolder(game_name) / std::filesystem::u8path(snapshot_name);
+
+    //Read before the folder goes, its references are only given back once it's really gone.
+    SnapshotManifest manifest;
+    if (!ReadManifest(snapshot_path / SNAPSHOT_MANIFEST_NAME, manifest))
+    {
+        manifest.entries.clear();
+    }
+
+    const std::vector<CatalogSnapshot> game_snapshots = catalog.Snapshots(game_name);
+    const auto removed = std::find_if(game_snapshots.begin(), game_snapshots.end(),
+                                      [&](const CatalogSnapshot& snapshot) { return snapshot.snapshot_name == snapshot_name; });
+
+    //Chunked snapshots free the chunks they held the last reference to, linked and archived ones the files no other snapshot
+    // links to.  A backup only ever links files of the snapshot before it, so the snapshots holding a file are always next to
+    // each other and looking at the two neighbours is enough (link counts would also see snapshots still in the trash).
+    // Neither counts the manifest or hash list, stored sizes don't either.
+    uint64_t freed_bytes = 0;
+    if (manifest.entries.empty())
+    {
+        std::vector<std::filesystem::path> neighbour_paths;
+        if (removed != game_snapshots.end() && removed != game_snapshots.begin())
+        {
+            neighbour_paths.push_back(GameBackupFolder(game_name) / std::filesystem::u8path((removed - 1)->snapshot_name));
+        }
+        if (removed != game_snapshots.end() && removed + 1 != game_snapshots.end())
+        {
+            neighbour_paths.push_back(GameBackupFolder(game_name) / std::filesystem::u8path((removed + 1)->snapshot_name));
+        }
+
+        std::error_code error;
+        for (std::filesystem::recursive_directory_iterator it(snapshot_path, error), end; !error && it != end; it.increment(error))
+        {
+            std::error_code file_error;
+            if (!it->is_regular_file(file_error) || it->path().filename() == SNAPSHOT_HASHES_NAME)
+            {
+                continue;
+            }
+
+            const std::filesystem::path relative_path = it->path().lexically_relative(snapshot_path);
+            const bool shared = std::any_of(neighbour_paths.begin(), neighbour_paths.end(), [&](const std::filesystem::path& neighbour_path)
+            {
+                std::error_code compare_error;
+                return std::filesystem::equivalent(neighbour_path / relative_path, it->path(), compare_error);
+            });
+            const uint64_t file_size = it->file_size(file_error);
+            if (!shared && !file_error)
+            {
+                freed_bytes += file_size;
+            }
+        }
+    }
+
+    //Gone as far as anyone can tell the moment it's renamed into the trash, the files are deleted in the background.
+    MoveToTrash(snapshot_path);
+    catalog.Remove(game_name, snapshot_name);
+    freed_bytes += chunk_store.ReleaseReferences(manifest);
+
+    //Whatever of its stored size is still on disk for newer snapshots' sake moves to the next one, see SnapshotCatalog.h.
+    if (removed != game_snapshots.end() && removed + 1 != game_snapshots.end() && removed->stored_size > freed_bytes)
+    {
+        const CatalogSnapshot& next = *(removed + 1);
+        catalog.SetStoredSize(game_name, next.snapshot_name, next.stored_size + removed->stored_size - freed_bytes);
+    }
+
+    return freed_bytes;
+}
+
+bool BackupEngine::StoreChunkedSnapshot(SnapshotJob& job, GameBackupResult& result)
+{
+    //Snapshot contents go into the shared chunk store, the snapshot folder itself only holds the manifest.
+    SnapshotManifest& manifest = job.manifest;
+    manifest.entries.resize(job.entries.size() + 1);
+    manifest.entries[0].is_directory = true;
+    manifest.entries[0].relative_path = job.save_dir;
+
+    std::atomic<bool> backup_failed(false);
+    std::mutex result_mutex;
+
+    {
+        TaskGroup file_tasks(pool);
+        for (size_t i = 0; i < job.entries.size(); i++)
+        {
+            ManifestEntry& manifest_entry = manifest.entries[i + 1];
+            manifest_entry.is_directory = job.entries[i].is_directory;
+            manifest_entry.relative_path = (std::filesystem::u8path(job.save_dir) / std::filesystem::u8path(job.entries[i].relative_path)).generic_u8string();
+
+            if (manifest_entry.is_directory || job.IsStored(i))
+            {
+                continue;
+            }
+
+            file_tasks.Run([&, i]
+            {
+                if (backup_failed)
+                {
+                    return;
+                }
+
+                ManifestEntry& file_entry = manifest.entries[i + 1];
+                try
+                {
+                    VolumeThrottle::Slots slots = throttle.Acquire({ job.source_paths[i], CHUNK_STORE_PATH });
+
+                    const uint64_t start_time = TelemetryTimestamp();
+                    uint64_t new_bytes_written = 0;
+                    std::vector<std::filesystem::path> written_chunks;
+                    file_entry.chunks = chunk_store.StoreFile(job.source_paths[i], file_entry.size, new_bytes_written, job.entries[i].content_hash, written_chunks);
+                    RecordFileCopy(start_time, file_entry.size);
+                    job.entries[i].size = file_entry.size;
+                    job.entries[i].has_content_hash = true;
+
+                    std::lock_guard<std::mutex> lock(result_mutex);
+                    job.written_files.insert(job.written_files.end(), written_chunks.begin(), written_chunks.end());
+                    result.bytes_written += new_bytes_written;
+                    (new_bytes_written > 0 ? result.files_stored : result.files_reused)++;
+                }
+                catch (const std::exception& e)
+                {
+                    std::lock_guard<std::mutex> lock(result_mutex);
+                    if (!backup_failed)
+                    {
+                        result.error = std::string("Error copying file ") + job.source_paths[i].u8string() + ": " + e.what();
+                    }
+                    backup_failed = true;
+                }
+            });
+        }
+        file_tasks.Wait();
+    }
+
+    if (!backup_failed && !WriteManifest(manifest, job.snapshot_path / SNAPSHOT_MANIFEST_NAME))
+    {
+        result.error = "Error writing backup manifest.";
+        backup_failed = true;
+    }
+    job.written_files.push_back(job.snapshot_path / SNAPSHOT_MANIFEST_NAME);
+
+    return !backup_failed;
+}
+
+bool BackupEngine::StoreLinkedSnapshot(SnapshotJob& job, const ChangeIndex& previous_index, GameBackupResult& result)
+{
+    //Plain folder tree like the original full copies, except that files the previous snapshot already holds unchanged are
+    // hard linked to it instead of copied (rsync --link-dest style).  Rotating a snapshot out only drops
+    // its links, the data stays alive as long as any snapshot still links to it.
+    //
+    // Big files that changed are stored as a delta instead (see FileDelta.h), under snapshot.delta next to the save folder:
+    // <path>.delta plus <path>.base, a hard link to the last whole copy of the file (its keyframe).
+    const std::filesystem::path snapshot_root = job.snapshot_path / std::filesystem::u8path(job.save_dir);
+
+    //Only a plain folder snapshot can be linked against, a chunked one has nothing on disk to link to.
+    std::filesystem::path previous_snapshot;
+    std::filesystem::path previous_root;
+    if (!previous_index.snapshot_name.empty())
+    {
+        previous_snapshot = job.snapshot_path.parent_path() / std::filesystem::u8path(previous_index.snapshot_name);
+        if (std::filesystem::exists(previous_snapshot / std::filesystem::u8path(job.save_dir)) && !std::filesystem::exists(previous_snapshot / SNAPSHOT_MANIFEST_NAME))
+        {
+            previous_root = previous_snapshot / std::filesystem::u8path(job.save_dir);
+        }
+    }
+    const uint64_t delta_min_file_size = settings.delta_min_file_mb * 1024 * 1024;
+
+    std::filesystem::create_directories(snapshot_root);
+    for (const auto& entry : job.entries)
+    {
+        if (entry.is_directory)
+        {
+            std::filesystem::create_directories(snapshot_root / std::filesystem::u8path(entry.relative_path));
+        }
+    }
+
+    std::atomic<bool> backup_failed(false);
+    std::mutex result_mutex;
+
+    //Small files that have to be copied are gathered into batches, each one copied by a single task with many files in
+    // flight at once.  Everything else is its own task.
+    auto copy_batch = [&](const std::vector<size_t>& batch)
+    {
+        if (backup_failed)
+        {
+            return;
+        }
+
+        std::vector<BatchCopyItem> items(batch.size());
+        for (size_t k = 0; k < batch.size(); k++)
+        {
+            items[k].source = job.source_paths[batch[k]];
+            items[k].destination = snapshot_root / std::filesystem::u8path(job.entries[batch[k]].relative_path);
+        }
+
+        {
+            VolumeThrottle::Slots slots = throttle.Acquire({ job.save_path, snapshot_root });
+            CopyFileBatch(items);
+        }
+
+        std::lock_guard<std::mutex> lock(result_mutex);
+        for (size_t k = 0; k < batch.size(); k++)
+        {
+            if (!items[k].error.empty())
+            {
+                if (!backup_failed)
+                {
+                    result.error = std::string("Error copying file ") + items[k].source.u8string() + ": " + items[k].error;
+                }
+                backup_failed = true;
+                continue;
+            }
+
+            IndexEntry& entry = job.entries[batch[k]];
+            entry.content_hash = items[k].content_hash;
+            entry.has_content_hash = true;
+            job.written_files.push_back(items[k].destination);
+            result.bytes_written += entry.size;
+            result.files_stored++;
+        }
+    };
+
+    TaskGroup file_tasks(pool);
+    std::vector<size_t> small_files;
+    for (size_t i = 0; i < job.entries.size(); i++)
+    {
+        if (job.entries[i].is_directory || job.IsStored(i))
+        {
+            continue;
+        }
+
+        //Same size and time as in the previous snapshot counts as unchanged, exactly the check rsync does by default.
+        const IndexEntry* previous = previous_root.empty() ? nullptr : previous_index.Find(job.entries[i].relative_path);
+        const bool unchanged = previous != nullptr && !previous->is_directory && previous->size == job.entries[i].size &&
+                               previous->modified_time == job.entries[i].modified_time;
+
+        if (!unchanged && job.entries[i].size < BATCH_COPY_MAX_FILE_SIZE)
+        {
+            small_files.push_back(i);
+            if (small_files.size() == BATCH_COPY_FILES_PER_TASK)
+            {
+                file_tasks.Run([&, batch = std::move(small_files)] { copy_batch(batch); });
+                small_files.clear();
+            }
+            continue;
+        }
+
+        file_tasks.Run([&, i, previous, unchanged]
+        {
+            if (backup_failed)
+            {
+                return;
+            }
+
+            IndexEntry& entry = job.entries[i];
+            const std::filesystem::path relative_path = std::filesystem::u8path(entry.relative_path);
+            const std::filesystem::path destination = snapshot_root / relative_path;
+
+            try
+            {
+                //The previous snapshot's version of the file, whole or as a delta against its keyframe.
+                const std::string snapshot_relative_path = (std::filesystem::u8path(job.save_dir) / relative_path).generic_u8string();
+                const std::filesystem::path delta_path = SnapshotDeltaPath(job.snapshot_path, snapshot_relative_path, DELTA_FILE_EXTENSION);
+                const std::filesystem::path base_path = SnapshotDeltaPath(job.snapshot_path, snapshot_relative_path, DELTA_BASE_EXTENSION);
+                std::filesystem::path previous_file, previous_delta, previous_base;
+                bool previous_is_delta = false;
+                if (!previous_root.empty())
+                {
+                    previous_file = previous_root / relative_path;
+                    previous_delta = SnapshotDeltaPath(previous_snapshot, snapshot_relative_path, DELTA_FILE_EXTENSION);
+                    previous_base = SnapshotDeltaPath(previous_snapshot, snapshot_relative_path, DELTA_BASE_EXTENSION);
+                    previous_is_delta = !std::filesystem::exists(previous_file) && std::filesystem::exists(previous_delta);
+                }
+
+                if (unchanged)
+                {
+                    VolumeThrottle::Slots slots = throttle.Acquire({ destination });
+
+                    std::error_code error;
+                    if (previous_is_delta)
+                    {
+                        //Still the same delta against the same keyframe, link both.
+                        std::filesystem::create_directories(delta_path.parent_path());
+                        std::filesystem::create_hard_link(previous_base, base_path, error);
+                        if (!error)
+                        {
+                            std::filesystem::create_hard_link(previous_delta, delta_path, error);
+                        }
+                    }
+                    else
+                    {
+                        std::filesystem::create_hard_link(previous_file, destination, error);
+                    }
+
+                    //Linking fails once a file hits NTFS's 1023 link limit, or if someone deleted it from the old snapshot. Copy instead.
+                    DeltaHeader previous_header;
+                    if (!error && (previous->has_content_hash || !previous_is_delta || ReadDeltaHeader(delta_path, previous_header)))
+                    {
+                        if (previous->has_content_hash)
+                        {
+                            entry.content_hash = previous->content_hash;
+                        }
+                        else
+                        {
+                            entry.content_hash = previous_is_delta ? previous_header.target_hash : HashFileContents(destination);
+                        }
+                        entry.has_content_hash = true;
+
+                        std::lock_guard<std::mutex> lock(result_mutex);
+                        result.files_reused++;
+                        return;
+                    }
+
+                    std::error_code cleanup_error;
+                    std::filesystem::remove(base_path, cleanup_error);
+                    std::filesystem::remove(delta_path, cleanup_error);
+                }
+
+                //A big file that changed, usually only a little, is stored as a delta against the keyframe its previous version
+                // is (or is based on).  Too many deltas in a row, or a delta that comes out too big, and it's stored whole again.
+                if (!unchanged && previous != nullptr && !previous->is_directory && delta_min_file_size > 0 && entry.size >= delta_min_file_size)
+                {
+                    DeltaHeader previous_header;
+                    std::filesystem::path keyframe;
+                    uint32_t keyframe_distance = 1;
+                    if (previous_is_delta && ReadDeltaHeader(previous_delta, previous_header))
+                    {
+                        keyframe = previous_base;
+                        keyframe_distance = previous_header.keyframe_distance + 1;
+                    }
+                    else if (!previous_is_delta && !previous_file.empty() && std::filesystem::is_regular_file(previous_file))
+                    {
+                        keyframe = previous_file;
+                    }
+
+                    if (!keyframe.empty() && keyframe_distance <= static_cast<uint32_t>(settings.delta_keyframe_interval))
+                    {
+                        VolumeThrottle::Slots slots = throttle.Acquire({ job.source_paths[i], destination });
+                        std::filesystem::create_directories(delta_path.parent_path());
+
+                        std::error_code error;
+                        std::filesystem::create_hard_link(keyframe, base_path, error);
+
+                        const uint64_t start_time = TelemetryTimestamp();
+                        DeltaHeader header;
+                        header.modified_time = entry.modified_time;
+                        header.keyframe_distance = keyframe_distance;
+                        if (!error && WriteFileDelta(keyframe, job.source_paths[i], delta_path, entry.size / DELTA_MAX_SHARE_OF_FILE, header))
+                        {
+                            RecordFileCopy(start_time, entry.size);
+                            entry.size = header.target_size;
+                            entry.content_hash = header.target_hash;
+                            entry.has_content_hash = true;
+
+                            std::lock_guard<std::mutex> lock(result_mutex);
+                            job.written_files.push_back(delta_path);
+                            result.bytes_written += std::filesystem::file_size(delta_path);
+                            result.files_stored++;
+                            return;
+                        }
+
+                        std::filesystem::remove(base_path, error);
+                    }
+                }
+
+                VolumeThrottle::Slots slots = throttle.Acquire({ job.source_paths[i], destination });
+                //Hashed on the way through for snapshot.hashes, which also lets the next backup tell a time stamp only change
+                // apart from a real one.  A huge file is split between workers, each extra one holding a slot of its own
+                // that's free right now, so the split never puts more streams on a drive than it takes.
+                std::vector<VolumeThrottle::Slots> range_slots;
+                while (entry.size >= RANGED_COPY_MIN_FILE_SIZE && range_slots.size() + 1 < RANGED_COPY_MAX_WORKERS)
+                {
+                    VolumeThrottle::Slots range_slot;
+                    if (!throttle.TryAcquire({ job.source_paths[i], destination }, range_slot))
+                    {
+                        break;
+                    }
+                    range_slots.push_back(std::move(range_slot));
+                }
+                const uint64_t start_time = TelemetryTimestamp();
+                entry.content_hash = CopyFileHashed(job.source_paths[i], destination, static_cast<int>(range_slots.size()) + 1);
+                range_slots.clear();
+                entry.has_content_hash = true;
+                RecordFileCopy(start_time, entry.size);
+
+                std::lock_guard<std::mutex> lock(result_mutex);
+                job.written_files.push_back(destination);
+                result.bytes_written += entry.size;
+                result.files_stored++;
+            }
+            catch (const std::exception& e)
+            {
+                std::lock_guard<std::mutex> lock(result_mutex);
+                if (!backup_failed)
+                {
+                    result.error = std::string("Error copying file ") + job.source_paths[i].u8string() + ": " + e.what();
+                }
+                backup_failed = true;
+            }
+        });
+    }
+    if (!small_files.empty())
+    {
+        file_tasks.Run([&, batch = std::move(small_files)] { copy_batch(batch); });
+    }
+    file_tasks.Wait();
+
+    if (backup_failed)
+    {
+        return false;
+    }
+
+    //Every file's hash as it was copied, for the verify command to check the snapshot against later.
+    std::vector<FileHash> hashes;
+    for (const auto& entry : job.entries)
+    {
+        if (!entry.is_directory)
+        {
+            const std::string relative_path = (std::filesystem::u8path(job.save_dir) / std::filesystem::u8path(entry.relative_path)).generic_u8string();
+            hashes.push_back({ relative_path, entry.size, entry.content_hash });
+        }
+    }
+
+    const std::filesystem::path hashes_path = job.snapshot_path / SNAPSHOT_HASHES_NAME;
+    if (!WriteSnapshotHashes(hashes, hashes_path))
+    {
+        result.error = "Error writing file hashes to " + hashes_path.u8string();
+        return false;
+    }
+    job.written_files.push_back(hashes_path);
+
+    return true;
+}
+
+bool BackupEngine::StoreArchivedSnapshot(SnapshotJob& job, GameBackupResult& result)
+{
+    //One sequential pass straight into the archive, so unlike the other formats the files of one game aren't split into
+    // parallel tasks.  Games still run in parallel with each other.
+    //
+    // Every capture pass writes the whole archive again, so the totals are only ever those of the last one.
+    result.files_stored = 0;
+    result.bytes_written = 0;
+    job.written_files.clear();
+
+    size_t current_file = 0;
+    try
+    {
+        ArchiveWriter archive(job.snapshot_path / SNAPSHOT_ARCHIVE_NAME);
+        archive.AddDirectory(job.save_dir);
+
+        for (current_file = 0; current_file < job.entries.size(); current_file++)
+        {
+            IndexEntry& entry = job.entries[current_file];
+            const std::string archive_path = (std::filesystem::u8path(job.save_dir) / std::filesystem::u8path(entry.relative_path)).generic_u8string();
+
+            if (entry.is_directory)
+            {
+                archive.AddDirectory(archive_path);
+                continue;
+            }
+
+            VolumeThrottle::Slots slots = throttle.Acquire({ job.source_paths[current_file], job.snapshot_path });
+            const uint64_t start_time = TelemetryTimestamp();
+            archive.AddFile(archive_path, job.source_paths[current_file], entry.size, entry.content_hash);
+            RecordFileCopy(start_time, entry.size);
+            entry.has_content_hash = true;
+            result.files_stored++;
+        }
+
+        archive.Finish();
+        job.written_files.push_back(job.snapshot_path / SNAPSHOT_ARCHIVE_NAME);
+        result.bytes_written += archive.BytesWritten();
+    }
+    catch (const std::exception& e)
+    {
+        if (current_file < job.source_paths.size())
+        {
+            result.error = std::string("Error copying file ") + job.source_paths[current_file].u8string() + ": " + e.what();
+        }
+        else
+        {
+            result.error = std::string("Error writing backup archive: ") + e.what();
+        }
+        return false;
+    }
+
+    return true;
+}
+
+void BackupEngine::PrepareRecapture(SnapshotJob& job, const FolderTree& current_tree, const std::vector<uint32_t>& listed_index)
+{
+    std::vector<bool> carried(job.entries.size(), false);
+    for (const uint32_t index : listed_index)
+    {
+        if (index != FOLDER_TREE_ROOT)
+        {
+            carried[index] = true;
+        }
+    }
+
+    //Take out what isn't carried over.  Going backwards empties folders before they are removed.  An archive is written
+    // from scratch every pass, there's nothing to take out of it.
+    const std::filesystem::path snapshot_root = job.snapshot_path / std::filesystem::u8path(job.save_dir);
+    std::set<std::filesystem::path> removed_files;
+    for (size_t i = job.entries.size(); i-- > 0;)
+    {
+        if (carried[i])
+        {
+            continue;
+        }
+
+        const IndexEntry& entry = job.entries[i];
+        if (settings.snapshot_format == SnapshotFormat::Chunked && !entry.is_directory)
+        {
+            job.replaced.entries.push_back(std::move(job.manifest.entries[i + 1]));
+        }
+        else if (settings.snapshot_format == SnapshotFormat::Linked)
+        {
+            //Never written over in place, an unchanged file is a hard link into the previous snapshot.
+            std::error_code error;
+            const std::string snapshot_relative_path = (std::filesystem::u8path(job.save_dir) / std::filesystem::u8path(entry.relative_path)).generic_u8string();
+            for (const auto& path : { snapshot_root / std::filesystem::u8path(entry.relative_path),
+                                      SnapshotDeltaPath(job.snapshot_path, snapshot_relative_path, DELTA_FILE_EXTENSION),
+                                      SnapshotDeltaPath(job.snapshot_path, snapshot_relative_path, DELTA_BASE_EXTENSION) })
+            {
+                std::filesystem::remove(path, error);
+                removed_files.insert(path);
+            }
+        }
+    }
+
+    job.written_files.erase(std::remove_if(job.written_files.begin(), job.written_files.end(),
+                                           [&removed_files](const std::filesystem::path& path) { return removed_files.count(path) != 0; }),
+                            job.written_files.end());
+
+    std::vector<IndexEntry> entries(current_tree.Entries().size());
+    std::vector<std::filesystem::path> source_paths(current_tree.Entries().size());
+    std::vector<bool> stored(current_tree.Entries().size(), false);
+    std::vector<ManifestEntry> manifest_entries;
+    if (settings.snapshot_format == SnapshotFormat::Chunked)
+    {
+        manifest_entries.resize(current_tree.Entries().size() + 1);
+        manifest_entries[0] = std::move(job.manifest.entries[0]);
+    }
+
+    for (size_t i = 0; i < current_tree.Entries().size(); i++)
+    {
+        const uint32_t listed = listed_index[i];
+        if (listed == FOLDER_TREE_ROOT)
+        {
+            entries[i] = ListedEntry(current_tree, i);
+            source_paths[i] = job.save_path / std::filesystem::u8path(entries[i].relative_path);
+            continue;
+        }
+
+        entries[i] = std::move(job.entries[listed]);
+        source_paths[i] = std::move(job.source_paths[listed]);
+        stored[i] = settings.snapshot_format != SnapshotFormat::Archive;
+        if (settings.snapshot_format == SnapshotFormat::Chunked)
+        {
+            manifest_entries[i + 1] = std::move(job.manifest.entries[listed + 1]);
+        }
+    }
+
+    job.entries = std::move(entries);
+    job.source_paths = std::move(source_paths);
+    job.stored = std::move(stored);
+    job.manifest.entries = std::move(manifest_entries);
+}
+
+bool BackupEngine::FlushSnapshotFiles(SnapshotJob& job, GameBackupResult& result)
+{
+    //One flush per file is unavoidable on Windows (there's no syncfs), but batching them keeps the task count low while the
+    // batches still overlap, so a snapshot of many small files waits for the disk a few times instead of once per file.
+    TelemetryPhase phase("flush", job.game_name);
+
+    std::atomic<bool> flush_failed(false);
+    std::mutex result_mutex;
+
+    TaskGroup flush_tasks(pool);
+    for (size_t batch_start = 0; batch_start < job.written_files.size(); batch_start += SNAPSHOT_FLUSH_BATCH_SIZE)
+    {
+        flush_tasks.Run([&, batch_start]
+        {
+            const size_t batch_end = std::min(batch_start + SNAPSHOT_FLUSH_BATCH_SIZE, job.written_files.size());
+            VolumeThrottle::Slots slots = throttle.Acquire({ job.written_files[batch_start] });
+
+            for (size_t i = batch_start; i < batch_end && !flush_failed; i++)
+            {
+                try
+                {
+                    FlushFileToDisk(job.written_files[i]);
+                }
+                catch (const std::exception& e)
+                {
+                    std::lock_guard<std::mutex> lock(result_mutex);
+                    if (!flush_failed)
+                    {
+                        result.error = std::string("Error flushing backup to disk: ") + e.what();
+                    }
+                    flush_failed = true;
+                }
+            }
+        });
+    }
+    flush_tasks.Wait();
+
+    return !flush_failed;
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+//Backs up games into snapshots.  Every game is its own task on the thread pool and every file inside a game is a sub-task,
+// so a library of many games (or one game with many files) keeps every core busy while the volume throttle stops slow
+// drives from being thrashed.
+
+#include "ChangeIndex.h"
+#include "ChunkStore.h"
+#include "Retention.h"
+#include "Settings.h"
+#include "SnapshotCatalog.h"
+#include "ThreadPool.h"
+#include "VolumeThrottle.h"
+
+#include <filesystem>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define BACKUPS_ROOT_PATH "./Backups"
+
+//Folder holding a game's snapshots.  Game names are UTF-8, the catalog reads them back from the folder names the same way.
+std::filesystem::path GameBackupFolder(const std::string& game_name);
+
+class FolderTree;
+
+enum class GameBackupStatus
+{
+    BackedUp,
+    Unchanged,
+    Failed
+};
+
+struct GameBackupResult
+{
+    std::string game_name;
+    GameBackupStatus status = GameBackupStatus::Failed;
+    std::string error;
+    std::string snapshot_name;      //folder of the new snapshot when backed up
+    bool snapshots_rotated_out = false;   //retention removed some of the game's older snapshots
+
+    size_t files_stored = 0;        //files whose data had to be written
+    size_t files_reused = 0;        //files the store or the previous snapshot already had
+    uint64_t bytes_written = 0;
+
+    int capture_passes = 0;         //times the files were stored, more than 1 when consistent capture caught the save changing
+    bool capture_settled = true;    //false when consistent capture ran out of retries with the save still changing
+};
+
+//What a retention pass removed.
+struct RetentionResult
+{
+    std::vector<SnapshotRemoval> removed;
+    size_t chunks_removed = 0;      //store chunks only the removed snapshots used
+    std::string error;              //first removal that failed, the others were still tried
+};
+
+class BackupEngine
+{
+public:
+    explicit BackupEngine(const BackupSettings& settings);
+
+    //Backs up every (game name, save path) pair at once and returns one result per game in the same order.
+    // Save paths are expected to exist, asking the user what to do about missing ones is up to the caller.
+    // Once every game is done the retention rules run over all games, see LastRetention().
+    std::vector<GameBackupResult> BackupGames(const std::vector<std::pair<std::string, std::filesystem::path>>& games);
+
+    //Removes every snapshot the retention rules in the settings no longer keep (see Retention.h), then the store chunks only
+    // they used.  With game_names given, only snapshots of those games are removed, the rules still look at every game.
+    // Removed snapshots are moved into the trash and their files deleted in the background (see SnapshotTrash.h).
+    RetentionResult ApplyRetention(const std::vector<std::string>& game_names = std::vector<std::string>());
+
+    //What the retention pass of the last BackupGames() removed.
+    const RetentionResult& LastRetention() const { return last_retention; }
+
+    //Deletes a game's oldest snapshots until at most keep_count are left.  Returns the names of the ones removed.
+    // Chunks only they used stay in the store until ChunkStore::CollectGarbage() runs.
+    std::vector<std::string> PruneSnapshots(const std::string& game_name, int keep_count);
+
+    ChunkStore& Store() { return chunk_store; }
+    SnapshotCatalog& Catalog() { return catalog; }
+
+private:
+    //A snapshot being written: the live save folder as listed before any data was read.
+    struct SnapshotJob
+    {
+        std::string game_name;
+        std::filesystem::path save_path;
+        std::filesystem::path snapshot_path;
+        std::string save_dir;                               //name of the save folder itself, the root of everything in the snapshot
+        std::vector<IndexEntry> entries;                    //relative to save_path, in the order of the listing, becomes the game's next change index
+        std::vector<std::filesystem::path> source_paths;    //full path of each entry
+        std::vector<std::filesystem::path> written_files;   //files whose data this snapshot wrote (not links), flushed before the commit
+        SnapshotManifest manifest;                          //chunked snapshots only, given back to the store if the snapshot is abandoned
+        std::vector<bool> stored;                           //consistent capture: entries already in the snapshot from an earlier pass
+        SnapshotManifest replaced;                          //consistent capture: references of files stored again, given back at the end
+
+        bool IsStored(size_t index) const { return index < stored.size() && stored[index]; }
+    };
+
+    GameBackupResult BackupGame(const std::string& game_name, const std::filesystem::path& save_path);
+
+    //Returns the bytes of backup data the removal freed, once the trash and garbage collection get to them.
+    uint64_t RemoveSnapshot(const std::string& game_name, const std::string& snapshot_name);
+
+    bool StoreChunkedSnapshot(SnapshotJob& job, GameBackupResult& result);
+    bool StoreLinkedSnapshot(SnapshotJob& job, const ChangeIndex& previous_index, GameBackupResult& result);
+    bool StoreArchivedSnapshot(SnapshotJob& job, GameBackupResult& result);
+
+    //Consistent capture: moves the job over to the save folder as listed now.  Entries that are still the same (listed_index
+    // says where they were in the job) are marked as stored, whatever changed or went away is taken back out of the snapshot
+    // so the next pass stores the new version.
+    void PrepareRecapture(SnapshotJob& job, const FolderTree& current_tree, const std::vector<uint32_t>& listed_index);
+
+    //Flushes job.written_files to disk, a batch of files per task, so the snapshot survives a power cut once it's renamed into place.
+    bool FlushSnapshotFiles(SnapshotJob& job, GameBackupResult& result);
+
+    BackupSettings settings;
+    ThreadPool pool;
+    VolumeThrottle throttle;
+    ChunkStore chunk_store;
+    SnapshotCatalog catalog;
+    RetentionResult last_retention;
+};
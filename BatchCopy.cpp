@@ -0,0 +1,269 @@
+#include "BatchCopy.h"
+#include "FileCopy.h"
+#include "Hashing.h"
+#include "Telemetry.h"
+
+#include <system_error>
+
+#define NOMINMAX
+#include <Windows.h>
+
+namespace
+{
+    //One file being copied.  The key the port hands back with a completion is the slot's index.
+    struct CopySlot
+    {
+        OVERLAPPED overlapped = {};
+        uint8_t* buffer = nullptr;
+        HANDLE source = INVALID_HANDLE_VALUE;
+        HANDLE destination = INVALID_HANDLE_VALUE;
+        BatchCopyItem* item = nullptr;
+        bool writing = false;
+        DWORD length = 0;
+        uint64_t start_time = 0;    //telemetry, 0 while it's off
+    };
+
+    std::string DescribeError(const std::string& what, const std::filesystem::path& path, DWORD error)
+    {
+        return std::filesystem::filesystem_error(what, path, std::error_code(static_cast<int>(error), std::system_category())).what();
+    }
+
+    void CloseSlot(CopySlot& slot)
+    {
+        if (slot.source != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(slot.source);
+            slot.source = INVALID_HANDLE_VALUE;
+        }
+        if (slot.destination != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(slot.destination);
+            slot.destination = INVALID_HANDLE_VALUE;
+        }
+        slot.item = nullptr;
+    }
+
+    void Fail(CopySlot& slot, const std::string& what, DWORD error)
+    {
+        slot.item->error = DescribeError(what, slot.item->source, error);
+        CloseSlot(slot);
+    }
+
+    //Bigger than a batch buffer after all (or it grew since it was listed), copy it the regular way.
+    void CopySeparately(BatchCopyItem& item)
+    {
+        try
+        {
+            const uint64_t start_time = TelemetryTimestamp();
+            item.content_hash = CopyFileHashed(item.source, item.destination);
+            item.bytes_copied = std::filesystem::file_size(item.destination);
+            RecordFileCopy(start_time, item.bytes_copied);
+        }
+        catch (const std::exception& e)
+        {
+            item.error = e.what();
+        }
+    }
+
+    void FinishCopy(CopySlot& slot, DWORD length)
+    {
+        FILETIME creation_time, access_time, write_time;
+        if (GetFileTime(slot.source, &creation_time, &access_time, &write_time))
+        {
+            SetFileTime(slot.destination, &creation_time, &access_time, &write_time);
+        }
+
+        slot.item->bytes_copied = length;
+        slot.item->content_hash = Xxh64::Hash(slot.buffer, length);
+        CloseSlot(slot);
+        RecordFileCopy(slot.start_time, length);
+    }
+
+    //Starts the write once the read is in.  Returns whether the slot still has I/O in flight.
+    bool StartWrite(CopySlot& slot, DWORD length)
+    {
+        if (length >= BATCH_COPY_MAX_FILE_SIZE)
+        {
+            BatchCopyItem& item = *slot.item;
+            CloseSlot(slot);
+            CopySeparately(item);
+            return false;
+        }
+        if (length == 0)
+        {
+            FinishCopy(slot, 0);
+            return false;
+        }
+
+        slot.writing = true;
+        slot.length = length;
+        slot.overlapped.Offset = 0;
+        slot.overlapped.OffsetHigh = 0;
+        if (!WriteFile(slot.destination, slot.buffer, length, NULL, &slot.overlapped) && GetLastError() != ERROR_IO_PENDING)
+        {
+            Fail(slot, "Unable to write file", GetLastError());
+            return false;
+        }
+        return true;
+    }
+
+    //Opens both files and starts the read.  Returns whether the slot now has I/O in flight.
+    bool StartCopy(CopySlot& slot, BatchCopyItem& item, HANDLE port, ULONG_PTR key)
+    {
+        slot.item = &item;
+        slot.writing = false;
+        slot.start_time = TelemetryTimestamp();
+
+        //Shared for writing too, so a game saving right now isn't refused (see FileReadStream).
+        slot.source = CreateFileW(item.source.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (slot.source == INVALID_HANDLE_VALUE)
+        {
+            Fail(slot, "Unable to open file", GetLastError());
+            return false;
+        }
+
+        LARGE_INTEGER size = {};
+        if (GetFileSizeEx(slot.source, &size) && size.QuadPart >= BATCH_COPY_MAX_FILE_SIZE)
+        {
+            CloseSlot(slot);
+            CopySeparately(item);
+            return false;
+        }
+
+        slot.destination = CreateFileW(item.destination.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, NULL);
+        if (slot.destination == INVALID_HANDLE_VALUE)
+        {
+            Fail(slot, "Unable to create file", GetLastError());
+            return false;
+        }
+
+        if (CreateIoCompletionPort(slot.source, port, key, 0) == NULL || CreateIoCompletionPort(slot.destination, port, key, 0) == NULL)
+        {
+            Fail(slot, "Unable to queue file", GetLastError());
+            return false;
+        }
+
+        //One read for the whole file.  Asking for the full buffer means a file that grew past it comes back as a full buffer.
+        slot.overlapped.Offset = 0;
+        slot.overlapped.OffsetHigh = 0;
+        if (!ReadFile(slot.source, slot.buffer, BATCH_COPY_MAX_FILE_SIZE, NULL, &slot.overlapped))
+        {
+            const DWORD error = GetLastError();
+            if (error == ERROR_HANDLE_EOF)
+            {
+                return StartWrite(slot, 0);
+            }
+            if (error != ERROR_IO_PENDING)
+            {
+                Fail(slot, "Unable to read file", error);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    //Moves a slot along after its read or write completed.  Returns whether it still has I/O in flight.
+    bool OnCompletion(CopySlot& slot, DWORD bytes_transferred, DWORD error)
+    {
+        if (!slot.writing)
+        {
+            if (error == ERROR_HANDLE_EOF)
+            {
+                bytes_transferred = 0;
+            }
+            else if (error != ERROR_SUCCESS)
+            {
+                Fail(slot, "Unable to read file", error);
+                return false;
+            }
+            return StartWrite(slot, bytes_transferred);
+        }
+
+        if (error != ERROR_SUCCESS || bytes_transferred != slot.length)
+        {
+            Fail(slot, "Unable to write file", error);
+            return false;
+        }
+        FinishCopy(slot, slot.length);
+        return false;
+    }
+}
+
+void CopyFileBatch(std::vector<BatchCopyItem>& items)
+{
+    HANDLE port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+    uint8_t* buffers = static_cast<uint8_t*>(VirtualAlloc(NULL, static_cast<SIZE_T>(BATCH_COPY_MAX_FILE_SIZE) * BATCH_COPY_QUEUE_DEPTH, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+    if (port == NULL || buffers == nullptr)
+    {
+        //Nothing to batch with, still copy everything.
+        if (port != NULL)
+        {
+            CloseHandle(port);
+        }
+        for (auto& item : items)
+        {
+            CopySeparately(item);
+        }
+        return;
+    }
+
+    std::vector<CopySlot> slots(BATCH_COPY_QUEUE_DEPTH);
+    std::vector<size_t> free_slots;
+    for (size_t i = 0; i < slots.size(); i++)
+    {
+        slots[i].buffer = buffers + i * BATCH_COPY_MAX_FILE_SIZE;
+        free_slots.push_back(slots.size() - 1 - i);
+    }
+
+    size_t next_item = 0;
+    size_t in_flight = 0;
+    auto start_copies = [&]
+    {
+        while (!free_slots.empty() && next_item < items.size())
+        {
+            const size_t slot_index = free_slots.back();
+            if (StartCopy(slots[slot_index], items[next_item++], port, slot_index))
+            {
+                free_slots.pop_back();
+                in_flight++;
+            }
+        }
+    };
+
+    start_copies();
+    while (in_flight > 0)
+    {
+        DWORD bytes_transferred = 0;
+        ULONG_PTR key = 0;
+        LPOVERLAPPED overlapped = NULL;
+        const BOOL succeeded = GetQueuedCompletionStatus(port, &bytes_transferred, &key, &overlapped, INFINITE);
+        if (overlapped == NULL)
+        {
+            //The port itself failed, which leaves no way to learn when the buffers are free again.  Keep them.
+            for (auto& slot : slots)
+            {
+                if (slot.item != nullptr)
+                {
+                    Fail(slot, "Unable to wait for file I/O", GetLastError());
+                }
+            }
+            for (; next_item < items.size(); next_item++)
+            {
+                items[next_item].error = DescribeError("Unable to wait for file I/O", items[next_item].source, GetLastError());
+            }
+            CloseHandle(port);
+            return;
+        }
+
+        CopySlot& slot = slots[key];
+        if (!OnCompletion(slot, bytes_transferred, succeeded ? ERROR_SUCCESS : GetLastError()))
+        {
+            free_slots.push_back(static_cast<size_t>(key));
+            in_flight--;
+            start_copies();
+        }
+    }
+
+    CloseHandle(port);
+    VirtualFree(buffers, 0, MEM_RELEASE);
+}
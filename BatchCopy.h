@@ -0,0 +1,32 @@
+#pragma once
+
+//Copies many small files at once through a single I/O completion port.  Copying a small file one at a time is mostly waiting:
+// the read, then the write, each a round trip to the drive for a few KB.  Here up to BATCH_COPY_QUEUE_DEPTH files have their
+// read or write in flight together and one thread moves each along as its previous step completes, so the drive always has
+// a deep queue to work through.  Every file is read with a single request into its own buffer and hashed on the way through.
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+//Files smaller than this go through a batch, anything bigger is better served by FileReadStream reading it ahead in blocks.
+#define BATCH_COPY_MAX_FILE_SIZE (128 * 1024)
+#define BATCH_COPY_QUEUE_DEPTH 32
+//Small files handed to one thread pool task, enough to keep the queue deep without leaving other workers idle.
+#define BATCH_COPY_FILES_PER_TASK 256
+
+struct BatchCopyItem
+{
+    std::filesystem::path source;
+    std::filesystem::path destination;     //overwritten, its folder has to exist
+
+    uint64_t bytes_copied = 0;
+    uint64_t content_hash = 0;              //XXH64 of the data copied
+    std::string error;                      //empty when the copy worked
+};
+
+//Copies every item keeping the modified time, like CopyFileHashed.  Files that turn out to be bigger than
+// BATCH_COPY_MAX_FILE_SIZE are copied with CopyFileHashed instead.  Failures are reported per item, never thrown.
+void CopyFileBatch(std::vector<BatchCopyItem>& items);
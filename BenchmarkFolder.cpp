@@ -0,0 +1,32 @@
+#include "BenchmarkFolder.h"
+
+#include <fstream>
+#include <stdexcept>
+#include <system_error>
+
+BenchmarkFolder::BenchmarkFolder(const std::filesystem::path& parent)
+    : path(std::filesystem::absolute(parent) / BENCHMARK_FOLDER_NAME)
+{
+    std::error_code error;
+    if (std::filesystem::exists(std::filesystem::symlink_status(path, error)))
+    {
+        if (!std::filesystem::is_directory(std::filesystem::symlink_status(path, error)) || !std::filesystem::exists(path / BENCHMARK_FOLDER_MARKER_NAME, error))
+        {
+            throw std::runtime_error(path.u8string() + " already exists and wasn't made by a benchmark, move it or pick another folder");
+        }
+        std::filesystem::remove_all(path);
+    }
+
+    std::filesystem::create_directories(path);
+    std::ofstream marker(path / BENCHMARK_FOLDER_MARKER_NAME, std::ios::trunc);
+    if (!marker)
+    {
+        throw std::filesystem::filesystem_error("Unable to create benchmark folder", path, std::make_error_code(std::errc::io_error));
+    }
+}
+
+BenchmarkFolder::~BenchmarkFolder()
+{
+    std::error_code error;
+    std::filesystem::remove_all(path, error);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+//Scratch folder the benchmarks write their trees, copies and backups into, deleted again once they're done.  It's always a
+// folder of its own under the one given on the command line, with a marker file in it, so a benchmark pointed at "." or at
+// a drive root never deletes anything it didn't create itself.
+
+#include <filesystem>
+
+#define BENCHMARK_FOLDER_NAME "SaveBackupManager.benchmark"
+//Written into the folder first thing, a folder of that name without it belongs to someone else.
+#define BENCHMARK_FOLDER_MARKER_NAME ".benchmark"
+
+class BenchmarkFolder
+{
+public:
+    //Creates <parent>/SaveBackupManager.benchmark, replacing one an earlier run left behind when it was cut short.  Throws
+    // std::runtime_error if a folder of that name exists that no benchmark made, filesystem_error if it can't be created.
+    explicit BenchmarkFolder(const std::filesystem::path& parent);
+
+    //Deletes the folder and everything in it, ignoring errors.
+    ~BenchmarkFolder();
+
+    BenchmarkFolder(const BenchmarkFolder&) = delete;
+    BenchmarkFolder& operator=(const BenchmarkFolder&) = delete;
+
+    //Absolute, the benchmarks change the working folder while they run.
+    const std::filesystem::path& Path() const { return path; }
+
+private:
+    std::filesystem::path path;
+};
@@ -0,0 +1,209 @@
+#include "ChangeIndex.h"
+#include "FileStream.h"
+#include "Hashing.h"
+
+#include <fstream>
+#include <sstream>
+#include <system_error>
+
+#define CHANGE_INDEX_HEADER "SaveBackupManager Index v1"
+
+bool ChangeIndex::Load(const std::filesystem::path& index_path)
+{
+    std::ifstream input(index_path, std::ios::in);
+    if (!input.is_open())
+    {
+        return false;
+    }
+
+    std::string line;
+    if (!std::getline(input, line) || line != CHANGE_INDEX_HEADER)
+    {
+        return false;
+    }
+
+    Clear();
+
+    //Same tab separated layout as the snapshot manifests.
+    // S <snapshot folder name>
+    // D <path>
+    // F <path> <size> <modified time> <hash, or - when not hashed>
+    while (std::getline(input, line))
+    {
+        std::istringstream iss(line);
+        std::string type;
+        if (!std::getline(iss, type, '\t'))
+        {
+            continue;
+        }
+
+        if (type == "S")
+        {
+            std::getline(iss, snapshot_name);
+            continue;
+        }
+
+        IndexEntry entry;
+        if (!std::getline(iss, entry.relative_path, '\t'))
+        {
+            return false;
+        }
+
+        if (type == "D")
+        {
+            entry.is_directory = true;
+        }
+        else
+        {
+            std::string hash_text;
+            if (type != "F" || !(iss >> entry.size >> entry.modified_time >> hash_text))
+            {
+                return false;
+            }
+
+            if (hash_text != "-")
+            {
+                std::istringstream hash_stream(hash_text);
+                entry.has_content_hash = static_cast<bool>(hash_stream >> std::hex >> entry.content_hash);
+            }
+        }
+
+        Add(entry);
+    }
+
+    dirty = false;
+    return !snapshot_name.empty();
+}
+
+bool ChangeIndex::Save(const std::filesystem::path& index_path) const
+{
+    //Write to a temporary file and swap it in so a crash mid-write leaves the old index rather than half of a new one.
+    std::filesystem::path temp_path = index_path;
+    temp_path += ".tmp";
+
+    std::ofstream output(temp_path, std::ios::out | std::ios::trunc);
+    if (!output.is_open())
+    {
+        return false;
+    }
+
+    output << CHANGE_INDEX_HEADER << "\n";
+    output << "S\t" << snapshot_name << "\n";
+    for (const auto& entry : entries)
+    {
+        if (entry.is_directory)
+        {
+            output << "D\t" << entry.relative_path << "\n";
+        }
+        else
+        {
+            output << "F\t" << entry.relative_path << "\t" << entry.size << "\t" << entry.modified_time << "\t";
+            if (entry.has_content_hash)
+            {
+                output << std::hex << entry.content_hash << std::dec << "\n";
+            }
+            else
+            {
+                output << "-\n";
+            }
+        }
+    }
+
+    output.close();
+    if (!output)
+    {
+        return false;
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temp_path, index_path, error);
+    return !error;
+}
+
+void ChangeIndex::Add(const IndexEntry& entry)
+{
+    entry_lookup[entry.relative_path] = entries.size();
+    entries.push_back(entry);
+}
+
+const IndexEntry* ChangeIndex::Find(const std::string& relative_path) const
+{
+    auto found = entry_lookup.find(relative_path);
+    return (found == entry_lookup.end()) ? nullptr : &entries[found->second];
+}
+
+void ChangeIndex::Clear()
+{
+    entries.clear();
+    entry_lookup.clear();
+    snapshot_name.clear();
+    dirty = false;
+}
+
+bool ChangeIndex::DetectChanges(const FolderTree& save_tree)
+{
+    //A different number of entries can only mean something was added or deleted.
+    const std::vector<FolderTreeEntry>& listed = save_tree.Entries();
+    if (listed.size() != entries.size())
+    {
+        return true;
+    }
+
+    for (size_t i = 0; i < listed.size(); i++)
+    {
+        const FolderTreeEntry& entry = listed[i];
+
+        auto found = entry_lookup.find(save_tree.RelativePath(i));
+        if (found == entry_lookup.end())
+        {
+            return true;
+        }
+
+        IndexEntry& indexed = entries[found->second];
+        if (entry.is_directory)
+        {
+            if (!indexed.is_directory)
+            {
+                return true;
+            }
+            continue;
+        }
+
+        if (indexed.is_directory || entry.size != indexed.size)
+        {
+            return true;
+        }
+
+        if (entry.modified_time == indexed.modified_time)
+        {
+            continue;
+        }
+
+        //Same size, different time: the game may have rewritten identical data, only the contents can tell.
+        if (!indexed.has_content_hash || HashFileContents(save_tree.FullPath(i)) != indexed.content_hash)
+        {
+            return true;
+        }
+
+        indexed.modified_time = entry.modified_time;
+        dirty = true;
+    }
+
+    //Same count and every listed path is in the index, so nothing was deleted either.
+    return false;
+}
+
+uint64_t HashFileContents(const std::filesystem::path& file_path)
+{
+    FileReadStream input(file_path);
+
+    Xxh64 hasher;
+    const uint8_t* data = nullptr;
+    size_t length = 0;
+    while (input.Next(data, length))
+    {
+        hasher.Update(data, length);
+    }
+
+    return hasher.Final();
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+//Per-game record of what the save folder looked like when the last snapshot was taken.
+// Lets a backup run stat-compare the live save against the last snapshot and skip the game entirely when nothing changed,
+// instead of taking an identical snapshot that rotates a useful older one out.
+
+#include "FolderTree.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define CHANGE_INDEX_NAME "change.index"
+
+struct IndexEntry
+{
+    bool is_directory = false;
+    std::string relative_path;      //UTF-8 generic path relative to the save folder
+    uint64_t size = 0;
+    int64_t modified_time = 0;      //std::filesystem::file_time_type ticks
+    uint64_t content_hash = 0;      //XXH64 of the file contents
+    bool has_content_hash = false;  //false when the file was copied without being read (hard linked snapshots)
+};
+
+class ChangeIndex
+{
+public:
+    bool Load(const std::filesystem::path& index_path);
+    bool Save(const std::filesystem::path& index_path) const;
+
+    //Compares a listing of the save folder with the index.  Only files whose size matches but whose modified time doesn't
+    // get read and hashed, everything else is decided from the listing alone.
+    // Files found to be unchanged apart from their time stamp get their time refreshed, see NeedsSave().
+    bool DetectChanges(const FolderTree& save_tree);
+
+    void Add(const IndexEntry& entry);
+    void Clear();
+
+    //nullptr when the path isn't in the index.
+    const IndexEntry* Find(const std::string& relative_path) const;
+
+    //True when DetectChanges() refreshed time stamps that are worth writing back so the next run doesn't hash those files again.
+    bool NeedsSave() const { return dirty; }
+
+    //Folder name of the snapshot this index describes.  If that snapshot is gone the index can't be trusted.
+    std::string snapshot_name;
+
+private:
+    std::vector<IndexEntry> entries;
+    std::unordered_map<std::string, size_t> entry_lookup;
+    bool dirty = false;
+};
+
+//Hashes a whole file with XXH64.  Throws on I/O errors.
+uint64_t HashFileContents(const std::filesystem::path& file_path);
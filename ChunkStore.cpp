@@ -0,0 +1,714 @@
+#include "ChunkStore.h"
+#include "FileLock.h"
+#include "FileStream.h"
+#include "Hashing.h"
+#include "Telemetry.h"
+#include "Timestamps.h"
+
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <system_error>
+
+#define MANIFEST_HEADER "SaveBackupManager Manifest v1"
+#define REFERENCES_HEADER "SaveBackupManager Chunk References v1"
+
+namespace
+{
+    //Gear table for the rolling hash.  Generated from a fixed seed so chunk boundaries never change between builds,
+    // otherwise a new build would stop deduplicating against everything already in the store.
+    std::array<uint64_t, 256> BuildGearTable()
+    {
+        std::array<uint64_t, 256> table = {};
+        uint64_t seed = 0x5342'4d5f'4745'4152ull;
+        for (auto& value : table)
+        {
+            //splitmix64
+            seed += 0x9e3779b97f4a7c15ull;
+            uint64_t z = seed;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+            value = z ^ (z >> 31);
+        }
+        return table;
+    }
+
+    const std::array<uint64_t, 256> gear_table = BuildGearTable();
+
+    //Normalized chunking: a stricter mask below the average size and a looser one above it pulls chunk sizes towards the average.
+    // The masks use the top bits because with a shift-left gear hash those depend on the last 64 bytes, the low bits on far fewer.
+    const uint64_t mask_below_average = ~0ull << (64 - 18);
+    const uint64_t mask_above_average = ~0ull << (64 - 14);
+
+    std::atomic<uint64_t> temp_file_counter(0);
+
+    std::filesystem::filesystem_error MakeIoError(const std::string& what, const std::filesystem::path& path)
+    {
+        return std::filesystem::filesystem_error(what, path, std::make_error_code(std::errc::io_error));
+    }
+}
+
+ChunkStore::Hold::Hold(ChunkStore& store)
+    : store(store)
+{
+    std::lock_guard<std::mutex> lock(store.references_mutex);
+    store.LoadReferenceCounts();
+    store.hold_count++;
+}
+
+ChunkStore::Hold::~Hold()
+{
+    std::lock_guard<std::mutex> lock(store.references_mutex);
+    if (--store.hold_count == 0)
+    {
+        store.UnlockReferenceCounts();
+    }
+}
+
+ChunkStore::ChunkStore(const std::filesystem::path& store_root)
+    : store_root(store_root), chunks_root(store_root / "chunks"), backups_root(store_root.parent_path())
+{
+    std::filesystem::create_directories(chunks_root);
+}
+
+ChunkStore::~ChunkStore()
+{
+    std::lock_guard<std::mutex> lock(references_mutex);
+    UnlockReferenceCounts();
+}
+
+std::filesystem::path ChunkStore::ChunkPath(const std::string& hash) const
+{
+    //Fan out on the first byte so no single directory ends up with hundreds of thousands of entries.
+    return chunks_root / hash.substr(0, 2) / hash;
+}
+
+void ChunkStore::WriteChunk(const uint8_t* data, size_t length, ChunkRef& ref, uint64_t& new_bytes_written, std::vector<std::filesystem::path>& written_chunks)
+{
+    ref.hash = Sha256::HexDigest(data, length);
+    ref.length = static_cast<uint32_t>(length);
+
+    //Reference the chunk before looking for it, so garbage collection can't delete it between the check and the manifest.
+    {
+        std::lock_guard<std::mutex> lock(references_mutex);
+        AddReference(ref.hash);
+    }
+
+    try
+    {
+        WriteChunkData(data, length, ref.hash, new_bytes_written, written_chunks);
+    }
+    catch (const std::exception&)
+    {
+        std::lock_guard<std::mutex> lock(references_mutex);
+        ReleaseReference(ref.hash);
+        throw;
+    }
+}
+
+void ChunkStore::WriteChunkData(const uint8_t* data, size_t length, const std::string& hash, uint64_t& new_bytes_written, std::vector<std::filesystem::path>& written_chunks)
+{
+    const std::filesystem::path chunk_path = ChunkPath(hash);
+    if (std::filesystem::exists(chunk_path))
+    {
+        return;
+    }
+
+    std::filesystem::create_directories(chunk_path.parent_path());
+
+    //Write under a temporary name then rename, so a chunk that exists under its real name is always complete.
+    // The name is unique per write because two games backing up in parallel can both find the same new chunk.
+    std::filesystem::path temp_path = chunk_path;
+    temp_path += "." + std::to_string(temp_file_counter++) + ".tmp";
+
+    std::ofstream output(temp_path, std::ios::binary | std::ios::trunc);
+    if (!output.is_open())
+    {
+        throw MakeIoError("Unable to create chunk", temp_path);
+    }
+    output.write(reinterpret_cast<const char*>(data), length);
+    output.close();
+    if (!output)
+    {
+        std::filesystem::remove(temp_path);
+        throw MakeIoError("Unable to write chunk", temp_path);
+    }
+
+    std::filesystem::rename(temp_path, chunk_path);
+    new_bytes_written += length;
+    written_chunks.push_back(chunk_path);
+}
+
+std::vector<ChunkRef> ChunkStore::StoreFile(const std::filesystem::path& file_path, uint64_t& file_size, uint64_t& new_bytes_written, uint64_t& content_hash,
+                                            std::vector<std::filesystem::path>& written_chunks)
+{
+    FileReadStream input(file_path, CHUNK_MAX_SIZE * 4);
+
+    std::vector<ChunkRef> chunks;
+
+    //Bytes of the chunk currently being built that came from earlier reads.
+    std::vector<uint8_t> pending;
+    pending.reserve(CHUNK_MAX_SIZE);
+
+    Xxh64 content_hasher;
+    uint64_t rolling_hash = 0;
+    file_size = 0;
+
+    const uint8_t* buffer = nullptr;
+    size_t bytes_read = 0;
+    try
+    {
+        while (input.Next(buffer, bytes_read))
+        {
+            file_size += bytes_read;
+            content_hasher.Update(buffer, bytes_read);
+
+            size_t chunk_start = 0;
+            for (size_t i = 0; i < bytes_read; i++)
+            {
+                rolling_hash = (rolling_hash << 1) + gear_table[buffer[i]];
+
+                const size_t chunk_length = pending.size() + (i + 1 - chunk_start);
+                if (chunk_length < CHUNK_MIN_SIZE)
+                {
+                    continue;
+                }
+
+                const uint64_t mask = (chunk_length < CHUNK_AVERAGE_SIZE) ? mask_below_average : mask_above_average;
+                if ((rolling_hash & mask) == 0 || chunk_length >= CHUNK_MAX_SIZE)
+                {
+                    ChunkRef ref;
+                    if (pending.empty())
+                    {
+                        WriteChunk(buffer + chunk_start, chunk_length, ref, new_bytes_written, written_chunks);
+                    }
+                    else
+                    {
+                        pending.insert(pending.end(), buffer + chunk_start, buffer + i + 1);
+                        WriteChunk(pending.data(), pending.size(), ref, new_bytes_written, written_chunks);
+                        pending.clear();
+                    }
+                    chunks.push_back(ref);
+
+                    chunk_start = i + 1;
+                    rolling_hash = 0;
+                }
+            }
+
+            pending.insert(pending.end(), buffer + chunk_start, buffer + bytes_read);
+        }
+
+        if (!pending.empty())
+        {
+            ChunkRef ref;
+            WriteChunk(pending.data(), pending.size(), ref, new_bytes_written, written_chunks);
+            chunks.push_back(ref);
+        }
+    }
+    catch (const std::exception&)
+    {
+        //The file never makes it into a manifest, give back what its chunks took so far.
+        std::lock_guard<std::mutex> lock(references_mutex);
+        for (const auto& chunk : chunks)
+        {
+            ReleaseReference(chunk.hash);
+        }
+        throw;
+    }
+
+    content_hash = content_hasher.Final();
+    return chunks;
+}
+
+void ChunkStore::RestoreFile(const std::vector<ChunkRef>& chunks, const std::filesystem::path& destination) const
+{
+    SparseFileWriter output(destination);
+
+    std::vector<char> buffer;
+    for (const auto& chunk : chunks)
+    {
+        const std::filesystem::path chunk_path = ChunkPath(chunk.hash);
+        std::ifstream input(chunk_path, std::ios::binary);
+        if (!input.is_open())
+        {
+            throw MakeIoError("Missing chunk in backup store", chunk_path);
+        }
+
+        buffer.resize(chunk.length);
+        input.read(buffer.data(), buffer.size());
+        if (static_cast<size_t>(input.gcount()) != chunk.length)
+        {
+            throw MakeIoError("Chunk in backup store is truncated", chunk_path);
+        }
+
+        output.Write(reinterpret_cast<const uint8_t*>(buffer.data()), buffer.size());
+    }
+
+    output.Finish();
+}
+
+uint64_t ChunkStore::HashFile(const std::vector<ChunkRef>& chunks) const
+{
+    Xxh64 hasher;
+    std::vector<char> buffer;
+    for (const auto& chunk : chunks)
+    {
+        const std::filesystem::path chunk_path = ChunkPath(chunk.hash);
+        std::ifstream input(chunk_path, std::ios::binary);
+        if (!input.is_open())
+        {
+            throw MakeIoError("Missing chunk in backup store", chunk_path);
+        }
+
+        buffer.resize(chunk.length);
+        input.read(buffer.data(), buffer.size());
+        if (static_cast<size_t>(input.gcount()) != chunk.length)
+        {
+            throw MakeIoError("Chunk in backup store is truncated", chunk_path);
+        }
+
+        hasher.Update(buffer.data(), buffer.size());
+    }
+
+    return hasher.Final();
+}
+
+bool ChunkStore::VerifyChunk(const ChunkRef& chunk) const
+{
+    const std::filesystem::path chunk_path = ChunkPath(chunk.hash);
+
+    std::error_code error;
+    const uintmax_t chunk_size = std::filesystem::file_size(chunk_path, error);
+    if (error || chunk_size != chunk.length)
+    {
+        return false;
+    }
+
+    std::ifstream input(chunk_path, std::ios::binary);
+    std::vector<char> buffer(chunk.length);
+    input.read(buffer.data(), buffer.size());
+    if (static_cast<size_t>(input.gcount()) != chunk.length)
+    {
+        return false;
+    }
+
+    return Sha256::HexDigest(buffer.data(), buffer.size()) == chunk.hash;
+}
+
+uint64_t ChunkStore::ReleaseReferences(const SnapshotManifest& manifest)
+{
+    std::lock_guard<std::mutex> lock(references_mutex);
+    uint64_t released_bytes = 0;
+    for (const auto& entry : manifest.entries)
+    {
+        for (const auto& chunk : entry.chunks)
+        {
+            if (ReleaseReference(chunk.hash))
+            {
+                released_bytes += chunk.length;
+            }
+        }
+    }
+    return released_bytes;
+}
+
+size_t ChunkStore::CollectGarbage()
+{
+    TelemetryPhase phase("collect garbage");
+
+    //Sweep a batch per lock, so backups storing files in the meantime only ever wait for one batch of deletes.
+    size_t removed = 0;
+    while (true)
+    {
+        std::lock_guard<std::mutex> lock(references_mutex);
+        LoadReferenceCounts();
+        if (garbage.empty())
+        {
+            break;
+        }
+
+        const size_t batch_start = (garbage.size() > CHUNK_COLLECT_BATCH_SIZE) ? garbage.size() - CHUNK_COLLECT_BATCH_SIZE : 0;
+        for (size_t i = batch_start; i < garbage.size(); i++)
+        {
+            //A backup may have referenced it again since it was released.
+            const auto count = reference_counts.find(garbage[i]);
+            if (count == reference_counts.end() || count->second != 0)
+            {
+                continue;
+            }
+
+            //One that can't be deleted right now keeps its zero count and is tried again by the next collection.
+            std::error_code error;
+            std::filesystem::remove(ChunkPath(garbage[i]), error);
+            if (!error)
+            {
+                reference_counts.erase(count);
+                MarkReferencesChanged();
+                removed++;
+            }
+        }
+        garbage.resize(batch_start);
+    }
+
+    SaveReferenceCounts();
+    return removed;
+}
+
+void ChunkStore::SaveReferenceCounts()
+{
+    std::lock_guard<std::mutex> lock(references_mutex);
+    try
+    {
+        if (references_changed)
+        {
+            WriteReferenceCounts();
+        }
+    }
+    catch (const std::exception&)
+    {
+        if (hold_count == 0)
+        {
+            UnlockReferenceCounts();
+        }
+        throw;
+    }
+
+    if (hold_count == 0)
+    {
+        UnlockReferenceCounts();
+    }
+}
+
+void ChunkStore::AddReference(const std::string& hash)
+{
+    LoadReferenceCounts();
+    reference_counts[hash]++;
+    MarkReferencesChanged();
+}
+
+bool ChunkStore::ReleaseReference(const std::string& hash)
+{
+    LoadReferenceCounts();
+    auto count = reference_counts.find(hash);
+    if (count == reference_counts.end() || count->second == 0)
+    {
+        return false;
+    }
+
+    const bool unused = (--count->second == 0);
+    if (unused)
+    {
+        garbage.push_back(hash);
+    }
+    MarkReferencesChanged();
+    return unused;
+}
+
+void ChunkStore::LoadReferenceCounts()
+{
+    if (references_lock)
+    {
+        return;
+    }
+
+    //Another instance may have changed the counts since this one last had the lock, so they're always read again.
+    references_lock = std::make_unique<FileLock>(store_root / CHUNK_STORE_LOCK_NAME, "Unable to lock the chunk store", CHUNK_STORE_LOCK_TIMEOUT_MS);
+    reference_counts.clear();
+    garbage.clear();
+    references_changed = false;
+
+    try
+    {
+        ReadReferenceCounts();
+    }
+    catch (const std::exception&)
+    {
+        UnlockReferenceCounts();
+        throw;
+    }
+}
+
+void ChunkStore::ReadReferenceCounts()
+{
+    //Counts saved before a change that never got saved itself can't be trusted, count again from the manifests.
+    bool loaded = false;
+    if (!std::filesystem::exists(store_root / CHUNK_REFERENCES_DIRTY_NAME))
+    {
+        std::ifstream input(store_root / CHUNK_REFERENCES_NAME, std::ios::in);
+        std::string line;
+        if (input.is_open() && std::getline(input, line) && line == REFERENCES_HEADER)
+        {
+            //<hash>\t<count> per chunk, then end\t<chunk count> so a cut off file isn't taken as complete.
+            while (std::getline(input, line))
+            {
+                const size_t separator = line.find('\t');
+                if (separator == std::string::npos)
+                {
+                    break;
+                }
+
+                const std::string hash = line.substr(0, separator);
+                const uint32_t count = static_cast<uint32_t>(std::strtoul(line.c_str() + separator + 1, nullptr, 10));
+                if (hash == "end")
+                {
+                    loaded = (count == reference_counts.size());
+                    break;
+                }
+
+                reference_counts[hash] = count;
+                if (count == 0)
+                {
+                    garbage.push_back(hash);
+                }
+            }
+        }
+    }
+
+    if (!loaded)
+    {
+        RebuildReferenceCounts();
+    }
+}
+
+void ChunkStore::RebuildReferenceCounts()
+{
+    reference_counts.clear();
+    garbage.clear();
+
+    //Mark: every reference of every finished snapshot of any game.  Staging folders are left out, nothing is writing them
+    // (chunked backups hold the store lock until they're done) and the next backup of their game deletes them.
+    for (const auto& game_folder : std::filesystem::directory_iterator(backups_root))
+    {
+        if (!game_folder.is_directory() || game_folder.path().filename().string().front() == '.')
+        {
+            continue;
+        }
+
+        for (const auto& snapshot_folder : std::filesystem::directory_iterator(game_folder.path()))
+        {
+            SnapshotManifest manifest;
+            if (!snapshot_folder.is_directory() || IsStagingName(snapshot_folder.path().filename().u8string()) ||
+                !ReadManifest(snapshot_folder.path() / SNAPSHOT_MANIFEST_NAME, manifest))
+            {
+                continue;
+            }
+
+            for (const auto& entry : manifest.entries)
+            {
+                for (const auto& chunk : entry.chunks)
+                {
+                    reference_counts[chunk.hash]++;
+                }
+            }
+        }
+    }
+
+    //Anything else in the store is garbage, including temp files left behind by an interrupted backup.  They're only queued
+    // here, CollectGarbage() deletes them.
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(chunks_root))
+    {
+        const std::string name = entry.path().filename().string();
+        if (entry.is_regular_file() && reference_counts.find(name) == reference_counts.end())
+        {
+            reference_counts[name] = 0;
+            garbage.push_back(name);
+        }
+    }
+
+    MarkReferencesChanged();
+}
+
+void ChunkStore::WriteReferenceCounts()
+{
+    //Same write then rename as chunks, a reader never sees half a file.
+    const std::filesystem::path references_path = store_root / CHUNK_REFERENCES_NAME;
+    std::filesystem::path temp_path = references_path;
+    temp_path += ".tmp";
+
+    std::ofstream output(temp_path, std::ios::out | std::ios::trunc);
+    if (!output.is_open())
+    {
+        throw MakeIoError("Unable to create chunk references", temp_path);
+    }
+    output << REFERENCES_HEADER << "\n";
+    for (const auto& count : reference_counts)
+    {
+        output << count.first << '\t' << count.second << "\n";
+    }
+    output << "end\t" << reference_counts.size() << "\n";
+    output.close();
+    if (!output)
+    {
+        std::filesystem::remove(temp_path);
+        throw MakeIoError("Unable to write chunk references", temp_path);
+    }
+
+    std::filesystem::rename(temp_path, references_path);
+
+    std::error_code error;
+    std::filesystem::remove(store_root / CHUNK_REFERENCES_DIRTY_NAME, error);
+    references_changed = false;
+}
+
+void ChunkStore::UnlockReferenceCounts()
+{
+    if (!references_lock)
+    {
+        return;
+    }
+
+    //Changes that can't be saved leave the dirty marker behind, so whoever takes the lock next counts again.
+    if (references_changed)
+    {
+        try
+        {
+            WriteReferenceCounts();
+        }
+        catch (const std::exception&)
+        {
+        }
+    }
+
+    reference_counts.clear();
+    garbage.clear();
+    references_changed = false;
+    references_lock.reset();
+}
+
+void ChunkStore::MarkReferencesChanged()
+{
+    if (references_changed)
+    {
+        return;
+    }
+    references_changed = true;
+
+    //Left in place until the counts are saved, so a run that's cut off before that makes the next one rebuild them.
+    std::ofstream marker(store_root / CHUNK_REFERENCES_DIRTY_NAME, std::ios::out | std::ios::trunc);
+}
+
+bool WriteManifest(const SnapshotManifest& manifest, const std::filesystem::path& manifest_path)
+{
+    std::ofstream output(manifest_path, std::ios::out | std::ios::trunc);
+    if (!output.is_open())
+    {
+        return false;
+    }
+
+    //One line per entry, tab separated (tabs can't appear in Windows file names).
+    // D <path>
+    // F <path> <size> <hash>:<length> <hash>:<length> ...
+    output << MANIFEST_HEADER << "\n";
+    for (const auto& entry : manifest.entries)
+    {
+        if (entry.is_directory)
+        {
+            output << "D\t" << entry.relative_path << "\n";
+            continue;
+        }
+
+        output << "F\t" << entry.relative_path << "\t" << entry.size << "\t";
+        for (size_t i = 0; i < entry.chunks.size(); i++)
+        {
+            if (i > 0)
+            {
+                output << ' ';
+            }
+            output << entry.chunks[i].hash << ':' << entry.chunks[i].length;
+        }
+        output << "\n";
+    }
+
+    output.close();
+    return static_cast<bool>(output);
+}
+
+bool ReadManifest(const std::filesystem::path& manifest_path, SnapshotManifest& manifest)
+{
+    std::ifstream input(manifest_path, std::ios::in);
+    if (!input.is_open())
+    {
+        return false;
+    }
+
+    std::string line;
+    if (!std::getline(input, line) || line != MANIFEST_HEADER)
+    {
+        return false;
+    }
+
+    manifest.entries.clear();
+    while (std::getline(input, line))
+    {
+        if (line.size() < 2)
+        {
+            continue;
+        }
+
+        std::istringstream iss(line);
+        std::string type;
+        ManifestEntry entry;
+        if (!std::getline(iss, type, '\t') || !std::getline(iss, entry.relative_path, '\t'))
+        {
+            return false;
+        }
+
+        if (type == "D")
+        {
+            entry.is_directory = true;
+        }
+        else if (type == "F")
+        {
+            std::string chunk_text;
+            if (!(iss >> entry.size))
+            {
+                return false;
+            }
+            while (iss >> chunk_text)
+            {
+                size_t separator = chunk_text.find(':');
+                if (separator == std::string::npos)
+                {
+                    return false;
+                }
+
+                ChunkRef chunk;
+                chunk.hash = chunk_text.substr(0, separator);
+                std::istringstream length_stream(chunk_text.substr(separator + 1));
+                if (!(length_stream >> chunk.length))
+                {
+                    return false;
+                }
+                entry.chunks.push_back(chunk);
+            }
+        }
+        else
+        {
+            return false;
+        }
+
+        manifest.entries.push_back(std::move(entry));
+    }
+
+    return true;
+}
+
+void RestoreManifest(const ChunkStore& store, const SnapshotManifest& manifest, const std::filesystem::path& destination_root)
+{
+    for (const auto& entry : manifest.entries)
+    {
+        const std::filesystem::path destination_path = destination_root / std::filesystem::u8path(entry.relative_path);
+
+        if (entry.is_directory)
+        {
+            std::filesystem::create_directories(destination_path);
+        }
+        else
+        {
+            std::filesystem::create_directories(destination_path.parent_path());
+            store.RestoreFile(entry.chunks, destination_path);
+        }
+    }
+}
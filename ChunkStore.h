@@ -0,0 +1,154 @@
+#pragma once
+
+//Content addressed chunk store that snapshots are written into instead of full copies of the save folder.
+// Files are cut into variable sized chunks with a rolling gear hash (content-defined chunking), so an edit in the middle of a
+// save only changes the chunks around the edit instead of shifting every chunk boundary after it.  Chunks are named by their
+// SHA-256 and only written once, so a snapshot of unchanged data costs nothing more than its manifest.
+//
+// There is one store for every game, so identical files shared between games (or between snapshots) are stored once.  The store
+// keeps a count of the references every snapshot manifest holds on each chunk.  Removing a snapshot drops its references, and
+// chunks nobody references anymore are swept a batch at a time, so collecting garbage never holds up backups writing to the
+// store for more than one batch.  If the counts were not saved after a change (the program was cut off), they are rebuilt the
+// first time they're needed by marking every chunk named by a manifest under the backups folder, and the rest is swept.
+//
+// Other instances (the watch daemon next to a command line backup, say) use the same store.  The counts are only read, changed
+// and swept while holding the store lock, which is taken when they're first needed, so they're read from disk again every
+// time, and let go once they're saved.  A backup holds references its manifest only settles at the end, so it keeps the store
+// locked for as long as it runs with a ChunkStore::Hold.
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define CHUNK_STORE_PATH "./Backups/.store"
+#define SNAPSHOT_MANIFEST_NAME "snapshot.manifest"
+#define CHUNK_REFERENCES_NAME "references"
+//Exists while the saved reference counts are behind the ones in memory.
+#define CHUNK_REFERENCES_DIRTY_NAME "references.dirty"
+//Held by whichever instance is changing the reference counts.
+#define CHUNK_STORE_LOCK_NAME "lock"
+//A chunked backup keeps the store locked until it's done, so waiting for the lock may mean waiting out another instance's backup.
+#define CHUNK_STORE_LOCK_TIMEOUT_MS (10 * 60 * 1000)
+//Chunks deleted per garbage collection step before the store is let go for backups again.
+#define CHUNK_COLLECT_BATCH_SIZE 64
+
+//Chunk size bounds.  Average is what the boundary mask aims for, min/max keep pathological data from making tiny or huge chunks.
+#define CHUNK_MIN_SIZE (16 * 1024)
+#define CHUNK_AVERAGE_SIZE (64 * 1024)
+#define CHUNK_MAX_SIZE (256 * 1024)
+
+struct ChunkRef
+{
+    std::string hash;
+    uint32_t length = 0;
+};
+
+struct ManifestEntry
+{
+    bool is_directory = false;
+    std::string relative_path;      //UTF-8 generic path, relative to the folder the save folder lives in (same layout as a plain backup)
+    uint64_t size = 0;
+    std::vector<ChunkRef> chunks;
+};
+
+struct SnapshotManifest
+{
+    std::vector<ManifestEntry> entries;
+};
+
+class FileLock;
+
+class ChunkStore
+{
+public:
+    //Keeps the store locked against other instances while it exists, saves the counts and lets the store go once the last one
+    // ends.  Takes the lock right away, throws std::filesystem::filesystem_error if it's still held by someone else after
+    // CHUNK_STORE_LOCK_TIMEOUT_MS.
+    class Hold
+    {
+    public:
+        explicit Hold(ChunkStore& store);
+        ~Hold();
+
+        Hold(const Hold&) = delete;
+        Hold& operator=(const Hold&) = delete;
+
+    private:
+        ChunkStore& store;
+    };
+
+    //The store lives in the backups folder it serves, which is where its manifests are looked for when counts are rebuilt.
+    explicit ChunkStore(const std::filesystem::path& store_root);
+    //Saves the counts if they changed and lets the store go.
+    ~ChunkStore();
+
+    ChunkStore(const ChunkStore&) = delete;
+    ChunkStore& operator=(const ChunkStore&) = delete;
+
+    //Chunks a file and writes every chunk the store doesn't have yet.  Returns the ordered chunk list that rebuilds the file.
+    // The XXH64 of the whole file is computed in the same read pass for the change index, and the paths of the chunks that were
+    // new are appended to written_chunks so the caller can flush them.
+    // Every chunk returned carries one reference, which the snapshot's manifest then holds (or ReleaseReferences() gives back
+    // if the snapshot is abandoned), so a Hold should cover everything from the first call to the manifest being written.
+    // Safe to call from several threads at once, and while garbage is being collected.
+    // Throws on I/O errors, same as std::filesystem::copy_file does, so callers can treat it as a drop in replacement.
+    std::vector<ChunkRef> StoreFile(const std::filesystem::path& file_path, uint64_t& file_size, uint64_t& new_bytes_written, uint64_t& content_hash,
+                                    std::vector<std::filesystem::path>& written_chunks);
+
+    //Rebuilds a file out of its chunks, overwriting the destination if it exists.
+    void RestoreFile(const std::vector<ChunkRef>& chunks, const std::filesystem::path& destination) const;
+
+    //XXH64 of the file the chunks rebuild, without writing it anywhere.  Throws if a chunk is missing.
+    uint64_t HashFile(const std::vector<ChunkRef>& chunks) const;
+
+    //Reads a chunk back and checks it still has its length and SHA-256.  False if it's missing, cut short or changed.
+    bool VerifyChunk(const ChunkRef& chunk) const;
+
+    //Drops the references a manifest holds, once its snapshot is deleted or abandoned.  Chunks nobody references anymore stay
+    // on disk until CollectGarbage() runs.  Returns their total length, what the next collection frees.
+    uint64_t ReleaseReferences(const SnapshotManifest& manifest);
+
+    //Deletes every chunk nobody references, CHUNK_COLLECT_BATCH_SIZE at a time, then saves the reference counts.
+    // Returns how many chunks were deleted.
+    size_t CollectGarbage();
+
+    //Writes the reference counts to the store if they changed, and lets the store go unless a Hold keeps it.  Throws if they
+    // can't be written, the store is let go all the same.
+    void SaveReferenceCounts();
+
+private:
+    std::filesystem::path ChunkPath(const std::string& hash) const;
+    void WriteChunk(const uint8_t* data, size_t length, ChunkRef& ref, uint64_t& new_bytes_written, std::vector<std::filesystem::path>& written_chunks);
+    void WriteChunkData(const uint8_t* data, size_t length, const std::string& hash, uint64_t& new_bytes_written, std::vector<std::filesystem::path>& written_chunks);
+
+    //Everything below expects references_mutex to be held.
+    void AddReference(const std::string& hash);
+    bool ReleaseReference(const std::string& hash);
+    void LoadReferenceCounts();
+    void ReadReferenceCounts();
+    void RebuildReferenceCounts();
+    void WriteReferenceCounts();
+    void MarkReferencesChanged();
+    void UnlockReferenceCounts();
+
+    std::filesystem::path store_root;
+    std::filesystem::path chunks_root;
+    std::filesystem::path backups_root;
+
+    std::mutex references_mutex;
+    std::unique_ptr<FileLock> references_lock;  //taken and the counts loaded on first use, so restoring or verifying never reads them
+    int hold_count = 0;
+    bool references_changed = false;
+    std::unordered_map<std::string, uint32_t> reference_counts;
+    std::vector<std::string> garbage;   //chunks whose count dropped to 0, checked again before they're deleted
+};
+
+bool WriteManifest(const SnapshotManifest& manifest, const std::filesystem::path& manifest_path);
+bool ReadManifest(const std::filesystem::path& manifest_path, SnapshotManifest& manifest);
+
+//Recreates every directory and file of a snapshot underneath destination_root.
+void RestoreManifest(const ChunkStore& store, const SnapshotManifest& manifest, const std::filesystem::path& destination_root);
@@ -0,0 +1,684 @@
+#include "CommandLine.h"
+#include "BackupBenchmark.h"
+#include "BackupEngine.h"
+#include "CopyBenchmark.h"
+#include "JsonWriter.h"
+#include "SaveWatcher.h"
+#include "SnapshotCatalog.h"
+#include "SnapshotRestore.h"
+#include "SnapshotVerify.h"
+#include "SortBenchmark.h"
+#include "Telemetry.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+namespace
+{
+    void PrintUsage()
+    {
+        std::cerr << "Usage:" << std::endl
+                  << "  SaveBackupManager.exe                                         interactive menu" << std::endl
+                  << "  SaveBackupManager.exe backup  [--game <name>]...              back up all (or the named) games" << std::endl
+                  << "  SaveBackupManager.exe list    [--game <name>]...              list snapshots" << std::endl
+                  << "  SaveBackupManager.exe restore <game> <snapshot|latest> [--no-safety-copy]" << std::endl
+                  << "  SaveBackupManager.exe prune   [--game <name>]... [--keep <count>]" << std::endl
+                  << "  SaveBackupManager.exe verify  [--game <name>]...              check snapshots for damage" << std::endl
+                  << "  SaveBackupManager.exe watch                                   back up games as their saves change" << std::endl
+                  << "  SaveBackupManager.exe benchmark-backup [folder] [chunked|linked|archive]" << std::endl
+                  << "  SaveBackupManager.exe benchmark-copy [folder]" << std::endl
+                  << "  SaveBackupManager.exe benchmark-sort [count]" << std::endl;
+    }
+
+    //Usage errors still print JSON so a script reading stdout always gets something it can parse.
+    int UsageError(const std::string& command, const std::string& message)
+    {
+        JsonWriter json(std::cout);
+        json.BeginObject();
+        json.Key("command");
+        json.String(command);
+        json.Key("error");
+        json.String(message);
+        json.EndObject();
+        std::cout << std::endl;
+
+        std::cerr << message << std::endl;
+        PrintUsage();
+        return EXIT_CODE_USAGE;
+    }
+
+    struct CommandArguments
+    {
+        std::vector<std::string> games;         //--game, empty means every game
+        std::vector<std::string> positional;
+        int keep_count = -1;                    //--keep
+        bool safety_copy = true;                //--no-safety-copy turns it off
+        std::string error;
+    };
+
+    CommandArguments ParseArguments(int argc, char* argv[])
+    {
+        CommandArguments arguments;
+        for (int i = 2; i < argc; i++)
+        {
+            const std::string argument = argv[i];
+            if (argument == "--game" && i + 1 < argc)
+            {
+                arguments.games.push_back(argv[++i]);
+            }
+            else if (argument == "--keep" && i + 1 < argc)
+            {
+                try
+                {
+                    arguments.keep_count = std::stoi(argv[++i]);
+                }
+                catch (const std::exception&)
+                {
+                    arguments.error = "Invalid --keep count.";
+                }
+            }
+            else if (argument == "--no-safety-copy")
+            {
+                arguments.safety_copy = false;
+            }
+            else if (argument.compare(0, 2, "--") == 0)
+            {
+                arguments.error = "Unknown option " + argument + ".";
+            }
+            else
+            {
+                arguments.positional.push_back(argument);
+            }
+        }
+        return arguments;
+    }
+
+    //The named games, or every configured game sorted by name so output is stable between runs.
+    bool SelectGames(const std::vector<std::string>& requested_games, const std::unordered_map<std::string, std::string>& save_paths,
+                     std::vector<std::pair<std::string, std::filesystem::path>>& selected_games, std::string& error)
+    {
+        if (requested_games.empty())
+        {
+            for (const auto& save_path : save_paths)
+            {
+                selected_games.emplace_back(save_path.first, std::filesystem::u8path(save_path.second));
+            }
+            std::sort(selected_games.begin(), selected_games.end());
+            return true;
+        }
+
+        for (const auto& game_name : requested_games)
+        {
+            auto found = save_paths.find(game_name);
+            if (found == save_paths.end())
+            {
+                error = "Unknown game \"" + game_name + "\".";
+                return false;
+            }
+            selected_games.emplace_back(found->first, std::filesystem::u8path(found->second));
+        }
+        return true;
+    }
+
+    const char* StatusName(GameBackupStatus status)
+    {
+        switch (status)
+        {
+        case GameBackupStatus::BackedUp:
+            return "backed_up";
+        case GameBackupStatus::Unchanged:
+            return "unchanged";
+        case GameBackupStatus::Failed:
+            return "failed";
+        }
+        return "unknown";
+    }
+
+    size_t RemoveUnusedChunks(BackupEngine& backup_engine)
+    {
+        try
+        {
+            return backup_engine.Store().CollectGarbage();
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "Error cleaning up unused backup data: " << e.what() << std::endl;
+            return 0;
+        }
+    }
+
+    void WriteRemovedSnapshots(JsonWriter& json, const std::vector<SnapshotRemoval>& removed)
+    {
+        json.Key("snapshots_removed");
+        json.BeginArray();
+        for (const auto& removal : removed)
+        {
+            json.BeginObject();
+            json.Key("game");
+            json.String(removal.snapshot.game_name);
+            json.Key("snapshot");
+            json.String(removal.snapshot.snapshot_name);
+            json.Key("reason");
+            json.String(removal.reason);
+            json.EndObject();
+        }
+        json.EndArray();
+    }
+
+    int RunBackup(const CommandArguments& arguments, const BackupSettings& settings, const std::unordered_map<std::string, std::string>& save_paths)
+    {
+        std::vector<std::pair<std::string, std::filesystem::path>> selected_games;
+        std::string error;
+        if (!SelectGames(arguments.games, save_paths, selected_games, error))
+        {
+            return UsageError("backup", error);
+        }
+
+        //Missing save folders fail on their own instead of prompting like the menu does.
+        std::vector<std::pair<std::string, std::filesystem::path>> games_to_back_up;
+        std::vector<GameBackupResult> results;
+        for (const auto& game : selected_games)
+        {
+            if (std::filesystem::exists(game.second))
+            {
+                games_to_back_up.push_back(game);
+            }
+            else
+            {
+                GameBackupResult result;
+                result.game_name = game.first;
+                result.error = "Save folder " + game.second.u8string() + " doesn't exist.";
+                results.push_back(result);
+            }
+        }
+
+        BackupEngine backup_engine(settings);
+        std::vector<GameBackupResult> engine_results = backup_engine.BackupGames(games_to_back_up);
+
+        for (auto& result : engine_results)
+        {
+            results.push_back(std::move(result));
+        }
+        const RetentionResult& retention = backup_engine.LastRetention();
+        if (!retention.error.empty())
+        {
+            std::cerr << retention.error << std::endl;
+        }
+
+        std::sort(results.begin(), results.end(), [](const GameBackupResult& a, const GameBackupResult& b) { return a.game_name < b.game_name; });
+
+        bool any_failed = false;
+        JsonWriter json(std::cout);
+        json.BeginObject();
+        json.Key("command");
+        json.String("backup");
+        json.Key("games");
+        json.BeginArray();
+        for (const auto& result : results)
+        {
+            any_failed = any_failed || result.status == GameBackupStatus::Failed;
+
+            json.BeginObject();
+            json.Key("game");
+            json.String(result.game_name);
+            json.Key("status");
+            json.String(StatusName(result.status));
+            if (result.status == GameBackupStatus::BackedUp)
+            {
+                json.Key("snapshot");
+                json.String(result.snapshot_name);
+                json.Key("files_written");
+                json.Number(static_cast<uint64_t>(result.files_stored));
+                json.Key("files_reused");
+                json.Number(static_cast<uint64_t>(result.files_reused));
+                json.Key("bytes_written");
+                json.Number(result.bytes_written);
+                if (settings.consistent_capture)
+                {
+                    json.Key("capture_passes");
+                    json.Number(static_cast<uint64_t>(result.capture_passes));
+                    json.Key("capture_settled");
+                    json.Bool(result.capture_settled);
+                }
+            }
+            if (result.status == GameBackupStatus::Failed)
+            {
+                json.Key("error");
+                json.String(result.error);
+            }
+            json.EndObject();
+        }
+        json.EndArray();
+        WriteRemovedSnapshots(json, retention.removed);
+        json.Key("chunks_removed");
+        json.Number(static_cast<uint64_t>(retention.chunks_removed));
+        json.EndObject();
+        std::cout << std::endl;
+
+        return any_failed ? EXIT_CODE_FAILED : EXIT_CODE_SUCCESS;
+    }
+
+    int RunList(const CommandArguments& arguments, const std::unordered_map<std::string, std::string>& save_paths)
+    {
+        std::vector<std::pair<std::string, std::filesystem::path>> selected_games;
+        std::string error;
+        if (!SelectGames(arguments.games, save_paths, selected_games, error))
+        {
+            return UsageError("list", error);
+        }
+
+        SnapshotCatalog catalog(SNAPSHOT_CATALOG_PATH, BACKUPS_ROOT_PATH);
+
+        JsonWriter json(std::cout);
+        json.BeginObject();
+        json.Key("command");
+        json.String("list");
+        json.Key("games");
+        json.BeginArray();
+        for (const auto& game : selected_games)
+        {
+            json.BeginObject();
+            json.Key("game");
+            json.String(game.first);
+            json.Key("save_path");
+            json.String(game.second.u8string());
+            json.Key("snapshots");
+            json.BeginArray();
+            for (const auto& snapshot : catalog.Snapshots(game.first))
+            {
+                char fingerprint[17];
+                std::snprintf(fingerprint, sizeof(fingerprint), "%016llx", static_cast<unsigned long long>(snapshot.fingerprint));
+
+                json.BeginObject();
+                json.Key("name");
+                json.String(snapshot.snapshot_name);
+                json.Key("created");
+                json.Number(static_cast<int64_t>(snapshot.created_time));
+                json.Key("format");
+                json.String(SnapshotFormatName(snapshot.format));
+                json.Key("files");
+                json.Number(static_cast<uint64_t>(snapshot.file_count));
+                json.Key("total_size");
+                json.Number(snapshot.total_size);
+                json.Key("stored_size");
+                json.Number(snapshot.stored_size);
+                json.Key("fingerprint");
+                json.String(fingerprint);
+                json.EndObject();
+            }
+            json.EndArray();
+            json.EndObject();
+        }
+        json.EndArray();
+        json.EndObject();
+        std::cout << std::endl;
+
+        return EXIT_CODE_SUCCESS;
+    }
+
+    int RunRestore(const CommandArguments& arguments, const std::unordered_map<std::string, std::string>& save_paths)
+    {
+        if (arguments.positional.size() != 2)
+        {
+            return UsageError("restore", "restore needs a game and a snapshot name (or \"latest\").");
+        }
+
+        const std::string& game_name = arguments.positional[0];
+        auto found = save_paths.find(game_name);
+        if (found == save_paths.end())
+        {
+            return UsageError("restore", "Unknown game \"" + game_name + "\".");
+        }
+        const std::filesystem::path save_path = std::filesystem::u8path(found->second);
+
+        SnapshotCatalog catalog(SNAPSHOT_CATALOG_PATH, BACKUPS_ROOT_PATH);
+        const std::vector<CatalogSnapshot> snapshots = catalog.Snapshots(game_name);
+
+        std::string snapshot_name = arguments.positional[1];
+        if (snapshot_name == "latest")
+        {
+            if (snapshots.empty())
+            {
+                return UsageError("restore", "\"" + game_name + "\" has no backups.");
+            }
+            snapshot_name = snapshots.back().snapshot_name;
+        }
+        else if (std::none_of(snapshots.begin(), snapshots.end(), [&](const CatalogSnapshot& snapshot) { return snapshot.snapshot_name == snapshot_name; }))
+        {
+            return UsageError("restore", "\"" + game_name + "\" has no backup named \"" + snapshot_name + "\".");
+        }
+
+        const std::filesystem::path snapshot_path = GameBackupFolder(game_name) / std::filesystem::u8path(snapshot_name);
+
+        std::string error;
+        RestoreResult restore_result;
+        try
+        {
+            if (!std::filesystem::exists(snapshot_path))
+            {
+                catalog.Rebuild();
+                throw std::filesystem::filesystem_error("Backup no longer exists", snapshot_path, std::make_error_code(std::errc::no_such_file_or_directory));
+            }
+
+            restore_result = RestoreSnapshot(snapshot_path, save_path, arguments.safety_copy);
+        }
+        catch (const std::exception& e)
+        {
+            error = e.what();
+
+            //Files replaced before the failure were already moved into the safety copy.
+            const std::filesystem::path safety_copy_path = save_path.parent_path() / CURRENT_SAVE_BACKUP_NAME;
+            if (arguments.safety_copy && std::filesystem::exists(safety_copy_path))
+            {
+                restore_result.safety_copy_path = safety_copy_path;
+            }
+        }
+
+        JsonWriter json(std::cout);
+        json.BeginObject();
+        json.Key("command");
+        json.String("restore");
+        json.Key("game");
+        json.String(game_name);
+        json.Key("snapshot");
+        json.String(snapshot_name);
+        json.Key("status");
+        json.String(error.empty() ? "restored" : "failed");
+        json.Key("restored_to");
+        json.String(save_path.parent_path().u8string());
+        if (error.empty())
+        {
+            json.Key("files_written");
+            json.Number(static_cast<uint64_t>(restore_result.files_written));
+            json.Key("files_deleted");
+            json.Number(static_cast<uint64_t>(restore_result.files_deleted));
+            json.Key("files_unchanged");
+            json.Number(static_cast<uint64_t>(restore_result.files_unchanged));
+            json.Key("bytes_written");
+            json.Number(restore_result.bytes_written);
+        }
+        json.Key("safety_copy");
+        if (restore_result.safety_copy_path.empty())
+        {
+            json.Null();
+        }
+        else
+        {
+            json.String(restore_result.safety_copy_path.u8string());
+        }
+        if (!error.empty())
+        {
+            json.Key("error");
+            json.String(error);
+        }
+        json.EndObject();
+        std::cout << std::endl;
+
+        return error.empty() ? EXIT_CODE_SUCCESS : EXIT_CODE_FAILED;
+    }
+
+    int RunPrune(const CommandArguments& arguments, const BackupSettings& settings, const std::unordered_map<std::string, std::string>& save_paths)
+    {
+        std::vector<std::pair<std::string, std::filesystem::path>> selected_games;
+        std::string error;
+        if (!SelectGames(arguments.games, save_paths, selected_games, error))
+        {
+            return UsageError("prune", error);
+        }
+
+        BackupEngine backup_engine(settings);
+
+        //Without --keep the retention rules from settings.ini decide, only the selected games lose snapshots.
+        if (arguments.keep_count < 0)
+        {
+            std::vector<std::string> game_names;
+            for (const auto& game : selected_games)
+            {
+                game_names.push_back(game.first);
+            }
+            const RetentionResult retention = backup_engine.ApplyRetention(game_names);
+
+            JsonWriter json(std::cout);
+            json.BeginObject();
+            json.Key("command");
+            json.String("prune");
+            json.Key("keep");
+            json.String("retention");
+            WriteRemovedSnapshots(json, retention.removed);
+            json.Key("chunks_removed");
+            json.Number(static_cast<uint64_t>(retention.chunks_removed));
+            if (!retention.error.empty())
+            {
+                json.Key("error");
+                json.String(retention.error);
+            }
+            json.EndObject();
+            std::cout << std::endl;
+
+            return retention.error.empty() ? EXIT_CODE_SUCCESS : EXIT_CODE_FAILED;
+        }
+
+        const int keep_count = arguments.keep_count;
+
+        bool any_failed = false;
+        bool snapshots_removed = false;
+
+        JsonWriter json(std::cout);
+        json.BeginObject();
+        json.Key("command");
+        json.String("prune");
+        json.Key("keep");
+        json.Number(static_cast<int64_t>(keep_count));
+        json.Key("games");
+        json.BeginArray();
+        for (const auto& game : selected_games)
+        {
+            json.BeginObject();
+            json.Key("game");
+            json.String(game.first);
+            try
+            {
+                const std::vector<std::string> removed_snapshots = backup_engine.PruneSnapshots(game.first, keep_count);
+                snapshots_removed = snapshots_removed || !removed_snapshots.empty();
+
+                json.Key("removed");
+                json.BeginArray();
+                for (const auto& snapshot_name : removed_snapshots)
+                {
+                    json.String(snapshot_name);
+                }
+                json.EndArray();
+            }
+            catch (const std::exception& e)
+            {
+                any_failed = true;
+                json.Key("error");
+                json.String(e.what());
+            }
+            json.EndObject();
+        }
+        json.EndArray();
+        json.Key("chunks_removed");
+        json.Number(static_cast<uint64_t>(snapshots_removed ? RemoveUnusedChunks(backup_engine) : 0));
+        json.EndObject();
+        std::cout << std::endl;
+
+        return any_failed ? EXIT_CODE_FAILED : EXIT_CODE_SUCCESS;
+    }
+
+    int RunVerify(const CommandArguments& arguments, const BackupSettings& settings)
+    {
+        //Snapshots can be checked for games that were since removed from savefolders.ini, so games come from the catalog.
+        SnapshotCatalog catalog(SNAPSHOT_CATALOG_PATH, BACKUPS_ROOT_PATH);
+        const std::vector<std::string> known_games = catalog.Games();
+        for (const auto& game_name : arguments.games)
+        {
+            if (std::find(known_games.begin(), known_games.end(), game_name) == known_games.end())
+            {
+                return UsageError("verify", "No backups of game \"" + game_name + "\".");
+            }
+        }
+
+        const std::vector<SnapshotVerifyResult> results = VerifySnapshots(settings, catalog, arguments.games);
+
+        size_t damaged_count = 0;
+
+        JsonWriter json(std::cout);
+        json.BeginObject();
+        json.Key("command");
+        json.String("verify");
+        json.Key("snapshots");
+        json.BeginArray();
+        for (const auto& result : results)
+        {
+            json.BeginObject();
+            json.Key("game");
+            json.String(result.game_name);
+            json.Key("snapshot");
+            json.String(result.snapshot_name);
+            json.Key("format");
+            json.String(SnapshotFormatName(result.format));
+            json.Key("status");
+            json.String(VerifyStatusName(result.status));
+            json.Key("files_checked");
+            json.Number(static_cast<uint64_t>(result.files_checked));
+            json.Key("bytes_checked");
+            json.Number(result.bytes_checked);
+            json.Key("problems");
+            json.BeginArray();
+            for (const auto& problem : result.problems)
+            {
+                json.BeginObject();
+                json.Key("path");
+                json.String(problem.relative_path);
+                json.Key("problem");
+                json.String(problem.problem);
+                json.EndObject();
+            }
+            json.EndArray();
+            json.EndObject();
+
+            if (result.status == VerifyStatus::Damaged)
+            {
+                damaged_count++;
+            }
+        }
+        json.EndArray();
+        json.Key("damaged");
+        json.Number(static_cast<uint64_t>(damaged_count));
+        json.EndObject();
+        std::cout << std::endl;
+
+        return (damaged_count > 0) ? EXIT_CODE_FAILED : EXIT_CODE_SUCCESS;
+    }
+}
+
+int RunCommandLine(int argc, char* argv[], const BackupSettings& settings, const std::unordered_map<std::string, std::string>& save_paths)
+{
+    const std::string command = argv[1];
+
+    if (command == "benchmark-backup")
+    {
+        std::vector<SnapshotFormat> formats = { SnapshotFormat::Chunked, SnapshotFormat::Linked, SnapshotFormat::Archive };
+        if (argc >= 4)
+        {
+            const auto named = std::find_if(formats.begin(), formats.end(), [&](SnapshotFormat format) { return argv[3] == std::string(SnapshotFormatName(format)); });
+            if (named == formats.end())
+            {
+                std::cerr << "Unknown snapshot format \"" << argv[3] << "\"." << std::endl;
+                PrintUsage();
+                return EXIT_CODE_USAGE;
+            }
+            formats = { *named };
+        }
+        return RunBackupBenchmark(settings, argc >= 3 ? std::filesystem::u8path(argv[2]) : std::filesystem::path(BACKUP_BENCHMARK_DEFAULT_FOLDER), formats);
+    }
+    if (command == "benchmark-copy")
+    {
+        return RunCopyBenchmark(argc >= 3 ? std::filesystem::u8path(argv[2]) : std::filesystem::path(COPY_BENCHMARK_DEFAULT_FOLDER));
+    }
+    if (command == "benchmark-sort")
+    {
+        size_t count = SORT_BENCHMARK_DEFAULT_COUNT;
+        if (argc >= 3)
+        {
+            //Digits only, stoul would take "-1" as a huge count and stops quietly at trailing junk.
+            const std::string argument = argv[2];
+            try
+            {
+                size_t parsed_length = 0;
+                count = (argument.find_first_not_of("0123456789") == std::string::npos) ? static_cast<size_t>(std::stoull(argument, &parsed_length)) : 0;
+                if (parsed_length != argument.size())
+                {
+                    count = 0;
+                }
+            }
+            catch (const std::exception&)
+            {
+                count = 0;
+            }
+
+            if (count == 0)
+            {
+                std::cerr << "Invalid count \"" << argument << "\"." << std::endl;
+                PrintUsage();
+                return EXIT_CODE_USAGE;
+            }
+        }
+        return RunSortBenchmark(count);
+    }
+    if (command == "watch")
+    {
+        return RunWatchDaemon(settings, save_paths);
+    }
+    if (command == "help" || command == "--help" || command == "/?")
+    {
+        PrintUsage();
+        return EXIT_CODE_SUCCESS;
+    }
+
+    const CommandArguments arguments = ParseArguments(argc, argv);
+    if (!arguments.error.empty())
+    {
+        return UsageError(command, arguments.error);
+    }
+
+    //Telemetry tables go to stderr, stdout only ever carries the JSON.
+
+    if (command == "backup")
+    {
+        StartTelemetry(settings);
+        const int exit_code = RunBackup(arguments, settings, save_paths);
+        FinishTelemetry(std::cerr);
+        return exit_code;
+    }
+    if (command == "list")
+    {
+        return RunList(arguments, save_paths);
+    }
+    if (command == "restore")
+    {
+        StartTelemetry(settings);
+        const int exit_code = RunRestore(arguments, save_paths);
+        FinishTelemetry(std::cerr);
+        return exit_code;
+    }
+    if (command == "prune")
+    {
+        StartTelemetry(settings);
+        const int exit_code = RunPrune(arguments, settings, save_paths);
+        FinishTelemetry(std::cerr);
+        return exit_code;
+    }
+    if (command == "verify")
+    {
+        return RunVerify(arguments, settings);
+    }
+
+    return UsageError(command, "Unknown command \"" + command + "\".");
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+//Non-interactive subcommands, so backups can be scripted or scheduled:
+//
+//   SaveBackupManager.exe backup  [--game <name>]...
+//   SaveBackupManager.exe list    [--game <name>]...
+//   SaveBackupManager.exe restore <game> <snapshot | latest> [--no-safety-copy]
+//   SaveBackupManager.exe prune   [--game <name>]... [--keep <count>]
+//   SaveBackupManager.exe verify  [--game <name>]...
+//   SaveBackupManager.exe watch
+//   SaveBackupManager.exe benchmark-backup [folder] [chunked | linked | archive]
+//   SaveBackupManager.exe benchmark-copy [folder]
+//   SaveBackupManager.exe benchmark-sort [count]
+//
+// backup, list, restore, prune and verify print a single JSON object on stdout.  They use the same BackupEngine as the menu, minus
+// the prompts and console clearing.  With telemetry on in settings.ini, backup, restore and prune also print where the time
+// went to stderr.
+
+#include "Settings.h"
+
+#include <string>
+#include <unordered_map>
+
+#define EXIT_CODE_SUCCESS 0
+#define EXIT_CODE_FAILED 1      //the command ran but some game (or the restore) failed, or verify found a damaged snapshot
+#define EXIT_CODE_USAGE 2       //unknown command, bad arguments or unknown game
+
+int RunCommandLine(int argc, char* argv[], const BackupSettings& settings, const std::unordered_map<std::string, std::string>& save_paths);
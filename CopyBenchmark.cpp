@@ -0,0 +1,345 @@
+#include "CopyBenchmark.h"
+#include "BatchCopy.h"
+#include "BenchmarkFolder.h"
+#include "FileCopy.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+    struct TreeEntry
+    {
+        std::filesystem::path relative_path;
+        bool is_directory = false;
+        uint64_t size = 0;
+    };
+
+    void WriteRandomFile(const std::filesystem::path& path, uint64_t size, std::mt19937_64& random)
+    {
+        std::ofstream output(path, std::ios::binary | std::ios::trunc);
+        std::vector<uint64_t> block(64 * 1024 / sizeof(uint64_t));
+
+        uint64_t remaining = size;
+        while (remaining > 0)
+        {
+            for (auto& value : block)
+            {
+                value = random();
+            }
+
+            const size_t write_size = static_cast<size_t>(std::min<uint64_t>(remaining, block.size() * sizeof(uint64_t)));
+            output.write(reinterpret_cast<const char*>(block.data()), write_size);
+            remaining -= write_size;
+        }
+    }
+
+    //Roughly what a real save folder looks like: lots of small slot/metadata files a few folders deep, a handful of
+    // medium sized saves and a couple of big blobs.
+    std::vector<TreeEntry> GenerateSaveTree(const std::filesystem::path& root)
+    {
+        std::mt19937_64 random(20240101);
+        std::vector<TreeEntry> entries;
+
+        auto add_file = [&](const std::filesystem::path& relative_path, uint64_t size)
+        {
+            std::filesystem::create_directories((root / relative_path).parent_path());
+            WriteRandomFile(root / relative_path, size, random);
+            entries.push_back({ relative_path, false, size });
+        };
+
+        for (int slot = 0; slot < 20; slot++)
+        {
+            const std::filesystem::path slot_folder = std::filesystem::path("profile") / ("slot" + std::to_string(slot));
+            entries.push_back({ slot_folder, true, 0 });
+            for (int file = 0; file < 100; file++)
+            {
+                add_file(slot_folder / ("meta" + std::to_string(file) + ".dat"), 1024 + random() % (63 * 1024));
+            }
+        }
+
+        for (int save = 0; save < 40; save++)
+        {
+            add_file(std::filesystem::path("saves") / ("save" + std::to_string(save) + ".sav"), 256 * 1024 + random() % (4 * 1024 * 1024));
+        }
+
+        add_file("world.bin", 128ull * 1024 * 1024);
+        add_file("cache.bin", 128ull * 1024 * 1024);
+
+        return entries;
+    }
+
+    double TimeTreeCopy(const std::vector<TreeEntry>& entries, const std::filesystem::path& source_root, const std::filesystem::path& destination_root,
+                        const std::function<void(const std::filesystem::path&, const std::filesystem::path&)>& copy)
+    {
+        std::filesystem::remove_all(destination_root);
+        std::filesystem::create_directories(destination_root);
+
+        const auto start = std::chrono::steady_clock::now();
+        for (const auto& entry : entries)
+        {
+            const std::filesystem::path destination = destination_root / entry.relative_path;
+            if (entry.is_directory)
+            {
+                std::filesystem::create_directories(destination);
+            }
+            else
+            {
+                std::filesystem::create_directories(destination.parent_path());
+                copy(source_root / entry.relative_path, destination);
+            }
+        }
+        const auto end = std::chrono::steady_clock::now();
+
+        return std::chrono::duration<double>(end - start).count();
+    }
+
+    //The many small files case on its own: SMALL_FILE_BENCHMARK_COUNT files of a few KB spread over 100 folders.
+    std::vector<TreeEntry> GenerateSmallFileTree(const std::filesystem::path& root)
+    {
+        std::mt19937_64 random(20240102);
+        std::vector<TreeEntry> entries;
+
+        const int folder_count = 100;
+        for (int folder = 0; folder < folder_count; folder++)
+        {
+            const std::filesystem::path folder_path = std::filesystem::path("slots") / ("folder" + std::to_string(folder));
+            std::filesystem::create_directories(root / folder_path);
+            entries.push_back({ folder_path, true, 0 });
+
+            for (int file = 0; file < SMALL_FILE_BENCHMARK_COUNT / folder_count; file++)
+            {
+                const std::filesystem::path relative_path = folder_path / ("slot" + std::to_string(file) + ".meta");
+                const uint64_t size = 512 + random() % (16 * 1024);
+                WriteRandomFile(root / relative_path, size, random);
+                entries.push_back({ relative_path, false, size });
+            }
+        }
+
+        return entries;
+    }
+
+    //What backups used to do per file: walk the tree, work out the relative path, make sure the folder exists, copy_file.
+    double TimeDirectoryWalkCopy(const std::filesystem::path& source_root, const std::filesystem::path& destination_root)
+    {
+        std::filesystem::remove_all(destination_root);
+
+        const auto start = std::chrono::steady_clock::now();
+        for (const auto& entry : std::filesystem::recursive_directory_iterator(source_root))
+        {
+            const std::filesystem::path destination = destination_root / std::filesystem::relative(entry.path(), source_root);
+            if (entry.is_directory())
+            {
+                std::filesystem::create_directories(destination);
+            }
+            else
+            {
+                std::filesystem::create_directories(destination.parent_path());
+                std::filesystem::copy_file(entry.path(), destination, std::filesystem::copy_options::overwrite_existing);
+            }
+        }
+        const auto end = std::chrono::steady_clock::now();
+
+        return std::chrono::duration<double>(end - start).count();
+    }
+
+    //Folders made up front like a snapshot does, then every file through CopyFileBatch in backup sized batches.
+    double TimeBatchCopy(const std::vector<TreeEntry>& entries, const std::filesystem::path& source_root, const std::filesystem::path& destination_root)
+    {
+        std::filesystem::remove_all(destination_root);
+
+        const auto start = std::chrono::steady_clock::now();
+        std::vector<BatchCopyItem> items;
+        for (const auto& entry : entries)
+        {
+            if (entry.is_directory)
+            {
+                std::filesystem::create_directories(destination_root / entry.relative_path);
+                continue;
+            }
+
+            items.emplace_back();
+            items.back().source = source_root / entry.relative_path;
+            items.back().destination = destination_root / entry.relative_path;
+            if (items.size() == BATCH_COPY_FILES_PER_TASK)
+            {
+                CopyFileBatch(items);
+                for (const auto& item : items)
+                {
+                    if (!item.error.empty())
+                    {
+                        throw std::runtime_error(item.error);
+                    }
+                }
+                items.clear();
+            }
+        }
+        CopyFileBatch(items);
+        for (const auto& item : items)
+        {
+            if (!item.error.empty())
+            {
+                throw std::runtime_error(item.error);
+            }
+        }
+        const auto end = std::chrono::steady_clock::now();
+
+        return std::chrono::duration<double>(end - start).count();
+    }
+
+    void PrintResultRow(const std::string& name, double seconds, uint64_t total_bytes, size_t total_files)
+    {
+        std::cout << std::left << std::setw(30) << name << std::right << std::fixed << std::setprecision(3)
+                  << std::setw(12) << seconds
+                  << std::setprecision(1) << std::setw(12) << (total_bytes / (1024.0 * 1024.0)) / seconds
+                  << std::setw(12) << total_files / seconds << std::endl;
+    }
+
+    void PrintResultHeader(const std::string& first_column)
+    {
+        std::cout << std::left << std::setw(30) << first_column << std::right << std::setw(12) << "Seconds" << std::setw(12) << "MB/s" << std::setw(12) << "Files/s" << std::endl;
+        std::cout << std::string(66, '-') << std::endl;
+    }
+
+    //Small files are dominated by per file overhead rather than bandwidth, so they get their own table.
+    int RunSmallFileBenchmark(const std::filesystem::path& work_folder)
+    {
+        const std::filesystem::path source_root = work_folder / "small_source";
+        const std::filesystem::path destination_root = work_folder / "small_copy";
+
+        std::cout << std::endl << "Generating " << SMALL_FILE_BENCHMARK_COUNT << " small files..." << std::endl;
+        const std::vector<TreeEntry> entries = GenerateSmallFileTree(source_root);
+
+        uint64_t total_bytes = 0;
+        for (const auto& entry : entries)
+        {
+            total_bytes += entry.size;
+        }
+        const size_t total_files = SMALL_FILE_BENCHMARK_COUNT;
+
+        struct Candidate
+        {
+            std::string name;
+            std::function<double()> run;
+        };
+
+        std::vector<Candidate> candidates;
+        candidates.push_back({ "walk + copy_file loop", [&] { return TimeDirectoryWalkCopy(source_root, destination_root); } });
+        candidates.push_back({ "buffered, one at a time", [&]
+            { return TimeTreeCopy(entries, source_root, destination_root, [](const std::filesystem::path& from, const std::filesystem::path& to) { CopyFileHashed(from, to); }); } });
+        candidates.push_back({ "batched (completion port)", [&] { return TimeBatchCopy(entries, source_root, destination_root); } });
+
+        //Warm the cache the same way as the big tree.
+        TimeDirectoryWalkCopy(source_root, destination_root);
+
+        PrintResultHeader("Small files");
+
+        int exit_code = 0;
+        for (const auto& candidate : candidates)
+        {
+            try
+            {
+                PrintResultRow(candidate.name, candidate.run(), total_bytes, total_files);
+            }
+            catch (const std::exception& e)
+            {
+                std::cout << std::left << std::setw(30) << candidate.name << "failed: " << e.what() << std::endl;
+                exit_code = 1;
+            }
+        }
+        return exit_code;
+    }
+}
+
+int RunCopyBenchmark(const std::filesystem::path& parent_folder)
+{
+    std::unique_ptr<BenchmarkFolder> benchmark_folder;
+    try
+    {
+        benchmark_folder = std::make_unique<BenchmarkFolder>(parent_folder);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    const std::filesystem::path& work_folder = benchmark_folder->Path();
+    const std::filesystem::path source_root = work_folder / "source";
+    const std::filesystem::path destination_root = work_folder / "copy";
+
+    std::cout << "Generating synthetic save tree in " << work_folder << "..." << std::endl;
+    std::vector<TreeEntry> entries = GenerateSaveTree(source_root);
+
+    uint64_t total_bytes = 0;
+    size_t total_files = 0;
+    for (const auto& entry : entries)
+    {
+        if (!entry.is_directory)
+        {
+            total_bytes += entry.size;
+            total_files++;
+        }
+    }
+    std::cout << total_files << " files, " << total_bytes / (1024 * 1024) << " MB" << std::endl << std::endl;
+
+    struct Candidate
+    {
+        std::string name;
+        std::function<void(const std::filesystem::path&, const std::filesystem::path&)> copy;
+    };
+
+    std::vector<Candidate> candidates;
+    candidates.push_back({ "std::filesystem::copy_file", [](const std::filesystem::path& from, const std::filesystem::path& to)
+        { std::filesystem::copy_file(from, to, std::filesystem::copy_options::overwrite_existing); } });
+    candidates.push_back({ CopyBackendName(CopyBackend::Buffered), [](const std::filesystem::path& from, const std::filesystem::path& to)
+        { CopyFileFast(from, to, CopyBackend::Buffered); } });
+    candidates.push_back({ CopyBackendName(CopyBackend::KernelCopy), [](const std::filesystem::path& from, const std::filesystem::path& to)
+        { CopyFileFast(from, to, CopyBackend::KernelCopy); } });
+
+    if (SupportsBlockClone(source_root, destination_root))
+    {
+        candidates.push_back({ CopyBackendName(CopyBackend::BlockClone), [](const std::filesystem::path& from, const std::filesystem::path& to)
+            { CopyFileFast(from, to, CopyBackend::BlockClone); } });
+    }
+    else
+    {
+        std::cout << "Block cloning isn't supported on this volume, skipping it." << std::endl << std::endl;
+    }
+
+    //One untimed pass so every backend reads from the same (warm) cache.
+    TimeTreeCopy(entries, source_root, destination_root, candidates[0].copy);
+
+    PrintResultHeader("Backend");
+
+    int exit_code = 0;
+    for (const auto& candidate : candidates)
+    {
+        try
+        {
+            PrintResultRow(candidate.name, TimeTreeCopy(entries, source_root, destination_root, candidate.copy), total_bytes, total_files);
+        }
+        catch (const std::exception& e)
+        {
+            std::cout << std::left << std::setw(30) << candidate.name << "failed: " << e.what() << std::endl;
+            exit_code = 1;
+        }
+    }
+
+    if (RunSmallFileBenchmark(work_folder) != 0)
+    {
+        exit_code = 1;
+    }
+
+    return exit_code;
+}
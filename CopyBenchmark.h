@@ -0,0 +1,15 @@
+#pragma once
+
+//Times every copy backend against the same generated save tree, run with "SaveBackupManager.exe benchmark-copy [folder]".
+// The folder should be on the drive you want numbers for, block cloning only shows up when it's an ReFS / Dev Drive volume.
+// Everything is written to a SaveBackupManager.benchmark folder inside it and only that is deleted afterwards, see
+// BenchmarkFolder.h.
+// A second run copies a tree of SMALL_FILE_BENCHMARK_COUNT small files, comparing the old walk + copy_file loop with the
+// batched small file copy.
+
+#include <filesystem>
+
+#define COPY_BENCHMARK_DEFAULT_FOLDER "."
+#define SMALL_FILE_BENCHMARK_COUNT 10000
+
+int RunCopyBenchmark(const std::filesystem::path& parent_folder);
@@ -0,0 +1,577 @@
+#include "FileCopy.h"
+#include "FileStream.h"
+#include "Hashing.h"
+#include "VolumeThrottle.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#define NOMINMAX
+#include <Windows.h>
+#include <winioctl.h>
+
+//Largest range handed to a single FSCTL_DUPLICATE_EXTENTS_TO_FILE call (the API limit is just under 4GB).
+#define BLOCK_CLONE_MAX_RANGE (1024ull * 1024 * 1024)
+//Above this CopyFileExW is told to skip the cache, big files would only evict everything else from it.
+#define KERNEL_COPY_UNBUFFERED_THRESHOLD (64ull * 1024 * 1024)
+//Piece of a ranged copy read, written and hashed as one.  Also the smallest hole a sparse copy keeps when the source
+// has zeros where it doesn't have a hole.
+#define RANGED_COPY_BLOCK_SIZE (8 * 1024 * 1024)
+
+namespace
+{
+    //Closes a Win32 handle when it goes out of scope.
+    class ScopedHandle
+    {
+    public:
+        explicit ScopedHandle(HANDLE handle) : handle(handle) {}
+        ~ScopedHandle()
+        {
+            if (IsValid())
+            {
+                CloseHandle(handle);
+            }
+        }
+
+        ScopedHandle(const ScopedHandle&) = delete;
+        ScopedHandle& operator=(const ScopedHandle&) = delete;
+
+        bool IsValid() const { return handle != INVALID_HANDLE_VALUE && handle != NULL; }
+        HANDLE Get() const { return handle; }
+
+    private:
+        HANDLE handle;
+    };
+
+    std::filesystem::filesystem_error MakeCopyError(const std::string& what, const std::filesystem::path& source, const std::filesystem::path& destination)
+    {
+        return std::filesystem::filesystem_error(what, source, destination, std::error_code(static_cast<int>(GetLastError()), std::system_category()));
+    }
+
+    struct VolumeCloneInfo
+    {
+        bool supports_block_clone = false;
+        DWORD cluster_size = 0;
+    };
+
+    //Volume capabilities don't change while we run, so look each one up once.
+    std::mutex volume_info_mutex;
+    std::unordered_map<std::string, VolumeCloneInfo> volume_info_cache;
+
+    VolumeCloneInfo GetVolumeCloneInfo(const std::filesystem::path& path)
+    {
+        const std::string volume_name = VolumeThrottle::VolumeOf(path);
+
+        std::lock_guard<std::mutex> lock(volume_info_mutex);
+        auto found = volume_info_cache.find(volume_name);
+        if (found != volume_info_cache.end())
+        {
+            return found->second;
+        }
+
+        VolumeCloneInfo info;
+
+        wchar_t volume_root[MAX_PATH] = {};
+        std::error_code error;
+        const std::filesystem::path absolute_path = std::filesystem::absolute(path, error);
+        if (GetVolumePathNameW(absolute_path.c_str(), volume_root, MAX_PATH))
+        {
+            DWORD file_system_flags = 0;
+            if (GetVolumeInformationW(volume_root, NULL, 0, NULL, NULL, &file_system_flags, NULL, 0))
+            {
+                info.supports_block_clone = (file_system_flags & FILE_SUPPORTS_BLOCK_REFCOUNTING) != 0;
+            }
+
+            DWORD sectors_per_cluster = 0, bytes_per_sector = 0, free_clusters = 0, total_clusters = 0;
+            if (GetDiskFreeSpaceW(volume_root, &sectors_per_cluster, &bytes_per_sector, &free_clusters, &total_clusters))
+            {
+                info.cluster_size = sectors_per_cluster * bytes_per_sector;
+            }
+        }
+
+        if (info.cluster_size == 0)
+        {
+            info.supports_block_clone = false;
+        }
+
+        volume_info_cache[volume_name] = info;
+        return info;
+    }
+
+    //Copies the time stamps over, copy_file (and CopyFileExW) keep the modified time and the change index relies on it.
+    void CopyFileTimes(HANDLE source, HANDLE destination)
+    {
+        FILETIME creation_time, access_time, write_time;
+        if (GetFileTime(source, &creation_time, &access_time, &write_time))
+        {
+            SetFileTime(destination, &creation_time, &access_time, &write_time);
+        }
+    }
+
+    void BlockCloneCopy(const std::filesystem::path& source, const std::filesystem::path& destination)
+    {
+        const VolumeCloneInfo info = GetVolumeCloneInfo(destination);
+
+        ScopedHandle source_file(CreateFileW(source.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, 0, NULL));
+        if (!source_file.IsValid())
+        {
+            throw MakeCopyError("Unable to open file for cloning", source, destination);
+        }
+
+        LARGE_INTEGER file_size = {};
+        BY_HANDLE_FILE_INFORMATION source_info = {};
+        if (!GetFileSizeEx(source_file.Get(), &file_size) || !GetFileInformationByHandle(source_file.Get(), &source_info))
+        {
+            throw MakeCopyError("Unable to read file size for cloning", source, destination);
+        }
+
+        ScopedHandle destination_file(CreateFileW(destination.c_str(), GENERIC_READ | GENERIC_WRITE | DELETE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL));
+        if (!destination_file.IsValid())
+        {
+            throw MakeCopyError("Unable to create file for cloning", source, destination);
+        }
+
+        bool cloned = false;
+        {
+            DWORD bytes_returned = 0;
+
+            //ReFS only clones between files of the same sparseness.
+            if ((source_info.dwFileAttributes & FILE_ATTRIBUTE_SPARSE_FILE) != 0)
+            {
+                DeviceIoControl(destination_file.Get(), FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &bytes_returned, NULL);
+            }
+
+            FILE_END_OF_FILE_INFO end_of_file = {};
+            end_of_file.EndOfFile = file_size;
+            if (SetFileInformationByHandle(destination_file.Get(), FileEndOfFileInfo, &end_of_file, sizeof(end_of_file)))
+            {
+                //Ranges have to be whole clusters, the last one may run past the end of the file.
+                const uint64_t total_bytes = (static_cast<uint64_t>(file_size.QuadPart) + info.cluster_size - 1) / info.cluster_size * info.cluster_size;
+
+                cloned = true;
+                for (uint64_t offset = 0; offset < total_bytes && cloned; offset += BLOCK_CLONE_MAX_RANGE)
+                {
+                    DUPLICATE_EXTENTS_DATA extents = {};
+                    extents.FileHandle = source_file.Get();
+                    extents.SourceFileOffset.QuadPart = static_cast<LONGLONG>(offset);
+                    extents.TargetFileOffset.QuadPart = static_cast<LONGLONG>(offset);
+                    extents.ByteCount.QuadPart = static_cast<LONGLONG>(std::min<uint64_t>(BLOCK_CLONE_MAX_RANGE, total_bytes - offset));
+
+                    cloned = DeviceIoControl(destination_file.Get(), FSCTL_DUPLICATE_EXTENTS_TO_FILE, &extents, sizeof(extents), NULL, 0, &bytes_returned, NULL) != FALSE;
+                }
+            }
+        }
+
+        if (!cloned)
+        {
+            //Delete the half made file on close so the next backend starts clean.
+            std::filesystem::filesystem_error error = MakeCopyError("Block clone failed", source, destination);
+            FILE_DISPOSITION_INFO disposition = {};
+            disposition.DeleteFile = TRUE;
+            SetFileInformationByHandle(destination_file.Get(), FileDispositionInfo, &disposition, sizeof(disposition));
+            throw error;
+        }
+
+        CopyFileTimes(source_file.Get(), destination_file.Get());
+    }
+
+    void KernelCopy(const std::filesystem::path& source, const std::filesystem::path& destination)
+    {
+        DWORD copy_flags = 0;
+
+        std::error_code error;
+        const uintmax_t file_size = std::filesystem::file_size(source, error);
+        if (!error && file_size >= KERNEL_COPY_UNBUFFERED_THRESHOLD)
+        {
+            copy_flags |= COPY_FILE_NO_BUFFERING;
+        }
+
+        if (!CopyFileExW(source.c_str(), destination.c_str(), NULL, NULL, NULL, copy_flags))
+        {
+            throw MakeCopyError("Unable to copy file", source, destination);
+        }
+    }
+
+    //Hashes the data on its way through when hasher is set.  The source is read ahead by FileReadStream, so the disk is
+    // already fetching the next blocks while this one is hashed and written.
+    void BufferedCopy(const std::filesystem::path& source, const std::filesystem::path& destination, Xxh64* hasher = nullptr)
+    {
+        FileReadStream source_stream(source);
+
+        ScopedHandle destination_file(CreateFileW(destination.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL));
+        if (!destination_file.IsValid())
+        {
+            throw MakeCopyError("Unable to create file", source, destination);
+        }
+
+        const uint8_t* data = nullptr;
+        size_t length = 0;
+        while (source_stream.Next(data, length))
+        {
+            if (hasher != nullptr)
+            {
+                hasher->Update(data, length);
+            }
+
+            DWORD bytes_written = 0;
+            if (!WriteFile(destination_file.Get(), data, static_cast<DWORD>(length), &bytes_written, NULL) || bytes_written != length)
+            {
+                throw MakeCopyError("Unable to write file", source, destination);
+            }
+        }
+
+        CopyFileTimes(source_stream.Handle(), destination_file.Get());
+    }
+
+    struct CopyRange
+    {
+        uint64_t offset;
+        uint64_t length;
+    };
+
+    //Where a sparse file has data, sorted by offset.  Anything in between is a hole that reads back as zeros.  The whole
+    // file when it can't be asked.
+    std::vector<CopyRange> AllocatedRanges(HANDLE file, uint64_t file_size)
+    {
+        std::vector<CopyRange> ranges;
+
+        FILE_ALLOCATED_RANGE_BUFFER query = {};
+        query.FileOffset.QuadPart = 0;
+        query.Length.QuadPart = static_cast<LONGLONG>(file_size);
+        std::vector<FILE_ALLOCATED_RANGE_BUFFER> found(64);
+        while (true)
+        {
+            DWORD bytes_returned = 0;
+            const bool complete = DeviceIoControl(file, FSCTL_QUERY_ALLOCATED_RANGES, &query, sizeof(query), found.data(),
+                                                  static_cast<DWORD>(found.size() * sizeof(found[0])), &bytes_returned, NULL) != FALSE;
+            if (!complete && GetLastError() != ERROR_MORE_DATA)
+            {
+                return { { 0, file_size } };
+            }
+
+            const size_t count = bytes_returned / sizeof(FILE_ALLOCATED_RANGE_BUFFER);
+            for (size_t i = 0; i < count; i++)
+            {
+                const uint64_t offset = static_cast<uint64_t>(found[i].FileOffset.QuadPart);
+                if (offset < file_size)
+                {
+                    ranges.push_back({ offset, std::min(static_cast<uint64_t>(found[i].Length.QuadPart), file_size - offset) });
+                }
+            }
+            if (complete || count == 0)
+            {
+                break;
+            }
+
+            //More ranges than fit, ask again from the end of the last one.
+            query.FileOffset.QuadPart = found[count - 1].FileOffset.QuadPart + found[count - 1].Length.QuadPart;
+            query.Length.QuadPart = static_cast<LONGLONG>(file_size) - query.FileOffset.QuadPart;
+        }
+        return ranges;
+    }
+
+    void HashZeros(Xxh64& hasher, uint64_t count)
+    {
+        static const uint8_t zeros[64 * 1024] = {};
+        while (count > 0)
+        {
+            const size_t length = static_cast<size_t>(std::min<uint64_t>(count, sizeof(zeros)));
+            hasher.Update(zeros, length);
+            count -= length;
+        }
+    }
+
+    //Positional read or write on an overlapped handle, waited for.  Returns the bytes moved, 0 at the end of the file.
+    DWORD TransferAt(HANDLE file, bool write, uint8_t* data, DWORD length, uint64_t offset, HANDLE event)
+    {
+        OVERLAPPED overlapped = {};
+        overlapped.Offset = static_cast<DWORD>(offset);
+        overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        overlapped.hEvent = event;
+
+        DWORD transferred = 0;
+        const BOOL done = write ? WriteFile(file, data, length, &transferred, &overlapped) : ReadFile(file, data, length, &transferred, &overlapped);
+        if (!done && (GetLastError() != ERROR_IO_PENDING || !GetOverlappedResult(file, &overlapped, &transferred, TRUE)))
+        {
+            if (!write && GetLastError() == ERROR_HANDLE_EOF)
+            {
+                return 0;
+            }
+            return MAXDWORD;
+        }
+        return transferred;
+    }
+
+    //Copies the file a block at a time with positional reads and writes, split between up to `workers` threads.  Blocks
+    // are handed out in file order and hashed in file order, a worker that finishes early waits for its turn.
+    //
+    // A sparse source only has its allocated ranges read.  The copy is made sparse too and everything the source holds no
+    // data for, or holds a whole block of zeros for, is never written, so it stays a hole.
+    void RangedCopy(const std::filesystem::path& source, const std::filesystem::path& destination, bool sparse, int workers, Xxh64* hasher)
+    {
+        ScopedHandle source_file(CreateFileW(source.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL));
+        if (!source_file.IsValid())
+        {
+            throw MakeCopyError("Unable to open file", source, destination);
+        }
+
+        LARGE_INTEGER size = {};
+        if (!GetFileSizeEx(source_file.Get(), &size))
+        {
+            throw MakeCopyError("Unable to read file size", source, destination);
+        }
+        const uint64_t file_size = static_cast<uint64_t>(size.QuadPart);
+
+        ScopedHandle destination_file(CreateFileW(destination.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, NULL));
+        if (!destination_file.IsValid())
+        {
+            throw MakeCopyError("Unable to create file", source, destination);
+        }
+
+        DWORD bytes_returned = 0;
+        sparse = sparse && DeviceIoControl(destination_file.Get(), FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &bytes_returned, NULL) != FALSE;
+
+        std::vector<CopyRange> blocks;
+        for (const auto& range : sparse ? AllocatedRanges(source_file.Get(), file_size) : std::vector<CopyRange>{ { 0, file_size } })
+        {
+            for (uint64_t offset = 0; offset < range.length; offset += RANGED_COPY_BLOCK_SIZE)
+            {
+                blocks.push_back({ range.offset + offset, std::min<uint64_t>(RANGED_COPY_BLOCK_SIZE, range.length - offset) });
+            }
+        }
+
+        std::atomic<size_t> next_block(0);
+        std::atomic<bool> copy_failed(false);
+        std::exception_ptr copy_error;
+
+        std::mutex hash_mutex;
+        std::condition_variable hash_turn;
+        size_t blocks_hashed = 0;
+        uint64_t hashed_up_to = 0;
+
+        auto fail = [&](std::exception_ptr error)
+        {
+            std::lock_guard<std::mutex> lock(hash_mutex);
+            if (!copy_failed)
+            {
+                copy_error = error;
+            }
+            copy_failed = true;
+            hash_turn.notify_all();
+        };
+
+        auto copy_blocks = [&]
+        {
+            try
+            {
+                std::unique_ptr<uint8_t[]> buffer(new uint8_t[RANGED_COPY_BLOCK_SIZE]);
+                ScopedHandle event(CreateEventW(NULL, TRUE, FALSE, NULL));
+
+                for (size_t index = next_block++; index < blocks.size() && !copy_failed; index = next_block++)
+                {
+                    const CopyRange& block = blocks[index];
+                    const DWORD length = TransferAt(source_file.Get(), false, buffer.get(), static_cast<DWORD>(block.length), block.offset, event.Get());
+                    if (length == MAXDWORD)
+                    {
+                        throw MakeCopyError("Unable to read file", source, destination);
+                    }
+                    //Cut short by the source shrinking mid copy.  The copy, and the zeros hashed in for the missing bytes, would
+                    // be neither the old file nor the new one.
+                    if (length != block.length)
+                    {
+                        throw std::filesystem::filesystem_error("File changed while it was copied", source, destination,
+                                                                std::error_code(ERROR_HANDLE_EOF, std::system_category()));
+                    }
+
+                    const bool all_zero = sparse && std::all_of(buffer.get(), buffer.get() + length, [](uint8_t byte) { return byte == 0; });
+                    if (!all_zero && TransferAt(destination_file.Get(), true, buffer.get(), length, block.offset, event.Get()) != length)
+                    {
+                        throw MakeCopyError("Unable to write file", source, destination);
+                    }
+
+                    if (hasher != nullptr)
+                    {
+                        std::unique_lock<std::mutex> lock(hash_mutex);
+                        hash_turn.wait(lock, [&] { return blocks_hashed == index || copy_failed; });
+                        if (copy_failed)
+                        {
+                            return;
+                        }
+
+                        HashZeros(*hasher, block.offset - hashed_up_to);
+                        hasher->Update(buffer.get(), length);
+                        hashed_up_to = block.offset + length;
+                        blocks_hashed++;
+                        hash_turn.notify_all();
+                    }
+                }
+            }
+            catch (const std::exception&)
+            {
+                fail(std::current_exception());
+            }
+        };
+
+        const size_t thread_count = std::min<size_t>(static_cast<size_t>(std::max(workers, 1)), std::max<size_t>(blocks.size(), 1));
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < thread_count; i++)
+        {
+            threads.emplace_back(copy_blocks);
+        }
+        copy_blocks();
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+
+        if (copy_failed)
+        {
+            std::rethrow_exception(copy_error);
+        }
+
+        //Holes up to the end of the file.  Writes past the end extend a dense copy on their own.
+        if (sparse)
+        {
+            FILE_END_OF_FILE_INFO end_of_file = {};
+            end_of_file.EndOfFile.QuadPart = static_cast<LONGLONG>(file_size);
+            if (!SetFileInformationByHandle(destination_file.Get(), FileEndOfFileInfo, &end_of_file, sizeof(end_of_file)))
+            {
+                throw MakeCopyError("Unable to set file size", source, destination);
+            }
+            if (hasher != nullptr)
+            {
+                HashZeros(*hasher, file_size - std::min(hashed_up_to, file_size));
+            }
+        }
+
+        CopyFileTimes(source_file.Get(), destination_file.Get());
+    }
+
+    //User mode copy for the Buffered backend and hashed copies.  Sparse files, and very large files when more than one worker
+    // is allowed, go through RangedCopy, everything else through the read ahead stream.
+    void CopyFileData(const std::filesystem::path& source, const std::filesystem::path& destination, int workers, Xxh64* hasher)
+    {
+        const DWORD attributes = GetFileAttributesW(source.c_str());
+        const bool sparse = attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_SPARSE_FILE) != 0;
+
+        std::error_code error;
+        const uintmax_t file_size = std::filesystem::file_size(source, error);
+        if (sparse || (workers > 1 && !error && file_size >= RANGED_COPY_MIN_FILE_SIZE))
+        {
+            RangedCopy(source, destination, sparse, workers, hasher);
+        }
+        else
+        {
+            BufferedCopy(source, destination, hasher);
+        }
+    }
+}
+
+const char* CopyBackendName(CopyBackend backend)
+{
+    switch (backend)
+    {
+    case CopyBackend::Auto:         return "auto";
+    case CopyBackend::BlockClone:   return "block clone";
+    case CopyBackend::KernelCopy:   return "kernel copy";
+    case CopyBackend::Buffered:     return "buffered";
+    }
+    return "unknown";
+}
+
+bool SupportsBlockClone(const std::filesystem::path& source, const std::filesystem::path& destination)
+{
+    if (VolumeThrottle::VolumeOf(source) != VolumeThrottle::VolumeOf(destination))
+    {
+        return false;
+    }
+    return GetVolumeCloneInfo(destination).supports_block_clone;
+}
+
+CopyBackend CopyFileFast(const std::filesystem::path& source, const std::filesystem::path& destination, CopyBackend backend)
+{
+    switch (backend)
+    {
+    case CopyBackend::BlockClone:
+        BlockCloneCopy(source, destination);
+        return CopyBackend::BlockClone;
+
+    case CopyBackend::KernelCopy:
+        KernelCopy(source, destination);
+        return CopyBackend::KernelCopy;
+
+    case CopyBackend::Buffered:
+        CopyFileData(source, destination, 1, nullptr);
+        return CopyBackend::Buffered;
+
+    case CopyBackend::Auto:
+        break;
+    }
+
+    if (SupportsBlockClone(source, destination))
+    {
+        try
+        {
+            BlockCloneCopy(source, destination);
+            return CopyBackend::BlockClone;
+        }
+        catch (const std::filesystem::filesystem_error&)
+        {
+            //Some files can't be cloned even on ReFS (encrypted, integrity stream mismatch), fall through to a real copy.
+        }
+    }
+
+    //Nothing promises the kernel copy keeps a sparse file's holes, the buffered one only copies its data ranges.
+    const DWORD attributes = GetFileAttributesW(source.c_str());
+    const bool sparse = attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_SPARSE_FILE) != 0;
+    if (!sparse)
+    {
+        try
+        {
+            KernelCopy(source, destination);
+            return CopyBackend::KernelCopy;
+        }
+        catch (const std::filesystem::filesystem_error&)
+        {
+            //Last resort below reports its own error if this was a real I/O problem rather than the copy engine refusing.
+        }
+    }
+
+    CopyFileData(source, destination, 1, nullptr);
+    return CopyBackend::Buffered;
+}
+
+uint64_t CopyFileHashed(const std::filesystem::path& source, const std::filesystem::path& destination, int workers)
+{
+    Xxh64 hasher;
+    CopyFileData(source, destination, workers, &hasher);
+    return hasher.Final();
+}
+
+void FlushFileToDisk(const std::filesystem::path& file_path)
+{
+    ScopedHandle file(CreateFileW(file_path.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+                                  FILE_ATTRIBUTE_NORMAL, nullptr));
+    if (!file.IsValid() || !FlushFileBuffers(file.Get()))
+    {
+        throw std::filesystem::filesystem_error("Unable to flush file", file_path, std::error_code(static_cast<int>(GetLastError()), std::system_category()));
+    }
+}
+
+void MoveDurably(const std::filesystem::path& source, const std::filesystem::path& destination)
+{
+    if (!MoveFileExW(source.c_str(), destination.c_str(), MOVEFILE_WRITE_THROUGH))
+    {
+        throw MakeCopyError("Unable to rename", source, destination);
+    }
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+//Single file copy with a choice of backends, fastest first:
+// - BlockClone: ReFS / Dev Drive block cloning (FSCTL_DUPLICATE_EXTENTS_TO_FILE).  The copy shares the source's clusters
+//   copy-on-write, so it costs a metadata update no matter how big the file is.  Same volume only.
+// - KernelCopy: CopyFileExW, which keeps the data in the kernel (and offloads to the storage array when it supports ODX).
+// - Buffered: ReadFile/WriteFile through user mode buffers (FileReadStream reading ahead), works everywhere.  Sparse files
+//   only have their data ranges copied and keep their holes.
+// Auto walks down that list and remembers per volume when cloning isn't supported so it isn't retried for every file.
+// Sparse files skip KernelCopy, so restoring a linked snapshot keeps the holes its backup kept.
+
+#include <cstdint>
+#include <filesystem>
+
+//Hashed copies of files at least this big are split into ranges copied by several workers at once, when allowed more than one.
+#define RANGED_COPY_MIN_FILE_SIZE (256ull * 1024 * 1024)
+//Most workers one ranged copy is worth, a single file rarely goes any faster with more.
+#define RANGED_COPY_MAX_WORKERS 4
+
+enum class CopyBackend
+{
+    Auto,
+    BlockClone,
+    KernelCopy,
+    Buffered
+};
+
+const char* CopyBackendName(CopyBackend backend);
+
+//Copies source over destination (overwriting it) keeping the modified time, like copy_file with overwrite_existing.
+// Returns the backend that did the copy.  Throws std::filesystem::filesystem_error on failure.
+CopyBackend CopyFileFast(const std::filesystem::path& source, const std::filesystem::path& destination, CopyBackend backend = CopyBackend::Auto);
+
+//Copies through a user mode buffer like the Buffered backend and returns the XXH64 of the data, hashed on its way through so
+// knowing the hash costs no second read.  Throws std::filesystem::filesystem_error on failure.
+//
+// Like the Buffered backend it keeps sparse files sparse: only the source's allocated ranges are read and the holes (and
+// whole blocks of zeros) are left unwritten in the copy.  Files of at least RANGED_COPY_MIN_FILE_SIZE are copied as ranges by up to `workers` threads,
+// so one huge save image doesn't copy on a single core while the others sit idle.  Each worker is another stream on both
+// drives, callers going through a VolumeThrottle pass one worker per slot they hold.
+uint64_t CopyFileHashed(const std::filesystem::path& source, const std::filesystem::path& destination, int workers = 1);
+
+//True when both paths are on the same volume and that volume's file system can clone blocks.
+bool SupportsBlockClone(const std::filesystem::path& source, const std::filesystem::path& destination);
+
+//Pushes a file's data out of the system cache onto the disk (FlushFileBuffers).  Throws std::filesystem::filesystem_error on failure.
+void FlushFileToDisk(const std::filesystem::path& file_path);
+
+//Renames a file or folder and only returns once the rename is on disk (MOVEFILE_WRITE_THROUGH).  Throws on failure.
+void MoveDurably(const std::filesystem::path& source, const std::filesystem::path& destination);
@@ -0,0 +1,562 @@
+#include "FileDelta.h"
+#include "FileStream.h"
+#include "Hashing.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#define DELTA_MAGIC "SBMDLT01"
+#define DELTA_MAGIC_LENGTH 8
+#define DELTA_HEADER_LENGTH (DELTA_MAGIC_LENGTH + 4 * 8 + 4)
+
+//Ops: copy <u64 base offset> <u32 length>, literal <u32 length> <bytes>, then end.
+#define DELTA_OP_COPY 'C'
+#define DELTA_OP_LITERAL 'L'
+#define DELTA_OP_END 'E'
+
+//Ops are gathered and written out in pieces of about this size.
+#define DELTA_WRITE_BUFFER_SIZE (1024 * 1024)
+
+namespace
+{
+    const uint32_t no_block = 0xffffffffu;
+
+    std::filesystem::filesystem_error MakeIoError(const std::string& what, const std::filesystem::path& path)
+    {
+        return std::filesystem::filesystem_error(what, path, std::make_error_code(std::errc::io_error));
+    }
+
+    //All integers are little endian, written byte by byte so the layout doesn't depend on the compiler.
+    void AppendInteger(std::vector<uint8_t>& buffer, uint64_t value, int byte_count)
+    {
+        for (int i = 0; i < byte_count; i++)
+        {
+            buffer.push_back(static_cast<uint8_t>(value >> (8 * i)));
+        }
+    }
+
+    uint64_t ReadInteger(const uint8_t* bytes, int byte_count)
+    {
+        uint64_t value = 0;
+        for (int i = 0; i < byte_count; i++)
+        {
+            value |= static_cast<uint64_t>(bytes[i]) << (8 * i);
+        }
+        return value;
+    }
+
+    std::vector<uint8_t> EncodeHeader(const DeltaHeader& header)
+    {
+        std::vector<uint8_t> bytes(DELTA_MAGIC, DELTA_MAGIC + DELTA_MAGIC_LENGTH);
+        AppendInteger(bytes, header.base_size, 8);
+        AppendInteger(bytes, header.target_size, 8);
+        AppendInteger(bytes, header.target_hash, 8);
+        AppendInteger(bytes, static_cast<uint64_t>(header.modified_time), 8);
+        AppendInteger(bytes, header.keyframe_distance, 4);
+        return bytes;
+    }
+
+    //rsync's weak checksum: two running sums over the window that can both be rolled forward a byte at a time.
+    struct RollingChecksum
+    {
+        uint32_t a = 0;
+        uint32_t b = 0;
+
+        void Reset(const uint8_t* data, size_t length)
+        {
+            a = 0;
+            b = 0;
+            for (size_t i = 0; i < length; i++)
+            {
+                a += data[i];
+                b += static_cast<uint32_t>(length - i) * data[i];
+            }
+        }
+
+        void Roll(uint8_t out, uint8_t in, size_t length)
+        {
+            a += in - out;
+            b += a - static_cast<uint32_t>(length) * out;
+        }
+
+        uint32_t Value() const { return (a & 0xffff) | (b << 16); }
+    };
+
+    struct BlockSignature
+    {
+        uint32_t weak = 0;
+        uint64_t strong = 0;
+        uint32_t next_same_weak = no_block;
+    };
+
+    //Every whole block of the base, findable by weak checksum.  A partial last block is left out, it can't match a full window.
+    class BaseSignatures
+    {
+    public:
+        explicit BaseSignatures(const std::filesystem::path& base_path)
+        {
+            FileReadStream input(base_path);
+            std::vector<uint8_t> partial;
+
+            const uint8_t* data = nullptr;
+            size_t length = 0;
+            while (input.Next(data, length))
+            {
+                size_t position = 0;
+                if (!partial.empty())
+                {
+                    const size_t needed = std::min(DELTA_BLOCK_SIZE - partial.size(), length);
+                    partial.insert(partial.end(), data, data + needed);
+                    position = needed;
+                    if (partial.size() == DELTA_BLOCK_SIZE)
+                    {
+                        Add(partial.data());
+                        partial.clear();
+                    }
+                }
+                for (; length - position >= DELTA_BLOCK_SIZE; position += DELTA_BLOCK_SIZE)
+                {
+                    Add(data + position);
+                }
+                partial.insert(partial.end(), data + position, data + length);
+            }
+            base_size = input.BytesRead();
+        }
+
+        //Index of a base block holding exactly this window, no_block if none does.  The block after the last match is tried
+        // first so runs of copies from the same place stay one op.
+        uint32_t Find(const uint8_t* window, uint32_t weak, uint32_t preferred) const
+        {
+            bool strong_known = false;
+            uint64_t strong = 0;
+            auto matches = [&](uint32_t block)
+            {
+                if (blocks[block].weak != weak)
+                {
+                    return false;
+                }
+                if (!strong_known)
+                {
+                    strong = Xxh64::Hash(window, DELTA_BLOCK_SIZE);
+                    strong_known = true;
+                }
+                return blocks[block].strong == strong;
+            };
+
+            if (preferred < blocks.size() && matches(preferred))
+            {
+                return preferred;
+            }
+
+            const auto first = first_by_weak.find(weak);
+            for (uint32_t block = (first == first_by_weak.end()) ? no_block : first->second; block != no_block; block = blocks[block].next_same_weak)
+            {
+                if (matches(block))
+                {
+                    return block;
+                }
+            }
+            return no_block;
+        }
+
+        uint64_t BaseSize() const { return base_size; }
+
+    private:
+        void Add(const uint8_t* block)
+        {
+            RollingChecksum checksum;
+            checksum.Reset(block, DELTA_BLOCK_SIZE);
+
+            BlockSignature signature;
+            signature.weak = checksum.Value();
+            signature.strong = Xxh64::Hash(block, DELTA_BLOCK_SIZE);
+
+            //Chained newest first, the order doesn't matter for finding a match.
+            const uint32_t index = static_cast<uint32_t>(blocks.size());
+            auto first = first_by_weak.emplace(signature.weak, index);
+            if (!first.second)
+            {
+                signature.next_same_weak = first.first->second;
+                first.first->second = index;
+            }
+            blocks.push_back(signature);
+        }
+
+        std::vector<BlockSignature> blocks;
+        std::unordered_map<uint32_t, uint32_t> first_by_weak;
+        uint64_t base_size = 0;
+    };
+
+    //Buffers ops and writes them to the delta file, keeping count of its size.
+    class DeltaOutput
+    {
+    public:
+        explicit DeltaOutput(const std::filesystem::path& delta_path)
+            : delta_path(delta_path)
+        {
+            output.open(delta_path, std::ios::binary | std::ios::trunc);
+            if (!output.is_open())
+            {
+                throw MakeIoError("Unable to create delta", delta_path);
+            }
+
+            //Room for the header, written once the sizes and hash are known.
+            buffer.assign(DELTA_HEADER_LENGTH, 0);
+        }
+
+        void Copy(uint64_t offset, uint32_t length)
+        {
+            //Continues the previous copy, grow that one instead.
+            if (pending_copy_length > 0 && pending_copy_offset + pending_copy_length == offset)
+            {
+                pending_copy_length += length;
+                return;
+            }
+            FlushCopy();
+            pending_copy_offset = offset;
+            pending_copy_length = length;
+        }
+
+        void Literal(const uint8_t* data, size_t length)
+        {
+            if (length == 0)
+            {
+                return;
+            }
+            FlushCopy();
+            buffer.push_back(DELTA_OP_LITERAL);
+            AppendInteger(buffer, length, 4);
+            buffer.insert(buffer.end(), data, data + length);
+            WriteIfFull();
+        }
+
+        void Finish(const DeltaHeader& header)
+        {
+            FlushCopy();
+            buffer.push_back(DELTA_OP_END);
+            Write();
+
+            const std::vector<uint8_t> header_bytes = EncodeHeader(header);
+            output.seekp(0);
+            output.write(reinterpret_cast<const char*>(header_bytes.data()), header_bytes.size());
+            output.close();
+            if (!output)
+            {
+                throw MakeIoError("Unable to write delta", delta_path);
+            }
+        }
+
+        uint64_t Size() const { return written + buffer.size(); }
+
+    private:
+        void FlushCopy()
+        {
+            //Copies longer than a u32 length are split.
+            while (pending_copy_length > 0)
+            {
+                const uint32_t length = static_cast<uint32_t>(std::min<uint64_t>(pending_copy_length, 0x80000000u));
+                buffer.push_back(DELTA_OP_COPY);
+                AppendInteger(buffer, pending_copy_offset, 8);
+                AppendInteger(buffer, length, 4);
+                pending_copy_offset += length;
+                pending_copy_length -= length;
+            }
+            WriteIfFull();
+        }
+
+        void WriteIfFull()
+        {
+            if (buffer.size() >= DELTA_WRITE_BUFFER_SIZE)
+            {
+                Write();
+            }
+        }
+
+        void Write()
+        {
+            output.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+            if (!output)
+            {
+                throw MakeIoError("Unable to write delta", delta_path);
+            }
+            written += buffer.size();
+            buffer.clear();
+        }
+
+        std::filesystem::path delta_path;
+        std::ofstream output;
+        std::vector<uint8_t> buffer;
+        uint64_t written = 0;
+
+        uint64_t pending_copy_offset = 0;
+        uint64_t pending_copy_length = 0;
+    };
+}
+
+bool WriteFileDelta(const std::filesystem::path& base_path, const std::filesystem::path& target_path, const std::filesystem::path& delta_path,
+                    uint64_t max_delta_size, DeltaHeader& header)
+{
+    const BaseSignatures base(base_path);
+    header.base_size = base.BaseSize();
+
+    FileReadStream input(target_path);
+    Xxh64 target_hasher;
+
+    bool written = false;
+    {
+        DeltaOutput output(delta_path);
+
+        //Target bytes not dealt with yet.  window_start is where the window being checked begins, literal_start where the
+        // bytes that matched nothing so far begin.
+        std::vector<uint8_t> data;
+        size_t window_start = 0;
+        size_t literal_start = 0;
+        bool at_end = false;
+
+        //Drops what's been dealt with and appends the next block of the target.  False once the target is used up.
+        auto refill = [&]
+        {
+            output.Literal(data.data() + literal_start, window_start - literal_start);
+            data.erase(data.begin(), data.begin() + window_start);
+            window_start = 0;
+            literal_start = 0;
+
+            const uint8_t* read_data = nullptr;
+            size_t read_length = 0;
+            if (at_end || !input.Next(read_data, read_length))
+            {
+                at_end = true;
+                return false;
+            }
+            target_hasher.Update(read_data, read_length);
+            data.insert(data.end(), read_data, read_data + read_length);
+            return true;
+        };
+
+        RollingChecksum checksum;
+        bool checksum_valid = false;
+        uint32_t next_block = no_block;
+
+        while (true)
+        {
+            if (data.size() - window_start < DELTA_BLOCK_SIZE)
+            {
+                if (!refill())
+                {
+                    break;
+                }
+                continue;
+            }
+
+            const uint8_t* window = data.data() + window_start;
+            if (!checksum_valid)
+            {
+                checksum.Reset(window, DELTA_BLOCK_SIZE);
+                checksum_valid = true;
+            }
+
+            const uint32_t block = base.Find(window, checksum.Value(), next_block);
+            if (block != no_block)
+            {
+                output.Literal(data.data() + literal_start, window_start - literal_start);
+                output.Copy(static_cast<uint64_t>(block) * DELTA_BLOCK_SIZE, DELTA_BLOCK_SIZE);
+                window_start += DELTA_BLOCK_SIZE;
+                literal_start = window_start;
+                checksum_valid = false;
+                next_block = block + 1;
+            }
+            else
+            {
+                //No match, the first byte of the window is a literal and the window moves on by one.
+                if (data.size() - window_start > DELTA_BLOCK_SIZE)
+                {
+                    checksum.Roll(window[0], window[DELTA_BLOCK_SIZE], DELTA_BLOCK_SIZE);
+                }
+                else
+                {
+                    checksum_valid = false;
+                }
+                window_start++;
+                next_block = no_block;
+            }
+
+            if (output.Size() > max_delta_size)
+            {
+                break;
+            }
+        }
+
+        //Whatever is left is shorter than a block and goes in as it is.
+        if (output.Size() <= max_delta_size)
+        {
+            output.Literal(data.data() + literal_start, data.size() - literal_start);
+        }
+
+        if (output.Size() <= max_delta_size)
+        {
+            header.target_size = input.BytesRead();
+            header.target_hash = target_hasher.Final();
+            output.Finish(header);
+            written = true;
+        }
+    }
+
+    if (!written)
+    {
+        std::error_code error;
+        std::filesystem::remove(delta_path, error);
+    }
+    return written;
+}
+
+bool ReadDeltaHeader(const std::filesystem::path& delta_path, DeltaHeader& header)
+{
+    std::ifstream input(delta_path, std::ios::binary);
+    uint8_t bytes[DELTA_HEADER_LENGTH];
+    input.read(reinterpret_cast<char*>(bytes), sizeof(bytes));
+    if (input.gcount() != static_cast<std::streamsize>(sizeof(bytes)) || std::memcmp(bytes, DELTA_MAGIC, DELTA_MAGIC_LENGTH) != 0)
+    {
+        return false;
+    }
+
+    const uint8_t* field = bytes + DELTA_MAGIC_LENGTH;
+    header.base_size = ReadInteger(field, 8);
+    header.target_size = ReadInteger(field + 8, 8);
+    header.target_hash = ReadInteger(field + 16, 8);
+    header.modified_time = static_cast<int64_t>(ReadInteger(field + 24, 8));
+    header.keyframe_distance = static_cast<uint32_t>(ReadInteger(field + 32, 4));
+    return true;
+}
+
+void ApplyFileDelta(const std::filesystem::path& base_path, const std::filesystem::path& delta_path, const std::function<void(const uint8_t*, size_t)>& output)
+{
+    DeltaHeader header;
+    if (!ReadDeltaHeader(delta_path, header))
+    {
+        throw MakeIoError("Not a delta file", delta_path);
+    }
+
+    std::error_code size_error;
+    if (std::filesystem::file_size(base_path, size_error) != header.base_size || size_error)
+    {
+        throw MakeIoError("Delta base doesn't match the delta", base_path);
+    }
+
+    std::ifstream delta(delta_path, std::ios::binary);
+    std::ifstream base(base_path, std::ios::binary);
+    if (!base.is_open())
+    {
+        throw MakeIoError("Unable to open delta base", base_path);
+    }
+    delta.seekg(DELTA_HEADER_LENGTH);
+
+    Xxh64 hasher;
+    uint64_t size = 0;
+    std::vector<uint8_t> buffer;
+    auto emit = [&](size_t length)
+    {
+        hasher.Update(buffer.data(), length);
+        size += length;
+        output(buffer.data(), length);
+    };
+
+    while (true)
+    {
+        uint8_t op_bytes[13];
+        if (!delta.read(reinterpret_cast<char*>(op_bytes), 1))
+        {
+            throw MakeIoError("Delta is cut short", delta_path);
+        }
+
+        if (op_bytes[0] == DELTA_OP_END)
+        {
+            break;
+        }
+        else if (op_bytes[0] == DELTA_OP_COPY)
+        {
+            if (!delta.read(reinterpret_cast<char*>(op_bytes + 1), 12))
+            {
+                throw MakeIoError("Delta is cut short", delta_path);
+            }
+            const uint64_t offset = ReadInteger(op_bytes + 1, 8);
+            uint64_t remaining = ReadInteger(op_bytes + 9, 4);
+            if (offset > header.base_size || remaining > header.base_size - offset)
+            {
+                throw MakeIoError("Delta is damaged", delta_path);
+            }
+
+            base.seekg(static_cast<std::streamoff>(offset));
+            while (remaining > 0)
+            {
+                const size_t length = static_cast<size_t>(std::min<uint64_t>(remaining, DELTA_WRITE_BUFFER_SIZE));
+                buffer.resize(length);
+                if (!base.read(reinterpret_cast<char*>(buffer.data()), length))
+                {
+                    throw MakeIoError("Unable to read delta base", base_path);
+                }
+                emit(length);
+                remaining -= length;
+            }
+        }
+        else if (op_bytes[0] == DELTA_OP_LITERAL)
+        {
+            if (!delta.read(reinterpret_cast<char*>(op_bytes + 1), 4))
+            {
+                throw MakeIoError("Delta is cut short", delta_path);
+            }
+            const size_t length = static_cast<size_t>(ReadInteger(op_bytes + 1, 4));
+            if (length > header.target_size - std::min(size, header.target_size))
+            {
+                throw MakeIoError("Delta is damaged", delta_path);
+            }
+
+            buffer.resize(length);
+            if (!delta.read(reinterpret_cast<char*>(buffer.data()), length))
+            {
+                throw MakeIoError("Delta is cut short", delta_path);
+            }
+            emit(length);
+        }
+        else
+        {
+            throw MakeIoError("Delta is damaged", delta_path);
+        }
+    }
+
+    if (size != header.target_size || hasher.Final() != header.target_hash)
+    {
+        throw MakeIoError("File rebuilt from delta doesn't match the backup", delta_path);
+    }
+}
+
+void RestoreFileDelta(const std::filesystem::path& base_path, const std::filesystem::path& delta_path, const std::filesystem::path& destination)
+{
+    DeltaHeader header;
+    if (!ReadDeltaHeader(delta_path, header))
+    {
+        throw MakeIoError("Not a delta file", delta_path);
+    }
+
+    {
+        SparseFileWriter output(destination);
+        ApplyFileDelta(base_path, delta_path, [&](const uint8_t* data, size_t length)
+        {
+            output.Write(data, length);
+        });
+        output.Finish();
+    }
+
+    //Same time stamp as the save had, the way a copied file keeps it.
+    std::filesystem::last_write_time(destination, std::filesystem::file_time_type(std::filesystem::file_time_type::duration(header.modified_time)));
+}
+
+std::filesystem::path SnapshotDeltaPath(const std::filesystem::path& snapshot_path, const std::string& relative_path, const char* extension)
+{
+    std::filesystem::path path = snapshot_path / SNAPSHOT_DELTA_FOLDER_NAME / std::filesystem::u8path(relative_path);
+    path += extension;
+    return path;
+}
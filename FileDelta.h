@@ -0,0 +1,52 @@
+#pragma once
+
+//Binary deltas for big save files that change a little between backups (rsync's algorithm, done locally).  The base file is
+// cut into DELTA_BLOCK_SIZE blocks, each listed under a weak rolling checksum and its XXH64.  The new version is then scanned
+// with the same rolling checksum one byte at a time: wherever a window matches a base block it becomes a copy from the base,
+// everything else is kept as literal bytes.  A save blob of hundreds of MB with a few KB changed comes out as a delta of a
+// few KB, written instead of the whole file.
+//
+//   header | ops ... | end
+//
+// Linked snapshots keep a delta next to a hard link to the full copy (keyframe) it was made against, so a file is always
+// rebuilt from one base and one delta, however long ago the keyframe was taken.
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <string>
+
+#define DELTA_BLOCK_SIZE (8 * 1024)
+
+#define SNAPSHOT_DELTA_FOLDER_NAME "snapshot.delta"
+#define DELTA_FILE_EXTENSION ".delta"
+#define DELTA_BASE_EXTENSION ".base"
+
+struct DeltaHeader
+{
+    uint64_t base_size = 0;             //checked before applying, a delta only rebuilds the file against its own base
+    uint64_t target_size = 0;
+    uint64_t target_hash = 0;           //XXH64 of the file the delta rebuilds
+    int64_t modified_time = 0;          //of the file when it was backed up, same units as IndexEntry::modified_time
+    uint32_t keyframe_distance = 0;     //backups of this file since its base was stored whole, 1 for the first delta
+};
+
+//Writes a delta turning base_path into target_path at delta_path, filling in header's sizes and hash (modified_time and
+// keyframe_distance are written as given).  Gives up once the delta grows past max_delta_size, returning false and leaving
+// no delta behind: the file changed too much for a delta to be worth it.  Throws on I/O errors.
+bool WriteFileDelta(const std::filesystem::path& base_path, const std::filesystem::path& target_path, const std::filesystem::path& delta_path,
+                    uint64_t max_delta_size, DeltaHeader& header);
+
+//False if the file is missing or isn't a delta.
+bool ReadDeltaHeader(const std::filesystem::path& delta_path, DeltaHeader& header);
+
+//Rebuilds the file, handing it to output in order.  Throws on I/O errors, if the base isn't the one the delta was made
+// against or if the result doesn't match its hash.
+void ApplyFileDelta(const std::filesystem::path& base_path, const std::filesystem::path& delta_path, const std::function<void(const uint8_t*, size_t)>& output);
+
+//Rebuilds the file at destination, overwriting it, with the modified time it had when it was backed up.
+void RestoreFileDelta(const std::filesystem::path& base_path, const std::filesystem::path& delta_path, const std::filesystem::path& destination);
+
+//Where a linked snapshot keeps a file stored as a delta: <snapshot>/snapshot.delta/<relative_path><extension>, with
+// relative_path as listed in snapshot.hashes and extension DELTA_FILE_EXTENSION or DELTA_BASE_EXTENSION.
+std::filesystem::path SnapshotDeltaPath(const std::filesystem::path& snapshot_path, const std::string& relative_path, const char* extension);
@@ -0,0 +1,31 @@
+#include "FileLock.h"
+
+#include <system_error>
+
+#define NOMINMAX
+#include <Windows.h>
+
+FileLock::FileLock(const std::filesystem::path& lock_path, const std::string& what, uint32_t timeout_ms)
+{
+    for (uint32_t waited = 0; ; waited += FILE_LOCK_RETRY_MS)
+    {
+        HANDLE lock_handle = CreateFileW(lock_path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_ALWAYS, FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+        if (lock_handle != INVALID_HANDLE_VALUE)
+        {
+            handle = lock_handle;
+            return;
+        }
+
+        const DWORD error = GetLastError();
+        if ((error != ERROR_SHARING_VIOLATION && error != ERROR_ACCESS_DENIED) || waited >= timeout_ms)
+        {
+            throw std::filesystem::filesystem_error(what, lock_path, std::error_code(static_cast<int>(error), std::system_category()));
+        }
+        Sleep(FILE_LOCK_RETRY_MS);
+    }
+}
+
+FileLock::~FileLock()
+{
+    CloseHandle(handle);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+//Cross process lock: an exclusively opened file that deletes itself when closed, so a crashed instance never leaves it behind.
+// The menu, command line runs and the watch daemon all share savefolders.ini and everything under ./Backups, so any file more
+// than one of them changes is only changed while holding the lock next to it.
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+#define FILE_LOCK_RETRY_MS 10
+
+class FileLock
+{
+public:
+    //Waits up to timeout_ms for whoever holds it.  Throws std::filesystem::filesystem_error with `what` as the message if it's
+    // still held then, or the lock file can't be created at all.
+    FileLock(const std::filesystem::path& lock_path, const std::string& what, uint32_t timeout_ms);
+    ~FileLock();
+
+    FileLock(const FileLock&) = delete;
+    FileLock& operator=(const FileLock&) = delete;
+
+private:
+    void* handle = nullptr;
+};
@@ -0,0 +1,280 @@
+#include "FileStream.h"
+
+#include <algorithm>
+#include <system_error>
+
+#define NOMINMAX
+#include <Windows.h>
+#include <winioctl.h>
+
+struct FileReadStream::Slot
+{
+    OVERLAPPED overlapped = {};
+    uint8_t* data = nullptr;
+    bool in_flight = false;
+    DWORD error = ERROR_SUCCESS;    //a read that failed as it was issued, reported once the caller gets to it
+};
+
+namespace
+{
+    std::filesystem::filesystem_error MakeFileError(const std::string& what, const std::filesystem::path& path, DWORD error)
+    {
+        return std::filesystem::filesystem_error(what, path, std::error_code(static_cast<int>(error), std::system_category()));
+    }
+}
+
+FileReadStream::FileReadStream(const std::filesystem::path& file_path, size_t block_size)
+    : file_path(file_path), block_size(block_size)
+{
+    //Unbuffered reads straight into the blocks only work when every read is whole sectors.
+    DWORD flags = FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN;
+    std::error_code size_error;
+    const uintmax_t file_size = std::filesystem::file_size(file_path, size_error);
+    if (!size_error && file_size >= FILE_STREAM_UNBUFFERED_THRESHOLD && block_size % FILE_STREAM_ALIGNMENT == 0)
+    {
+        flags |= FILE_FLAG_NO_BUFFERING;
+    }
+
+    //Reading never locks the game out of its own save.  A write landing mid-read leaves a torn copy, which the size and
+    // time recheck after the backup (consistent capture) picks up, where a sharing violation would have failed the game's save.
+    HANDLE handle = CreateFileW(file_path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, flags, NULL);
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        throw MakeFileError("Unable to open file", file_path, GetLastError());
+    }
+    file = handle;
+
+    LARGE_INTEGER size = {};
+    if (GetFileSizeEx(handle, &size))
+    {
+        known_size = static_cast<uint64_t>(size.QuadPart);
+    }
+
+    //No point keeping more reads in flight than the file has blocks (plus the one that finds the end).
+    const size_t blocks_needed = static_cast<size_t>(known_size / block_size) + 1;
+    const size_t slot_count = std::min<size_t>(FILE_STREAM_BLOCKS_IN_FLIGHT, blocks_needed);
+    const size_t slot_stride = (block_size + FILE_STREAM_ALIGNMENT - 1) / FILE_STREAM_ALIGNMENT * FILE_STREAM_ALIGNMENT;
+
+    buffers = static_cast<uint8_t*>(VirtualAlloc(NULL, slot_stride * slot_count, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+    if (buffers == nullptr)
+    {
+        const DWORD error = GetLastError();
+        CloseHandle(handle);
+        throw MakeFileError("Unable to allocate read buffers", file_path, error);
+    }
+
+    for (size_t i = 0; i < slot_count; i++)
+    {
+        slots.push_back(std::make_unique<Slot>());
+        slots.back()->data = buffers + i * slot_stride;
+        slots.back()->overlapped.hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+    }
+
+    IssueReads();
+}
+
+FileReadStream::~FileReadStream()
+{
+    //Reads still in flight write into the buffers, they have to be finished (or cancelled) before the memory goes.
+    for (auto& slot : slots)
+    {
+        if (slot->in_flight)
+        {
+            DWORD bytes_transferred = 0;
+            CancelIoEx(file, &slot->overlapped);
+            GetOverlappedResult(file, &slot->overlapped, &bytes_transferred, TRUE);
+        }
+        if (slot->overlapped.hEvent != NULL)
+        {
+            CloseHandle(slot->overlapped.hEvent);
+        }
+    }
+
+    VirtualFree(buffers, 0, MEM_RELEASE);
+    CloseHandle(file);
+}
+
+void FileReadStream::IssueReads()
+{
+    while (!reached_end && issue_offset <= known_size)
+    {
+        Slot& slot = *slots[issue_slot];
+        const bool held_by_caller = holding_block && issue_slot == (consume_slot + slots.size() - 1) % slots.size();
+        if (slot.in_flight || slot.error != ERROR_SUCCESS || held_by_caller)
+        {
+            return;
+        }
+
+        slot.overlapped.Offset = static_cast<DWORD>(issue_offset);
+        slot.overlapped.OffsetHigh = static_cast<DWORD>(issue_offset >> 32);
+        slot.in_flight = true;
+        if (!ReadFile(file, slot.data, static_cast<DWORD>(block_size), NULL, &slot.overlapped))
+        {
+            const DWORD error = GetLastError();
+            if (error != ERROR_IO_PENDING)
+            {
+                //Nothing was started, the end of the file (or the error) is picked up when this slot's turn comes.
+                slot.in_flight = false;
+                slot.error = error;
+            }
+        }
+
+        issue_offset += block_size;
+        issue_slot = (issue_slot + 1) % slots.size();
+    }
+}
+
+bool FileReadStream::Next(const uint8_t*& data, size_t& length)
+{
+    //The caller is done with the block it had, its slot can fetch more.
+    if (holding_block)
+    {
+        holding_block = false;
+        IssueReads();
+    }
+
+    if (reached_end)
+    {
+        return false;
+    }
+
+    Slot& slot = *slots[consume_slot];
+    DWORD bytes_transferred = 0;
+    if (slot.in_flight)
+    {
+        slot.in_flight = false;
+        if (!GetOverlappedResult(file, &slot.overlapped, &bytes_transferred, TRUE))
+        {
+            slot.error = GetLastError();
+        }
+    }
+    else if (slot.error == ERROR_SUCCESS)
+    {
+        //Nothing in flight in the next slot means no read was issued past the known end, which was reached.
+        reached_end = true;
+        return false;
+    }
+
+    const DWORD error = slot.error;
+    slot.error = ERROR_SUCCESS;
+    if (error == ERROR_HANDLE_EOF)
+    {
+        bytes_transferred = 0;
+    }
+    else if (error != ERROR_SUCCESS)
+    {
+        reached_end = true;
+        throw MakeFileError("Unable to read file", file_path, error);
+    }
+
+    bytes_read += bytes_transferred;
+    known_size = std::max(known_size, bytes_read);
+
+    //A short read is the end of the file.  Reads already issued past it only find the end too, the destructor collects them.
+    if (bytes_transferred < block_size)
+    {
+        reached_end = true;
+    }
+    if (bytes_transferred == 0)
+    {
+        return false;
+    }
+
+    data = slot.data;
+    length = bytes_transferred;
+    consume_slot = (consume_slot + 1) % slots.size();
+    holding_block = true;
+    return true;
+}
+
+SparseFileWriter::SparseFileWriter(const std::filesystem::path& file_path)
+    : file_path(file_path)
+{
+    HANDLE handle = CreateFileW(file_path.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        throw MakeFileError("Unable to create file", file_path, GetLastError());
+    }
+    file = handle;
+    block.reserve(SPARSE_WRITE_HOLE_SIZE);
+}
+
+SparseFileWriter::~SparseFileWriter()
+{
+    CloseHandle(file);
+}
+
+void SparseFileWriter::Write(const uint8_t* data, size_t length)
+{
+    while (length > 0)
+    {
+        const size_t taken = std::min(length, SPARSE_WRITE_HOLE_SIZE - block.size());
+        block.insert(block.end(), data, data + taken);
+        data += taken;
+        length -= taken;
+
+        if (block.size() == SPARSE_WRITE_HOLE_SIZE)
+        {
+            WriteBlock(block.data(), block.size());
+            block.clear();
+        }
+    }
+}
+
+void SparseFileWriter::Finish()
+{
+    //Only whole blocks become holes, a shorter last one is always written.
+    if (!block.empty())
+    {
+        WriteBlock(block.data(), block.size());
+        block.clear();
+    }
+
+    //Holes skipped at the end don't extend the file by themselves.
+    if (seek_pending)
+    {
+        FILE_END_OF_FILE_INFO end_of_file = {};
+        end_of_file.EndOfFile.QuadPart = static_cast<LONGLONG>(block_offset);
+        if (!SetFileInformationByHandle(file, FileEndOfFileInfo, &end_of_file, sizeof(end_of_file)))
+        {
+            throw MakeFileError("Unable to set file size", file_path, GetLastError());
+        }
+        seek_pending = false;
+    }
+}
+
+void SparseFileWriter::WriteBlock(const uint8_t* data, size_t length)
+{
+    const bool all_zero = length == SPARSE_WRITE_HOLE_SIZE && std::all_of(data, data + length, [](uint8_t byte) { return byte == 0; });
+    if (all_zero && !sparse)
+    {
+        //Only files that have holes are made sparse, the file system keeps sparse files in smaller pieces.
+        DWORD bytes_returned = 0;
+        sparse = DeviceIoControl(file, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &bytes_returned, NULL) != FALSE;
+    }
+
+    if (all_zero && sparse)
+    {
+        block_offset += length;
+        seek_pending = true;
+        return;
+    }
+
+    if (seek_pending)
+    {
+        LARGE_INTEGER offset = {};
+        offset.QuadPart = static_cast<LONGLONG>(block_offset);
+        if (!SetFilePointerEx(file, offset, NULL, FILE_BEGIN))
+        {
+            throw MakeFileError("Unable to write file", file_path, GetLastError());
+        }
+        seek_pending = false;
+    }
+
+    DWORD bytes_written = 0;
+    if (!WriteFile(file, data, static_cast<DWORD>(length), &bytes_written, NULL) || bytes_written != length)
+    {
+        throw MakeFileError("Unable to write file", file_path, GetLastError());
+    }
+    block_offset += length;
+}
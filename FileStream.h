@@ -0,0 +1,95 @@
+#pragma once
+
+//Sequential file reader that keeps several reads in flight (overlapped I/O) while the caller works on the block it was
+// handed, so hashing, chunking or compressing one block overlaps with the disk fetching the next ones.  Every backup format
+// reads the save through this in a single pass: whatever it computes (content hash, chunk hashes, compressed blocks, the
+// copy itself) comes from that one read.
+//
+// Blocks live in one page aligned allocation, which lets large files be read with FILE_FLAG_NO_BUFFERING straight into it
+// instead of being copied through (and evicting everything else from) the system cache.
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <vector>
+
+#define FILE_STREAM_BLOCK_SIZE (1024 * 1024)
+#define FILE_STREAM_BLOCKS_IN_FLIGHT 4
+//Unbuffered reads need sector aligned offsets, lengths and buffers.  A page covers every sector size in use.
+#define FILE_STREAM_ALIGNMENT 4096
+//Files at least this big skip the system cache.
+#define FILE_STREAM_UNBUFFERED_THRESHOLD (64ull * 1024 * 1024)
+//Smallest run of zeros a SparseFileWriter leaves as a hole, on offsets that are a multiple of it.
+#define SPARSE_WRITE_HOLE_SIZE (1024 * 1024)
+
+class FileReadStream
+{
+public:
+    //Opens the file and starts reading.  Throws std::filesystem::filesystem_error if it can't be opened.
+    explicit FileReadStream(const std::filesystem::path& file_path, size_t block_size = FILE_STREAM_BLOCK_SIZE);
+    ~FileReadStream();
+
+    FileReadStream(const FileReadStream&) = delete;
+    FileReadStream& operator=(const FileReadStream&) = delete;
+
+    //Hands out the next block of the file, valid until the next call.  Returns false at the end of the file, throws
+    // std::filesystem::filesystem_error on read errors.  A file that grows while it's read is followed to its new end.
+    bool Next(const uint8_t*& data, size_t& length);
+
+    //The open Win32 HANDLE, for reading its time stamps.
+    void* Handle() const { return file; }
+
+    uint64_t BytesRead() const { return bytes_read; }
+
+private:
+    struct Slot;
+
+    void IssueReads();
+
+    std::filesystem::path file_path;
+    void* file = nullptr;
+    size_t block_size = 0;
+
+    uint8_t* buffers = nullptr;
+    std::vector<std::unique_ptr<Slot>> slots;
+    size_t issue_slot = 0;          //next slot to start a read in, reads are issued in ring order
+    size_t consume_slot = 0;        //next slot to hand out, same order
+    bool holding_block = false;     //the slot before consume_slot is still with the caller
+
+    uint64_t issue_offset = 0;
+    uint64_t known_size = 0;        //reads are issued up to one block past this, in case the file grew
+    uint64_t bytes_read = 0;
+    bool reached_end = false;
+};
+
+//Writes a file front to back, the way restores rebuild a save, leaving every aligned SPARSE_WRITE_HOLE_SIZE block of zeros
+// unwritten.  The first one marks the file sparse, so they read back as zeros without taking disk space, and a sparse save
+// comes back as sparse as its backup kept it.  A file without any such block is written like any other.
+class SparseFileWriter
+{
+public:
+    //Creates the file, overwriting it if it exists.  Throws std::filesystem::filesystem_error if it can't be created.
+    explicit SparseFileWriter(const std::filesystem::path& file_path);
+    ~SparseFileWriter();
+
+    SparseFileWriter(const SparseFileWriter&) = delete;
+    SparseFileWriter& operator=(const SparseFileWriter&) = delete;
+
+    //Throws std::filesystem::filesystem_error on write errors.
+    void Write(const uint8_t* data, size_t length);
+
+    //Writes what's left and sets the file's size, holes at the end included.  Throws std::filesystem::filesystem_error on
+    // failure.  A writer destroyed without it leaves the file cut short.
+    void Finish();
+
+private:
+    void WriteBlock(const uint8_t* data, size_t length);
+
+    std::filesystem::path file_path;
+    void* file = nullptr;
+    std::vector<uint8_t> block;     //the current aligned block, held back until it's known whether it's all zeros
+    uint64_t block_offset = 0;
+    bool sparse = false;
+    bool seek_pending = false;      //a hole was skipped, the next write goes past it
+};
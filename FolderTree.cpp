@@ -0,0 +1,136 @@
+#include "FolderTree.h"
+
+#include <algorithm>
+#include <cwchar>
+#include <system_error>
+
+#define NOMINMAX
+#include <Windows.h>
+
+namespace
+{
+    std::filesystem::filesystem_error MakeListError(const std::filesystem::path& folder, DWORD error)
+    {
+        return std::filesystem::filesystem_error("Unable to list folder", folder, std::error_code(static_cast<int>(error), std::system_category()));
+    }
+
+    class FindHandle
+    {
+    public:
+        explicit FindHandle(HANDLE handle) : handle(handle) {}
+        ~FindHandle()
+        {
+            if (handle != INVALID_HANDLE_VALUE)
+            {
+                FindClose(handle);
+            }
+        }
+
+        FindHandle(const FindHandle&) = delete;
+        FindHandle& operator=(const FindHandle&) = delete;
+
+        HANDLE Get() const { return handle; }
+
+    private:
+        HANDLE handle;
+    };
+}
+
+FolderTree::FolderTree(const std::filesystem::path& root)
+    : root(root)
+{
+    //Depth first with an explicit stack, so deep saves can't run out of call stack.
+    std::vector<std::pair<uint32_t, std::filesystem::path>> pending;
+    pending.emplace_back(FOLDER_TREE_ROOT, root);
+    while (!pending.empty())
+    {
+        std::pair<uint32_t, std::filesystem::path> folder = std::move(pending.back());
+        pending.pop_back();
+        ListFolder(folder.second, folder.first, pending);
+    }
+}
+
+void FolderTree::ListFolder(const std::filesystem::path& folder, uint32_t folder_index, std::vector<std::pair<uint32_t, std::filesystem::path>>& pending)
+{
+    //Basic info skips the 8.3 short names nobody needs, large fetch asks for a bigger buffer per call.
+    WIN32_FIND_DATAW data;
+    FindHandle find(FindFirstFileExW((folder / "*").c_str(), FindExInfoBasic, &data, FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH));
+    if (find.Get() == INVALID_HANDLE_VALUE)
+    {
+        const DWORD error = GetLastError();
+        if (error == ERROR_FILE_NOT_FOUND)
+        {
+            return;
+        }
+        throw MakeListError(folder, error);
+    }
+
+    do
+    {
+        if (std::wcscmp(data.cFileName, L".") == 0 || std::wcscmp(data.cFileName, L"..") == 0)
+        {
+            continue;
+        }
+
+        FolderTreeEntry entry;
+        entry.parent = folder_index;
+        entry.attributes = data.dwFileAttributes;
+        entry.is_directory = (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+        entry.size = entry.is_directory ? 0 : ((static_cast<uint64_t>(data.nFileSizeHigh) << 32) | data.nFileSizeLow);
+        entry.modified_time = static_cast<int64_t>((static_cast<uint64_t>(data.ftLastWriteTime.dwHighDateTime) << 32) | data.ftLastWriteTime.dwLowDateTime);
+
+        //Straight into the shared buffer as UTF-8, at most 3 bytes per UTF-16 unit.
+        const int wide_length = static_cast<int>(std::wcslen(data.cFileName));
+        entry.name_offset = static_cast<uint32_t>(names.size());
+        names.resize(names.size() + static_cast<size_t>(wide_length) * 3);
+        const int length = WideCharToMultiByte(CP_UTF8, 0, data.cFileName, wide_length, &names[entry.name_offset], wide_length * 3, NULL, NULL);
+        names.resize(entry.name_offset + static_cast<size_t>(std::max(length, 0)));
+        entry.name_length = static_cast<uint32_t>(names.size() - entry.name_offset);
+
+        if (entry.is_directory && (entry.attributes & FILE_ATTRIBUTE_REPARSE_POINT) == 0)
+        {
+            pending.emplace_back(static_cast<uint32_t>(entries.size()), folder / data.cFileName);
+        }
+        entries.push_back(entry);
+    } while (FindNextFileW(find.Get(), &data));
+
+    const DWORD error = GetLastError();
+    if (error != ERROR_NO_MORE_FILES)
+    {
+        throw MakeListError(folder, error);
+    }
+}
+
+std::string_view FolderTree::Name(size_t index) const
+{
+    return std::string_view(names.data() + entries[index].name_offset, entries[index].name_length);
+}
+
+std::string FolderTree::RelativePath(size_t index) const
+{
+    //Measure the chain first, then fill the path in from the back.
+    size_t length = 0;
+    for (uint32_t current = static_cast<uint32_t>(index); current != FOLDER_TREE_ROOT; current = entries[current].parent)
+    {
+        length += entries[current].name_length + 1;
+    }
+
+    std::string path(length - 1, '/');
+    size_t end = path.size();
+    for (uint32_t current = static_cast<uint32_t>(index); current != FOLDER_TREE_ROOT; current = entries[current].parent)
+    {
+        const FolderTreeEntry& entry = entries[current];
+        end -= entry.name_length;
+        path.replace(end, entry.name_length, names, entry.name_offset, entry.name_length);
+        if (end > 0)
+        {
+            end--;
+        }
+    }
+    return path;
+}
+
+std::filesystem::path FolderTree::FullPath(size_t index) const
+{
+    return root / std::filesystem::u8path(RelativePath(index));
+}
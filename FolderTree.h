@@ -0,0 +1,56 @@
+#pragma once
+
+//One pass listing of a folder tree into a flat array, shared by the backup walk, change detection and restores.
+//
+// Each folder is read with FindFirstFileExW(FIND_FIRST_EX_LARGE_FETCH), which hands back the name, size, time and attributes
+// of many entries per request, so nothing is stat'ed per file.  Entries only keep their own name (in one shared buffer) and
+// their parent's index, so walking the tree never builds a full path or makes one relative.  Paths are put together only
+// for the entries that need one, RelativePath() from the parent chain and FullPath() from that.
+//
+// Reparse points (junctions, symbolic links) are listed but never followed, like recursive_directory_iterator does.
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+//Parent of everything directly inside the scanned folder.
+#define FOLDER_TREE_ROOT UINT32_MAX
+
+struct FolderTreeEntry
+{
+    uint32_t parent = FOLDER_TREE_ROOT;     //index of the folder the entry is in
+    uint32_t name_offset = 0;               //UTF-8 name in the tree's name buffer
+    uint32_t name_length = 0;
+    uint32_t attributes = 0;                //FILE_ATTRIBUTE_* flags
+    bool is_directory = false;
+    uint64_t size = 0;
+    int64_t modified_time = 0;              //std::filesystem::file_time_type ticks (FILETIME), like IndexEntry::modified_time
+};
+
+class FolderTree
+{
+public:
+    //Lists everything under root.  A folder always comes before anything inside it.  Throws filesystem_error if root, or any
+    // folder inside it, can't be listed.
+    explicit FolderTree(const std::filesystem::path& root);
+
+    const std::filesystem::path& Root() const { return root; }
+    const std::vector<FolderTreeEntry>& Entries() const { return entries; }
+
+    std::string_view Name(size_t index) const;
+
+    //'/' separated UTF-8 path from the root, the same string relative(path, root).generic_u8string() gives.
+    std::string RelativePath(size_t index) const;
+    std::filesystem::path FullPath(size_t index) const;
+
+private:
+    void ListFolder(const std::filesystem::path& folder, uint32_t folder_index, std::vector<std::pair<uint32_t, std::filesystem::path>>& pending);
+
+    std::filesystem::path root;
+    std::vector<FolderTreeEntry> entries;
+    std::string names;
+};
@@ -0,0 +1,299 @@
+#include "Hashing.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    const uint32_t sha256_round_constants[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+    };
+
+    inline uint32_t RotateRight(uint32_t value, int bits)
+    {
+        return (value >> bits) | (value << (32 - bits));
+    }
+
+    const uint64_t xxh64_prime1 = 0x9E3779B185EBCA87ull;
+    const uint64_t xxh64_prime2 = 0xC2B2AE3D27D4EB4Full;
+    const uint64_t xxh64_prime3 = 0x165667B19E3779F9ull;
+    const uint64_t xxh64_prime4 = 0x85EBCA77C2B2AE63ull;
+    const uint64_t xxh64_prime5 = 0x27D4EB2F165667C5ull;
+
+    inline uint64_t RotateLeft64(uint64_t value, int bits)
+    {
+        return (value << bits) | (value >> (64 - bits));
+    }
+
+    inline uint64_t ReadLE64(const uint8_t* bytes)
+    {
+        uint64_t value;
+        std::memcpy(&value, bytes, sizeof(value));  //x86/x64 only, so native order is already little endian
+        return value;
+    }
+
+    inline uint32_t ReadLE32(const uint8_t* bytes)
+    {
+        uint32_t value;
+        std::memcpy(&value, bytes, sizeof(value));
+        return value;
+    }
+
+    inline uint64_t Xxh64Round(uint64_t accumulator, uint64_t input)
+    {
+        accumulator += input * xxh64_prime2;
+        accumulator = RotateLeft64(accumulator, 31);
+        return accumulator * xxh64_prime1;
+    }
+
+    inline uint64_t Xxh64MergeRound(uint64_t hash, uint64_t accumulator)
+    {
+        hash ^= Xxh64Round(0, accumulator);
+        return hash * xxh64_prime1 + xxh64_prime4;
+    }
+}
+
+Sha256::Sha256()
+    : state{ 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 },
+      buffer{},
+      buffer_length(0),
+      total_length(0)
+{
+}
+
+void Sha256::ProcessBlock(const uint8_t* block)
+{
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++)
+    {
+        w[i] = (uint32_t(block[i * 4]) << 24) | (uint32_t(block[i * 4 + 1]) << 16) | (uint32_t(block[i * 4 + 2]) << 8) | uint32_t(block[i * 4 + 3]);
+    }
+    for (int i = 16; i < 64; i++)
+    {
+        uint32_t s0 = RotateRight(w[i - 15], 7) ^ RotateRight(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = RotateRight(w[i - 2], 17) ^ RotateRight(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+    for (int i = 0; i < 64; i++)
+    {
+        uint32_t s1 = RotateRight(e, 6) ^ RotateRight(e, 11) ^ RotateRight(e, 25);
+        uint32_t choice = (e & f) ^ (~e & g);
+        uint32_t temp1 = h + s1 + choice + sha256_round_constants[i] + w[i];
+        uint32_t s0 = RotateRight(a, 2) ^ RotateRight(a, 13) ^ RotateRight(a, 22);
+        uint32_t majority = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t temp2 = s0 + majority;
+
+        h = g;
+        g = f;
+        f = e;
+        e = d + temp1;
+        d = c;
+        c = b;
+        b = a;
+        a = temp1 + temp2;
+    }
+
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+void Sha256::Update(const void* data, size_t length)
+{
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    total_length += length;
+
+    //Top up a partially filled block first
+    if (buffer_length > 0)
+    {
+        size_t take = std::min(length, sizeof(buffer) - buffer_length);
+        std::memcpy(buffer + buffer_length, bytes, take);
+        buffer_length += take;
+        bytes += take;
+        length -= take;
+
+        if (buffer_length == sizeof(buffer))
+        {
+            ProcessBlock(buffer);
+            buffer_length = 0;
+        }
+    }
+
+    //Then hash whole blocks straight out of the caller's memory
+    while (length >= sizeof(buffer))
+    {
+        ProcessBlock(bytes);
+        bytes += sizeof(buffer);
+        length -= sizeof(buffer);
+    }
+
+    if (length > 0)
+    {
+        std::memcpy(buffer, bytes, length);
+        buffer_length = length;
+    }
+}
+
+std::array<uint8_t, 32> Sha256::Final()
+{
+    uint64_t bit_length = total_length * 8;
+
+    uint8_t padding[72] = { 0x80 };
+    size_t padding_length = (buffer_length < 56) ? (56 - buffer_length) : (120 - buffer_length);
+    for (int i = 0; i < 8; i++)
+    {
+        padding[padding_length + i] = uint8_t(bit_length >> (56 - i * 8));
+    }
+    Update(padding, padding_length + 8);
+
+    std::array<uint8_t, 32> digest;
+    for (int i = 0; i < 8; i++)
+    {
+        digest[i * 4] = uint8_t(state[i] >> 24);
+        digest[i * 4 + 1] = uint8_t(state[i] >> 16);
+        digest[i * 4 + 2] = uint8_t(state[i] >> 8);
+        digest[i * 4 + 3] = uint8_t(state[i]);
+    }
+    return digest;
+}
+
+std::string Sha256::HexDigest(const void* data, size_t length)
+{
+    Sha256 hasher;
+    hasher.Update(data, length);
+    std::array<uint8_t, 32> digest = hasher.Final();
+    return BytesToHex(digest.data(), digest.size());
+}
+
+Xxh64::Xxh64(uint64_t seed)
+    : accumulators{ seed + xxh64_prime1 + xxh64_prime2, seed + xxh64_prime2, seed, seed - xxh64_prime1 },
+      buffer{},
+      buffer_length(0),
+      total_length(0),
+      seed(seed)
+{
+}
+
+void Xxh64::Update(const void* data, size_t length)
+{
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    total_length += length;
+
+    if (buffer_length > 0)
+    {
+        size_t take = std::min(length, sizeof(buffer) - buffer_length);
+        std::memcpy(buffer + buffer_length, bytes, take);
+        buffer_length += take;
+        bytes += take;
+        length -= take;
+
+        if (buffer_length < sizeof(buffer))
+        {
+            return;
+        }
+
+        for (int lane = 0; lane < 4; lane++)
+        {
+            accumulators[lane] = Xxh64Round(accumulators[lane], ReadLE64(buffer + lane * 8));
+        }
+        buffer_length = 0;
+    }
+
+    //Four independent lanes, which keeps the multiplier units busy even though it's plain scalar code.
+    while (length >= 32)
+    {
+        accumulators[0] = Xxh64Round(accumulators[0], ReadLE64(bytes));
+        accumulators[1] = Xxh64Round(accumulators[1], ReadLE64(bytes + 8));
+        accumulators[2] = Xxh64Round(accumulators[2], ReadLE64(bytes + 16));
+        accumulators[3] = Xxh64Round(accumulators[3], ReadLE64(bytes + 24));
+        bytes += 32;
+        length -= 32;
+    }
+
+    if (length > 0)
+    {
+        std::memcpy(buffer, bytes, length);
+        buffer_length = length;
+    }
+}
+
+uint64_t Xxh64::Final() const
+{
+    uint64_t hash;
+    if (total_length >= 32)
+    {
+        hash = RotateLeft64(accumulators[0], 1) + RotateLeft64(accumulators[1], 7) + RotateLeft64(accumulators[2], 12) + RotateLeft64(accumulators[3], 18);
+        for (int lane = 0; lane < 4; lane++)
+        {
+            hash = Xxh64MergeRound(hash, accumulators[lane]);
+        }
+    }
+    else
+    {
+        hash = seed + xxh64_prime5;
+    }
+
+    hash += total_length;
+
+    const uint8_t* bytes = buffer;
+    size_t length = buffer_length;
+    while (length >= 8)
+    {
+        hash ^= Xxh64Round(0, ReadLE64(bytes));
+        hash = RotateLeft64(hash, 27) * xxh64_prime1 + xxh64_prime4;
+        bytes += 8;
+        length -= 8;
+    }
+    if (length >= 4)
+    {
+        hash ^= uint64_t(ReadLE32(bytes)) * xxh64_prime1;
+        hash = RotateLeft64(hash, 23) * xxh64_prime2 + xxh64_prime3;
+        bytes += 4;
+        length -= 4;
+    }
+    while (length > 0)
+    {
+        hash ^= (*bytes) * xxh64_prime5;
+        hash = RotateLeft64(hash, 11) * xxh64_prime1;
+        bytes++;
+        length--;
+    }
+
+    hash ^= hash >> 33;
+    hash *= xxh64_prime2;
+    hash ^= hash >> 29;
+    hash *= xxh64_prime3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+uint64_t Xxh64::Hash(const void* data, size_t length, uint64_t seed)
+{
+    Xxh64 hasher(seed);
+    hasher.Update(data, length);
+    return hasher.Final();
+}
+
+std::string BytesToHex(const uint8_t* bytes, size_t length)
+{
+    static const char hex_digits[] = "0123456789abcdef";
+
+    std::string result;
+    result.reserve(length * 2);
+    for (size_t i = 0; i < length; i++)
+    {
+        result.push_back(hex_digits[bytes[i] >> 4]);
+        result.push_back(hex_digits[bytes[i] & 0x0f]);
+    }
+    return result;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+//Hash functions used by the backup store.  Kept dependency free so the project still only needs nfd to build.
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+//SHA-256, used as the content address for chunks in the backup store so two different chunks can never share a name.
+class Sha256
+{
+public:
+    Sha256();
+
+    void Update(const void* data, size_t length);
+    std::array<uint8_t, 32> Final();
+
+    //One-shot helper, returns the lowercase hex digest.
+    static std::string HexDigest(const void* data, size_t length);
+
+private:
+    void ProcessBlock(const uint8_t* block);
+
+    uint32_t state[8];
+    uint8_t buffer[64];
+    size_t buffer_length;
+    uint64_t total_length;
+};
+
+//XXH64, a fast non-cryptographic hash used to tell whether file contents changed.
+class Xxh64
+{
+public:
+    explicit Xxh64(uint64_t seed = 0);
+
+    void Update(const void* data, size_t length);
+    uint64_t Final() const;
+
+    static uint64_t Hash(const void* data, size_t length, uint64_t seed = 0);
+
+private:
+    uint64_t accumulators[4];
+    uint8_t buffer[32];
+    size_t buffer_length;
+    uint64_t total_length;
+    uint64_t seed;
+};
+
+std::string BytesToHex(const uint8_t* bytes, size_t length);
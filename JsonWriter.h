@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <ostream>
+#include <string>
+#include <vector>
+
+//Minimal streaming JSON writer, only what the command output and the telemetry trace need.  Commas are tracked per nesting level.
+class JsonWriter
+{
+public:
+    explicit JsonWriter(std::ostream& output) : output(output) {}
+
+    void BeginObject() { Separate(); output << '{'; first_in_level.push_back(true); }
+    void EndObject() { output << '}'; first_in_level.pop_back(); }
+    void BeginArray() { Separate(); output << '['; first_in_level.push_back(true); }
+    void EndArray() { output << ']'; first_in_level.pop_back(); }
+
+    void Key(const std::string& key)
+    {
+        Separate();
+        WriteString(key);
+        output << ':';
+        after_key = true;
+    }
+
+    void String(const std::string& value) { Separate(); WriteString(value); }
+    void Number(uint64_t value) { Separate(); output << value; }
+    void Number(int64_t value) { Separate(); output << value; }
+    void Bool(bool value) { Separate(); output << (value ? "true" : "false"); }
+    void Null() { Separate(); output << "null"; }
+
+private:
+    void Separate()
+    {
+        if (after_key)
+        {
+            after_key = false;
+            return;
+        }
+        if (!first_in_level.empty())
+        {
+            if (!first_in_level.back())
+            {
+                output << ',';
+            }
+            first_in_level.back() = false;
+        }
+    }
+
+    void WriteString(const std::string& value)
+    {
+        output << '"';
+        for (const char character : value)
+        {
+            switch (character)
+            {
+            case '"': output << "\\\""; break;
+            case '\\': output << "\\\\"; break;
+            case '\n': output << "\\n"; break;
+            case '\r': output << "\\r"; break;
+            case '\t': output << "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(character) < 0x20)
+                {
+                    char escaped[8];
+                    std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned char>(character));
+                    output << escaped;
+                }
+                else
+                {
+                    output << character;    //already UTF-8
+                }
+            }
+        }
+        output << '"';
+    }
+
+    std::ostream& output;
+    std::vector<bool> first_in_level;
+    bool after_key = false;
+};
@@ -0,0 +1,215 @@
+#include "LzCodec.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+    const size_t min_match_length = 4;
+    const size_t max_match_offset = 65535;
+
+    //The last bytes of a block are always literals and no match starts close to the end, so the matcher can read
+    // four bytes ahead without bounds checks.  Same margins as LZ4.
+    const size_t last_literals = 5;
+    const size_t match_start_margin = 12;
+
+    const int hash_table_bits = 14;
+
+    inline uint32_t Read32(const uint8_t* bytes)
+    {
+        uint32_t value;
+        std::memcpy(&value, bytes, sizeof(value));
+        return value;
+    }
+
+    inline uint32_t HashSequence(uint32_t sequence)
+    {
+        return (sequence * 2654435761u) >> (32 - hash_table_bits);
+    }
+
+    //Lengths that don't fit in a token nibble continue in bytes of 255 until one is smaller.
+    uint8_t* WriteLength(uint8_t* output, size_t length)
+    {
+        while (length >= 255)
+        {
+            *output++ = 255;
+            length -= 255;
+        }
+        *output++ = static_cast<uint8_t>(length);
+        return output;
+    }
+
+    bool ReadLength(const uint8_t*& input, const uint8_t* input_end, size_t& length)
+    {
+        uint8_t byte;
+        do
+        {
+            if (input == input_end)
+            {
+                return false;
+            }
+            byte = *input++;
+            length += byte;
+        } while (byte == 255);
+        return true;
+    }
+
+    //A match_length of 0 writes the final literals-only sequence.
+    uint8_t* WriteSequence(uint8_t* output, const uint8_t* literals, size_t literal_length, size_t match_offset, size_t match_length)
+    {
+        const size_t match_code = (match_length > 0) ? match_length - min_match_length : 0;
+
+        *output++ = static_cast<uint8_t>((std::min<size_t>(literal_length, 15) << 4) | std::min<size_t>(match_code, 15));
+        if (literal_length >= 15)
+        {
+            output = WriteLength(output, literal_length - 15);
+        }
+
+        //Empty input comes with a null pointer, which memcpy mustn't be handed even for 0 bytes.
+        if (literal_length > 0)
+        {
+            std::memcpy(output, literals, literal_length);
+            output += literal_length;
+        }
+
+        if (match_length > 0)
+        {
+            *output++ = static_cast<uint8_t>(match_offset & 0xff);
+            *output++ = static_cast<uint8_t>(match_offset >> 8);
+            if (match_code >= 15)
+            {
+                output = WriteLength(output, match_code - 15);
+            }
+        }
+
+        return output;
+    }
+}
+
+size_t LzCompressBound(size_t length)
+{
+    return length + length / 255 + 16;
+}
+
+size_t LzCompress(const uint8_t* source, size_t length, uint8_t* destination)
+{
+    uint8_t* output = destination;
+    size_t anchor = 0;
+
+    if (length > match_start_margin)
+    {
+        //Last position each 4 byte sequence was seen at.  Stale or colliding slots are caught by comparing the bytes.
+        std::vector<uint32_t> positions(size_t(1) << hash_table_bits, 0);
+
+        const size_t match_start_limit = length - match_start_margin;
+        const size_t match_end_limit = length - last_literals;
+
+        size_t position = 1;
+        while (position < match_start_limit)
+        {
+            const uint32_t sequence = Read32(source + position);
+            uint32_t& slot = positions[HashSequence(sequence)];
+            const size_t candidate = slot;
+            slot = static_cast<uint32_t>(position);
+
+            if (position - candidate > max_match_offset || Read32(source + candidate) != sequence)
+            {
+                //Step further the longer nothing has matched, so incompressible data goes through quickly.
+                position += 1 + ((position - anchor) >> 6);
+                continue;
+            }
+
+            size_t match_length = min_match_length;
+            while (position + match_length < match_end_limit && source[candidate + match_length] == source[position + match_length])
+            {
+                match_length++;
+            }
+
+            output = WriteSequence(output, source + anchor, position - anchor, position - candidate, match_length);
+            position += match_length;
+            anchor = position;
+
+            //Seed the table from inside the match too, repetitive data then keeps matching right after it.
+            if (position - 2 < match_start_limit)
+            {
+                positions[HashSequence(Read32(source + position - 2))] = static_cast<uint32_t>(position - 2);
+            }
+        }
+    }
+
+    output = WriteSequence(output, source + anchor, length - anchor, 0, 0);
+    return static_cast<size_t>(output - destination);
+}
+
+bool LzDecompress(const uint8_t* source, size_t length, uint8_t* destination, size_t decompressed_length)
+{
+    const uint8_t* input = source;
+    const uint8_t* input_end = source + length;
+    uint8_t* output = destination;
+    uint8_t* output_end = destination + decompressed_length;
+
+    while (input < input_end)
+    {
+        const uint8_t token = *input++;
+
+        size_t literal_length = token >> 4;
+        if (literal_length == 15 && !ReadLength(input, input_end, literal_length))
+        {
+            return false;
+        }
+        if (literal_length > static_cast<size_t>(input_end - input) || literal_length > static_cast<size_t>(output_end - output))
+        {
+            return false;
+        }
+
+        if (literal_length > 0)
+        {
+            std::memcpy(output, input, literal_length);
+            input += literal_length;
+            output += literal_length;
+        }
+
+        //The final sequence has literals only.
+        if (input == input_end)
+        {
+            break;
+        }
+
+        if (input_end - input < 2)
+        {
+            return false;
+        }
+        const size_t match_offset = input[0] | (static_cast<size_t>(input[1]) << 8);
+        input += 2;
+
+        size_t match_length = token & 0x0f;
+        if (match_length == 15 && !ReadLength(input, input_end, match_length))
+        {
+            return false;
+        }
+        match_length += min_match_length;
+
+        if (match_offset == 0 || match_offset > static_cast<size_t>(output - destination) || match_length > static_cast<size_t>(output_end - output))
+        {
+            return false;
+        }
+
+        //Overlapping matches (offset shorter than the length) repeat the bytes just written, so copy forwards byte by byte.
+        const uint8_t* match = output - match_offset;
+        if (match_offset >= match_length)
+        {
+            std::memcpy(output, match, match_length);
+        }
+        else
+        {
+            for (size_t i = 0; i < match_length; i++)
+            {
+                output[i] = match[i];
+            }
+        }
+        output += match_length;
+    }
+
+    return output == output_end;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+//Small LZ77 byte codec for snapshot archives, in the LZ4 block layout: a token byte holding the literal and match lengths,
+// the literals, a 16 bit back reference offset, then length extension bytes.  Greedy single hash table matcher, so it
+// compresses at disk speed rather than aiming for the best ratio.  Kept in tree for the same reason as Hashing.h.
+
+#include <cstddef>
+#include <cstdint>
+
+//Largest output LzCompress() can produce for length bytes of input (incompressible data grows slightly).
+size_t LzCompressBound(size_t length);
+
+//Compresses source into destination, which must hold at least LzCompressBound(length) bytes.  Returns the compressed length.
+size_t LzCompress(const uint8_t* source, size_t length, uint8_t* destination);
+
+//Decompresses exactly decompressed_length bytes.  Returns false on malformed or truncated input instead of overrunning.
+bool LzDecompress(const uint8_t* source, size_t length, uint8_t* destination, size_t decompressed_length);
@@ -0,0 +1,143 @@
+#include "Retention.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+namespace
+{
+    //Days since 1970-01-01 of a civil date (proleptic Gregorian), so day and week numbers follow the local calendar.
+    int64_t DaysFromCivil(int64_t year, unsigned month, unsigned day)
+    {
+        year -= (month <= 2) ? 1 : 0;
+        const int64_t era = (year >= 0 ? year : year - 399) / 400;
+        const unsigned year_of_era = static_cast<unsigned>(year - era * 400);
+        const unsigned day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+        const unsigned day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+        return era * 146097 + static_cast<int64_t>(day_of_era) - 719468;
+    }
+
+    struct Periods
+    {
+        int64_t hour = 0;
+        int64_t day = 0;
+        int64_t week = 0;
+    };
+
+    Periods PeriodsOf(std::time_t time)
+    {
+        std::tm local_time = {};
+        localtime_s(&local_time, &time);
+
+        Periods periods;
+        periods.day = DaysFromCivil(local_time.tm_year + 1900, static_cast<unsigned>(local_time.tm_mon + 1), static_cast<unsigned>(local_time.tm_mday));
+        periods.hour = periods.day * 24 + local_time.tm_hour;
+        //1970-01-01 was a Thursday, shifting by 3 days makes every week start on a Monday.
+        periods.week = (periods.day + 3) / 7;
+        return periods;
+    }
+
+    //Keeps the newest snapshot of each of the first count periods that have one.  Snapshots are newest first.
+    void KeepPerPeriod(const std::vector<Periods>& periods, int64_t Periods::* period, int count, std::vector<bool>& keep)
+    {
+        int kept_periods = 0;
+        for (size_t i = 0; i < periods.size() && kept_periods < count; i++)
+        {
+            if (i == 0 || periods[i].*period != periods[i - 1].*period)
+            {
+                keep[i] = true;
+                kept_periods++;
+            }
+        }
+    }
+}
+
+std::vector<SnapshotRemoval> PlanRetention(const BackupSettings& settings, const std::vector<CatalogSnapshot>& snapshots, std::time_t now)
+{
+    std::unordered_map<std::string, std::vector<const CatalogSnapshot*>> games;
+    for (const auto& snapshot : snapshots)
+    {
+        games[snapshot.game_name].push_back(&snapshot);
+    }
+
+    std::vector<SnapshotRemoval> removals;
+
+    for (auto& game : games)
+    {
+        std::vector<const CatalogSnapshot*>& game_snapshots = game.second;
+        std::sort(game_snapshots.begin(), game_snapshots.end(), [](const CatalogSnapshot* a, const CatalogSnapshot* b)
+        {
+            return (a->created_time != b->created_time) ? a->created_time > b->created_time : a->snapshot_name > b->snapshot_name;
+        });
+
+        const RetentionPolicy& policy = settings.RetentionFor(game.first);
+
+        std::vector<Periods> periods;
+        periods.reserve(game_snapshots.size());
+        for (const auto* snapshot : game_snapshots)
+        {
+            periods.push_back(PeriodsOf(snapshot->created_time));
+        }
+
+        std::vector<bool> keep(game_snapshots.size(), false);
+        for (size_t i = 0; i < keep.size() && i < static_cast<size_t>(std::max(policy.keep_last, 1)); i++)
+        {
+            keep[i] = true;
+        }
+        KeepPerPeriod(periods, &Periods::hour, policy.keep_hourly, keep);
+        KeepPerPeriod(periods, &Periods::day, policy.keep_daily, keep);
+        KeepPerPeriod(periods, &Periods::week, policy.keep_weekly, keep);
+
+        const std::time_t oldest_allowed = (policy.max_age_days > 0) ? now - static_cast<std::time_t>(policy.max_age_days) * 24 * 60 * 60 : 0;
+        for (size_t i = 0; i < game_snapshots.size(); i++)
+        {
+            const CatalogSnapshot& snapshot = *game_snapshots[i];
+            if (i > 0 && policy.max_age_days > 0 && snapshot.created_time < oldest_allowed)
+            {
+                removals.push_back({ snapshot, "older than max_age_days" });
+            }
+            else if (!keep[i])
+            {
+                removals.push_back({ snapshot, "not kept by any retention rule" });
+            }
+        }
+    }
+
+    std::sort(removals.begin(), removals.end(), [](const SnapshotRemoval& a, const SnapshotRemoval& b)
+    {
+        if (a.snapshot.game_name != b.snapshot.game_name)
+        {
+            return a.snapshot.game_name < b.snapshot.game_name;
+        }
+        return a.snapshot.created_time < b.snapshot.created_time;
+    });
+    return removals;
+}
+
+std::vector<CatalogSnapshot> BudgetCandidates(const std::vector<CatalogSnapshot>& snapshots)
+{
+    std::unordered_map<std::string, const CatalogSnapshot*> newest;
+    for (const auto& snapshot : snapshots)
+    {
+        const CatalogSnapshot*& game_newest = newest[snapshot.game_name];
+        if (game_newest == nullptr || snapshot.created_time > game_newest->created_time ||
+            (snapshot.created_time == game_newest->created_time && snapshot.snapshot_name > game_newest->snapshot_name))
+        {
+            game_newest = &snapshot;
+        }
+    }
+
+    std::vector<CatalogSnapshot> candidates;
+    for (const auto& snapshot : snapshots)
+    {
+        if (newest[snapshot.game_name] != &snapshot)
+        {
+            candidates.push_back(snapshot);
+        }
+    }
+
+    std::stable_sort(candidates.begin(), candidates.end(), [](const CatalogSnapshot& a, const CatalogSnapshot& b)
+    {
+        return a.created_time < b.created_time;
+    });
+    return candidates;
+}
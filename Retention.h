@@ -0,0 +1,34 @@
+#pragma once
+
+//Decides which snapshots the retention rules in settings.ini no longer keep.  Works from the catalog alone in one pass over
+// every game's snapshots, so even a watch daemon rotating every few minutes never lists a backup folder to do it.
+//
+// Per game, walking from the newest snapshot back:
+// - the newest keep_last are kept,
+// - so is the newest snapshot of each of the last keep_hourly hours (keep_daily days, keep_weekly weeks) that have one,
+// - anything older than max_age_days goes even if a rule keeps it.
+// Then, across all games, the oldest survivors go until the snapshots left fit in disk_budget_mb.  A game's newest snapshot
+// is never removed by any rule.
+//
+// The disk budget can't be planned up front: removing a snapshot frees less than its stored size whenever newer snapshots
+// still use some of its data, which then counts toward the next one instead (see SnapshotCatalog.h).  So PlanRetention()
+// only applies the rules, and the caller removes BudgetCandidates() one at a time, counting what each really freed.
+
+#include "Settings.h"
+#include "SnapshotCatalog.h"
+
+#include <ctime>
+#include <string>
+#include <vector>
+
+struct SnapshotRemoval
+{
+    CatalogSnapshot snapshot;
+    std::string reason;
+};
+
+//Snapshots to remove out of the given ones (any games, any order), ordered by game and then oldest first.
+std::vector<SnapshotRemoval> PlanRetention(const BackupSettings& settings, const std::vector<CatalogSnapshot>& snapshots, std::time_t now);
+
+//Snapshots the disk budget may remove, oldest first across every game: all but each game's newest.
+std::vector<CatalogSnapshot> BudgetCandidates(const std::vector<CatalogSnapshot>& snapshots);
@@ -3,8 +3,20 @@
 //Simple purpose console program which I can use to backup saves for various games.  Will store a file with a series of save data locations based on searching them with this program.
 #include "nfd/nfd.h"
 
+#include "BackupEngine.h"
+#include "ChunkStore.h"
+#include "CommandLine.h"
+#include "FileCopy.h"
+#include "SaveFolderStore.h"
+#include "Settings.h"
+#include "SnapshotArchive.h"
+#include "SnapshotCatalog.h"
+#include "SnapshotRestore.h"
+#include "Telemetry.h"
+#include "Timestamps.h"
+
+#include <algorithm>
 #include <chrono>
-#include <csignal>
 #include <cstdlib>
 #include <ctime>
 #include <filesystem>
@@ -14,82 +26,37 @@
 #include <sstream>
 #include <string>
 #include <unordered_map>
+#include <vector>
 #include <Windows.h>
 
-#define DEFAULT_BACKUP_SAVE_LIMIT 5
-
 //Ignore some deprecation warnings
 
-bool compareTimestamps_Strs(const std::string& path1, const std::string& path2);
-bool compareTimestamps_Paths(const std::filesystem::path& path1, const std::filesystem::path& path2);
-std::string GetCurrentDateTimeAsString();
-
 
 static bool exit_program = false;
-static std::unordered_map<std::string, std::string> save_paths;
-static int backup_save_limit = DEFAULT_BACKUP_SAVE_LIMIT;
+static SaveFolderStore save_folders(SAVE_FOLDERS_PATH);
+static BackupSettings settings;
 
-//A signal handled function that should ALWAYS run at the end of the program REGARDLESS of how we are closed UNLESS by Task Manager
-// This makes sense b/c a user SHOULD expect program state to break or not do things if they intentionally force closed it.
-// We are mostly guarding against accidentally closing the app (Ctrl + C in terminal/cmd, "X" button on console", or normal closing of app)
-void ProgramExitLastSteps()
+int main(int argc, char* argv[])
 {
-    std::filesystem::path textFilePath("./savefolders.ini");
-    std::ofstream outputFileStream;
-
-    //creates file if doesn't exist
-    outputFileStream.open(textFilePath, std::ios::out);
-
-    if (outputFileStream.is_open())
+    //Any arguments mean a scripted run (see CommandLine.h), nothing is printed besides the command's own output.
+    if (argc >= 2)
     {
-        //Before exiting, rewrite the save paths folder to include all of the new paths into the file list.
-        for (auto key_value_pair : save_paths)
+        try
         {
-            outputFileStream << key_value_pair.first << " = " << key_value_pair.second << "\n";
+            save_folders.Load();
         }
-        outputFileStream.close();
-    }
-    else
-    {
-        std::cerr << "Error creating save folders .ini file." << std::endl;
-    }
-}
-
-//Just for registering console close commands.
-BOOL onConsoleEvent(DWORD event) {
-
-    switch (event) {
-    case CTRL_C_EVENT:
-    case CTRL_CLOSE_EVENT:
-        ProgramExitLastSteps();
-        break;
+        catch (const std::exception& e)
+        {
+            std::cerr << "Error loading savefolders.ini: " << e.what() << std::endl;
+            return 1;
+        }
+        settings = LoadSettings(SETTINGS_FILE_PATH);
+        return RunCommandLine(argc, argv, settings, save_folders.Paths());
     }
 
-    return TRUE;
-}
-
-void signalHandler(int signum) {
-    // Make sure create file with all paths we've saved.
-    ProgramExitLastSteps();
+    //Nothing needs saving on the way out (or on Ctrl+C / closing the window), every change to the save folder list is written
+    // to disk as it's made.  See SaveFolderStore.h.
 
-    // Exit the program
-    std::exit(signum);
-}
-
-
-int main()
-{
-    //==========================================================
-    //  Register signal exits so we can ALWAYS run final code.
-    //  (like saving paths to our ini file)
-    //==========================================================
-    
-    std::atexit(ProgramExitLastSteps);              // Before program exits normally, always run this
-    std::signal(SIGTERM, signalHandler);            // Termination request, including console window closing
-    std::signal(SIGINT, signalHandler);             // Interrupt signal (Ctrl+C)
-    SetConsoleCtrlHandler(onConsoleEvent, TRUE);    // Handle Console Window closing
-
-    
     //Right away set focus so user input can go straight to the console without needing to click (hey, they opened the app...).
     HWND consoleWindow = GetConsoleWindow();
     if (consoleWindow != NULL)
@@ -102,44 +69,19 @@ int main()
     //  Load savefolders.ini config file
     //==========================================================
 
-    std::filesystem::path textFilePath("./savefolders.ini");
-    std::ifstream inputFileStream;
-    inputFileStream.open(textFilePath, std::ios::in);
-
-    if (inputFileStream.is_open())
+    bool config_found = false;
+    try
     {
-        //Read every file path into our list
-        std::string line;
-        int part = 0;
-
-        while (std::getline(inputFileStream, line))
-        {
-
-            //every even iteration/part is a key, every odd iteration is the value
-            //we are also cutting the spaces around the '=' sign.
-            std::istringstream iss(line);
-            std::string key, value;
-            if (std::getline(iss >> std::ws, key, '=') && std::getline(iss >> std::ws, value)) {
-                // Process key and value
-
-                //Remove trailing whitespace
-                while (!key.empty() && std::isspace(key.back())) {
-                    key.pop_back();
-                }
-
-                while (!value.empty() && std::isspace(value.back())) {
-                    value.pop_back();
-                }
-
-                save_paths[key] = value;
-            }
-
-            part++;
-        }
-
-        inputFileStream.close();
+        config_found = save_folders.Load();
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error loading savefolders.ini: " << e.what() << std::endl;
+    }
 
-        std::cout << "Successfully loaded " << part << " save backup path(s) from configuration." << std::endl;
+    if (config_found)
+    {
+        std::cout << "Successfully loaded " << save_folders.Paths().size() << " save backup path(s) from configuration." << std::endl;
         std::cout << std::endl;
     }
     else
@@ -147,6 +89,8 @@ int main()
         std::cout << "Didn't find savefolders.ini file.  No save data backup locations were loaded." << std::endl;
     }
 
+    settings = LoadSettings(SETTINGS_FILE_PATH);
+
 
     //==========================================================
     //  Run main program loop
@@ -157,6 +101,16 @@ int main()
 
     while (!exit_program)
     {
+        //Pick up games another instance (the watch daemon, say) added or removed in the meantime.
+        try
+        {
+            save_folders.Load();
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "Error reloading savefolders.ini: " << e.what() << std::endl;
+        }
+
         std::cout << "Save Backup Manager:" << std::endl <<
                      "--------------------" << std::endl <<
                      "1. Choose a new folder to add to the managed save backups list." << std::endl <<
@@ -222,7 +176,7 @@ int main()
 
                     std::vector<std::string> all_save_folders;
                     std::vector<std::string> all_save_game_names;
-                    for (const auto& pair : save_paths)
+                    for (const auto& pair : save_folders.Paths())
                     {
                         all_save_game_names.push_back(pair.first);  //keys
                         all_save_folders.push_back(pair.second);    //values
@@ -260,8 +214,15 @@ int main()
                             }
                         }
 
-                        save_paths[userInputGameName] = selected_path;
-                        file_result_text = "Added \"" + selected_path + "\" to save backup path list with the name: \"" + userInputGameName + "\"";
+                        try
+                        {
+                            save_folders.Set(userInputGameName, selected_path);
+                            file_result_text = "Added \"" + selected_path + "\" to save backup path list with the name: \"" + userInputGameName + "\"";
+                        }
+                        catch (const std::exception& e)
+                        {
+                            file_result_text = "Error saving \"" + selected_path + "\" to savefolders.ini: " + e.what();
+                        }
                     }
                     else
                     {
@@ -299,7 +260,7 @@ int main()
                              "---------------" << std::endl <<
                              "Game Name           |             Save Game Path" << std::endl <<
                              "-------------------------------------------------------------" << std::endl;
-                for (auto save_path : save_paths)
+                for (const auto& save_path : save_folders.Paths())
                 {
                     std::cout << save_path.first << " | " << save_path.second << std::endl;
                 }
@@ -313,110 +274,21 @@ int main()
             case 3:
             {
                 std::vector<std::string> all_save_game_names;
-                for (const auto& pair : save_paths)
+                for (const auto& pair : save_folders.Paths())
                 {
                     all_save_game_names.push_back(pair.first);  //keys
                 }
 
-                std::vector<std::string> game_saves_updated;
-                bool backup_performed = false;
-
-                //Loop through the save games and update save game backups
+                //Sort out missing save folders first, while nothing is running, since it needs an answer from the user.
+                std::vector<std::pair<std::string, std::filesystem::path>> games_to_back_up;
                 for (auto save_game_name : all_save_game_names)
                 {
-                    //Get current time and append to the path for our save backup
-                    std::filesystem::path backup_folder = "./Backups/" + save_game_name;
-                    std::filesystem::path backup_path = backup_folder.generic_string() + "/" + "Backup" + " - " + GetCurrentDateTimeAsString();
-
-                    if (!std::filesystem::exists(backup_folder))
-                    {
-                        //Create this save game backup folder if doesn't exist
-                        std::filesystem::create_directories(backup_folder);
-                    }
-
-                    //Count how many backups exist already
-                    int count = 0;
-                    std::string backup_name = "Backup";
-                    std::vector<std::string> backup_folder_paths;
-
-                    for (const auto& entry : std::filesystem::directory_iterator(backup_folder))
-                    {
-                        if (std::filesystem::is_directory(entry))
-                        {
-                            // Check if the substring exists in the directory name
-                            if (entry.path().filename().string().find(backup_name) != std::string::npos)
-                            {
-                                backup_folder_paths.push_back(entry.path().generic_string());
-                                count++;
-                            }
-                        }
-                    }
-
-                    std::sort(backup_folder_paths.begin(), backup_folder_paths.end(), compareTimestamps_Strs);
-
-                    //If amount of backups >= save limit, remove earliest ones until we have save_limit - 1 (b/c need to make new one)
-                    if (count + 1 > backup_save_limit)
-                    {
-                        for (auto path : backup_folder_paths)
-                        {
-                            if (count == backup_save_limit - 1)
-                            {
-                                break;
-                            }
-
-                            std::filesystem::path path_to_remove(path);
-                            std::filesystem::remove_all(path_to_remove);
-                            count--;
-                        }
-                    }
-
-
                     //Check if the backup exists/needs to be made at all
-                    std::filesystem::path actual_save_path = save_paths[save_game_name];
+                    std::filesystem::path actual_save_path = save_folders.Paths().at(save_game_name);
 
                     if (std::filesystem::exists(actual_save_path))
                     {
-                        //Create the time stamped folder first
-                        std::filesystem::create_directories(backup_path);
-
-                        //Make root directory of save folder
-                        std::string save_dir = std::filesystem::relative(actual_save_path, actual_save_path.parent_path()).generic_string();
-                        std::filesystem::path backup_final_directory(backup_path.string() + "/" + save_dir);
-                        std::filesystem::create_directories(backup_final_directory);
-
-                        //Attempt to back up the save data inside the root save folder.
-                        for (const auto& entry : std::filesystem::recursive_directory_iterator(actual_save_path))
-                        {
-                            const std::filesystem::path& currentPath = entry.path();
-                            const std::filesystem::path relativePath = std::filesystem::relative(currentPath, actual_save_path);
-                            const std::filesystem::path destinationPath = backup_final_directory / relativePath;
-
-                            try
-                            {
-                                if (std::filesystem::is_directory(entry.status())) {
-                                    std::filesystem::create_directories(destinationPath);
-                                }
-                                else if (std::filesystem::is_regular_file(entry.status())) {
-                                    std::filesystem::copy_file(currentPath, destinationPath, std::filesystem::copy_options::overwrite_existing);
-                                }
-                            }
-                            catch (const std::exception& e)
-                            {
-
-                                //if we failed to do so, remove the backup folder we created and all data we tried to backup there
-                                std::cerr << "Error copying file " << currentPath << ": " << e.what() << std::endl;
-                                std::cout << std::endl;
-                                std::cout << "Deleting backup that was attempted..." << std::endl;
-                                
-                                std::filesystem::remove_all(backup_path);
-
-                                std::cout << "Deleted incomplete backup data." << std::endl;
-                            }
-                        }
-
-                        game_saves_updated.push_back(save_game_name);
-
-                        backup_performed = true;
+                        games_to_back_up.emplace_back(save_game_name, actual_save_path);
                     }
                     else
                     {
@@ -432,7 +304,15 @@ int main()
 
                             if (userAnswer == "y")
                             {
-                                //Remove this backup -- the actual config file will be updated whenever the dictionary is saved later.
+                                //Remove this backup from the configuration, backups already made for it are left alone.
+                                try
+                                {
+                                    save_folders.Remove(save_game_name);
+                                }
+                                catch (const std::exception& e)
+                                {
+                                    std::cerr << "Error removing \"" << save_game_name << "\" from savefolders.ini: " << e.what() << std::endl;
+                                }
                             }
                             else if (userAnswer == "n")
                             {
@@ -447,9 +327,45 @@ int main()
                         }
                     }
                 }
+
+                //Back up every game at once
+                StartTelemetry(settings);
+                std::vector<GameBackupResult> results;
+                {
+                    BackupEngine backup_engine(settings);
+                    results = backup_engine.BackupGames(games_to_back_up);
+
+                    if (!backup_engine.LastRetention().error.empty())
+                    {
+                        std::cerr << backup_engine.LastRetention().error << std::endl;
+                    }
+                }
+
                 system("cls");
 
-                if (backup_performed)
+                std::vector<std::string> game_saves_updated;
+                std::vector<std::string> game_saves_unchanged;
+                for (const auto& result : results)
+                {
+                    if (result.status == GameBackupStatus::BackedUp)
+                    {
+                        game_saves_updated.push_back(result.game_name + " (" + std::to_string(result.files_stored) + " files written, " +
+                                                     std::to_string(result.files_reused) + " reused" +
+                                                     (result.capture_settled ? ")" : ", kept changing while it was backed up)"));
+                    }
+                    else if (result.status == GameBackupStatus::Unchanged)
+                    {
+                        game_saves_unchanged.push_back(result.game_name);
+                    }
+                    else
+                    {
+                        std::cerr << "Backup of \"" << result.game_name << "\" failed, incomplete backup data was deleted." << std::endl;
+                        std::cerr << result.error << std::endl;
+                        std::cout << std::endl;
+                    }
+                }
+
+                if (!game_saves_updated.empty())
                 {
                     std::cout << "Backups made for the following games:" << std::endl <<
                                  "-------------------------------------" << std::endl;
@@ -462,11 +378,23 @@ int main()
                 }
                 else
                 {
-                    //TODO: Currently, we aren't actually checking if the files are matching with MD5... so as for now this is kind of irrelevant.
                     std::cout << "No save data needed backing up." << std::endl;
                     std::cout << std::endl;
                 }
 
+                if (!game_saves_unchanged.empty())
+                {
+                    std::cout << "Unchanged since their last backup:" << std::endl <<
+                                 "----------------------------------" << std::endl;
+
+                    for (const auto& name : game_saves_unchanged)
+                    {
+                        std::cout << name << std::endl;
+                    }
+                    std::cout << std::endl;
+                }
+
+                FinishTelemetry(std::cout);
                 break;
             }
 
@@ -483,7 +411,7 @@ int main()
 
                 //Get list of game names
                 int count = 1;
-                for (auto entry : save_paths)
+                for (const auto& entry : save_folders.Paths())
                 {
                     save_game_names.push_back(entry.first);
                     count++;
@@ -546,15 +474,14 @@ int main()
 
                 //Then let's backup the existing save for the game chosen at the dir right before the location of the current save
                 std::string game_name = save_game_names[numberChoice - 1];
-                std::filesystem::path game_save_path(save_paths[game_name]);
+                std::filesystem::path game_save_path(save_folders.Paths().at(game_name));
                 std::filesystem::path parent_path = game_save_path.parent_path();
 
-                std::filesystem::path backup_current_save_path(parent_path.string() + "/" + "CurrentSaveBackup");
+                std::filesystem::path backup_current_save_path = parent_path / CURRENT_SAVE_BACKUP_NAME;
 
                 bool overwrite_current_save_backup = false;
                 if (!std::filesystem::exists(backup_current_save_path))
                 {
-                    std::filesystem::create_directory(backup_current_save_path);
                     overwrite_current_save_backup = true;
                 }
                 else
@@ -571,7 +498,7 @@ int main()
 
                         if (userChoiceInput == "n")
                         {
-                            //Cancel overwrite, but still allows writing backup.
+                            //Cancel overwrite, the old current save backup is kept and the restore goes ahead without a new one.
                             break;
                         }
                         else if (userChoiceInput != "y")
@@ -581,72 +508,25 @@ int main()
                             std::cout << std::endl;
                         }
                     }
+
+                    overwrite_current_save_backup = (userChoiceInput == "y");
                 }
 
                 //Just to space stuff out a bit more.
                 std::cout << std::endl;
 
-                //If we got here, then user selected "y" they want to overwrite current save backup OR it didn't exist before
-                //So we should go ahead and write/overwrite the current save backup
+                //The current save backup itself is made by the restore, out of the files it replaces (see SnapshotRestore.h).
 
-                //Make root directory of save folder
-                std::string save_dir = std::filesystem::relative(game_save_path, game_save_path.parent_path()).string();
-                std::filesystem::path backup_current_save_final_directory(backup_current_save_path.string() + "/" + save_dir);
-                std::filesystem::create_directories(backup_current_save_final_directory);
-
-                //TODO: Need to make sure that the save directory actually exists anymore first?
-                for (const auto& entry : std::filesystem::recursive_directory_iterator(game_save_path))
-                {
-                    const std::filesystem::path& currentPath = entry.path();
-                    const std::filesystem::path relativePath = std::filesystem::relative(currentPath, game_save_path);
-                    const std::filesystem::path destinationPath = backup_current_save_final_directory / relativePath;
-
-                    try
-                    {
-                        if (std::filesystem::is_directory(entry.status())) {
-                            std::filesystem::create_directories(destinationPath);
-                        }
-                        else if (std::filesystem::is_regular_file(entry.status())) {
-                            std::filesystem::copy_file(currentPath, destinationPath, std::filesystem::copy_options::overwrite_existing);
-                        }
-                    }
-                    catch (const std::exception& e)
-                    {
-
-                        //if we failed to do so, remove the backup folder we created and all data we tried to backup there
-                        std::cerr << "Error copying file " << currentPath << ": " << e.what() << std::endl;
-                        std::cout << std::endl;
-                        std::cout << "Deleting backup that was attempted..." << std::endl;
-
-                        std::filesystem::remove_all(backup_current_save_path);
-
-                        std::cout << "Deleted incomplete backup data." << std::endl;
-                        break;
-                    }
-                }
-
-                //Then let's pull up a list of the backups for that game for the user to choose from                
-                //Count how many backups exist already
-                int backup_folder_count = 0;
-                std::filesystem::path backup_folder = "./Backups/" + game_name;
-                std::string backup_name = "Backup";
+                //Then let's pull up a list of the backups for that game for the user to choose from, straight out of the catalog
+                const std::filesystem::path backup_folder = GameBackupFolder(game_name);
+                SnapshotCatalog catalog(SNAPSHOT_CATALOG_PATH, BACKUPS_ROOT_PATH);
                 std::vector<std::filesystem::path> backup_folder_paths;
 
-                for (const auto& entry : std::filesystem::directory_iterator(backup_folder))
+                for (const auto& snapshot : catalog.Snapshots(game_name))
                 {
-                    if (std::filesystem::is_directory(entry))
-                    {
-                        // Check if the substring exists in the directory name
-                        if (entry.path().filename().string().find(backup_name) != std::string::npos)
-                        {
-                            backup_folder_paths.push_back(entry.path());
-                            backup_folder_count++;
-                        }
-                    }
+                    backup_folder_paths.push_back(backup_folder / std::filesystem::u8path(snapshot.snapshot_name));
                 }
 
-                std::sort(backup_folder_paths.begin(), backup_folder_paths.end(), compareTimestamps_Paths);
-
                 std::string hyphens_from_name_size = "";
                 for (int i = 0; i < game_name.length(); i++)
                 {
@@ -710,50 +590,109 @@ int main()
 
 
                 //Finally, overwrite the current save with their backup selection
-                //TODO: Also make this step actually happen.
 
                 std::filesystem::path backup_path_selected = backup_folder_paths[integerChoice - 1];
 
-                //Make sure we're restoring in the PLACE where the save data is stored, not the folder selected for save data, since we backed up that too.
-                const std::filesystem::path game_dir_to_overwrite_save = game_save_path.parent_path();
-
-                for (const auto& entry : std::filesystem::recursive_directory_iterator(backup_path_selected))
+                //Folders deleted by hand are still in the catalog, catch up with what's on disk for next time.
+                if (!std::filesystem::exists(backup_path_selected))
                 {
-                    const std::filesystem::path& currentPath = entry.path();
-                    const std::filesystem::path relativePath = std::filesystem::relative(currentPath, backup_path_selected);
-                    const std::filesystem::path destinationPath = game_dir_to_overwrite_save / relativePath;
+                    catalog.Rebuild();
 
-                    try
+                    system("cls");
+                    std::cerr << "The backup " << backup_path_selected.filename() << " no longer exists." << std::endl;
+                    std::cout << std::endl;
+                    break;
+                }
+
+                RestoreResult restore_result;
+                try
+                {
+                    //Archives can hand back a single file without unpacking the rest, so offer that too.
+                    std::string file_to_restore;
+                    if (std::filesystem::exists(backup_path_selected / SNAPSHOT_ARCHIVE_NAME))
                     {
-                        if (std::filesystem::is_directory(entry.status()))
+                        ArchiveReader archive(backup_path_selected / SNAPSHOT_ARCHIVE_NAME);
+
+                        std::vector<const ArchiveEntry*> archived_files;
+                        for (const auto& entry : archive.Entries())
                         {
-                            std::filesystem::create_directories(destinationPath);
+                            if (!entry.is_directory)
+                            {
+                                archived_files.push_back(&entry);
+                            }
                         }
-                        else if (std::filesystem::is_regular_file(entry.status()))
+
+                        bool fileChoiceValid = false;
+                        int fileChoice = 0;
+                        while (!fileChoiceValid)
                         {
-                            std::filesystem::copy_file(currentPath, destinationPath, std::filesystem::copy_options::overwrite_existing);
+                            std::cout << "Restore which files?" << std::endl <<
+                                         "--------------------" << std::endl;
+                            std::cout << "1. [Everything in this backup]" << std::endl;
+
+                            for (size_t i = 0; i < archived_files.size(); i++)
+                            {
+                                std::cout << i + 2 << ". " << archived_files[i]->relative_path << std::endl;
+                            }
+                            std::cout << std::endl;
+
+                            std::string userChoice;
+                            std::getline(std::cin >> std::ws, userChoice);
+
+                            try
+                            {
+                                fileChoice = std::stoi(userChoice);
+                            }
+                            catch (const std::exception& ex)
+                            {
+                                fileChoice = 0;
+                            }
+
+                            if (fileChoice <= 0 || fileChoice > archived_files.size() + 1)
+                            {
+                                system("cls");
+                                std::cerr << "Invalid input, '" << userChoice << "'." << std::endl;
+                                std::cerr << "Enter a number corresponding to one of the options." << std::endl;
+                                std::cout << "\n";
+                                continue;
+                            }
+
+                            fileChoiceValid = true;
                         }
-                    }
-                    catch (const std::exception& e)
-                    {
 
-                        //if we failed to do so... until I write file/folder restoration do nothing. (probably need a better process)
-                        std::cerr << "Error copying file " << currentPath << ": " << e.what() << std::endl;
-                        std::cout << std::endl;
-                        std::cout << "Deleting backup that was attempted..." << std::endl;
+                        if (fileChoice != 1)
+                        {
+                            file_to_restore = archived_files[fileChoice - 2]->relative_path;
+                        }
+                    }
 
-                        std::cout << "Deleted incomplete backup data." << std::endl;
-                        break;
+                    StartTelemetry(settings);
+                    restore_result = RestoreSnapshot(backup_path_selected, game_save_path, overwrite_current_save_backup, file_to_restore);
+                }
+                catch (const std::exception& e)
+                {
+                    system("cls");
+                    std::cerr << "Error restoring backup " << backup_path_selected << ": " << e.what() << std::endl;
+                    if (overwrite_current_save_backup)
+                    {
+                        std::cerr << "Any save files already replaced are in " << backup_current_save_path << "." << std::endl;
                     }
+                    std::cout << std::endl;
+                    FinishTelemetry(std::cout);
+                    break;
                 }
 
                 //Let user know everything went okay
-
-                //TODO: Make this also say which backup data was chosen to overwrite.
-                //TODO: Oh and ALSO, this doesn't currently actual overwrite anything yet, just backs up current save.
                 system("cls");
-                std::cout << "Current save data for \"" << game_name << "\" was successfully overwritten." << std::endl;
+                std::cout << "Current save data for \"" << game_name << "\" was successfully overwritten with " << backup_path_selected.filename() << " (" <<
+                             restore_result.files_written << " files written, " << restore_result.files_deleted << " removed, " <<
+                             restore_result.files_unchanged << " already matched)." << std::endl;
+                if (!restore_result.safety_copy_path.empty())
+                {
+                    std::cout << "The replaced files were moved to " << restore_result.safety_copy_path << "." << std::endl;
+                }
                 std::cout << std::endl;
+                FinishTelemetry(std::cout);
                 break;
             }
 
@@ -766,72 +705,8 @@ int main()
                 system("cls");
                 std::cout << "Exiting..." << std::endl;
 
-                //We use a signal to ensure file writes happen regardless of whether app is closed early or by this option.
                 break;
             }
         }
     };
 }
-
-
-
-//==========================================================
-//    Helpers
-//==========================================================
-
-//Gets current time as a string
-std::string GetCurrentDateTimeAsString() {
-
-
-    // Get the current time
-    auto currentTime = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
-
-    std::stringstream ss;
-
-    // Convert the time to a struct tm using localtime_s
-    struct std::tm timeInfo = {};
-    if (localtime_s(&timeInfo, &currentTime) == 0)
-    {
-        // Create a stringstream to format the date and time
-        ss << std::put_time(&timeInfo, "%Y-%m-%d %Hh%Mm%Ss");
-    }
-    else
-    {
-        // Handle the case where localtime fails
-        std::cerr << "Error getting local time." << std::endl;
-    }
-    // Convert stringstream to string
-    return ss.str();
-}
-
-bool compareTimestamps_Strs(const std::string& path1, const std::string& path2) {
-    // Extract timestamps from the paths
-    auto extractTimestamp = [](const std::string& path) {
-        std::tm timestamp = {};
-        sscanf_s(path.c_str(), "Backup - %d-%d-%d %dh%dm%ds",
-            &timestamp.tm_year, &timestamp.tm_mon, &timestamp.tm_mday,
-            &timestamp.tm_hour, &timestamp.tm_min, &timestamp.tm_sec);
-        timestamp.tm_year -= 1900; // Adjust year
-        timestamp.tm_mon -= 1;    // Adjust month
-        return std::mktime(&timestamp);
-        };
-
-    // Compare timestamps
-    return extractTimestamp(path1) < extractTimestamp(path2);
-}
-
-bool compareTimestamps_Paths(const std::filesystem::path& path1, const std::filesystem::path& path2) {
-    // Extract timestamps from the paths
-    auto extractTimestamp = [](const std::string& path) {
-        std::tm timestamp = {};
-        sscanf_s(path.c_str(), "Backup - %d-%d-%d %dh%dm%ds",
-            &timestamp.tm_year, &timestamp.tm_mon, &timestamp.tm_mday,
-            &timestamp.tm_hour, &timestamp.tm_min, &timestamp.tm_sec);
-        timestamp.tm_year -= 1900; // Adjust year
-        timestamp.tm_mon -= 1;    // Adjust month
-        return std::mktime(&timestamp);
-        };
-
-    // Compare timestamps
-    return extractTimestamp(path1.string()) < extractTimestamp(path2.string());
-}
\ No newline at end of file
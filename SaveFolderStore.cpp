@@ -0,0 +1,255 @@
+#define NOMINMAX
+#include "SaveFolderStore.h"
+#include "FileCopy.h"
+#include "FileLock.h"
+#include "Hashing.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <system_error>
+#include <utility>
+#include <vector>
+#include <Windows.h>
+
+namespace
+{
+    std::filesystem::filesystem_error MakeIoError(const std::string& what, const std::filesystem::path& path)
+    {
+        return std::filesystem::filesystem_error(what, path, std::make_error_code(std::errc::io_error));
+    }
+
+    std::string RecordCheck(const std::string& record)
+    {
+        char check[17];
+        std::snprintf(check, sizeof(check), "%016llx", static_cast<unsigned long long>(Xxh64::Hash(record.data(), record.size())));
+        return check;
+    }
+
+    //"name = path", the same split the file has always used.  Returns false for lines that aren't an entry.
+    bool ParseEntry(const std::string& line, std::string& key, std::string& value)
+    {
+        //we are also cutting the spaces around the '=' sign.
+        std::istringstream iss(line);
+        if (!std::getline(iss >> std::ws, key, '=') || !std::getline(iss >> std::ws, value))
+        {
+            return false;
+        }
+
+        //Remove trailing whitespace
+        while (!key.empty() && std::isspace(static_cast<unsigned char>(key.back())))
+        {
+            key.pop_back();
+        }
+
+        while (!value.empty() && std::isspace(static_cast<unsigned char>(value.back())))
+        {
+            value.pop_back();
+        }
+
+        return true;
+    }
+}
+
+SaveFolderStore::SaveFolderStore(const std::filesystem::path& config_path)
+    : config_path(config_path)
+{
+    journal_path = config_path;
+    journal_path += ".journal";
+    lock_path = config_path;
+    lock_path += ".lock";
+}
+
+bool SaveFolderStore::Load()
+{
+    FileLock lock(lock_path, "Unable to lock the save folder configuration", CONFIG_LOCK_TIMEOUT_MS);
+    Refresh();
+
+    return config_stamp.exists || std::filesystem::exists(journal_path);
+}
+
+void SaveFolderStore::Set(const std::string& game_name, const std::string& save_path)
+{
+    FileLock lock(lock_path, "Unable to lock the save folder configuration", CONFIG_LOCK_TIMEOUT_MS);
+    Refresh();
+
+    paths[game_name] = save_path;
+    AppendRecord("+ " + game_name + " = " + save_path);
+}
+
+void SaveFolderStore::Remove(const std::string& game_name)
+{
+    FileLock lock(lock_path, "Unable to lock the save folder configuration", CONFIG_LOCK_TIMEOUT_MS);
+    Refresh();
+
+    if (paths.erase(game_name) > 0)
+    {
+        AppendRecord("- " + game_name);
+    }
+}
+
+SaveFolderStore::FileStamp SaveFolderStore::StampOf(const std::filesystem::path& path)
+{
+    FileStamp stamp;
+    std::error_code error;
+    const std::filesystem::file_status status = std::filesystem::status(path, error);
+    if (!error && std::filesystem::is_regular_file(status))
+    {
+        stamp.exists = true;
+        stamp.size = std::filesystem::file_size(path, error);
+        stamp.modified_time = std::filesystem::last_write_time(path, error).time_since_epoch().count();
+    }
+    return stamp;
+}
+
+void SaveFolderStore::Refresh()
+{
+    //A new savefolders.ini means another instance compacted (or someone edited it by hand), read everything again.
+    // So does a journal shorter than what was already read from it.
+    std::error_code error;
+    const uintmax_t journal_size = std::filesystem::exists(journal_path) ? std::filesystem::file_size(journal_path, error) : 0;
+    if (!(StampOf(config_path) == config_stamp) || journal_size < journal_offset)
+    {
+        ReadConfig();
+        journal_offset = 0;
+        journal_records = 0;
+        journal_torn = false;
+    }
+
+    if (journal_size > journal_offset)
+    {
+        ReadJournal();
+    }
+}
+
+void SaveFolderStore::ReadConfig()
+{
+    paths.clear();
+    config_stamp = StampOf(config_path);
+
+    std::ifstream input(config_path, std::ios::in);
+    std::string line;
+    while (std::getline(input, line))
+    {
+        std::string key, value;
+        if (ParseEntry(line, key, value))
+        {
+            paths[key] = value;
+        }
+    }
+}
+
+void SaveFolderStore::ReadJournal()
+{
+    std::ifstream input(journal_path, std::ios::binary);
+    if (!input.is_open())
+    {
+        return;
+    }
+    input.seekg(static_cast<std::streamoff>(journal_offset));
+
+    //Only whole lines count.  A last line without its newline was cut off mid write and is left for compaction to drop.
+    std::string line;
+    while (std::getline(input, line))
+    {
+        if (input.eof())
+        {
+            journal_torn = true;
+            break;
+        }
+        journal_offset += line.size() + 1;
+        journal_records++;
+
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.pop_back();
+        }
+
+        const size_t separator = line.find(' ');
+        if (separator == std::string::npos || line.compare(0, separator, RecordCheck(line.substr(separator + 1))) != 0)
+        {
+            journal_torn = true;
+            continue;
+        }
+
+        const std::string record = line.substr(separator + 1);
+        std::string key, value;
+        if (record.compare(0, 2, "+ ") == 0 && ParseEntry(record.substr(2), key, value))
+        {
+            paths[key] = value;
+        }
+        else if (record.compare(0, 2, "- ") == 0)
+        {
+            paths.erase(record.substr(2));
+        }
+    }
+}
+
+void SaveFolderStore::AppendRecord(const std::string& record)
+{
+    try
+    {
+        if (journal_torn || journal_records + 1 >= CONFIG_JOURNAL_COMPACT_RECORDS)
+        {
+            Compact();
+            return;
+        }
+
+        const std::string line = RecordCheck(record) + " " + record + "\n";
+        {
+            std::ofstream output(journal_path, std::ios::binary | std::ios::app);
+            output.write(line.data(), line.size());
+            output.close();
+            if (!output)
+            {
+                throw MakeIoError("Unable to write the save folder journal", journal_path);
+            }
+        }
+        FlushFileToDisk(journal_path);
+
+        journal_offset += line.size();
+        journal_records++;
+    }
+    catch (const std::exception&)
+    {
+        //Whatever made it to disk is read back next time instead of trusting the in-memory list.
+        config_stamp = FileStamp();
+        config_stamp.modified_time = -1;
+        throw;
+    }
+}
+
+void SaveFolderStore::Compact()
+{
+    //Sorted so the file reads well and doesn't reshuffle every time it's written.
+    std::vector<std::pair<std::string, std::string>> sorted_paths(paths.begin(), paths.end());
+    std::sort(sorted_paths.begin(), sorted_paths.end());
+
+    std::filesystem::path temp_path = config_path;
+    temp_path += ".tmp";
+    {
+        std::ofstream output(temp_path, std::ios::out | std::ios::trunc);
+        for (const auto& entry : sorted_paths)
+        {
+            output << entry.first << " = " << entry.second << "\n";
+        }
+        output.close();
+        if (!output)
+        {
+            std::error_code error;
+            std::filesystem::remove(temp_path, error);
+            throw MakeIoError("Unable to write the save folder configuration", temp_path);
+        }
+    }
+    FlushFileToDisk(temp_path);
+    std::filesystem::rename(temp_path, config_path);
+
+    //Replaying the journal over the new file changes nothing, so a crash before this line loses nothing either.
+    std::filesystem::remove(journal_path);
+
+    config_stamp = StampOf(config_path);
+    journal_offset = 0;
+    journal_records = 0;
+    journal_torn = false;
+}
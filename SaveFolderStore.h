@@ -0,0 +1,75 @@
+#pragma once
+
+//The list of games and their save folders (savefolders.ini), kept on disk as every change is made instead of being rewritten
+// when the program exits.
+//
+// savefolders.ini itself stays the plain "name = path" file it always was.  Changes are appended to savefolders.ini.journal,
+// one line per change with an XXH64 check in front, so adding a game costs one small append and a line cut off by a crash is
+// simply ignored.  Once the journal has CONFIG_JOURNAL_COMPACT_RECORDS lines it is folded back into savefolders.ini, which is
+// written to a temporary file and renamed over the old one.
+//
+// Every read and write holds savefolders.ini.lock, so the watch daemon and the menu can run at the same time.  Each one picks up
+// the other's changes before making its own, only reading the part of the journal it hasn't seen yet.
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+
+#define SAVE_FOLDERS_PATH "./savefolders.ini"
+#define CONFIG_JOURNAL_COMPACT_RECORDS 128
+#define CONFIG_LOCK_TIMEOUT_MS 10000
+
+class SaveFolderStore
+{
+public:
+    explicit SaveFolderStore(const std::filesystem::path& config_path);
+
+    //Reads savefolders.ini and its journal.  Returns false when neither exists yet.  Throws if the lock can't be taken.
+    // Calling it again picks up changes made by other instances, reading only what they appended since.
+    bool Load();
+
+    //Game name -> save folder, as of the last Load(), Set() or Remove().
+    const std::unordered_map<std::string, std::string>& Paths() const { return paths; }
+
+    //Adds or changes a game.  Written to disk before returning, throws std::filesystem::filesystem_error on failure.
+    void Set(const std::string& game_name, const std::string& save_path);
+
+    //Forgets a game.  Written to disk before returning, throws std::filesystem::filesystem_error on failure.
+    void Remove(const std::string& game_name);
+
+private:
+    struct FileStamp
+    {
+        bool exists = false;
+        uintmax_t size = 0;
+        int64_t modified_time = 0;
+
+        bool operator==(const FileStamp& other) const
+        {
+            return exists == other.exists && size == other.size && modified_time == other.modified_time;
+        }
+    };
+
+    static FileStamp StampOf(const std::filesystem::path& path);
+
+    //Catches up with what other instances wrote.  Call with the lock held.
+    void Refresh();
+    void ReadConfig();
+    void ReadJournal();
+
+    void AppendRecord(const std::string& record);
+    void Compact();
+
+    std::filesystem::path config_path;
+    std::filesystem::path journal_path;
+    std::filesystem::path lock_path;
+
+    std::unordered_map<std::string, std::string> paths;
+
+    //What has been read so far, used to tell whether another instance changed the files since.
+    FileStamp config_stamp;
+    uint64_t journal_offset = 0;
+    size_t journal_records = 0;
+    bool journal_torn = false;
+};
@@ -0,0 +1,185 @@
+#include "SaveTreeGenerator.h"
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+//Bytes patched into a huge blob per spot, and spots per blob per save.
+#define HUGE_FILE_PATCH_SIZE (4 * 1024)
+#define HUGE_FILE_PATCHES 3
+
+namespace
+{
+    std::runtime_error MakeWriteError(const std::filesystem::path& path)
+    {
+        return std::runtime_error("Unable to write " + path.u8string());
+    }
+}
+
+SaveTreeGenerator::SaveTreeGenerator(const std::filesystem::path& root, const SaveTreeShape& shape, uint64_t seed)
+    : root(root), shape(shape), random(seed)
+{
+}
+
+std::filesystem::path SaveTreeGenerator::TinyFilePath(int index)
+{
+    //Spread over the folders, each one nested somewhere between 1 and nesting_depth levels deep.
+    const int folder = index % std::max(shape.tiny_file_folders, 1);
+    const int depth = 1 + folder % std::max(shape.nesting_depth, 1);
+
+    std::filesystem::path path = "profile";
+    path /= "group" + std::to_string(folder);
+    for (int level = 1; level < depth; level++)
+    {
+        path /= "level" + std::to_string(level);
+    }
+    return path / ("slot" + std::to_string(index) + ".dat");
+}
+
+void SaveTreeGenerator::WriteFile(const GeneratedFile& file, bool compressible)
+{
+    const std::filesystem::path path = root / file.relative_path;
+    std::filesystem::create_directories(path.parent_path());
+
+    std::ofstream output(path, std::ios::binary | std::ios::trunc);
+    if (!output.is_open())
+    {
+        throw MakeWriteError(path);
+    }
+
+    //Compressible files alternate random blocks with repeated ones, like a save with a lot of structure and padding in it.
+    std::vector<uint64_t> block(64 * 1024 / sizeof(uint64_t));
+    uint64_t remaining = file.size;
+    while (remaining > 0)
+    {
+        for (size_t i = 0; i < block.size(); i++)
+        {
+            block[i] = (compressible && (i / 512) % 2 == 1) ? 0x0000'0001'0000'0000ull * (i % 7) : random();
+        }
+
+        const size_t write_size = static_cast<size_t>(std::min<uint64_t>(remaining, block.size() * sizeof(uint64_t)));
+        output.write(reinterpret_cast<const char*>(block.data()), write_size);
+        remaining -= write_size;
+    }
+
+    output.close();
+    if (!output)
+    {
+        throw MakeWriteError(path);
+    }
+}
+
+void SaveTreeGenerator::Generate()
+{
+    std::filesystem::remove_all(root);
+    std::filesystem::create_directories(root);
+    tiny_files.clear();
+    medium_files.clear();
+    huge_files.clear();
+    next_tiny_file = 0;
+
+    for (; next_tiny_file < shape.tiny_files; next_tiny_file++)
+    {
+        tiny_files.push_back({ TinyFilePath(next_tiny_file), 256 + random() % (16 * 1024 - 256) });
+        WriteFile(tiny_files.back(), true);
+    }
+
+    for (int i = 0; i < shape.medium_files; i++)
+    {
+        medium_files.push_back({ std::filesystem::path("saves") / ("save" + std::to_string(i) + ".sav"), 256 * 1024 + random() % (4 * 1024 * 1024 - 256 * 1024) });
+        WriteFile(medium_files.back(), true);
+    }
+
+    for (int i = 0; i < shape.huge_files; i++)
+    {
+        huge_files.push_back({ "world" + std::to_string(i) + ".bin", shape.huge_file_size });
+        WriteFile(huge_files.back(), false);
+    }
+}
+
+SaveTreeMutation SaveTreeGenerator::Mutate()
+{
+    SaveTreeMutation mutation;
+
+    //About 2% of the tiny files rewritten, with a new size.
+    const size_t tiny_changes = std::max<size_t>(tiny_files.size() / 50, 1);
+    for (size_t i = 0; i < tiny_changes && !tiny_files.empty(); i++)
+    {
+        GeneratedFile& file = tiny_files[random() % tiny_files.size()];
+        file.size = 256 + random() % (16 * 1024 - 256);
+        WriteFile(file, true);
+        mutation.files_changed++;
+        mutation.bytes_changed += file.size;
+    }
+
+    //A few new ones, a few removed.
+    const size_t tiny_churn = std::max<size_t>(tiny_files.size() / 500, 1);
+    for (size_t i = 0; i < tiny_churn; i++)
+    {
+        tiny_files.push_back({ TinyFilePath(next_tiny_file++), 256 + random() % (16 * 1024 - 256) });
+        WriteFile(tiny_files.back(), true);
+        mutation.files_added++;
+        mutation.bytes_changed += tiny_files.back().size;
+    }
+    for (size_t i = 0; i < tiny_churn && tiny_files.size() > 1; i++)
+    {
+        const size_t index = random() % tiny_files.size();
+        std::filesystem::remove(root / tiny_files[index].relative_path);
+        tiny_files.erase(tiny_files.begin() + index);
+        mutation.files_removed++;
+    }
+
+    //The slot that was just saved to.
+    if (!medium_files.empty())
+    {
+        GeneratedFile& file = medium_files[random() % medium_files.size()];
+        WriteFile(file, true);
+        mutation.files_changed++;
+        mutation.bytes_changed += file.size;
+    }
+
+    //Big blobs only get a few pages patched, the case whole file copies handle worst.
+    for (const auto& file : huge_files)
+    {
+        const std::filesystem::path path = root / file.relative_path;
+        std::fstream output(path, std::ios::binary | std::ios::in | std::ios::out);
+        if (!output.is_open())
+        {
+            throw MakeWriteError(path);
+        }
+
+        std::vector<uint64_t> patch(HUGE_FILE_PATCH_SIZE / sizeof(uint64_t));
+        for (int i = 0; i < HUGE_FILE_PATCHES && file.size >= HUGE_FILE_PATCH_SIZE; i++)
+        {
+            for (auto& value : patch)
+            {
+                value = random();
+            }
+            output.seekp(static_cast<std::streamoff>(random() % (file.size - HUGE_FILE_PATCH_SIZE + 1)));
+            output.write(reinterpret_cast<const char*>(patch.data()), HUGE_FILE_PATCH_SIZE);
+            mutation.bytes_changed += HUGE_FILE_PATCH_SIZE;
+        }
+
+        output.close();
+        if (!output)
+        {
+            throw MakeWriteError(path);
+        }
+        mutation.files_changed++;
+    }
+
+    return mutation;
+}
+
+uint64_t SaveTreeGenerator::TotalBytes() const
+{
+    uint64_t total = 0;
+    for (const auto* group : { &tiny_files, &medium_files, &huge_files })
+    {
+        for (const auto& file : *group)
+        {
+            total += file.size;
+        }
+    }
+    return total;
+}
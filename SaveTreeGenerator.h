@@ -0,0 +1,66 @@
+#pragma once
+
+//Generates synthetic save folders for the benchmarks, and changes them between runs the way games do when they save.
+// The same seed always gives the same tree and the same sequence of changes, so runs (and formats) can be compared.
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+
+struct SaveTreeShape
+{
+    int tiny_files = 5000;                          //slot metadata, thumbnails, settings: 256 B to 16 KB each
+    int tiny_file_folders = 50;
+    int nesting_depth = 6;                          //tiny files sit up to this many folders deep
+    int medium_files = 40;                          //regular save slots: 256 KB to 4 MB
+    int huge_files = 2;                             //world or profile blobs rewritten in place on every save
+    uint64_t huge_file_size = 128ull * 1024 * 1024;
+};
+
+//What one Mutate() did, for reporting.
+struct SaveTreeMutation
+{
+    size_t files_changed = 0;
+    size_t files_added = 0;
+    size_t files_removed = 0;
+    uint64_t bytes_changed = 0;
+};
+
+class SaveTreeGenerator
+{
+public:
+    SaveTreeGenerator(const std::filesystem::path& root, const SaveTreeShape& shape, uint64_t seed);
+
+    //Writes the whole tree, deleting anything already in the root folder, so root must be somewhere under a BenchmarkFolder.
+    void Generate();
+
+    //One save's worth of changes: a few tiny files rewritten, added and removed, one medium save rewritten whole and a few KB
+    // patched in place in every huge blob.  Everything else is left alone, time stamps included.
+    SaveTreeMutation Mutate();
+
+    const std::filesystem::path& Root() const { return root; }
+    uint64_t TotalBytes() const;
+    size_t FileCount() const { return tiny_files.size() + medium_files.size() + huge_files.size(); }
+
+private:
+    struct GeneratedFile
+    {
+        std::filesystem::path relative_path;
+        uint64_t size = 0;
+    };
+
+    void WriteFile(const GeneratedFile& file, bool compressible);
+    std::filesystem::path TinyFilePath(int index);
+
+    std::filesystem::path root;
+    SaveTreeShape shape;
+    std::mt19937_64 random;
+
+    std::vector<GeneratedFile> tiny_files;
+    std::vector<GeneratedFile> medium_files;
+    std::vector<GeneratedFile> huge_files;
+    int next_tiny_file = 0;                         //numbers new tiny files, so an added file never reuses a removed one's name
+};
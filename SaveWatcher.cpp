@@ -0,0 +1,219 @@
+#define NOMINMAX
+#include "SaveWatcher.h"
+#include "BackupEngine.h"
+#include "Timestamps.h"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <utility>
+#include <vector>
+#include <Windows.h>
+
+//Big enough that a burst of writes doesn't overflow it, and at the 64KB limit ReadDirectoryChangesW has on network shares.
+#define WATCH_BUFFER_SIZE (64 * 1024)
+
+#define WATCH_NOTIFY_FILTER (FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE)
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    struct WatchedGame
+    {
+        std::string game_name;
+        std::filesystem::path save_path;
+
+        HANDLE directory = INVALID_HANDLE_VALUE;
+        OVERLAPPED overlapped = {};
+        std::vector<DWORD> buffer = std::vector<DWORD>(WATCH_BUFFER_SIZE / sizeof(DWORD));     //DWORD aligned, as ReadDirectoryChangesW requires
+
+        //Changes seen since the last backup of this game.
+        bool pending = false;
+        Clock::time_point first_change;
+        Clock::time_point last_change;
+
+        ~WatchedGame()
+        {
+            if (directory != INVALID_HANDLE_VALUE)
+            {
+                CloseHandle(directory);
+            }
+        }
+    };
+
+    void Log(const std::string& message)
+    {
+        std::cout << "[" << GetCurrentDateTimeAsString() << "] " << message << std::endl;
+    }
+
+    bool IssueRead(WatchedGame& game)
+    {
+        //Which files changed doesn't matter, any change means the game is due a backup, so the buffer contents are never parsed.
+        game.overlapped = {};
+        return ReadDirectoryChangesW(game.directory, game.buffer.data(), static_cast<DWORD>(game.buffer.size() * sizeof(DWORD)), TRUE,
+                                     WATCH_NOTIFY_FILTER, nullptr, &game.overlapped, nullptr) != FALSE;
+    }
+
+    void BackUp(BackupEngine& backup_engine, const std::vector<std::pair<std::string, std::filesystem::path>>& games)
+    {
+        std::vector<GameBackupResult> results = backup_engine.BackupGames(games);
+
+        for (const auto& result : results)
+        {
+            switch (result.status)
+            {
+            case GameBackupStatus::BackedUp:
+                Log("Backed up \"" + result.game_name + "\" (" + std::to_string(result.files_stored) + " files written, " +
+                    std::to_string(result.files_reused) + " reused).");
+                if (!result.capture_settled)
+                {
+                    Log("\"" + result.game_name + "\" kept changing while it was backed up, the backup may mix old and new files.");
+                }
+                break;
+            case GameBackupStatus::Unchanged:
+                break;
+            case GameBackupStatus::Failed:
+                std::cerr << "Backup of \"" << result.game_name << "\" failed: " << result.error << std::endl;
+                break;
+            }
+        }
+
+        const RetentionResult& retention = backup_engine.LastRetention();
+        for (const auto& removal : retention.removed)
+        {
+            Log("Removed \"" + removal.snapshot.game_name + "\" backup " + removal.snapshot.snapshot_name + " (" + removal.reason + ").");
+        }
+        if (!retention.error.empty())
+        {
+            std::cerr << retention.error << std::endl;
+        }
+    }
+}
+
+int RunWatchDaemon(const BackupSettings& settings, const std::unordered_map<std::string, std::string>& save_paths)
+{
+    const auto debounce = std::chrono::milliseconds(std::max(settings.watch_debounce_ms, 0));
+    const auto max_delay = std::chrono::milliseconds(std::max(settings.watch_max_delay_ms, settings.watch_debounce_ms));
+
+    HANDLE completion_port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1);
+    if (completion_port == nullptr)
+    {
+        std::cerr << "Unable to create an I/O completion port." << std::endl;
+        return 1;
+    }
+
+    //unique_ptr so every OVERLAPPED keeps its address while reads are in flight.
+    std::vector<std::unique_ptr<WatchedGame>> watched_games;
+    for (const auto& save_path : save_paths)
+    {
+        auto game = std::make_unique<WatchedGame>();
+        game->game_name = save_path.first;
+        game->save_path = std::filesystem::u8path(save_path.second);
+
+        if (!std::filesystem::is_directory(game->save_path))
+        {
+            std::cerr << "Not watching \"" << game->game_name << "\", its save folder " << game->save_path << " doesn't exist." << std::endl;
+            continue;
+        }
+
+        game->directory = CreateFileW(game->save_path.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+                                      OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+
+        //The completion key is the game's index, that's how a completed read is traced back to its game.
+        if (game->directory == INVALID_HANDLE_VALUE ||
+            CreateIoCompletionPort(game->directory, completion_port, static_cast<ULONG_PTR>(watched_games.size()), 0) == nullptr ||
+            !IssueRead(*game))
+        {
+            std::cerr << "Not watching \"" << game->game_name << "\", unable to watch " << game->save_path << " (error " << GetLastError() << ")." << std::endl;
+            continue;
+        }
+
+        watched_games.push_back(std::move(game));
+    }
+
+    if (watched_games.empty())
+    {
+        std::cerr << "No save folders to watch." << std::endl;
+        CloseHandle(completion_port);
+        return 1;
+    }
+
+    BackupEngine backup_engine(settings);
+
+    //Catch up on anything that changed while nothing was watching.  Unchanged games are skipped by their change index.
+    Log("Watching " + std::to_string(watched_games.size()) + " save folder(s), checking for changes since the last backup...");
+    {
+        std::vector<std::pair<std::string, std::filesystem::path>> games;
+        for (const auto& game : watched_games)
+        {
+            games.emplace_back(game->game_name, game->save_path);
+        }
+        BackUp(backup_engine, games);
+    }
+    Log("Waiting for changes.  Close the window or press Ctrl+C to stop.");
+
+    while (true)
+    {
+        //Sleep until the next read completes or the earliest pending game is due, whichever comes first.
+        Clock::time_point now = Clock::now();
+        DWORD timeout = INFINITE;
+        for (const auto& game : watched_games)
+        {
+            if (game->pending)
+            {
+                const Clock::time_point due = std::min(game->last_change + debounce, game->first_change + max_delay);
+                const auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(due - now).count();
+                timeout = std::min<DWORD>(timeout, static_cast<DWORD>(std::max<long long>(wait, 0)));
+            }
+        }
+
+        DWORD bytes_transferred = 0;
+        ULONG_PTR completion_key = 0;
+        OVERLAPPED* overlapped = nullptr;
+        const BOOL completed = GetQueuedCompletionStatus(completion_port, &bytes_transferred, &completion_key, &overlapped, timeout);
+
+        now = Clock::now();
+        if (overlapped != nullptr && completion_key < watched_games.size())
+        {
+            WatchedGame& game = *watched_games[completion_key];
+
+            //Zero bytes means more changed than fit in the buffer, which still just means "changed".
+            if (!game.pending)
+            {
+                game.pending = true;
+                game.first_change = now;
+            }
+            game.last_change = now;
+
+            if (!completed || !IssueRead(game))
+            {
+                //The folder was deleted or renamed, there's nothing left to back up or watch.
+                std::cerr << "Stopped watching \"" << game.game_name << "\", " << game.save_path << " can't be watched anymore." << std::endl;
+                CloseHandle(game.directory);
+                game.directory = INVALID_HANDLE_VALUE;
+            }
+        }
+
+        std::vector<std::pair<std::string, std::filesystem::path>> due_games;
+        for (const auto& game : watched_games)
+        {
+            if (game->pending && (now >= game->last_change + debounce || now >= game->first_change + max_delay))
+            {
+                game->pending = false;
+                if (game->directory != INVALID_HANDLE_VALUE)
+                {
+                    due_games.emplace_back(game->game_name, game->save_path);
+                }
+            }
+        }
+
+        //Changes that arrive during the backup queue up on the completion port and start the next round.
+        if (!due_games.empty())
+        {
+            BackUp(backup_engine, due_games);
+        }
+    }
+}
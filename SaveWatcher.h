@@ -0,0 +1,17 @@
+#pragma once
+
+//Headless mode, run with "SaveBackupManager.exe watch".  Watches every save folder for changes and backs a game up on its own
+// shortly after it stops writing, instead of waiting for someone to pick "Backup all new saves" in the menu.
+//
+// Each save folder gets a directory handle with an overlapped ReadDirectoryChangesW (whole subtree) on one I/O completion port,
+// so the daemon sleeps until the file system reports a write rather than polling folder trees.  Games tend to rewrite a save
+// several times in a row, so a game is only backed up once it has been quiet for watch_debounce_ms, or at the latest
+// watch_max_delay_ms after its first change for games that never stop writing.
+
+#include "Settings.h"
+
+#include <string>
+#include <unordered_map>
+
+//Runs until the process is closed.  Returns non-zero if there was nothing it could watch.
+int RunWatchDaemon(const BackupSettings& settings, const std::unordered_map<std::string, std::string>& save_paths);
@@ -0,0 +1,279 @@
+#include "Settings.h"
+#include "VolumeThrottle.h"
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#define VOLUME_CONCURRENCY_KEY "volume_concurrency"
+
+namespace
+{
+    void TrimTrailingWhitespace(std::string& text)
+    {
+        while (!text.empty() && std::isspace(static_cast<unsigned char>(text.back())))
+        {
+            text.pop_back();
+        }
+    }
+
+    void WriteDefaultSettings(const std::filesystem::path& settings_path)
+    {
+        std::ofstream output(settings_path, std::ios::out);
+        if (!output.is_open())
+        {
+            return;
+        }
+
+        const BackupSettings defaults;
+        output << "; Save Backup Manager settings.  Lines starting with ';' are ignored." << "\n";
+        output << "; Snapshots kept per game: the newest backup_save_limit, plus the newest one of each of the last keep_hourly hours," << "\n";
+        output << "; keep_daily days and keep_weekly weeks.  Anything older than max_age_days (0 = no limit) goes regardless." << "\n";
+        output << "backup_save_limit = " << defaults.retention.keep_last << "\n";
+        output << "keep_hourly = " << defaults.retention.keep_hourly << "\n";
+        output << "keep_daily = " << defaults.retention.keep_daily << "\n";
+        output << "keep_weekly = " << defaults.retention.keep_weekly << "\n";
+        output << "max_age_days = " << defaults.retention.max_age_days << "\n";
+        output << "; Per game override, e.g.:" << "\n";
+        output << "; keep_daily Elden Ring = 14" << "\n";
+        output << "; Oldest backups of any game are removed once all backups together take more MB than this, 0 = no limit." << "\n";
+        output << "disk_budget_mb = " << defaults.disk_budget_mb << "\n";
+        output << "; chunked = deduplicated store (smallest), linked = plain folders, unchanged files hard linked to the previous backup," << "\n";
+        output << "; archive = one compressed file per backup." << "\n";
+        output << "snapshot_format = " << SnapshotFormatName(defaults.snapshot_format) << "\n";
+        output << "; Linked backups store changed files of at least delta_min_file_mb MB as the difference to the previous backup" << "\n";
+        output << "; (0 = never), and the whole file again after delta_keyframe_interval differences in a row." << "\n";
+        output << "delta_min_file_mb = " << defaults.delta_min_file_mb << "\n";
+        output << "delta_keyframe_interval = " << defaults.delta_keyframe_interval << "\n";
+        output << "; 1 = check a save again after backing it up and back up whatever the game wrote meanwhile again, until nothing" << "\n";
+        output << "; changes or capture_retries runs out.  For backing up games that are running and autosaving." << "\n";
+        output << "consistent_capture = " << (defaults.consistent_capture ? 1 : 0) << "\n";
+        output << "capture_retries = " << defaults.capture_retries << "\n";
+        output << "; Threads used to back up games in parallel, 0 = one per CPU thread." << "\n";
+        output << "worker_threads = " << defaults.worker_threads << "\n";
+        output << "; File copies allowed at once per drive, 0 = detect (SSD gets " << SOLID_STATE_VOLUME_CONCURRENCY
+               << ", spinning disk gets " << ROTATIONAL_VOLUME_CONCURRENCY << ")." << "\n";
+        output << "default_volume_concurrency = " << defaults.default_volume_concurrency << "\n";
+        output << "; Watch mode backs a game up once it stopped writing for this long, but no later than the max delay." << "\n";
+        output << "watch_debounce_ms = " << defaults.watch_debounce_ms << "\n";
+        output << "watch_max_delay_ms = " << defaults.watch_max_delay_ms << "\n";
+        output << "; 1 = print how long each step of a backup or restore took, telemetry_trace = <file> also saves it as a Chrome trace." << "\n";
+        output << "telemetry = " << (defaults.telemetry ? 1 : 0) << "\n";
+        output << "; Per drive override, e.g.:" << "\n";
+        output << "; " << VOLUME_CONCURRENCY_KEY << " D: = 1" << "\n";
+    }
+
+    int ParseInt(const std::string& key, const std::string& value, int fallback)
+    {
+        try
+        {
+            return std::stoi(value);
+        }
+        catch (const std::exception&)
+        {
+            std::cerr << "Invalid value '" << value << "' for setting \"" << key << "\", using " << fallback << "." << std::endl;
+            return fallback;
+        }
+    }
+
+    //The retention rule a settings.ini name stands for, nullptr if it isn't one.
+    int* RetentionField(RetentionPolicy& policy, const std::string& name)
+    {
+        if (name == "backup_save_limit")
+        {
+            return &policy.keep_last;
+        }
+        if (name == "keep_hourly")
+        {
+            return &policy.keep_hourly;
+        }
+        if (name == "keep_daily")
+        {
+            return &policy.keep_daily;
+        }
+        if (name == "keep_weekly")
+        {
+            return &policy.keep_weekly;
+        }
+        if (name == "max_age_days")
+        {
+            return &policy.max_age_days;
+        }
+        return nullptr;
+    }
+
+    void SetRetentionValue(RetentionPolicy& policy, const std::string& name, const std::string& key, const std::string& value)
+    {
+        //Keeping no snapshot at all would delete every backup, at least the newest one always stays.
+        int* field = RetentionField(policy, name);
+        *field = std::max(ParseInt(key, value, *field), (field == &policy.keep_last) ? 1 : 0);
+    }
+}
+
+const RetentionPolicy& BackupSettings::RetentionFor(const std::string& game_name) const
+{
+    auto found = game_retention.find(game_name);
+    return (found == game_retention.end()) ? retention : found->second;
+}
+
+const char* SnapshotFormatName(SnapshotFormat format)
+{
+    switch (format)
+    {
+    case SnapshotFormat::Chunked:
+        return "chunked";
+    case SnapshotFormat::Linked:
+        return "linked";
+    case SnapshotFormat::Archive:
+        return "archive";
+    }
+    return "unknown";
+}
+
+BackupSettings LoadSettings(const std::filesystem::path& settings_path)
+{
+    BackupSettings settings;
+
+    std::ifstream input(settings_path, std::ios::in);
+    if (!input.is_open())
+    {
+        WriteDefaultSettings(settings_path);
+        return settings;
+    }
+
+    //Per game rules start from the global ones, which may come later in the file, so they're applied at the end.
+    struct GameOverride
+    {
+        std::string game_name;
+        std::string name;
+        std::string value;
+    };
+    std::vector<GameOverride> game_overrides;
+
+    std::string line;
+    while (std::getline(input, line))
+    {
+        std::istringstream iss(line);
+        std::string key, value;
+        if (!std::getline(iss >> std::ws, key, '=') || !std::getline(iss >> std::ws, value))
+        {
+            continue;
+        }
+
+        TrimTrailingWhitespace(key);
+        TrimTrailingWhitespace(value);
+
+        if (key.empty() || key[0] == ';' || key[0] == '#')
+        {
+            continue;
+        }
+
+        //"keep_daily Elden Ring" is the keep_daily rule for that game alone.
+        const size_t name_end = key.find(' ');
+        const std::string name = key.substr(0, name_end);
+        std::string game_name = (name_end == std::string::npos) ? std::string() : key.substr(name_end + 1);
+        game_name.erase(0, game_name.find_first_not_of(' '));
+
+        RetentionPolicy unused;
+        if (RetentionField(unused, name) != nullptr)
+        {
+            if (game_name.empty())
+            {
+                SetRetentionValue(settings.retention, name, key, value);
+            }
+            else
+            {
+                game_overrides.push_back({ game_name, name, value });
+            }
+            continue;
+        }
+
+        if (key == "disk_budget_mb")
+        {
+            settings.disk_budget_mb = static_cast<uint64_t>(std::max(ParseInt(key, value, 0), 0));
+        }
+        else if (key == "delta_min_file_mb")
+        {
+            settings.delta_min_file_mb = static_cast<uint64_t>(std::max(ParseInt(key, value, static_cast<int>(settings.delta_min_file_mb)), 0));
+        }
+        else if (key == "delta_keyframe_interval")
+        {
+            settings.delta_keyframe_interval = std::max(ParseInt(key, value, settings.delta_keyframe_interval), 1);
+        }
+        else if (key == "snapshot_format")
+        {
+            if (value == SnapshotFormatName(SnapshotFormat::Chunked))
+            {
+                settings.snapshot_format = SnapshotFormat::Chunked;
+            }
+            else if (value == SnapshotFormatName(SnapshotFormat::Linked))
+            {
+                settings.snapshot_format = SnapshotFormat::Linked;
+            }
+            else if (value == SnapshotFormatName(SnapshotFormat::Archive))
+            {
+                settings.snapshot_format = SnapshotFormat::Archive;
+            }
+            else
+            {
+                std::cerr << "Unknown snapshot_format '" << value << "', using chunked." << std::endl;
+            }
+        }
+        else if (key == "consistent_capture")
+        {
+            settings.consistent_capture = ParseInt(key, value, settings.consistent_capture ? 1 : 0) != 0;
+        }
+        else if (key == "capture_retries")
+        {
+            settings.capture_retries = std::max(ParseInt(key, value, settings.capture_retries), 0);
+        }
+        else if (key == "worker_threads")
+        {
+            settings.worker_threads = ParseInt(key, value, settings.worker_threads);
+        }
+        else if (key == "default_volume_concurrency")
+        {
+            settings.default_volume_concurrency = ParseInt(key, value, settings.default_volume_concurrency);
+        }
+        else if (key == "watch_debounce_ms")
+        {
+            settings.watch_debounce_ms = ParseInt(key, value, settings.watch_debounce_ms);
+        }
+        else if (key == "watch_max_delay_ms")
+        {
+            settings.watch_max_delay_ms = ParseInt(key, value, settings.watch_max_delay_ms);
+        }
+        else if (key == "telemetry")
+        {
+            settings.telemetry = ParseInt(key, value, settings.telemetry ? 1 : 0) != 0;
+        }
+        else if (key == "telemetry_trace")
+        {
+            settings.telemetry_trace_path = value;
+        }
+        else if (key.compare(0, sizeof(VOLUME_CONCURRENCY_KEY) - 1, VOLUME_CONCURRENCY_KEY) == 0)
+        {
+            std::istringstream volume_stream(key.substr(sizeof(VOLUME_CONCURRENCY_KEY) - 1));
+            std::string volume;
+            if (volume_stream >> volume)
+            {
+                settings.volume_concurrency[volume] = ParseInt(key, value, 0);
+            }
+        }
+        else
+        {
+            std::cerr << "Unknown setting \"" << key << "\" in " << settings_path.filename().string() << "." << std::endl;
+        }
+    }
+
+    for (const auto& game_override : game_overrides)
+    {
+        auto inserted = settings.game_retention.emplace(game_override.game_name, settings.retention);
+        SetRetentionValue(inserted.first->second, game_override.name, game_override.name + " " + game_override.game_name, game_override.value);
+    }
+
+    return settings;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+//Program settings loaded from settings.ini, in the same "key = value" format as savefolders.ini.
+// Unlike savefolders.ini this file is only ever written by the user (or created once with the defaults), never rewritten on exit.
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+
+#define SETTINGS_FILE_PATH "./settings.ini"
+#define DEFAULT_BACKUP_SAVE_LIMIT 5
+
+//How a snapshot's data is kept on disk.
+enum class SnapshotFormat
+{
+    Chunked,    //deduplicated chunks in ./Backups/.store, the snapshot folder only holds a manifest
+    Linked,     //plain folder tree, files unchanged since the previous snapshot are hard links to it
+    Archive     //one compressed snapshot.archive file per snapshot
+};
+
+//Which snapshots of a game survive rotation, grandfather-father-son style.  A snapshot is kept when any of the rules keeps it.
+struct RetentionPolicy
+{
+    int keep_last = DEFAULT_BACKUP_SAVE_LIMIT;  //newest snapshots whatever their age ("backup_save_limit")
+    int keep_hourly = 0;                        //newest snapshot of each of the last N hours that have one
+    int keep_daily = 0;                         //same per day
+    int keep_weekly = 0;                        //same per week (Monday to Sunday)
+    int max_age_days = 0;                       //older snapshots go even when a rule above keeps them, 0 = no limit
+};
+
+struct BackupSettings
+{
+    SnapshotFormat snapshot_format = SnapshotFormat::Chunked;
+
+    //Linked snapshots: changed files of at least this many MB are stored as a delta against the previous backup, 0 = never.
+    // After delta_keyframe_interval deltas in a row the file is stored whole again.
+    uint64_t delta_min_file_mb = 16;
+    int delta_keyframe_interval = 16;
+
+    //Retention for every game, and per game overrides from "keep_daily <game> = 14" style lines.
+    RetentionPolicy retention;
+    std::unordered_map<std::string, RetentionPolicy> game_retention;
+
+    //Oldest snapshots of any game are removed once all of them together take more than this, 0 = no limit.
+    // A game's newest snapshot is never removed for it.
+    uint64_t disk_budget_mb = 0;
+
+    //Consistent capture: once a snapshot's files are stored the save folder is listed again, and files that changed while
+    // they were read (a game autosaving mid-backup) are stored again, up to capture_retries times, so the snapshot doesn't
+    // mix old and new files of one save.
+    bool consistent_capture = false;
+    int capture_retries = 3;
+
+    //Threads backing up games and files in parallel, 0 means one per hardware thread.
+    int worker_threads = 0;
+
+    //Simultaneous file copies allowed per drive.  0 asks the drive whether it's an SSD or a spinning disk.
+    int default_volume_concurrency = 0;
+
+    //Watch mode: back a game up once its save folder has been quiet this long, or this long after the first change at the latest.
+    int watch_debounce_ms = 2000;
+    int watch_max_delay_ms = 30000;
+
+    //Print where backups and restores spent their time (see Telemetry.h), and write it as a Chrome trace too if a path is given.
+    bool telemetry = false;
+    std::string telemetry_trace_path;
+
+    //Per drive overrides, keyed by volume ("D:") from "volume_concurrency D: = 1" lines.
+    std::unordered_map<std::string, int> volume_concurrency;
+
+    const RetentionPolicy& RetentionFor(const std::string& game_name) const;
+};
+
+//Name used for the format in settings.ini ("chunked", "linked", "archive").
+const char* SnapshotFormatName(SnapshotFormat format);
+
+//Loads settings, leaving defaults in place for anything missing.  Creates the file with the defaults if it doesn't exist yet.
+BackupSettings LoadSettings(const std::filesystem::path& settings_path);
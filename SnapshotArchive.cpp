@@ -0,0 +1,376 @@
+#include "SnapshotArchive.h"
+#include "FileStream.h"
+#include "Hashing.h"
+#include "LzCodec.h"
+
+#include <cstring>
+#include <system_error>
+
+#define ARCHIVE_HEADER_MAGIC "SBMARC01"
+#define ARCHIVE_FOOTER_MAGIC "SBMAREND"
+#define ARCHIVE_MAGIC_LENGTH 8
+#define ARCHIVE_FOOTER_LENGTH (3 * 8 + ARCHIVE_MAGIC_LENGTH)
+
+//Set on a block's stored length when compressing didn't make it smaller and the bytes are kept as is.
+#define ARCHIVE_BLOCK_UNCOMPRESSED 0x80000000u
+
+namespace
+{
+    std::filesystem::filesystem_error MakeIoError(const std::string& what, const std::filesystem::path& path)
+    {
+        return std::filesystem::filesystem_error(what, path, std::make_error_code(std::errc::io_error));
+    }
+
+    //All integers are little endian, written byte by byte so the layout doesn't depend on the compiler.
+    void AppendInteger(std::vector<uint8_t>& buffer, uint64_t value, int byte_count)
+    {
+        for (int i = 0; i < byte_count; i++)
+        {
+            buffer.push_back(static_cast<uint8_t>(value >> (8 * i)));
+        }
+    }
+
+    uint64_t ReadInteger(const uint8_t* bytes, int byte_count)
+    {
+        uint64_t value = 0;
+        for (int i = 0; i < byte_count; i++)
+        {
+            value |= static_cast<uint64_t>(bytes[i]) << (8 * i);
+        }
+        return value;
+    }
+
+    //Bounds checked reader over the index bytes.
+    class IndexParser
+    {
+    public:
+        IndexParser(const std::vector<uint8_t>& buffer) : buffer(buffer) {}
+
+        bool Integer(uint64_t& value, int byte_count)
+        {
+            if (buffer.size() - position < static_cast<size_t>(byte_count))
+            {
+                return false;
+            }
+            value = ReadInteger(buffer.data() + position, byte_count);
+            position += byte_count;
+            return true;
+        }
+
+        bool String(std::string& value, size_t length)
+        {
+            if (buffer.size() - position < length)
+            {
+                return false;
+            }
+            value.assign(reinterpret_cast<const char*>(buffer.data() + position), length);
+            position += length;
+            return true;
+        }
+
+    private:
+        const std::vector<uint8_t>& buffer;
+        size_t position = 0;
+    };
+}
+
+ArchiveWriter::ArchiveWriter(const std::filesystem::path& archive_path)
+    : archive_path(archive_path),
+      compressed_buffer(LzCompressBound(ARCHIVE_BLOCK_SIZE))
+{
+    temp_path = archive_path;
+    temp_path += ".tmp";
+
+    output.open(temp_path, std::ios::binary | std::ios::trunc);
+    if (!output.is_open())
+    {
+        throw MakeIoError("Unable to create archive", temp_path);
+    }
+
+    Write(ARCHIVE_HEADER_MAGIC, ARCHIVE_MAGIC_LENGTH);
+}
+
+ArchiveWriter::~ArchiveWriter()
+{
+    //Abandoned part way through, don't leave half an archive lying around.
+    if (!finished)
+    {
+        output.close();
+        std::error_code error;
+        std::filesystem::remove(temp_path, error);
+    }
+}
+
+void ArchiveWriter::Write(const void* data, size_t length)
+{
+    output.write(static_cast<const char*>(data), length);
+    if (!output)
+    {
+        throw MakeIoError("Unable to write archive", temp_path);
+    }
+    offset += length;
+}
+
+void ArchiveWriter::AddDirectory(const std::string& relative_path)
+{
+    ArchiveEntry entry;
+    entry.is_directory = true;
+    entry.relative_path = relative_path;
+    entries.push_back(entry);
+}
+
+void ArchiveWriter::AddFile(const std::string& relative_path, const std::filesystem::path& source, uint64_t& file_size, uint64_t& content_hash)
+{
+    FileReadStream input(source, ARCHIVE_BLOCK_SIZE);
+
+    ArchiveEntry entry;
+    entry.relative_path = relative_path;
+    entry.data_offset = offset;
+
+    Xxh64 content_hasher;
+    std::vector<uint8_t> block_header;
+
+    //The next blocks are already being read while this one is compressed.
+    const uint8_t* read_data = nullptr;
+    size_t bytes_read = 0;
+    while (input.Next(read_data, bytes_read))
+    {
+        content_hasher.Update(read_data, bytes_read);
+        entry.size += bytes_read;
+
+        //Save data that's already compressed (or encrypted) won't shrink, store those blocks raw so extraction just copies them.
+        const size_t compressed_length = LzCompress(read_data, bytes_read, compressed_buffer.data());
+        const bool keep_compressed = compressed_length < bytes_read;
+
+        block_header.clear();
+        AppendInteger(block_header, bytes_read, 4);
+        AppendInteger(block_header, keep_compressed ? compressed_length : (bytes_read | ARCHIVE_BLOCK_UNCOMPRESSED), 4);
+        Write(block_header.data(), block_header.size());
+
+        if (keep_compressed)
+        {
+            Write(compressed_buffer.data(), compressed_length);
+        }
+        else
+        {
+            Write(read_data, bytes_read);
+        }
+        entry.block_count++;
+    }
+
+    entry.content_hash = content_hasher.Final();
+    file_size = entry.size;
+    content_hash = entry.content_hash;
+    entries.push_back(entry);
+}
+
+void ArchiveWriter::Finish()
+{
+    //Index, one record per entry:
+    // u8 is_directory, u32 path length, path, u64 size, u64 content hash, u64 data offset, u32 block count
+    std::vector<uint8_t> index;
+    AppendInteger(index, entries.size(), 4);
+    for (const auto& entry : entries)
+    {
+        AppendInteger(index, entry.is_directory ? 1 : 0, 1);
+        AppendInteger(index, entry.relative_path.size(), 4);
+        index.insert(index.end(), entry.relative_path.begin(), entry.relative_path.end());
+        AppendInteger(index, entry.size, 8);
+        AppendInteger(index, entry.content_hash, 8);
+        AppendInteger(index, entry.data_offset, 8);
+        AppendInteger(index, entry.block_count, 4);
+    }
+
+    //Footer: u64 index offset, u64 index length, u64 XXH64 of the index, end magic
+    std::vector<uint8_t> footer;
+    AppendInteger(footer, offset, 8);
+    AppendInteger(footer, index.size(), 8);
+    AppendInteger(footer, Xxh64::Hash(index.data(), index.size()), 8);
+    footer.insert(footer.end(), ARCHIVE_FOOTER_MAGIC, ARCHIVE_FOOTER_MAGIC + ARCHIVE_MAGIC_LENGTH);
+
+    Write(index.data(), index.size());
+    Write(footer.data(), footer.size());
+
+    output.close();
+    if (!output)
+    {
+        throw MakeIoError("Unable to write archive", temp_path);
+    }
+
+    std::filesystem::rename(temp_path, archive_path);
+    finished = true;
+}
+
+ArchiveReader::ArchiveReader(const std::filesystem::path& archive_path)
+    : archive_path(archive_path),
+      input(archive_path, std::ios::binary)
+{
+    if (!input.is_open())
+    {
+        throw MakeIoError("Unable to open archive", archive_path);
+    }
+
+    //Find the index through the footer at the very end.
+    input.seekg(0, std::ios::end);
+    const uint64_t archive_size = static_cast<uint64_t>(input.tellg());
+    if (archive_size < ARCHIVE_MAGIC_LENGTH + ARCHIVE_FOOTER_LENGTH)
+    {
+        throw MakeIoError("Not a snapshot archive", archive_path);
+    }
+
+    uint8_t footer[ARCHIVE_FOOTER_LENGTH];
+    input.seekg(archive_size - ARCHIVE_FOOTER_LENGTH);
+    input.read(reinterpret_cast<char*>(footer), sizeof(footer));
+    if (!input || std::memcmp(footer + 24, ARCHIVE_FOOTER_MAGIC, ARCHIVE_MAGIC_LENGTH) != 0)
+    {
+        throw MakeIoError("Not a snapshot archive", archive_path);
+    }
+
+    const uint64_t index_offset = ReadInteger(footer, 8);
+    const uint64_t index_length = ReadInteger(footer + 8, 8);
+    const uint64_t index_hash = ReadInteger(footer + 16, 8);
+    if (index_offset < ARCHIVE_MAGIC_LENGTH || index_offset > archive_size - ARCHIVE_FOOTER_LENGTH ||
+        index_length != archive_size - ARCHIVE_FOOTER_LENGTH - index_offset)
+    {
+        throw MakeIoError("Snapshot archive index is damaged", archive_path);
+    }
+
+    std::vector<uint8_t> index(static_cast<size_t>(index_length));
+    input.seekg(index_offset);
+    input.read(reinterpret_cast<char*>(index.data()), index.size());
+    if (!input || Xxh64::Hash(index.data(), index.size()) != index_hash)
+    {
+        throw MakeIoError("Snapshot archive index is damaged", archive_path);
+    }
+
+    IndexParser parser(index);
+    uint64_t entry_count = 0;
+    if (!parser.Integer(entry_count, 4))
+    {
+        throw MakeIoError("Snapshot archive index is damaged", archive_path);
+    }
+
+    entries.resize(static_cast<size_t>(entry_count));
+    for (auto& entry : entries)
+    {
+        uint64_t is_directory = 0;
+        uint64_t path_length = 0;
+        uint64_t block_count = 0;
+        if (!parser.Integer(is_directory, 1) || !parser.Integer(path_length, 4) || !parser.String(entry.relative_path, static_cast<size_t>(path_length)) ||
+            !parser.Integer(entry.size, 8) || !parser.Integer(entry.content_hash, 8) || !parser.Integer(entry.data_offset, 8) || !parser.Integer(block_count, 4))
+        {
+            throw MakeIoError("Snapshot archive index is damaged", archive_path);
+        }
+
+        entry.is_directory = (is_directory != 0);
+        entry.block_count = static_cast<uint32_t>(block_count);
+    }
+
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        entry_lookup[entries[i].relative_path] = i;
+    }
+}
+
+const ArchiveEntry* ArchiveReader::Find(const std::string& relative_path) const
+{
+    auto found = entry_lookup.find(relative_path);
+    return (found == entry_lookup.end()) ? nullptr : &entries[found->second];
+}
+
+void ArchiveReader::ExtractFile(const ArchiveEntry& entry, const std::filesystem::path& destination)
+{
+    SparseFileWriter output(destination);
+    const bool matches = DecodeFile(entry, &output);
+    output.Finish();
+
+    if (!matches)
+    {
+        throw MakeIoError("Restored file doesn't match the backup", destination);
+    }
+}
+
+bool ArchiveReader::VerifyFile(const ArchiveEntry& entry)
+{
+    return DecodeFile(entry, nullptr);
+}
+
+bool ArchiveReader::DecodeFile(const ArchiveEntry& entry, SparseFileWriter* output)
+{
+    input.clear();
+    input.seekg(entry.data_offset);
+
+    std::vector<uint8_t> stored_buffer;
+    std::vector<uint8_t> block_buffer;
+    Xxh64 content_hasher;
+    uint64_t bytes_extracted = 0;
+
+    for (uint32_t block = 0; block < entry.block_count; block++)
+    {
+        uint8_t block_header[8];
+        input.read(reinterpret_cast<char*>(block_header), sizeof(block_header));
+        if (!input)
+        {
+            throw MakeIoError("Snapshot archive is truncated", archive_path);
+        }
+
+        const uint32_t block_length = static_cast<uint32_t>(ReadInteger(block_header, 4));
+        const uint32_t stored_field = static_cast<uint32_t>(ReadInteger(block_header + 4, 4));
+        const bool is_compressed = (stored_field & ARCHIVE_BLOCK_UNCOMPRESSED) == 0;
+        const uint32_t stored_length = stored_field & ~ARCHIVE_BLOCK_UNCOMPRESSED;
+
+        if (block_length > ARCHIVE_BLOCK_SIZE || stored_length > LzCompressBound(ARCHIVE_BLOCK_SIZE))
+        {
+            throw MakeIoError("Snapshot archive block is damaged", archive_path);
+        }
+
+        stored_buffer.resize(stored_length);
+        input.read(reinterpret_cast<char*>(stored_buffer.data()), stored_length);
+        if (!input)
+        {
+            throw MakeIoError("Snapshot archive is truncated", archive_path);
+        }
+
+        const uint8_t* block_data = stored_buffer.data();
+        if (is_compressed)
+        {
+            block_buffer.resize(block_length);
+            if (!LzDecompress(stored_buffer.data(), stored_length, block_buffer.data(), block_length))
+            {
+                throw MakeIoError("Snapshot archive block is damaged", archive_path);
+            }
+            block_data = block_buffer.data();
+        }
+        else if (stored_length != block_length)
+        {
+            throw MakeIoError("Snapshot archive block is damaged", archive_path);
+        }
+
+        content_hasher.Update(block_data, block_length);
+        if (output != nullptr)
+        {
+            output->Write(block_data, block_length);
+        }
+        bytes_extracted += block_length;
+    }
+
+    return bytes_extracted == entry.size && content_hasher.Final() == entry.content_hash;
+}
+
+void RestoreArchive(ArchiveReader& reader, const std::filesystem::path& destination_root)
+{
+    for (const auto& entry : reader.Entries())
+    {
+        const std::filesystem::path destination_path = destination_root / std::filesystem::u8path(entry.relative_path);
+
+        if (entry.is_directory)
+        {
+            std::filesystem::create_directories(destination_path);
+        }
+        else
+        {
+            std::filesystem::create_directories(destination_path.parent_path());
+            reader.ExtractFile(entry, destination_path);
+        }
+    }
+}
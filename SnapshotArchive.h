@@ -0,0 +1,94 @@
+#pragma once
+
+//Single file snapshot format.  Instead of a folder tree (hundreds of tiny files for games with many save slots) the whole
+// snapshot is one archive written front to back in a single pass:
+//
+//   header | file data blocks ... | index | footer
+//
+// Every file is cut into blocks of up to ARCHIVE_BLOCK_SIZE that are compressed on their own with LzCodec.  The index at the
+// end lists every entry with the offset of its first block, and the fixed size footer points at the index, so a reader can
+// seek straight to one file and only decompress that file's blocks.
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class SparseFileWriter;
+
+#define SNAPSHOT_ARCHIVE_NAME "snapshot.archive"
+#define ARCHIVE_BLOCK_SIZE (256 * 1024)
+
+struct ArchiveEntry
+{
+    bool is_directory = false;
+    std::string relative_path;      //UTF-8 generic path, same layout as a manifest entry
+    uint64_t size = 0;
+    uint64_t content_hash = 0;      //XXH64 of the uncompressed file, checked on extraction
+    uint64_t data_offset = 0;       //archive offset of the first block
+    uint32_t block_count = 0;
+};
+
+class ArchiveWriter
+{
+public:
+    //Starts writing under a temporary name, nothing exists under archive_path until Finish().  Throws on I/O errors.
+    explicit ArchiveWriter(const std::filesystem::path& archive_path);
+    ~ArchiveWriter();
+
+    void AddDirectory(const std::string& relative_path);
+
+    //Reads, hashes and compresses a file onto the end of the archive.  Throws on I/O errors.
+    void AddFile(const std::string& relative_path, const std::filesystem::path& source, uint64_t& file_size, uint64_t& content_hash);
+
+    //Writes the index and footer and moves the archive into place.  Throws on I/O errors.
+    void Finish();
+
+    uint64_t BytesWritten() const { return offset; }
+
+private:
+    void Write(const void* data, size_t length);
+
+    std::filesystem::path archive_path;
+    std::filesystem::path temp_path;
+    std::ofstream output;
+    uint64_t offset = 0;
+    bool finished = false;
+
+    std::vector<ArchiveEntry> entries;
+    std::vector<uint8_t> compressed_buffer;
+};
+
+class ArchiveReader
+{
+public:
+    //Reads the footer and index.  Throws if the file isn't an archive or the index is damaged.
+    explicit ArchiveReader(const std::filesystem::path& archive_path);
+
+    const std::vector<ArchiveEntry>& Entries() const { return entries; }
+
+    //nullptr when the path isn't in the archive.
+    const ArchiveEntry* Find(const std::string& relative_path) const;
+
+    //Decompresses one file to destination, overwriting it.  Throws on I/O errors or if the data doesn't match its hash.
+    void ExtractFile(const ArchiveEntry& entry, const std::filesystem::path& destination);
+
+    //Decompresses one file without writing it anywhere.  False if it doesn't match its size and hash, throws if the blocks
+    // themselves are damaged or cut short.
+    bool VerifyFile(const ArchiveEntry& entry);
+
+private:
+    //Decodes one file's blocks, writing them to output unless it's null.  Returns whether they match the entry's size and hash.
+    bool DecodeFile(const ArchiveEntry& entry, SparseFileWriter* output);
+
+    std::filesystem::path archive_path;
+    std::ifstream input;
+
+    std::vector<ArchiveEntry> entries;
+    std::unordered_map<std::string, size_t> entry_lookup;
+};
+
+//Recreates every directory and file of an archived snapshot underneath destination_root.
+void RestoreArchive(ArchiveReader& reader, const std::filesystem::path& destination_root);
@@ -0,0 +1,744 @@
+#define NOMINMAX
+#include "SnapshotCatalog.h"
+#include "ChunkStore.h"
+#include "FileLock.h"
+#include "SnapshotArchive.h"
+#include "SnapshotVerify.h"
+#include "Timestamps.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <system_error>
+#include <unordered_set>
+#include <Windows.h>
+
+#define CATALOG_RECORDS_NAME "records.bin"
+#define CATALOG_STRINGS_NAME "strings.bin"
+#define CATALOG_LOCK_NAME "lock"
+#define CATALOG_LOCK_TIMEOUT_MS 10000
+#define CATALOG_RECORDS_MAGIC "SBMCAT01"
+#define CATALOG_STRINGS_MAGIC "SBMSTR01"
+#define CATALOG_MAGIC_LENGTH 8
+#define CATALOG_HEADER_LENGTH 32
+#define CATALOG_RECORD_LENGTH 64
+
+#define CATALOG_RECORD_SNAPSHOT 0
+#define CATALOG_RECORD_REMOVAL 1
+#define CATALOG_RECORD_STORED_SIZE 2
+
+namespace
+{
+    //Read only view of a whole file, empty if the file doesn't exist (or is empty, which can't be mapped).
+    class MappedFile
+    {
+    public:
+        explicit MappedFile(const std::filesystem::path& path)
+        {
+            file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+                               OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (file == INVALID_HANDLE_VALUE)
+            {
+                return;
+            }
+
+            LARGE_INTEGER file_size;
+            if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+            {
+                return;
+            }
+
+            mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping == nullptr)
+            {
+                return;
+            }
+
+            view = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+            if (view != nullptr)
+            {
+                size = static_cast<uint64_t>(file_size.QuadPart);
+            }
+        }
+
+        ~MappedFile()
+        {
+            if (view != nullptr)
+            {
+                UnmapViewOfFile(view);
+            }
+            if (mapping != nullptr)
+            {
+                CloseHandle(mapping);
+            }
+            if (file != INVALID_HANDLE_VALUE)
+            {
+                CloseHandle(file);
+            }
+        }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        const uint8_t* Data() const { return view; }
+        uint64_t Size() const { return size; }
+
+    private:
+        HANDLE file = INVALID_HANDLE_VALUE;
+        HANDLE mapping = nullptr;
+        const uint8_t* view = nullptr;
+        uint64_t size = 0;
+    };
+
+    //Little endian, byte by byte like the snapshot archive.
+    void StoreInteger(uint8_t* bytes, uint64_t value, int byte_count)
+    {
+        for (int i = 0; i < byte_count; i++)
+        {
+            bytes[i] = static_cast<uint8_t>(value >> (8 * i));
+        }
+    }
+
+    uint64_t LoadInteger(const uint8_t* bytes, int byte_count)
+    {
+        uint64_t value = 0;
+        for (int i = 0; i < byte_count; i++)
+        {
+            value |= static_cast<uint64_t>(bytes[i]) << (8 * i);
+        }
+        return value;
+    }
+
+    //Header: magic, u32 record length (0 for the strings file), u32 reserved, u64 generation, 8 reserved bytes.
+    void BuildHeader(uint8_t* header, const char* magic, uint32_t record_length, uint64_t generation)
+    {
+        std::memset(header, 0, CATALOG_HEADER_LENGTH);
+        std::memcpy(header, magic, CATALOG_MAGIC_LENGTH);
+        StoreInteger(header + 8, record_length, 4);
+        StoreInteger(header + 16, generation, 8);
+    }
+
+    bool CheckHeader(const MappedFile& file, const char* magic, uint32_t record_length, uint64_t& generation)
+    {
+        if (file.Size() < CATALOG_HEADER_LENGTH || std::memcmp(file.Data(), magic, CATALOG_MAGIC_LENGTH) != 0 ||
+            LoadInteger(file.Data() + 8, 4) != record_length)
+        {
+            return false;
+        }
+        generation = LoadInteger(file.Data() + 16, 8);
+        return true;
+    }
+
+    //Record: i64 created time, u64 total size, u64 stored size, u64 fingerprint, u32 game name offset,
+    // u32 snapshot name offset, u32 file count, u16 game name length, u16 snapshot name length, u8 format, u8 kind, 14 reserved.
+    void BuildRecord(uint8_t* record, const CatalogSnapshot& snapshot, uint32_t game_name_offset, uint32_t snapshot_name_offset, int kind)
+    {
+        std::memset(record, 0, CATALOG_RECORD_LENGTH);
+        StoreInteger(record, static_cast<uint64_t>(snapshot.created_time), 8);
+        StoreInteger(record + 8, snapshot.total_size, 8);
+        StoreInteger(record + 16, snapshot.stored_size, 8);
+        StoreInteger(record + 24, snapshot.fingerprint, 8);
+        StoreInteger(record + 32, game_name_offset, 4);
+        StoreInteger(record + 36, snapshot_name_offset, 4);
+        StoreInteger(record + 40, snapshot.file_count, 4);
+        StoreInteger(record + 44, snapshot.game_name.size(), 2);
+        StoreInteger(record + 46, snapshot.snapshot_name.size(), 2);
+        record[48] = static_cast<uint8_t>(snapshot.format);
+        record[49] = static_cast<uint8_t>(kind);
+    }
+
+    //Volume serial number and file index, the same for every hard link to a file.  False if the file can't be opened.
+    bool GetFileIdentity(const std::filesystem::path& path, std::pair<uint64_t, uint64_t>& identity)
+    {
+        HANDLE file = CreateFileW(path.c_str(), FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+                                  OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            return false;
+        }
+
+        BY_HANDLE_FILE_INFORMATION info = {};
+        const bool found = GetFileInformationByHandle(file, &info) != 0;
+        CloseHandle(file);
+
+        identity.first = info.dwVolumeSerialNumber;
+        identity.second = (static_cast<uint64_t>(info.nFileIndexHigh) << 32) | info.nFileIndexLow;
+        return found;
+    }
+
+    struct FileIdentityHash
+    {
+        size_t operator()(const std::pair<uint64_t, uint64_t>& identity) const
+        {
+            return std::hash<uint64_t>()(identity.first * 0x9e3779b97f4a7c15ull ^ identity.second);
+        }
+    };
+
+    typedef std::unordered_set<std::pair<uint64_t, uint64_t>, FileIdentityHash> FileIdentitySet;
+
+    //A linked snapshot's stored size is what it holds that the game's earlier snapshots don't link to, seen_files has every
+    // file of those and gets this one's added.
+    void SummarizeFolder(const std::filesystem::path& folder, CatalogSnapshot& snapshot, FileIdentitySet& seen_files)
+    {
+        for (const auto& entry : std::filesystem::recursive_directory_iterator(folder))
+        {
+            if (!entry.is_regular_file())
+            {
+                continue;
+            }
+
+            const uint64_t file_size = entry.file_size();
+            snapshot.total_size += file_size;
+            snapshot.file_count++;
+
+            //The hash list isn't counted by the backup that writes it either.
+            std::pair<uint64_t, uint64_t> identity;
+            if (entry.path().filename() != SNAPSHOT_HASHES_NAME && (!GetFileIdentity(entry.path(), identity) || seen_files.insert(identity).second))
+            {
+                snapshot.stored_size += file_size;
+            }
+        }
+
+        //Files stored as deltas take less room than the save they hold, the hash list has the real sizes.
+        std::vector<FileHash> hashes;
+        if (ReadSnapshotHashes(folder / SNAPSHOT_HASHES_NAME, hashes))
+        {
+            snapshot.total_size = 0;
+            snapshot.file_count = 0;
+            for (const auto& file : hashes)
+            {
+                snapshot.total_size += file.size;
+                snapshot.file_count++;
+            }
+        }
+    }
+}
+
+SnapshotCatalog::SnapshotCatalog(const std::filesystem::path& catalog_root, const std::filesystem::path& backups_root)
+    : lock_path(catalog_root / CATALOG_LOCK_NAME),
+      records_path(catalog_root / CATALOG_RECORDS_NAME),
+      strings_path(catalog_root / CATALOG_STRINGS_NAME),
+      backups_root(backups_root)
+{
+    std::filesystem::create_directories(catalog_root);
+
+    FileLock file_lock(lock_path, "Unable to lock the snapshot catalog", CATALOG_LOCK_TIMEOUT_MS);
+    Reload();
+}
+
+bool SnapshotCatalog::Load()
+{
+    games.clear();
+    string_offsets.clear();
+    removal_count = 0;
+    snapshot_count = 0;
+
+    bool torn_record = false;
+    {
+        MappedFile records(records_path);
+        MappedFile strings(strings_path);
+
+        uint64_t records_generation = 0;
+        uint64_t strings_generation = 0;
+        if (!CheckHeader(records, CATALOG_RECORDS_MAGIC, CATALOG_RECORD_LENGTH, records_generation) ||
+            !CheckHeader(strings, CATALOG_STRINGS_MAGIC, 0, strings_generation) || records_generation != strings_generation)
+        {
+            return false;
+        }
+
+        generation = records_generation;
+        strings_length = strings.Size();
+
+        const uint64_t record_bytes = records.Size() - CATALOG_HEADER_LENGTH;
+        torn_record = (record_bytes % CATALOG_RECORD_LENGTH) != 0;
+        records_length = records.Size() - record_bytes % CATALOG_RECORD_LENGTH;
+
+        if (!ReadRecords(records.Data(), CATALOG_HEADER_LENGTH, records_length, strings.Data()))
+        {
+            return false;
+        }
+    }
+
+    //Half a record means appends would land misaligned from now on, and removals that outnumber what's left are wasted reads.
+    if (torn_record || 2 * removal_count > snapshot_count)
+    {
+        WriteFiles();
+    }
+
+    return true;
+}
+
+//Expects the lock file to be held.  Returns false when the files had to be rebuilt from the folders, which then already
+// include every change made to them.
+bool SnapshotCatalog::Reload()
+{
+    if (Load())
+    {
+        return true;
+    }
+
+    ScanBackups();
+    WriteFiles();
+    return false;
+}
+
+//Reload() for when the catalog is already loaded.  Unless another instance compacted the files (or they were damaged or
+// deleted) since, only the records appended after the ones already read are applied.
+bool SnapshotCatalog::Refresh()
+{
+    bool compact = false;
+    {
+        MappedFile records(records_path);
+        MappedFile strings(strings_path);
+
+        uint64_t records_generation = 0;
+        uint64_t strings_generation = 0;
+        if (!CheckHeader(records, CATALOG_RECORDS_MAGIC, CATALOG_RECORD_LENGTH, records_generation) ||
+            !CheckHeader(strings, CATALOG_STRINGS_MAGIC, 0, strings_generation) ||
+            records_generation != generation || strings_generation != generation ||
+            records.Size() < records_length || (records.Size() - CATALOG_HEADER_LENGTH) % CATALOG_RECORD_LENGTH != 0)
+        {
+            return Reload();
+        }
+
+        strings_length = strings.Size();
+        if (records.Size() == records_length)
+        {
+            return true;
+        }
+
+        if (!ReadRecords(records.Data(), records_length, records.Size(), strings.Data()))
+        {
+            return Reload();
+        }
+        records_length = records.Size();
+        compact = 2 * removal_count > snapshot_count;
+    }
+
+    if (compact)
+    {
+        WriteFiles();
+    }
+    return true;
+}
+
+//Applies the records between begin and end, false if one points outside the strings file.
+bool SnapshotCatalog::ReadRecords(const uint8_t* records, uint64_t begin, uint64_t end, const uint8_t* strings)
+{
+    for (uint64_t position = begin; position + CATALOG_RECORD_LENGTH <= end; position += CATALOG_RECORD_LENGTH)
+    {
+        const uint8_t* record = records + position;
+
+        const uint64_t game_name_offset = LoadInteger(record + 32, 4);
+        const uint64_t snapshot_name_offset = LoadInteger(record + 36, 4);
+        const uint64_t game_name_length = LoadInteger(record + 44, 2);
+        const uint64_t snapshot_name_length = LoadInteger(record + 46, 2);
+        if (game_name_offset < CATALOG_HEADER_LENGTH || game_name_offset + game_name_length > strings_length ||
+            snapshot_name_offset < CATALOG_HEADER_LENGTH || snapshot_name_offset + snapshot_name_length > strings_length)
+        {
+            return false;
+        }
+
+        CatalogSnapshot snapshot;
+        snapshot.game_name.assign(reinterpret_cast<const char*>(strings + game_name_offset), static_cast<size_t>(game_name_length));
+        snapshot.snapshot_name.assign(reinterpret_cast<const char*>(strings + snapshot_name_offset), static_cast<size_t>(snapshot_name_length));
+        snapshot.created_time = static_cast<std::time_t>(LoadInteger(record, 8));
+        snapshot.total_size = LoadInteger(record + 8, 8);
+        snapshot.stored_size = LoadInteger(record + 16, 8);
+        snapshot.fingerprint = LoadInteger(record + 24, 8);
+        snapshot.file_count = static_cast<uint32_t>(LoadInteger(record + 40, 4));
+        snapshot.format = static_cast<SnapshotFormat>(record[48]);
+
+        string_offsets[snapshot.game_name] = static_cast<uint32_t>(game_name_offset);
+        string_offsets[snapshot.snapshot_name] = static_cast<uint32_t>(snapshot_name_offset);
+
+        ApplyChange(snapshot, record[49]);
+    }
+
+    return true;
+}
+
+void SnapshotCatalog::ScanBackups()
+{
+    games.clear();
+
+    if (!std::filesystem::exists(backups_root))
+    {
+        return;
+    }
+
+    //Stored sizes go to whichever snapshot first holds the data, the same as a backup counts what it had to write, so they add
+    // up to what the backups take on disk.  Chunks are shared by every game, they're counted once all games are listed.
+    std::vector<std::pair<SnapshotId, CatalogSnapshot*>> chunked_snapshots;
+
+    for (const auto& game_folder : std::filesystem::directory_iterator(backups_root))
+    {
+        //Skip the chunk store, the catalog itself and anything else that isn't a game.
+        const std::string game_name = game_folder.path().filename().u8string();
+        if (!game_folder.is_directory() || game_name.empty() || game_name[0] == '.')
+        {
+            continue;
+        }
+
+        std::vector<SnapshotId> snapshot_ids;
+        for (const auto& snapshot_folder : std::filesystem::directory_iterator(game_folder.path()))
+        {
+            const std::string snapshot_name = snapshot_folder.path().filename().u8string();
+            //Snapshots still being written (or cut off by a crash) aren't part of the history.
+            if (!snapshot_folder.is_directory() || snapshot_name.find("Backup") == std::string::npos || IsStagingName(snapshot_name))
+            {
+                continue;
+            }
+            snapshot_ids.push_back(SnapshotId::FromName(snapshot_name));
+        }
+
+        std::sort(snapshot_ids.begin(), snapshot_ids.end());
+
+        std::vector<CatalogSnapshot>& game_snapshots = games[game_name];
+        game_snapshots.resize(snapshot_ids.size());
+
+        FileIdentitySet seen_files;
+        for (size_t i = 0; i < snapshot_ids.size(); i++)
+        {
+            const std::filesystem::path snapshot_path = game_folder.path() / std::filesystem::u8path(snapshot_ids[i].name);
+
+            CatalogSnapshot& snapshot = game_snapshots[i];
+            snapshot.game_name = game_name;
+            snapshot.snapshot_name = snapshot_ids[i].name;
+            snapshot.created_time = ParseBackupTimestamp(snapshot.snapshot_name);
+
+            try
+            {
+                SnapshotManifest manifest;
+                const std::filesystem::path archive_path = snapshot_path / SNAPSHOT_ARCHIVE_NAME;
+                if (std::filesystem::exists(archive_path))
+                {
+                    snapshot.format = SnapshotFormat::Archive;
+                    snapshot.stored_size = std::filesystem::file_size(archive_path);
+
+                    ArchiveReader archive(archive_path);
+                    for (const auto& entry : archive.Entries())
+                    {
+                        if (!entry.is_directory)
+                        {
+                            snapshot.total_size += entry.size;
+                            snapshot.file_count++;
+                        }
+                    }
+                }
+                else if (ReadManifest(snapshot_path / SNAPSHOT_MANIFEST_NAME, manifest))
+                {
+                    snapshot.format = SnapshotFormat::Chunked;
+                    for (const auto& entry : manifest.entries)
+                    {
+                        if (!entry.is_directory)
+                        {
+                            snapshot.total_size += entry.size;
+                            snapshot.file_count++;
+                        }
+                    }
+                    chunked_snapshots.emplace_back(snapshot_ids[i], &snapshot);
+                }
+                else
+                {
+                    snapshot.format = SnapshotFormat::Linked;
+                    SummarizeFolder(snapshot_path, snapshot, seen_files);
+                }
+            }
+            catch (const std::exception&)
+            {
+                //Still list it, the sizes just stay unknown.
+            }
+        }
+    }
+
+    //Oldest first across every game, each chunk counts toward the first snapshot that references it.  The manifests are read
+    // again rather than kept around, a rescan only happens when the catalog is missing or damaged.
+    std::sort(chunked_snapshots.begin(), chunked_snapshots.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    std::unordered_set<std::string> seen_chunks;
+    for (auto& chunked_snapshot : chunked_snapshots)
+    {
+        CatalogSnapshot& snapshot = *chunked_snapshot.second;
+        SnapshotManifest manifest;
+        if (!ReadManifest(backups_root / std::filesystem::u8path(snapshot.game_name) / std::filesystem::u8path(snapshot.snapshot_name) / SNAPSHOT_MANIFEST_NAME, manifest))
+        {
+            continue;
+        }
+
+        for (const auto& entry : manifest.entries)
+        {
+            for (const auto& chunk : entry.chunks)
+            {
+                if (seen_chunks.insert(chunk.hash).second)
+                {
+                    snapshot.stored_size += chunk.length;
+                }
+            }
+        }
+    }
+}
+
+void SnapshotCatalog::WriteFiles()
+{
+    //Fresh pair of files holding only live snapshots.  The strings go in first, so if a crash lands between the two renames the
+    // generations don't match and the next start rebuilds from the folders instead of reading names from the wrong file.
+    generation = static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count()) ^ (generation + 1);
+
+    std::vector<uint8_t> records(CATALOG_HEADER_LENGTH);
+    std::vector<uint8_t> strings(CATALOG_HEADER_LENGTH);
+    BuildHeader(records.data(), CATALOG_RECORDS_MAGIC, CATALOG_RECORD_LENGTH, generation);
+    BuildHeader(strings.data(), CATALOG_STRINGS_MAGIC, 0, generation);
+
+    string_offsets.clear();
+    auto add_string = [&](const std::string& value)
+    {
+        auto found = string_offsets.find(value);
+        if (found != string_offsets.end())
+        {
+            return found->second;
+        }
+
+        const uint32_t offset = static_cast<uint32_t>(strings.size());
+        strings.insert(strings.end(), value.begin(), value.end());
+        string_offsets[value] = offset;
+        return offset;
+    };
+
+    snapshot_count = 0;
+    removal_count = 0;
+    for (const auto& game : games)
+    {
+        for (const auto& snapshot : game.second)
+        {
+            const uint32_t game_name_offset = add_string(snapshot.game_name);
+            const uint32_t snapshot_name_offset = add_string(snapshot.snapshot_name);
+
+            records.resize(records.size() + CATALOG_RECORD_LENGTH);
+            BuildRecord(records.data() + records.size() - CATALOG_RECORD_LENGTH, snapshot, game_name_offset, snapshot_name_offset, CATALOG_RECORD_SNAPSHOT);
+            snapshot_count++;
+        }
+    }
+    strings_length = strings.size();
+    records_length = records.size();
+
+    auto write_file = [](const std::filesystem::path& path, const std::vector<uint8_t>& contents)
+    {
+        std::filesystem::path temp_path = path;
+        temp_path += ".tmp";
+
+        std::ofstream output(temp_path, std::ios::binary | std::ios::trunc);
+        output.write(reinterpret_cast<const char*>(contents.data()), contents.size());
+        output.close();
+
+        std::error_code error;
+        if (!output)
+        {
+            std::filesystem::remove(temp_path, error);
+            return false;
+        }
+        std::filesystem::rename(temp_path, path, error);
+        return !error;
+    };
+
+    if (!write_file(strings_path, strings) || !write_file(records_path, records))
+    {
+        //Leave nothing half written behind, the next start rebuilds from the folders.
+        std::error_code error;
+        std::filesystem::remove(records_path, error);
+    }
+}
+
+uint32_t SnapshotCatalog::AppendString(const std::string& value)
+{
+    auto found = string_offsets.find(value);
+    if (found != string_offsets.end())
+    {
+        return found->second;
+    }
+
+    std::ofstream output(strings_path, std::ios::binary | std::ios::app);
+    output.write(value.data(), value.size());
+    output.close();
+    if (!output)
+    {
+        throw std::filesystem::filesystem_error("Unable to write catalog", strings_path, std::make_error_code(std::errc::io_error));
+    }
+
+    const uint32_t offset = static_cast<uint32_t>(strings_length);
+    strings_length += value.size();
+    string_offsets[value] = offset;
+    return offset;
+}
+
+void SnapshotCatalog::AppendRecord(const CatalogSnapshot& snapshot, int kind)
+{
+    bool applied = false;
+    try
+    {
+        //Pick up whatever other instances appended (or compacted) since, so name offsets point where the names really are now.
+        FileLock file_lock(lock_path, "Unable to lock the snapshot catalog", CATALOG_LOCK_TIMEOUT_MS);
+        if (!Refresh())
+        {
+            //Rebuilt from the folders, which already have the change.
+            return;
+        }
+
+        const bool changed = ApplyChange(snapshot, kind);
+        applied = true;
+        if (!changed)
+        {
+            //Already listed, or removed or resized after it's gone.
+            return;
+        }
+
+        //Names first, so a record on disk never points at strings that aren't there yet.
+        const uint32_t game_name_offset = AppendString(snapshot.game_name);
+        const uint32_t snapshot_name_offset = AppendString(snapshot.snapshot_name);
+
+        uint8_t record[CATALOG_RECORD_LENGTH];
+        BuildRecord(record, snapshot, game_name_offset, snapshot_name_offset, kind);
+
+        std::ofstream output(records_path, std::ios::binary | std::ios::app);
+        output.write(reinterpret_cast<const char*>(record), sizeof(record));
+        output.close();
+        if (!output)
+        {
+            throw std::filesystem::filesystem_error("Unable to write catalog", records_path, std::make_error_code(std::errc::io_error));
+        }
+        records_length += CATALOG_RECORD_LENGTH;
+    }
+    catch (const std::exception&)
+    {
+        //The catalog is only a cache of what's in the folders.  Rather than fail the backup, drop it so the next start rebuilds it,
+        // and keep this instance's copy right until then.
+        std::error_code error;
+        std::filesystem::remove(records_path, error);
+        if (!applied)
+        {
+            ApplyChange(snapshot, kind);
+        }
+    }
+}
+
+bool SnapshotCatalog::ApplyChange(const CatalogSnapshot& snapshot, int kind)
+{
+    std::vector<CatalogSnapshot>& game_snapshots = games[snapshot.game_name];
+    const auto existing = std::find_if(game_snapshots.begin(), game_snapshots.end(),
+                                       [&](const CatalogSnapshot& listed) { return listed.snapshot_name == snapshot.snapshot_name; });
+    if (kind == CATALOG_RECORD_REMOVAL)
+    {
+        if (existing == game_snapshots.end())
+        {
+            return false;
+        }
+
+        game_snapshots.erase(existing);
+        removal_count++;
+        return true;
+    }
+
+    if (kind == CATALOG_RECORD_STORED_SIZE)
+    {
+        if (existing == game_snapshots.end())
+        {
+            return false;
+        }
+
+        //Takes the place of the record it updates, counted like a removal and an add so compaction drops it in time.
+        existing->stored_size = snapshot.stored_size;
+        snapshot_count++;
+        removal_count++;
+        return true;
+    }
+
+    if (existing != game_snapshots.end())
+    {
+        return false;
+    }
+
+    game_snapshots.push_back(snapshot);
+    snapshot_count++;
+    return true;
+}
+
+std::vector<CatalogSnapshot> SnapshotCatalog::Snapshots(const std::string& game_name) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto found = games.find(game_name);
+    return (found == games.end()) ? std::vector<CatalogSnapshot>() : found->second;
+}
+
+std::vector<CatalogSnapshot> SnapshotCatalog::AllSnapshots() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    std::vector<std::pair<std::string, const std::vector<CatalogSnapshot>*>> game_snapshots;
+    for (const auto& game : games)
+    {
+        game_snapshots.emplace_back(game.first, &game.second);
+    }
+    std::sort(game_snapshots.begin(), game_snapshots.end());
+
+    std::vector<CatalogSnapshot> snapshots;
+    for (const auto& game : game_snapshots)
+    {
+        snapshots.insert(snapshots.end(), game.second->begin(), game.second->end());
+    }
+    return snapshots;
+}
+
+std::vector<std::string> SnapshotCatalog::Games() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    std::vector<std::string> game_names;
+    for (const auto& game : games)
+    {
+        if (!game.second.empty())
+        {
+            game_names.push_back(game.first);
+        }
+    }
+    std::sort(game_names.begin(), game_names.end());
+    return game_names;
+}
+
+void SnapshotCatalog::Add(const CatalogSnapshot& snapshot)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    AppendRecord(snapshot, CATALOG_RECORD_SNAPSHOT);
+}
+
+void SnapshotCatalog::Remove(const std::string& game_name, const std::string& snapshot_name)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    CatalogSnapshot removal;
+    removal.game_name = game_name;
+    removal.snapshot_name = snapshot_name;
+    AppendRecord(removal, CATALOG_RECORD_REMOVAL);
+}
+
+void SnapshotCatalog::SetStoredSize(const std::string& game_name, const std::string& snapshot_name, uint64_t stored_size)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    CatalogSnapshot resize;
+    resize.game_name = game_name;
+    resize.snapshot_name = snapshot_name;
+    resize.stored_size = stored_size;
+    AppendRecord(resize, CATALOG_RECORD_STORED_SIZE);
+}
+
+void SnapshotCatalog::Rebuild()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    FileLock file_lock(lock_path, "Unable to lock the snapshot catalog", CATALOG_LOCK_TIMEOUT_MS);
+    ScanBackups();
+    WriteFiles();
+}
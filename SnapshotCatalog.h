@@ -0,0 +1,95 @@
+#pragma once
+
+//Binary catalog of every snapshot of every game, so listing backups (and picking which to rotate out) doesn't mean a
+// directory scan of ./Backups/<game> each time.  Two append-only files:
+//
+//   records.bin   fixed 32 byte header, then one fixed 64 byte record per snapshot added, removed or resized
+//   strings.bin   fixed 32 byte header, then the game and snapshot names the records point into
+//
+// Both are memory mapped once when the catalog is opened.  After that a backup appends its name and then its record, and
+// rotating a snapshot out appends a removal record instead of rewriting anything (a changed stored size, a record carrying
+// just the new size).  Once superseded records outnumber live snapshots (or a crash left half a record at the end) the
+// files are compacted into fresh copies.
+//
+// Other instances (the watch daemon, command line runs) append to the same files, so every change holds the catalog's lock
+// file and first reads the records appended since this instance last looked (all of them again if another instance compacted
+// in the meantime).  Names are then appended at the real end of strings.bin, never where this instance last saw it end.
+
+#include "Settings.h"
+
+#include <cstdint>
+#include <ctime>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define SNAPSHOT_CATALOG_PATH "./Backups/.catalog"
+
+//A snapshot's stored size is what its backup wrote, data no older snapshot had.  A rescan of the folders counts it the same
+// way, each chunk (or hard linked file) going to the oldest snapshot that holds it.  When a snapshot is removed, whatever of
+// its data newer snapshots still use moves over to the game's next snapshot, so the stored sizes of every snapshot listed
+// always add up to what the backups take on disk.
+struct CatalogSnapshot
+{
+    std::string game_name;
+    std::string snapshot_name;      //folder name under ./Backups/<game>
+    std::time_t created_time = 0;
+    uint64_t total_size = 0;        //bytes of save data the snapshot holds
+    uint64_t stored_size = 0;       //backup data on disk counted toward this snapshot, see above
+    uint32_t file_count = 0;
+    uint64_t fingerprint = 0;       //XXH64 over every file's path, size and content hash, 0 if unknown
+    SnapshotFormat format = SnapshotFormat::Chunked;
+};
+
+class SnapshotCatalog
+{
+public:
+    //Maps the catalog, or rebuilds it from a scan of backups_root if it doesn't exist yet or is damaged.
+    SnapshotCatalog(const std::filesystem::path& catalog_root, const std::filesystem::path& backups_root);
+
+    //Snapshots of one game, oldest first.
+    std::vector<CatalogSnapshot> Snapshots(const std::string& game_name) const;
+
+    //Every snapshot of every game, ordered by game and then oldest first.
+    std::vector<CatalogSnapshot> AllSnapshots() const;
+
+    //Every game with at least one snapshot, sorted by name.
+    std::vector<std::string> Games() const;
+
+    void Add(const CatalogSnapshot& snapshot);
+    void Remove(const std::string& game_name, const std::string& snapshot_name);
+
+    //Changes the stored size of a snapshot already listed, for when a removed snapshot's data stays on disk for its sake.
+    void SetStoredSize(const std::string& game_name, const std::string& snapshot_name, uint64_t stored_size);
+
+    //Throws the catalog away and scans backups_root again, for when the folders were changed by hand.
+    void Rebuild();
+
+private:
+    bool Load();
+    bool Reload();
+    bool Refresh();
+    bool ReadRecords(const uint8_t* records, uint64_t begin, uint64_t end, const uint8_t* strings);
+    void ScanBackups();
+    void WriteFiles();
+    void AppendRecord(const CatalogSnapshot& snapshot, int kind);
+    bool ApplyChange(const CatalogSnapshot& snapshot, int kind);
+    uint32_t AppendString(const std::string& value);
+
+    std::filesystem::path lock_path;
+    std::filesystem::path records_path;
+    std::filesystem::path strings_path;
+    std::filesystem::path backups_root;
+
+    std::unordered_map<std::string, std::vector<CatalogSnapshot>> games;
+    std::unordered_map<std::string, uint32_t> string_offsets;
+    uint64_t strings_length = 0;
+    uint64_t records_length = 0;    //how much of records.bin has been read into games
+    uint64_t generation = 0;        //stamped in both headers so a records file is never read against another strings file
+    size_t removal_count = 0;
+    size_t snapshot_count = 0;
+
+    mutable std::mutex mutex;
+};
@@ -0,0 +1,459 @@
+#include "SnapshotRestore.h"
+#include "ChangeIndex.h"
+#include "ChunkStore.h"
+#include "FileCopy.h"
+#include "FileDelta.h"
+#include "FolderTree.h"
+#include "SnapshotArchive.h"
+#include "SnapshotVerify.h"
+#include "Telemetry.h"
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <set>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+    //One file or folder of a snapshot, whatever format it's stored in.  Paths are relative to the folder the save lives in.
+    struct SnapshotFile
+    {
+        bool is_directory = false;
+        std::string relative_path;
+        uint64_t size = 0;
+        int64_t modified_time = 0;          //only trusted when has_modified_time is set
+        bool has_modified_time = false;
+        uint64_t content_hash = 0;
+        bool has_content_hash = false;
+
+        const ArchiveEntry* archive_entry = nullptr;
+        const ManifestEntry* manifest_entry = nullptr;
+        std::filesystem::path source_path;  //plain and hard linked snapshots
+        std::filesystem::path delta_base_path;  //linked snapshot files stored as a delta, source_path is the delta then
+    };
+
+    struct LiveFile
+    {
+        bool is_directory = false;
+        uint64_t size = 0;
+        int64_t modified_time = 0;
+    };
+
+    //Lists a snapshot's files and reads them back, hiding which of the formats it was written in.
+    class SnapshotSource
+    {
+    public:
+        explicit SnapshotSource(const std::filesystem::path& snapshot_path)
+        {
+            TelemetryPhase phase("open snapshot");
+
+            SnapshotManifest read_manifest;
+            if (std::filesystem::exists(snapshot_path / SNAPSHOT_ARCHIVE_NAME))
+            {
+                archive = std::make_unique<ArchiveReader>(snapshot_path / SNAPSHOT_ARCHIVE_NAME);
+                for (const auto& entry : archive->Entries())
+                {
+                    SnapshotFile file;
+                    file.is_directory = entry.is_directory;
+                    file.relative_path = entry.relative_path;
+                    file.size = entry.size;
+                    file.content_hash = entry.content_hash;
+                    file.has_content_hash = !entry.is_directory;
+                    file.archive_entry = &entry;
+                    files.push_back(file);
+                }
+            }
+            else if (ReadManifest(snapshot_path / SNAPSHOT_MANIFEST_NAME, read_manifest))
+            {
+                manifest = std::move(read_manifest);
+                chunk_store = std::make_unique<ChunkStore>(CHUNK_STORE_PATH);
+                for (const auto& entry : manifest.entries)
+                {
+                    SnapshotFile file;
+                    file.is_directory = entry.is_directory;
+                    file.relative_path = entry.relative_path;
+                    file.size = entry.size;
+                    file.manifest_entry = &entry;
+                    files.push_back(file);
+                }
+            }
+            else
+            {
+                //Plain copies keep the modified time of the save they were copied from, so it can stand in for a hash.
+                // Linked snapshots also list every file's hash next to the save folder, which saves hashing them at all.
+                std::unordered_map<std::string, FileHash> hashes;
+                std::vector<FileHash> read_hashes;
+                if (ReadSnapshotHashes(snapshot_path / SNAPSHOT_HASHES_NAME, read_hashes))
+                {
+                    for (const auto& hash : read_hashes)
+                    {
+                        hashes[hash.relative_path] = hash;
+                    }
+                }
+
+                //Everything in snapshot.delta is listed by AddDeltaFiles() instead, under the paths the files are restored to.
+                const FolderTree snapshot_tree(snapshot_path);
+                const std::vector<FolderTreeEntry>& listed = snapshot_tree.Entries();
+                std::vector<bool> in_delta_folder(listed.size(), false);
+                for (size_t i = 0; i < listed.size(); i++)
+                {
+                    const FolderTreeEntry& entry = listed[i];
+                    if (entry.parent != FOLDER_TREE_ROOT)
+                    {
+                        in_delta_folder[i] = in_delta_folder[entry.parent];
+                    }
+                    else if (!entry.is_directory && snapshot_tree.Name(i) == SNAPSHOT_HASHES_NAME)
+                    {
+                        continue;
+                    }
+                    else if (entry.is_directory && snapshot_tree.Name(i) == SNAPSHOT_DELTA_FOLDER_NAME)
+                    {
+                        in_delta_folder[i] = true;
+                        AddDeltaFiles(snapshot_path);
+                    }
+                    if (in_delta_folder[i])
+                    {
+                        continue;
+                    }
+
+                    SnapshotFile file;
+                    file.relative_path = snapshot_tree.RelativePath(i);
+                    file.source_path = snapshot_path / std::filesystem::u8path(file.relative_path);
+                    file.is_directory = entry.is_directory;
+                    if (!entry.is_directory)
+                    {
+                        file.size = entry.size;
+                        file.modified_time = entry.modified_time;
+                        file.has_modified_time = true;
+
+                        const auto hash = hashes.find(file.relative_path);
+                        if (hash != hashes.end() && hash->second.size == file.size)
+                        {
+                            file.content_hash = hash->second.content_hash;
+                            file.has_content_hash = true;
+                        }
+                    }
+                    files.push_back(file);
+                }
+            }
+
+            //The change index of the newest snapshot has every file's time and hash from when it was taken, which saves hashing
+            // the snapshot side when restoring it.
+            ChangeIndex change_index;
+            if (change_index.Load(snapshot_path.parent_path() / CHANGE_INDEX_NAME) &&
+                change_index.snapshot_name == snapshot_path.filename().u8string())
+            {
+                for (auto& file : files)
+                {
+                    const size_t separator = file.relative_path.find('/');
+                    const IndexEntry* indexed = (separator == std::string::npos) ? nullptr : change_index.Find(file.relative_path.substr(separator + 1));
+                    if (indexed != nullptr && !indexed->is_directory && !file.is_directory && indexed->size == file.size)
+                    {
+                        file.modified_time = indexed->modified_time;
+                        file.has_modified_time = true;
+                        if (indexed->has_content_hash && !file.has_content_hash)
+                        {
+                            file.content_hash = indexed->content_hash;
+                            file.has_content_hash = true;
+                        }
+                    }
+                }
+            }
+        }
+
+        std::vector<SnapshotFile>& Files() { return files; }
+
+        uint64_t ContentHash(SnapshotFile& file)
+        {
+            if (!file.has_content_hash)
+            {
+                file.content_hash = (file.manifest_entry != nullptr) ? chunk_store->HashFile(file.manifest_entry->chunks) : HashFileContents(file.source_path);
+                file.has_content_hash = true;
+            }
+            return file.content_hash;
+        }
+
+        void WriteFile(const SnapshotFile& file, const std::filesystem::path& destination)
+        {
+            if (file.archive_entry != nullptr)
+            {
+                archive->ExtractFile(*file.archive_entry, destination);
+            }
+            else if (file.manifest_entry != nullptr)
+            {
+                chunk_store->RestoreFile(file.manifest_entry->chunks, destination);
+            }
+            else if (!file.delta_base_path.empty())
+            {
+                RestoreFileDelta(file.delta_base_path, file.source_path, destination);
+            }
+            else
+            {
+                CopyFileFast(file.source_path, destination);
+            }
+        }
+
+    private:
+        //Files of a linked snapshot stored as a delta, each <path>.delta next to its <path>.base.
+        void AddDeltaFiles(const std::filesystem::path& snapshot_path)
+        {
+            const std::filesystem::path delta_folder = snapshot_path / SNAPSHOT_DELTA_FOLDER_NAME;
+            for (const auto& entry : std::filesystem::recursive_directory_iterator(delta_folder))
+            {
+                DeltaHeader header;
+                if (!entry.is_regular_file() || entry.path().extension() != DELTA_FILE_EXTENSION || !ReadDeltaHeader(entry.path(), header))
+                {
+                    continue;
+                }
+
+                SnapshotFile file;
+                file.relative_path = std::filesystem::relative(entry.path(), delta_folder).replace_extension().generic_u8string();
+                file.source_path = entry.path();
+                file.delta_base_path = entry.path();
+                file.delta_base_path.replace_extension(DELTA_BASE_EXTENSION);
+                file.size = header.target_size;
+                file.modified_time = header.modified_time;
+                file.has_modified_time = true;
+                file.content_hash = header.target_hash;
+                file.has_content_hash = true;
+                files.push_back(file);
+            }
+        }
+
+        std::unique_ptr<ArchiveReader> archive;
+        SnapshotManifest manifest;
+        std::unique_ptr<ChunkStore> chunk_store;
+        std::vector<SnapshotFile> files;
+    };
+
+    //Moves a live file into the safety copy.  Same volume, so normally just a rename, with a copy as the fallback for a file
+    // some other program holds open in a way that blocks renaming.
+    void MoveAside(const std::filesystem::path& live_path, const std::filesystem::path& safety_path, bool remove_original)
+    {
+        std::filesystem::create_directories(safety_path.parent_path());
+
+        std::error_code error;
+        std::filesystem::rename(live_path, safety_path, error);
+        if (error)
+        {
+            CopyFileFast(live_path, safety_path);
+            if (remove_original)
+            {
+                std::filesystem::remove(live_path);
+            }
+        }
+    }
+}
+
+RestoreResult RestoreSnapshot(const std::filesystem::path& snapshot_path, const std::filesystem::path& save_path, bool make_safety_copy,
+                              const std::string& only_file)
+{
+    //Make sure we're restoring in the PLACE where the save data is stored, not the folder selected for save data, since we backed up that too.
+    const std::filesystem::path destination_root = save_path.parent_path();
+    const std::filesystem::path safety_root = destination_root / CURRENT_SAVE_BACKUP_NAME;
+    const std::string game_name = save_path.filename().u8string();
+    const uint64_t start_time = TelemetryTimestamp();
+
+    SnapshotSource source(snapshot_path);
+    std::vector<SnapshotFile>& snapshot_files = source.Files();
+
+    if (!only_file.empty())
+    {
+        snapshot_files.erase(std::remove_if(snapshot_files.begin(), snapshot_files.end(),
+                                            [&](const SnapshotFile& file) { return file.is_directory || file.relative_path != only_file; }),
+                             snapshot_files.end());
+        if (snapshot_files.empty())
+        {
+            throw std::filesystem::filesystem_error("File isn't in the backup", snapshot_path / std::filesystem::u8path(only_file),
+                                                    std::make_error_code(std::errc::no_such_file_or_directory));
+        }
+    }
+
+    //Only look at the live folders the snapshot covers, never at whatever else lives next to the save.
+    TelemetryPhase scan_phase("scan live save", game_name);
+    std::unordered_map<std::string, LiveFile> live_files;
+    std::set<std::string> top_level_names;
+    for (const auto& file : snapshot_files)
+    {
+        top_level_names.insert(file.relative_path.substr(0, file.relative_path.find('/')));
+    }
+
+    auto add_live_file = [&](const std::filesystem::directory_entry& entry)
+    {
+        LiveFile live_file;
+        if (entry.is_directory())
+        {
+            live_file.is_directory = true;
+        }
+        else
+        {
+            live_file.size = entry.file_size();
+            live_file.modified_time = entry.last_write_time().time_since_epoch().count();
+        }
+        live_files[std::filesystem::relative(entry.path(), destination_root).generic_u8string()] = live_file;
+    };
+
+    if (!only_file.empty())
+    {
+        const std::filesystem::directory_entry entry(destination_root / std::filesystem::u8path(only_file));
+        if (entry.exists())
+        {
+            add_live_file(entry);
+        }
+    }
+    else
+    {
+        for (const auto& name : top_level_names)
+        {
+            const std::filesystem::directory_entry top_entry(destination_root / std::filesystem::u8path(name));
+            if (!top_entry.exists())
+            {
+                continue;
+            }
+
+            add_live_file(top_entry);
+            if (top_entry.is_directory())
+            {
+                const FolderTree live_tree(top_entry.path());
+                for (size_t i = 0; i < live_tree.Entries().size(); i++)
+                {
+                    const FolderTreeEntry& entry = live_tree.Entries()[i];
+
+                    LiveFile live_file;
+                    live_file.is_directory = entry.is_directory;
+                    live_file.size = entry.size;
+                    live_file.modified_time = entry.modified_time;
+                    live_files[name + "/" + live_tree.RelativePath(i)] = live_file;
+                }
+            }
+        }
+    }
+
+    scan_phase.Stop();
+
+    //Diff: which snapshot files have to be written, and which live files have to go.
+    TelemetryPhase compare_phase("compare with live save", game_name);
+    RestoreResult result;
+    std::vector<SnapshotFile*> files_to_write;
+    std::vector<std::string> files_to_replace;      //live files that files_to_write overwrites
+    std::vector<std::string> paths_to_delete;
+
+    std::unordered_map<std::string, bool> snapshot_kinds;   //relative path -> is_directory
+    for (auto& file : snapshot_files)
+    {
+        snapshot_kinds[file.relative_path] = file.is_directory;
+        if (file.is_directory)
+        {
+            continue;
+        }
+
+        auto live = live_files.find(file.relative_path);
+        if (live == live_files.end() || live->second.is_directory)
+        {
+            files_to_write.push_back(&file);
+            continue;
+        }
+
+        //Same size and time counts as unchanged, like the change index does.  Same size with a different time gets hashed.
+        bool unchanged = false;
+        if (live->second.size == file.size)
+        {
+            unchanged = (file.has_modified_time && live->second.modified_time == file.modified_time) ||
+                        HashFileContents(destination_root / std::filesystem::u8path(file.relative_path)) == source.ContentHash(file);
+        }
+
+        if (unchanged)
+        {
+            result.files_unchanged++;
+        }
+        else
+        {
+            files_to_write.push_back(&file);
+            files_to_replace.push_back(file.relative_path);
+        }
+    }
+
+    if (only_file.empty())
+    {
+        for (const auto& live : live_files)
+        {
+            auto in_snapshot = snapshot_kinds.find(live.first);
+            if (in_snapshot == snapshot_kinds.end() || in_snapshot->second != live.second.is_directory)
+            {
+                paths_to_delete.push_back(live.first);
+            }
+        }
+    }
+
+    //Deepest paths first, so a folder's contents are gone (or moved aside) before the folder itself.
+    std::sort(paths_to_delete.begin(), paths_to_delete.end(), std::greater<std::string>());
+    compare_phase.Stop();
+
+    TelemetryPhase delete_phase("delete and move aside", game_name);
+
+    if (make_safety_copy && (!files_to_replace.empty() || !paths_to_delete.empty()))
+    {
+        std::filesystem::remove_all(safety_root);
+        std::filesystem::create_directories(safety_root);
+        result.safety_copy_path = safety_root;
+    }
+
+    for (const auto& relative_path : paths_to_delete)
+    {
+        const std::filesystem::path live_path = destination_root / std::filesystem::u8path(relative_path);
+        if (live_files[relative_path].is_directory)
+        {
+            //Whatever was inside has been handled already, as its own entry.
+            std::error_code error;
+            std::filesystem::remove(live_path, error);
+        }
+        else if (!result.safety_copy_path.empty())
+        {
+            MoveAside(live_path, safety_root / std::filesystem::u8path(relative_path), true);
+        }
+        else
+        {
+            std::filesystem::remove(live_path);
+        }
+        result.files_deleted += live_files[relative_path].is_directory ? 0 : 1;
+    }
+
+    for (const auto& file : snapshot_files)
+    {
+        if (file.is_directory)
+        {
+            std::filesystem::create_directories(destination_root / std::filesystem::u8path(file.relative_path));
+        }
+    }
+
+    if (!result.safety_copy_path.empty())
+    {
+        for (const auto& relative_path : files_to_replace)
+        {
+            MoveAside(destination_root / std::filesystem::u8path(relative_path), safety_root / std::filesystem::u8path(relative_path), false);
+        }
+    }
+
+    delete_phase.Stop();
+
+    TelemetryPhase write_phase("write files", game_name);
+    for (const SnapshotFile* file : files_to_write)
+    {
+        const std::filesystem::path destination_path = destination_root / std::filesystem::u8path(file->relative_path);
+        std::filesystem::create_directories(destination_path.parent_path());
+
+        const uint64_t file_start_time = TelemetryTimestamp();
+        source.WriteFile(*file, destination_path);
+        RecordFileCopy(file_start_time, file->size);
+
+        result.files_written++;
+        result.bytes_written += file->size;
+    }
+    write_phase.Stop();
+
+    RecordGameTotals(game_name, start_time, result.files_written, result.files_unchanged, result.bytes_written);
+    return result;
+}
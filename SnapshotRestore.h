@@ -0,0 +1,35 @@
+#pragma once
+
+//Restoring a snapshot over a game's live save, shared by the interactive menu and the command line.
+//
+// A restore compares the snapshot with the live save first and only touches what differs: files whose size differs are
+// rewritten, files of the same size are compared by modified time and then by XXH64, and files the snapshot doesn't have are
+// deleted.  Restoring a snapshot that is almost the same as the live save only costs reading the files of equal size.
+//
+// The safety copy is built from that same comparison.  Instead of copying the whole live save, every file the restore is
+// about to replace or delete is moved into <folder the save lives in>/CurrentSaveBackup, keeping its relative path.  Files
+// that already matched are identical to the snapshot, so restoring the snapshot and then copying the safety copy back over
+// it gives the save as it was before (apart from files the restore added).
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+#define CURRENT_SAVE_BACKUP_NAME "CurrentSaveBackup"
+
+struct RestoreResult
+{
+    size_t files_written = 0;
+    size_t files_deleted = 0;
+    size_t files_unchanged = 0;
+    uint64_t bytes_written = 0;
+    std::filesystem::path safety_copy_path;     //empty when no safety copy was asked for or nothing had to be replaced
+};
+
+//Restores a snapshot in any format over the save.  Snapshots hold the save folder itself, so the files land in the folder
+// the save lives in.  With only_file set (a path as the snapshot lists it) just that one file is restored and nothing is
+// deleted.  A safety copy replaces the previous one.  Throws on the first file that can't be restored, anything already moved
+// aside stays in the safety copy.
+RestoreResult RestoreSnapshot(const std::filesystem::path& snapshot_path, const std::filesystem::path& save_path, bool make_safety_copy,
+                              const std::string& only_file = std::string());
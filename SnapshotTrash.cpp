@@ -0,0 +1,285 @@
+#include "SnapshotTrash.h"
+#include "FolderTree.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#define NOMINMAX
+#include <Windows.h>
+
+namespace
+{
+    //Lowers the current thread's CPU and I/O priority for as long as it's in scope.  Nested scopes leave it to the outer one.
+    class BackgroundMode
+    {
+    public:
+        BackgroundMode()
+            : entered(SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN) != 0)
+        {
+        }
+
+        ~BackgroundMode()
+        {
+            if (entered)
+            {
+                SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_END);
+            }
+        }
+
+        BackgroundMode(const BackgroundMode&) = delete;
+        BackgroundMode& operator=(const BackgroundMode&) = delete;
+
+    private:
+        bool entered;
+    };
+
+    class TrashDeleter
+    {
+    public:
+        TrashDeleter() = default;
+
+        //Program exit: files already being deleted finish their batch, the rest stays in the trash for the next run.
+        ~TrashDeleter()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            wake_condition.notify_all();
+            idle_condition.notify_all();
+
+            if (thread.joinable())
+            {
+                thread.join();
+            }
+        }
+
+        TrashDeleter(const TrashDeleter&) = delete;
+        TrashDeleter& operator=(const TrashDeleter&) = delete;
+
+        //Trash folders are kept as absolute paths, the working folder may change while the deleter is busy (the benchmark does).
+        void Wake(const std::filesystem::path& trash_folder)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (stopping)
+                {
+                    return;
+                }
+                if (std::find(pending_folders.begin(), pending_folders.end(), trash_folder) == pending_folders.end())
+                {
+                    pending_folders.push_back(trash_folder);
+                }
+                if (!thread.joinable())
+                {
+                    thread = std::thread(&TrashDeleter::Run, this);
+                }
+            }
+            wake_condition.notify_all();
+        }
+
+        void WaitUntilIdle()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            idle_condition.wait(lock, [this] { return stopping || (pending_folders.empty() && !busy); });
+        }
+
+    private:
+        void Run()
+        {
+            BackgroundMode background;
+            ThreadPool pool(TRASH_DELETE_THREADS);
+
+            while (true)
+            {
+                std::vector<std::filesystem::path> trash_folders;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    busy = false;
+                    idle_condition.notify_all();
+
+                    wake_condition.wait(lock, [this] { return stopping || !pending_folders.empty(); });
+                    if (stopping)
+                    {
+                        return;
+                    }
+                    trash_folders.swap(pending_folders);
+                    busy = true;
+                }
+
+                for (const auto& trash_folder : trash_folders)
+                {
+                    EmptyTrashFolder(pool, trash_folder);
+                }
+            }
+        }
+
+        void EmptyTrashFolder(ThreadPool& pool, const std::filesystem::path& trash_folder)
+        {
+            std::error_code error;
+            std::vector<std::filesystem::path> items;
+            for (std::filesystem::directory_iterator it(trash_folder, error), end; !error && it != end; it.increment(error))
+            {
+                items.push_back(it->path());
+            }
+
+            for (const auto& item : items)
+            {
+                if (stopping)
+                {
+                    return;
+                }
+
+                try
+                {
+                    DeleteItem(pool, item);
+                }
+                catch (const std::exception&)
+                {
+                    //Couldn't even be listed, maybe something still has it open.  The next run tries again.
+                }
+            }
+        }
+
+        void DeleteItem(ThreadPool& pool, const std::filesystem::path& item)
+        {
+            std::error_code error;
+            if (!std::filesystem::is_directory(std::filesystem::symlink_status(item, error)))
+            {
+                std::filesystem::remove(item, error);
+                return;
+            }
+
+            //Files (and links, which are removed without following them) in parallel batches, then the folders deepest first.
+            // A folder always comes before what's inside it in the listing, so going through it backwards empties each folder
+            // before removing it.
+            const FolderTree tree(item);
+            std::vector<uint32_t> files;
+            std::vector<uint32_t> folders;
+            for (size_t i = 0; i < tree.Entries().size(); i++)
+            {
+                const FolderTreeEntry& entry = tree.Entries()[i];
+                if (entry.is_directory && (entry.attributes & FILE_ATTRIBUTE_REPARSE_POINT) == 0)
+                {
+                    folders.push_back(static_cast<uint32_t>(i));
+                }
+                else
+                {
+                    files.push_back(static_cast<uint32_t>(i));
+                }
+            }
+
+            {
+                TaskGroup delete_tasks(pool);
+                for (size_t batch_start = 0; batch_start < files.size(); batch_start += TRASH_DELETE_BATCH_SIZE)
+                {
+                    delete_tasks.Run([this, &tree, &files, batch_start]
+                    {
+                        if (stopping)
+                        {
+                            return;
+                        }
+
+                        BackgroundMode background;
+                        const size_t batch_end = std::min(batch_start + TRASH_DELETE_BATCH_SIZE, files.size());
+                        for (size_t i = batch_start; i < batch_end; i++)
+                        {
+                            std::error_code delete_error;
+                            std::filesystem::remove(tree.FullPath(files[i]), delete_error);
+                        }
+                    });
+                }
+                delete_tasks.Wait();
+            }
+
+            if (stopping)
+            {
+                return;
+            }
+
+            for (auto folder = folders.rbegin(); folder != folders.rend(); ++folder)
+            {
+                std::filesystem::remove(tree.FullPath(*folder), error);
+            }
+            std::filesystem::remove(item, error);
+        }
+
+        std::mutex mutex;
+        std::condition_variable wake_condition;
+        std::condition_variable idle_condition;
+        std::vector<std::filesystem::path> pending_folders;
+        std::atomic<bool> stopping{ false };
+        bool busy = false;
+        std::thread thread;
+    };
+
+    TrashDeleter& Deleter()
+    {
+        static TrashDeleter deleter;
+        return deleter;
+    }
+
+    std::filesystem::path AbsoluteTrashPath()
+    {
+        return std::filesystem::absolute(TRASH_PATH);
+    }
+}
+
+void MoveToTrash(const std::filesystem::path& path)
+{
+    const std::filesystem::path trash_path = AbsoluteTrashPath();
+    std::filesystem::create_directories(trash_path);
+
+    //"<game> <snapshot>", numbered if the same name is already waiting to be deleted.
+    std::filesystem::path trash_name = path.parent_path().filename();
+    trash_name += " ";
+    trash_name += path.filename();
+
+    std::filesystem::path destination = trash_path / trash_name;
+    for (int number = 1; std::filesystem::exists(destination); number++)
+    {
+        destination = trash_path / trash_name;
+        destination += "." + std::to_string(number);
+    }
+
+    std::filesystem::rename(path, destination);
+    Deleter().Wake(trash_path);
+}
+
+void DiscardFolder(const std::filesystem::path& path)
+{
+    try
+    {
+        MoveToTrash(path);
+    }
+    catch (const std::exception&)
+    {
+        std::error_code error;
+        std::filesystem::remove_all(path, error);
+    }
+}
+
+void EmptyTrashInBackground()
+{
+    std::error_code error;
+    const std::filesystem::path trash_path = AbsoluteTrashPath();
+    if (std::filesystem::is_directory(trash_path, error) && !std::filesystem::is_empty(trash_path, error))
+    {
+        Deleter().Wake(trash_path);
+    }
+}
+
+void WaitForEmptyTrash()
+{
+    EmptyTrashInBackground();
+    Deleter().WaitUntilIdle();
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+//Removing snapshots without waiting on the disk.  Deleting a snapshot of tens of thousands of files one by one takes a
+// while, so rotation and pruning rename the snapshot folder into the trash instead, which is instant whatever it holds, and
+// a background deleter empties the trash later on.
+//
+// The deleter has a few threads of its own running at background I/O priority, so backups and restores going on at the
+// same time keep the disk and never wait on it.  Whatever is left in the trash when the program exits is deleted by the
+// next run that creates a BackupEngine.
+
+#include <filesystem>
+
+//Next to the snapshots, on the same drive, so moving one in is a rename.  Skipped like every other dot folder.
+#define TRASH_PATH "./Backups/.trash"
+//Threads deleting files out of the trash.
+#define TRASH_DELETE_THREADS 2
+//Files one task deletes before it checks again whether the program is shutting down.
+#define TRASH_DELETE_BATCH_SIZE 256
+
+//Renames a snapshot (or any folder under ./Backups) into the trash and wakes the deleter.  Throws filesystem_error if it
+// can't be renamed, the folder is left where it was then.
+void MoveToTrash(const std::filesystem::path& path);
+
+//Same, but deletes the folder in place if it can't be moved, ignoring errors.  For staging folders nobody needs anymore.
+void DiscardFolder(const std::filesystem::path& path);
+
+//Wakes the deleter for anything an earlier run left in the trash.  Does nothing if there is no trash.
+void EmptyTrashInBackground();
+
+//Blocks until the deleter is done with everything in the trash (or gave up on what it couldn't delete).
+void WaitForEmptyTrash();
@@ -0,0 +1,359 @@
+#include "SnapshotVerify.h"
+#include "BackupEngine.h"
+#include "ChangeIndex.h"
+#include "ChunkStore.h"
+#include "FileDelta.h"
+#include "SnapshotArchive.h"
+#include "ThreadPool.h"
+#include "VolumeThrottle.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <system_error>
+#include <unordered_map>
+
+#define SNAPSHOT_HASHES_HEADER "SaveBackupManager Hashes v1"
+
+namespace
+{
+    //Chunks already checked during this run, shared by every snapshot since most of them use the same chunks.
+    class CheckedChunks
+    {
+    public:
+        explicit CheckedChunks(const ChunkStore& store) : store(store) {}
+
+        bool IsIntact(const ChunkRef& chunk)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                const auto found = results.find(chunk.hash);
+                if (found != results.end())
+                {
+                    return found->second;
+                }
+            }
+
+            //Two snapshots may read the same chunk at the same time, which only costs a second read.
+            const bool intact = store.VerifyChunk(chunk);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            results[chunk.hash] = intact;
+            return intact;
+        }
+
+    private:
+        const ChunkStore& store;
+        std::mutex mutex;
+        std::unordered_map<std::string, bool> results;
+    };
+
+    void AddProblem(SnapshotVerifyResult& result, const std::string& relative_path, const std::string& problem)
+    {
+        result.problems.push_back({ relative_path, problem });
+        result.status = VerifyStatus::Damaged;
+    }
+
+    void VerifyArchive(const std::filesystem::path& snapshot_path, SnapshotVerifyResult& result)
+    {
+        std::unique_ptr<ArchiveReader> archive;
+        try
+        {
+            archive = std::make_unique<ArchiveReader>(snapshot_path / SNAPSHOT_ARCHIVE_NAME);
+        }
+        catch (const std::exception& e)
+        {
+            AddProblem(result, SNAPSHOT_ARCHIVE_NAME, e.what());
+            return;
+        }
+
+        for (const auto& entry : archive->Entries())
+        {
+            if (entry.is_directory)
+            {
+                continue;
+            }
+
+            try
+            {
+                if (!archive->VerifyFile(entry))
+                {
+                    AddProblem(result, entry.relative_path, "contents don't match the backup");
+                }
+            }
+            catch (const std::exception& e)
+            {
+                AddProblem(result, entry.relative_path, e.what());
+            }
+            result.files_checked++;
+            result.bytes_checked += entry.size;
+        }
+    }
+
+    void VerifyChunked(const std::filesystem::path& snapshot_path, CheckedChunks& checked_chunks, SnapshotVerifyResult& result)
+    {
+        SnapshotManifest manifest;
+        if (!ReadManifest(snapshot_path / SNAPSHOT_MANIFEST_NAME, manifest))
+        {
+            AddProblem(result, SNAPSHOT_MANIFEST_NAME, "manifest is unreadable");
+            return;
+        }
+
+        for (const auto& entry : manifest.entries)
+        {
+            if (entry.is_directory)
+            {
+                continue;
+            }
+
+            uint64_t chunked_size = 0;
+            size_t damaged_chunks = 0;
+            for (const auto& chunk : entry.chunks)
+            {
+                chunked_size += chunk.length;
+                if (!checked_chunks.IsIntact(chunk))
+                {
+                    damaged_chunks++;
+                }
+            }
+
+            if (damaged_chunks > 0)
+            {
+                AddProblem(result, entry.relative_path, std::to_string(damaged_chunks) + " chunk(s) missing or damaged");
+            }
+            else if (chunked_size != entry.size)
+            {
+                AddProblem(result, entry.relative_path, "chunks don't add up to the file size");
+            }
+            result.files_checked++;
+            result.bytes_checked += entry.size;
+        }
+    }
+
+    //A big file the backup stored as a delta against its keyframe: rebuilt without writing it out and checked as a whole.
+    void VerifyDeltaFile(const std::filesystem::path& snapshot_path, const FileHash& file, SnapshotVerifyResult& result)
+    {
+        const std::filesystem::path delta_path = SnapshotDeltaPath(snapshot_path, file.relative_path, DELTA_FILE_EXTENSION);
+        const std::filesystem::path base_path = SnapshotDeltaPath(snapshot_path, file.relative_path, DELTA_BASE_EXTENSION);
+
+        DeltaHeader header;
+        if (!ReadDeltaHeader(delta_path, header) || header.target_size != file.size || header.target_hash != file.content_hash)
+        {
+            AddProblem(result, file.relative_path, "delta doesn't match the backup");
+            return;
+        }
+
+        try
+        {
+            //Throws when the rebuilt file doesn't match the hash the delta was made with.
+            ApplyFileDelta(base_path, delta_path, [](const uint8_t*, size_t) {});
+        }
+        catch (const std::exception& e)
+        {
+            AddProblem(result, file.relative_path, e.what());
+        }
+        result.bytes_checked += file.size;
+    }
+
+    void VerifyLinked(const std::filesystem::path& snapshot_path, SnapshotVerifyResult& result)
+    {
+        std::vector<FileHash> hashes;
+        if (!ReadSnapshotHashes(snapshot_path / SNAPSHOT_HASHES_NAME, hashes))
+        {
+            if (std::filesystem::exists(snapshot_path / SNAPSHOT_HASHES_NAME))
+            {
+                AddProblem(result, SNAPSHOT_HASHES_NAME, "hash list is unreadable");
+            }
+            else
+            {
+                result.status = VerifyStatus::Unverified;
+            }
+            return;
+        }
+
+        for (const auto& file : hashes)
+        {
+            const std::filesystem::path file_path = snapshot_path / std::filesystem::u8path(file.relative_path);
+            result.files_checked++;
+
+            std::error_code error;
+            const uintmax_t size = std::filesystem::file_size(file_path, error);
+            if (error && std::filesystem::exists(SnapshotDeltaPath(snapshot_path, file.relative_path, DELTA_FILE_EXTENSION)))
+            {
+                VerifyDeltaFile(snapshot_path, file, result);
+                continue;
+            }
+            if (error)
+            {
+                AddProblem(result, file.relative_path, "missing");
+                continue;
+            }
+            if (size != file.size)
+            {
+                AddProblem(result, file.relative_path, "size doesn't match the backup");
+                continue;
+            }
+
+            try
+            {
+                if (HashFileContents(file_path) != file.content_hash)
+                {
+                    AddProblem(result, file.relative_path, "contents don't match the backup");
+                }
+            }
+            catch (const std::exception& e)
+            {
+                AddProblem(result, file.relative_path, e.what());
+            }
+            result.bytes_checked += file.size;
+        }
+    }
+}
+
+bool WriteSnapshotHashes(const std::vector<FileHash>& hashes, const std::filesystem::path& hashes_path)
+{
+    std::ofstream output(hashes_path, std::ios::out | std::ios::trunc);
+    if (!output.is_open())
+    {
+        return false;
+    }
+
+    //One tab separated line per file, then a count so a list cut short can't pass for a complete one.
+    // <xxh64 hex> <size> <path>
+    // end <file count>
+    output << SNAPSHOT_HASHES_HEADER << "\n";
+    for (const auto& file : hashes)
+    {
+        char hash_text[17];
+        std::snprintf(hash_text, sizeof(hash_text), "%016llx", static_cast<unsigned long long>(file.content_hash));
+        output << hash_text << "\t" << file.size << "\t" << file.relative_path << "\n";
+    }
+    output << "end\t" << hashes.size() << "\n";
+
+    output.close();
+    return static_cast<bool>(output);
+}
+
+bool ReadSnapshotHashes(const std::filesystem::path& hashes_path, std::vector<FileHash>& hashes)
+{
+    std::ifstream input(hashes_path, std::ios::in);
+    if (!input.is_open())
+    {
+        return false;
+    }
+
+    std::string line;
+    if (!std::getline(input, line) || line != SNAPSHOT_HASHES_HEADER)
+    {
+        return false;
+    }
+
+    hashes.clear();
+    while (std::getline(input, line))
+    {
+        std::istringstream iss(line);
+        std::string hash_text;
+        if (!std::getline(iss, hash_text, '\t'))
+        {
+            return false;
+        }
+
+        if (hash_text == "end")
+        {
+            size_t count = 0;
+            return static_cast<bool>(iss >> count) && count == hashes.size();
+        }
+
+        FileHash file;
+        std::istringstream hash_stream(hash_text);
+        if (!(hash_stream >> std::hex >> file.content_hash) || !(iss >> file.size) || iss.get() != '\t' || !std::getline(iss, file.relative_path))
+        {
+            return false;
+        }
+        hashes.push_back(file);
+    }
+
+    //No end line, the file was cut short.
+    return false;
+}
+
+const char* VerifyStatusName(VerifyStatus status)
+{
+    switch (status)
+    {
+    case VerifyStatus::Intact:
+        return "intact";
+    case VerifyStatus::Damaged:
+        return "damaged";
+    case VerifyStatus::Unverified:
+        return "unverified";
+    }
+    return "unknown";
+}
+
+std::vector<SnapshotVerifyResult> VerifySnapshots(const BackupSettings& settings, const SnapshotCatalog& catalog, const std::vector<std::string>& game_names)
+{
+    const std::vector<std::string> games = game_names.empty() ? catalog.Games() : game_names;
+
+    std::vector<SnapshotVerifyResult> results;
+    for (const auto& game_name : games)
+    {
+        for (const auto& snapshot : catalog.Snapshots(game_name))
+        {
+            SnapshotVerifyResult result;
+            result.game_name = game_name;
+            result.snapshot_name = snapshot.snapshot_name;
+            results.push_back(result);
+        }
+    }
+
+    ThreadPool pool(static_cast<size_t>(std::max(settings.worker_threads, 0)));
+    VolumeThrottle throttle(settings.volume_concurrency, settings.default_volume_concurrency);
+    ChunkStore chunk_store(CHUNK_STORE_PATH);
+    CheckedChunks checked_chunks(chunk_store);
+
+    //One task per snapshot.  Which format a snapshot is in is read off its folder rather than the catalog, so snapshots written
+    // before the format could be picked are checked the right way too.
+    TaskGroup snapshot_tasks(pool);
+    for (auto& result : results)
+    {
+        snapshot_tasks.Run([&]
+        {
+            const std::filesystem::path snapshot_path = GameBackupFolder(result.game_name) / std::filesystem::u8path(result.snapshot_name);
+
+            try
+            {
+                VolumeThrottle::Slots slots = throttle.Acquire({ snapshot_path });
+                if (std::filesystem::exists(snapshot_path / SNAPSHOT_ARCHIVE_NAME))
+                {
+                    result.format = SnapshotFormat::Archive;
+                    VerifyArchive(snapshot_path, result);
+                }
+                else if (std::filesystem::exists(snapshot_path / SNAPSHOT_MANIFEST_NAME))
+                {
+                    result.format = SnapshotFormat::Chunked;
+                    VerifyChunked(snapshot_path, checked_chunks, result);
+                }
+                else if (std::filesystem::is_directory(snapshot_path))
+                {
+                    result.format = SnapshotFormat::Linked;
+                    VerifyLinked(snapshot_path, result);
+                }
+                else
+                {
+                    AddProblem(result, "", "snapshot folder is missing");
+                }
+            }
+            catch (const std::exception& e)
+            {
+                AddProblem(result, "", e.what());
+            }
+        });
+    }
+    snapshot_tasks.Wait();
+
+    return results;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+//Integrity checking for snapshots, run with "SaveBackupManager.exe verify".
+//
+// Every format carries hashes taken while the backup read the save, so checking a snapshot never needs the live save:
+// - Archive: the index holds each file's XXH64, files are decompressed and hashed without writing them out.
+// - Chunked: chunks are named by their SHA-256, so every chunk the manifest uses is re-hashed.  Snapshots share most of their
+//   chunks, each one is only checked once per run.
+// - Linked: snapshot.hashes lists each file's size and XXH64, written by the backup from the same pass that copied the file.
+//   Files stored as a delta are rebuilt from it without writing them out and checked the same way.
+//   Plain backups from before that file existed can only be reported as unverified.
+//
+// Snapshots are checked in parallel on the thread pool, with the volume throttle keeping spinning drives from thrashing.
+
+#include "Settings.h"
+#include "SnapshotCatalog.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#define SNAPSHOT_HASHES_NAME "snapshot.hashes"
+
+struct FileHash
+{
+    std::string relative_path;      //UTF-8 generic path, same layout as a manifest entry
+    uint64_t size = 0;
+    uint64_t content_hash = 0;      //XXH64
+};
+
+bool WriteSnapshotHashes(const std::vector<FileHash>& hashes, const std::filesystem::path& hashes_path);
+
+//False if the file is missing, cut short or not a hashes file.
+bool ReadSnapshotHashes(const std::filesystem::path& hashes_path, std::vector<FileHash>& hashes);
+
+enum class VerifyStatus
+{
+    Intact,
+    Damaged,
+    Unverified      //nothing to check against
+};
+
+const char* VerifyStatusName(VerifyStatus status);
+
+struct VerifyProblem
+{
+    std::string relative_path;
+    std::string problem;
+};
+
+struct SnapshotVerifyResult
+{
+    std::string game_name;
+    std::string snapshot_name;
+    SnapshotFormat format = SnapshotFormat::Chunked;
+    VerifyStatus status = VerifyStatus::Intact;
+    size_t files_checked = 0;
+    uint64_t bytes_checked = 0;
+    std::vector<VerifyProblem> problems;
+};
+
+//Checks every snapshot the catalog has of the given games (every game with backups when empty).  Results are ordered by game,
+// then oldest snapshot first.
+std::vector<SnapshotVerifyResult> VerifySnapshots(const BackupSettings& settings, const SnapshotCatalog& catalog, const std::vector<std::string>& game_names);
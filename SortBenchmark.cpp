@@ -0,0 +1,149 @@
+#include "SortBenchmark.h"
+#include "Timestamps.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+    //What sorting did before snapshot names were pre-parsed: sscanf and mktime on both names for every comparison.
+    bool LegacyCompare(const std::string& name1, const std::string& name2)
+    {
+        auto extractTimestamp = [](const std::string& name) {
+            std::tm timestamp = {};
+            sscanf_s(name.c_str(), "Backup - %d-%d-%d %dh%dm%ds",
+                &timestamp.tm_year, &timestamp.tm_mon, &timestamp.tm_mday,
+                &timestamp.tm_hour, &timestamp.tm_min, &timestamp.tm_sec);
+            timestamp.tm_year -= 1900;
+            timestamp.tm_mon -= 1;
+            return std::mktime(&timestamp);
+            };
+
+        return extractTimestamp(name1) < extractTimestamp(name2);
+    }
+
+    std::string FolderName(const std::string& path)
+    {
+        const size_t name_start = path.find_last_of("/\\");
+        return (name_start == std::string::npos) ? path : path.substr(name_start + 1);
+    }
+
+    //Snapshot names in the order they'd have been made, about one in ten made in the same second as the one before it.
+    std::vector<std::string> GenerateOrderedNames(size_t count)
+    {
+        std::mt19937_64 random(20240229);
+
+        std::vector<std::array<int, 6>> times(count);
+        for (auto& time : times)
+        {
+            time = { 2015 + static_cast<int>(random() % 10), 1 + static_cast<int>(random() % 12), 1 + static_cast<int>(random() % 28),
+                     static_cast<int>(random() % 24), static_cast<int>(random() % 60), static_cast<int>(random() % 60) };
+        }
+        for (size_t i = 1; i < times.size(); i++)
+        {
+            if (random() % 10 == 0)
+            {
+                times[i] = times[i - 1];
+            }
+        }
+        std::sort(times.begin(), times.end());
+
+        std::vector<std::string> names;
+        names.reserve(count);
+        int sequence = 1;
+        for (size_t i = 0; i < times.size(); i++)
+        {
+            sequence = (i > 0 && times[i] == times[i - 1]) ? sequence + 1 : 1;
+
+            char name[64];
+            std::snprintf(name, sizeof(name), "Backup - %04d-%02d-%02d %02dh%02dm%02ds",
+                times[i][0], times[i][1], times[i][2], times[i][3], times[i][4], times[i][5]);
+
+            names.push_back(sequence > 1 ? std::string(name) + " (" + std::to_string(sequence) + ")" : std::string(name));
+        }
+        return names;
+    }
+
+    template<typename Sort>
+    double TimeSort(std::vector<std::string> names, std::vector<std::string>& sorted_names, Sort sort)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        sort(names);
+        const auto end = std::chrono::steady_clock::now();
+
+        sorted_names = std::move(names);
+        return std::chrono::duration<double>(end - start).count();
+    }
+
+    bool MatchesExpected(const std::vector<std::string>& sorted_names, const std::vector<std::string>& expected_names)
+    {
+        if (sorted_names.size() != expected_names.size())
+        {
+            return false;
+        }
+        for (size_t i = 0; i < sorted_names.size(); i++)
+        {
+            if (FolderName(sorted_names[i]) != expected_names[i])
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+int RunSortBenchmark(size_t snapshot_count)
+{
+    const std::vector<std::string> expected_names = GenerateOrderedNames(snapshot_count);
+
+    std::vector<std::string> shuffled_names = expected_names;
+    std::shuffle(shuffled_names.begin(), shuffled_names.end(), std::mt19937_64(7));
+
+    //Rotation used to be handed full paths, so test with those as well as bare folder names.
+    std::vector<std::string> shuffled_paths;
+    for (const auto& name : shuffled_names)
+    {
+        shuffled_paths.push_back("./Backups/Some Game/" + name);
+    }
+
+    struct Run
+    {
+        std::string name;
+        double seconds;
+        bool correct;
+    };
+    std::vector<Run> runs;
+    std::vector<std::string> sorted_names;
+
+    double seconds = TimeSort(shuffled_names, sorted_names, [](std::vector<std::string>& names) { std::sort(names.begin(), names.end(), LegacyCompare); });
+    runs.push_back({ "legacy compare, names", seconds, MatchesExpected(sorted_names, expected_names) });
+
+    seconds = TimeSort(shuffled_paths, sorted_names, [](std::vector<std::string>& names) { std::sort(names.begin(), names.end(), LegacyCompare); });
+    runs.push_back({ "legacy compare, full paths", seconds, MatchesExpected(sorted_names, expected_names) });
+
+    seconds = TimeSort(shuffled_names, sorted_names, [](std::vector<std::string>& names) { SortSnapshotNames(names); });
+    runs.push_back({ "SortSnapshotNames, names", seconds, MatchesExpected(sorted_names, expected_names) });
+
+    seconds = TimeSort(shuffled_paths, sorted_names, [](std::vector<std::string>& names) { SortSnapshotNames(names); });
+    runs.push_back({ "SortSnapshotNames, full paths", seconds, MatchesExpected(sorted_names, expected_names) });
+
+    std::cout << snapshot_count << " snapshots" << std::endl << std::endl;
+    std::cout << std::left << std::setw(32) << "Sort" << std::right << std::setw(12) << "ms" << std::setw(10) << "Order" << std::endl;
+    std::cout << std::string(54, '-') << std::endl;
+    for (const auto& run : runs)
+    {
+        std::cout << std::left << std::setw(32) << run.name << std::right << std::fixed << std::setprecision(3)
+                  << std::setw(12) << run.seconds * 1000.0 << std::setw(10) << (run.correct ? "ok" : "WRONG") << std::endl;
+    }
+
+    //Only the new sort has to be right, the legacy rows show what it replaced.
+    return (runs[2].correct && runs[3].correct) ? 0 : 1;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+//Checks and times snapshot ordering, run with "SaveBackupManager.exe benchmark-sort [count]".
+// Generates count snapshot names (some sharing a second, so they carry a sequence number), shuffles them as full paths
+// and checks SortSnapshotNames puts them back in order, next to the old parse-on-every-comparison sort for timing.
+
+#include <cstddef>
+
+#define SORT_BENCHMARK_DEFAULT_COUNT 5000
+
+int RunSortBenchmark(size_t snapshot_count);
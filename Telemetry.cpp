@@ -0,0 +1,371 @@
+#include "Telemetry.h"
+#include "JsonWriter.h"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+std::atomic<bool> telemetry_enabled(false);
+
+namespace
+{
+    struct PhaseTotals
+    {
+        uint64_t runs = 0;
+        uint64_t total_time = 0;        //nanoseconds, summed over every thread that ran the phase
+        uint64_t max_time = 0;
+    };
+
+    struct GameTotals
+    {
+        uint64_t runs = 0;
+        uint64_t total_time = 0;
+        size_t files_written = 0;
+        size_t files_reused = 0;
+        uint64_t bytes_written = 0;
+    };
+
+    struct TraceEvent
+    {
+        const char* name = nullptr;
+        std::string game_name;
+        uint32_t thread_id = 0;
+        uint64_t start_time = 0;
+        uint64_t duration = 0;
+    };
+
+    struct TelemetryState
+    {
+        std::mutex mutex;
+        bool started = false;
+        std::chrono::steady_clock::time_point epoch;
+        std::filesystem::path trace_path;               //empty when no trace was asked for
+
+        std::vector<std::pair<std::string, PhaseTotals>> phases;    //in the order they first finished, there are only a handful
+        std::map<std::string, GameTotals> games;
+        std::vector<TraceEvent> trace_events;
+
+        //File copies are counted without the lock, there can be thousands a second from every worker at once.
+        std::atomic<uint64_t> copy_buckets[TELEMETRY_HISTOGRAM_BUCKETS] = {};
+        std::atomic<uint64_t> copy_count{ 0 };
+        std::atomic<uint64_t> copy_bytes{ 0 };
+        std::atomic<uint64_t> copy_total_time{ 0 };
+        std::atomic<uint64_t> copy_max_time{ 0 };
+
+        std::atomic<uint32_t> next_thread_id{ 1 };
+    };
+
+    TelemetryState state;
+
+    //Small numbers for the trace's thread lanes, handed out the first time a thread finishes a phase.
+    uint32_t TraceThreadId()
+    {
+        thread_local uint32_t thread_id = 0;
+        if (thread_id == 0)
+        {
+            thread_id = state.next_thread_id.fetch_add(1);
+        }
+        return thread_id;
+    }
+
+    void UpdateMaximum(std::atomic<uint64_t>& maximum, uint64_t value)
+    {
+        uint64_t current = maximum.load(std::memory_order_relaxed);
+        while (value > current && !maximum.compare_exchange_weak(current, value, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    size_t HistogramBucket(uint64_t duration)
+    {
+        const uint64_t microseconds = duration / 1000;
+        size_t bucket = 0;
+        while (bucket + 1 < TELEMETRY_HISTOGRAM_BUCKETS && (microseconds >> (bucket + 1)) != 0)
+        {
+            bucket++;
+        }
+        return bucket;
+    }
+
+    std::string FormatMicroseconds(uint64_t microseconds)
+    {
+        if (microseconds < 1000)
+        {
+            return std::to_string(microseconds) + " us";
+        }
+        if (microseconds < 1000 * 1000)
+        {
+            return std::to_string(microseconds / 1000) + " ms";
+        }
+        return std::to_string(microseconds / (1000 * 1000)) + " s";
+    }
+
+    //Upper bound of the bucket the given share of copies falls in.
+    std::string HistogramPercentile(const uint64_t (&buckets)[TELEMETRY_HISTOGRAM_BUCKETS], uint64_t count, double share)
+    {
+        const uint64_t rank = static_cast<uint64_t>(count * share);
+        uint64_t seen = 0;
+        for (size_t bucket = 0; bucket < TELEMETRY_HISTOGRAM_BUCKETS; bucket++)
+        {
+            seen += buckets[bucket];
+            if (seen > rank)
+            {
+                return (bucket + 1 < TELEMETRY_HISTOGRAM_BUCKETS) ? "< " + FormatMicroseconds(2ull << bucket) : ">= " + FormatMicroseconds(1ull << bucket);
+            }
+        }
+        return "-";
+    }
+
+    void PrintPhases(std::ostream& output)
+    {
+        output << std::left << std::setw(30) << "Phase" << std::right << std::setw(10) << "Runs" << std::setw(12) << "Seconds" << std::setw(12) << "Avg ms"
+               << std::setw(12) << "Max ms" << std::endl;
+        output << std::string(76, '-') << std::endl;
+        for (const auto& phase : state.phases)
+        {
+            output << std::left << std::setw(30) << phase.first << std::right << std::setw(10) << phase.second.runs << std::fixed << std::setprecision(3)
+                   << std::setw(12) << phase.second.total_time / 1e9 << std::setprecision(1)
+                   << std::setw(12) << phase.second.total_time / 1e6 / phase.second.runs
+                   << std::setw(12) << phase.second.max_time / 1e6 << std::endl;
+        }
+        output << "(phases running on several threads at once add up to more seconds than the run took)" << std::endl;
+    }
+
+    void PrintGames(std::ostream& output)
+    {
+        output << std::left << std::setw(30) << "Game" << std::right << std::setw(10) << "Seconds" << std::setw(12) << "Written" << std::setw(12) << "Reused"
+               << std::setw(12) << "MB written" << std::endl;
+        output << std::string(76, '-') << std::endl;
+        for (const auto& game : state.games)
+        {
+            output << std::left << std::setw(30) << game.first << std::right << std::fixed << std::setprecision(3) << std::setw(10) << game.second.total_time / 1e9
+                   << std::setw(12) << game.second.files_written << std::setw(12) << game.second.files_reused
+                   << std::setprecision(1) << std::setw(12) << game.second.bytes_written / (1024.0 * 1024.0) << std::endl;
+        }
+    }
+
+    void PrintFileCopies(std::ostream& output)
+    {
+        uint64_t buckets[TELEMETRY_HISTOGRAM_BUCKETS];
+        for (size_t bucket = 0; bucket < TELEMETRY_HISTOGRAM_BUCKETS; bucket++)
+        {
+            buckets[bucket] = state.copy_buckets[bucket].load();
+        }
+        const uint64_t count = state.copy_count.load();
+
+        output << "File copies: " << count << ", " << std::fixed << std::setprecision(1) << state.copy_bytes.load() / (1024.0 * 1024.0) << " MB, average "
+               << std::setprecision(3) << (count > 0 ? state.copy_total_time.load() / 1e6 / count : 0.0) << " ms, slowest " << state.copy_max_time.load() / 1e6 << " ms" << std::endl;
+        if (count == 0)
+        {
+            return;
+        }
+
+        output << "p50 " << HistogramPercentile(buckets, count, 0.50) << ", p90 " << HistogramPercentile(buckets, count, 0.90)
+               << ", p99 " << HistogramPercentile(buckets, count, 0.99) << std::endl;
+
+        //Only the range that has any copies in it.
+        size_t first = 0;
+        size_t last = TELEMETRY_HISTOGRAM_BUCKETS - 1;
+        while (buckets[first] == 0)
+        {
+            first++;
+        }
+        while (buckets[last] == 0)
+        {
+            last--;
+        }
+
+        for (size_t bucket = first; bucket <= last; bucket++)
+        {
+            const std::string range = (bucket == 0) ? "< 2 us" :
+                                      (bucket + 1 == TELEMETRY_HISTOGRAM_BUCKETS) ? ">= " + FormatMicroseconds(1ull << bucket) :
+                                      FormatMicroseconds(1ull << bucket) + " - " + FormatMicroseconds(2ull << bucket);
+            const size_t bar = static_cast<size_t>((buckets[bucket] * 40 + count - 1) / count);
+            output << std::left << std::setw(20) << range << std::right << std::setw(10) << buckets[bucket] << "  " << std::string(bar, '#') << std::endl;
+        }
+    }
+
+    bool WriteTrace(const std::filesystem::path& trace_path)
+    {
+        std::ofstream output(trace_path, std::ios::binary | std::ios::trunc);
+        if (!output.is_open())
+        {
+            return false;
+        }
+
+        //Chrome's trace event format, complete ("X") events with times in microseconds.
+        JsonWriter json(output);
+        json.BeginObject();
+        json.Key("displayTimeUnit");
+        json.String("ms");
+        json.Key("traceEvents");
+        json.BeginArray();
+        for (const auto& event : state.trace_events)
+        {
+            json.BeginObject();
+            json.Key("name");
+            json.String(event.name);
+            json.Key("ph");
+            json.String("X");
+            json.Key("pid");
+            json.Number(static_cast<uint64_t>(1));
+            json.Key("tid");
+            json.Number(static_cast<uint64_t>(event.thread_id));
+            json.Key("ts");
+            json.Number(event.start_time / 1000);
+            json.Key("dur");
+            json.Number(event.duration / 1000);
+            if (!event.game_name.empty())
+            {
+                json.Key("args");
+                json.BeginObject();
+                json.Key("game");
+                json.String(event.game_name);
+                json.EndObject();
+            }
+            json.EndObject();
+        }
+        json.EndArray();
+        json.EndObject();
+
+        output.close();
+        return static_cast<bool>(output);
+    }
+}
+
+void StartTelemetry(const BackupSettings& settings)
+{
+    std::lock_guard<std::mutex> lock(state.mutex);
+
+    state.started = settings.telemetry;
+    state.trace_path = settings.telemetry_trace_path.empty() ? std::filesystem::path() : std::filesystem::u8path(settings.telemetry_trace_path);
+    state.phases.clear();
+    state.games.clear();
+    state.trace_events.clear();
+    for (auto& bucket : state.copy_buckets)
+    {
+        bucket = 0;
+    }
+    state.copy_count = 0;
+    state.copy_bytes = 0;
+    state.copy_total_time = 0;
+    state.copy_max_time = 0;
+    state.epoch = std::chrono::steady_clock::now();
+
+    telemetry_enabled = state.started;
+}
+
+void FinishTelemetry(std::ostream& output)
+{
+    telemetry_enabled = false;
+
+    std::lock_guard<std::mutex> lock(state.mutex);
+    if (!state.started)
+    {
+        return;
+    }
+    state.started = false;
+
+    output << std::endl;
+    if (!state.phases.empty())
+    {
+        PrintPhases(output);
+        output << std::endl;
+    }
+    if (!state.games.empty())
+    {
+        PrintGames(output);
+        output << std::endl;
+    }
+    PrintFileCopies(output);
+
+    if (!state.trace_path.empty())
+    {
+        if (WriteTrace(state.trace_path))
+        {
+            output << "Trace written to " << state.trace_path << "." << std::endl;
+        }
+        else
+        {
+            output << "Unable to write the trace to " << state.trace_path << "." << std::endl;
+        }
+    }
+    output << std::endl;
+}
+
+uint64_t TelemetryTimestamp()
+{
+    if (!TelemetryEnabled())
+    {
+        return 0;
+    }
+
+    //Offset by one so a time stamp taken in the very first nanosecond still isn't mistaken for "off".
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - state.epoch).count()) + 1;
+}
+
+void RecordFileCopy(uint64_t start_time, uint64_t bytes)
+{
+    const uint64_t end_time = TelemetryTimestamp();
+    if (start_time == 0 || end_time == 0)
+    {
+        return;
+    }
+
+    const uint64_t duration = end_time - start_time;
+    state.copy_buckets[HistogramBucket(duration)].fetch_add(1, std::memory_order_relaxed);
+    state.copy_count.fetch_add(1, std::memory_order_relaxed);
+    state.copy_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    state.copy_total_time.fetch_add(duration, std::memory_order_relaxed);
+    UpdateMaximum(state.copy_max_time, duration);
+}
+
+void RecordGameTotals(const std::string& game_name, uint64_t start_time, size_t files_written, size_t files_reused, uint64_t bytes_written)
+{
+    const uint64_t end_time = TelemetryTimestamp();
+    if (start_time == 0 || end_time == 0)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(state.mutex);
+    GameTotals& totals = state.games[game_name];
+    totals.runs++;
+    totals.total_time += end_time - start_time;
+    totals.files_written += files_written;
+    totals.files_reused += files_reused;
+    totals.bytes_written += bytes_written;
+}
+
+void TelemetryPhase::Finish()
+{
+    const uint64_t end_time = TelemetryTimestamp();
+    if (end_time == 0)
+    {
+        return;
+    }
+    const uint64_t duration = end_time - start_time;
+    const uint32_t thread_id = TraceThreadId();
+
+    std::lock_guard<std::mutex> lock(state.mutex);
+    auto phase = std::find_if(state.phases.begin(), state.phases.end(), [this](const std::pair<std::string, PhaseTotals>& phase) { return phase.first == name; });
+    if (phase == state.phases.end())
+    {
+        state.phases.emplace_back(name, PhaseTotals());
+        phase = state.phases.end() - 1;
+    }
+    phase->second.runs++;
+    phase->second.total_time += duration;
+    phase->second.max_time = std::max(phase->second.max_time, duration);
+
+    if (!state.trace_path.empty())
+    {
+        state.trace_events.push_back({ name, std::move(game_name), thread_id, start_time, duration });
+    }
+}
@@ -0,0 +1,191 @@
+#include "ThreadPool.h"
+
+#include <chrono>
+
+namespace
+{
+    //Which pool/queue the current thread works for, so tasks submitted from inside a task stay local.
+    thread_local const ThreadPool* current_pool = nullptr;
+    thread_local size_t current_worker_index = 0;
+}
+
+ThreadPool::ThreadPool(size_t thread_count)
+{
+    if (thread_count == 0)
+    {
+        thread_count = std::thread::hardware_concurrency();
+        if (thread_count == 0)
+        {
+            thread_count = 4;
+        }
+    }
+
+    for (size_t i = 0; i < thread_count; i++)
+    {
+        queues.push_back(std::make_unique<WorkerQueue>());
+    }
+
+    for (size_t i = 0; i < thread_count; i++)
+    {
+        workers.emplace_back(&ThreadPool::WorkerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        stopping = true;
+    }
+    wake_condition.notify_all();
+
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+}
+
+void ThreadPool::Submit(std::function<void()> task)
+{
+    size_t queue_index;
+    if (current_pool == this)
+    {
+        queue_index = current_worker_index;
+    }
+    else
+    {
+        queue_index = next_queue.fetch_add(1) % queues.size();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(queues[queue_index]->mutex);
+        queues[queue_index]->tasks.push_back(std::move(task));
+    }
+
+    {
+        //Taken so a worker can't check queued_tasks and then go to sleep in between the increment and the notify.
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        queued_tasks++;
+    }
+    wake_condition.notify_one();
+}
+
+bool ThreadPool::TakeTask(size_t preferred_queue, std::function<void()>& task)
+{
+    //Own queue first, newest task first (its data is most likely still in cache).
+    {
+        WorkerQueue& own = *queues[preferred_queue];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty())
+        {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            queued_tasks--;
+            return true;
+        }
+    }
+
+    //Otherwise steal the oldest task from another queue, which tends to be the biggest piece of work left there.
+    for (size_t offset = 1; offset < queues.size(); offset++)
+    {
+        WorkerQueue& victim = *queues[(preferred_queue + offset) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty())
+        {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            queued_tasks--;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool ThreadPool::RunPendingTask()
+{
+    const size_t preferred_queue = (current_pool == this) ? current_worker_index : next_queue.load() % queues.size();
+
+    std::function<void()> task;
+    if (!TakeTask(preferred_queue, task))
+    {
+        return false;
+    }
+
+    task();
+    return true;
+}
+
+void ThreadPool::WorkerLoop(size_t worker_index)
+{
+    current_pool = this;
+    current_worker_index = worker_index;
+
+    while (true)
+    {
+        std::function<void()> task;
+        if (TakeTask(worker_index, task))
+        {
+            task();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(wake_mutex);
+        wake_condition.wait(lock, [this] { return stopping || queued_tasks > 0; });
+        if (stopping && queued_tasks == 0)
+        {
+            return;
+        }
+    }
+}
+
+TaskGroup::TaskGroup(ThreadPool& pool)
+    : pool(pool)
+{
+}
+
+TaskGroup::~TaskGroup()
+{
+    //Tasks capture things by reference from the scope that owns the group, they must all be done before it goes away.
+    Wait();
+}
+
+void TaskGroup::Run(std::function<void()> task)
+{
+    outstanding++;
+    pool.Submit([this, task = std::move(task)]
+    {
+        try
+        {
+            task();
+        }
+        catch (...)
+        {
+        }
+
+        std::lock_guard<std::mutex> lock(done_mutex);
+        if (--outstanding == 0)
+        {
+            done_condition.notify_all();
+        }
+    });
+}
+
+void TaskGroup::Wait()
+{
+    while (outstanding > 0)
+    {
+        if (pool.RunPendingTask())
+        {
+            continue;
+        }
+
+        //Nothing to help with, the remaining tasks are running elsewhere.  The timeout covers tasks that get queued
+        // (and could be helped with) while we sleep.
+        std::unique_lock<std::mutex> lock(done_mutex);
+        done_condition.wait_for(lock, std::chrono::milliseconds(1), [this] { return outstanding == 0; });
+    }
+
+    //The last task decrements under the lock, so taking it once more guarantees that task is done touching this group.
+    std::lock_guard<std::mutex> lock(done_mutex);
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+//Small work-stealing thread pool used to back up several games (and the files inside them) at the same time.
+// Every worker owns a deque: it pushes and pops its own work at the back and, when it runs dry, steals from the front of
+// someone else's.  Tasks started from inside a task land on the current worker's deque, so a game's files stay on the
+// thread that walked the game until other threads go idle and take some.
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+    //0 threads means one per hardware thread.
+    explicit ThreadPool(size_t thread_count = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void Submit(std::function<void()> task);
+
+    //Runs one queued task on the calling thread if there is one.  Used to help out instead of sleeping while waiting on tasks.
+    bool RunPendingTask();
+
+    size_t ThreadCount() const { return workers.size(); }
+
+private:
+    struct WorkerQueue
+    {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void WorkerLoop(size_t worker_index);
+    bool TakeTask(size_t preferred_queue, std::function<void()>& task);
+
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    std::vector<std::thread> workers;
+
+    std::mutex wake_mutex;
+    std::condition_variable wake_condition;
+    std::atomic<size_t> queued_tasks{ 0 };
+    std::atomic<size_t> next_queue{ 0 };
+    bool stopping = false;
+};
+
+//Set of tasks that can be waited on together.  Waiting runs other queued tasks meanwhile, so tasks can wait on their own
+// sub-tasks without tying up a worker (and without deadlocking when every worker is waiting).
+class TaskGroup
+{
+public:
+    explicit TaskGroup(ThreadPool& pool);
+    ~TaskGroup();
+
+    //Exceptions thrown by a task are swallowed so one bad task can't take down a worker thread, tasks report their own errors.
+    void Run(std::function<void()> task);
+    void Wait();
+
+private:
+    ThreadPool& pool;
+    std::atomic<size_t> outstanding{ 0 };
+    std::mutex done_mutex;
+    std::condition_variable done_condition;
+};
@@ -0,0 +1,183 @@
+#include "Timestamps.h"
+
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#define SNAPSHOT_NAME_PREFIX "Backup - "
+
+namespace
+{
+    //Parses "Backup - YYYY-MM-DD HHhMMmSSs" with an optional " (N)" after it.  Written out by hand because this runs for every
+    // snapshot of every game, and sscanf went through the locale machinery twice per comparison.
+    bool ParseSnapshotName(const std::string& folder_name, int fields[6], uint32_t& sequence)
+    {
+        //Callers used to pass full paths, where the prefix never matched.  Only the folder name counts.
+        const size_t name_start = folder_name.find_last_of("/\\");
+        size_t position = (name_start == std::string::npos) ? 0 : name_start + 1;
+
+        if (folder_name.compare(position, sizeof(SNAPSHOT_NAME_PREFIX) - 1, SNAPSHOT_NAME_PREFIX) != 0)
+        {
+            return false;
+        }
+        position += sizeof(SNAPSHOT_NAME_PREFIX) - 1;
+
+        auto read_number = [&](int& value)
+        {
+            const size_t start = position;
+            value = 0;
+            while (position < folder_name.size() && position - start < 9 && folder_name[position] >= '0' && folder_name[position] <= '9')
+            {
+                value = value * 10 + (folder_name[position] - '0');
+                position++;
+            }
+            return position > start;
+        };
+
+        auto expect = [&](char separator)
+        {
+            if (position < folder_name.size() && folder_name[position] == separator)
+            {
+                position++;
+                return true;
+            }
+            return false;
+        };
+
+        if (!read_number(fields[0]) || !expect('-') || !read_number(fields[1]) || !expect('-') || !read_number(fields[2]) || !expect(' ') ||
+            !read_number(fields[3]) || !expect('h') || !read_number(fields[4]) || !expect('m') || !read_number(fields[5]) || !expect('s'))
+        {
+            return false;
+        }
+
+        sequence = 0;
+        if (position < folder_name.size())
+        {
+            int sequence_number = 0;
+            if (!expect(' ') || !expect('(') || !read_number(sequence_number) || !expect(')') || position != folder_name.size())
+            {
+                return false;
+            }
+            sequence = static_cast<uint32_t>(sequence_number);
+        }
+
+        return true;
+    }
+}
+
+SnapshotId SnapshotId::FromName(const std::string& folder_name)
+{
+    SnapshotId id;
+
+    const size_t name_start = folder_name.find_last_of("/\\");
+    id.name = (name_start == std::string::npos) ? folder_name : folder_name.substr(name_start + 1);
+
+    int fields[6];
+    uint32_t sequence = 0;
+    if (ParseSnapshotName(id.name, fields, sequence))
+    {
+        //year 14 bits, month 4, day 5, hour 5, minute 6, second 6, then 24 bits of sequence.
+        const int field_bits[6] = { 14, 4, 5, 5, 6, 6 };
+        for (int i = 0; i < 6; i++)
+        {
+            const uint64_t field_max = (1ull << field_bits[i]) - 1;
+            id.key = (id.key << field_bits[i]) | std::min<uint64_t>(static_cast<uint64_t>(fields[i]), field_max);
+        }
+        id.key = (id.key << 24) | std::min<uint32_t>(sequence, 0xffffff);
+    }
+
+    return id;
+}
+
+//Gets current time as a string
+std::string GetCurrentDateTimeAsString() {
+
+
+    // Get the current time
+    auto currentTime = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+
+    std::stringstream ss;
+
+    // Convert the time to a struct tm using localtime_s
+    struct std::tm timeInfo = {};
+    if (localtime_s(&timeInfo, &currentTime) == 0)
+    {
+        // Create a stringstream to format the date and time
+        ss << std::put_time(&timeInfo, "%Y-%m-%d %Hh%Mm%Ss");
+    }
+    else
+    {
+        // Handle the case where localtime fails
+        std::cerr << "Error getting local time." << std::endl;
+    }
+    // Convert stringstream to string
+    return ss.str();
+}
+
+bool IsStagingName(const std::string& folder_name)
+{
+    const size_t suffix_length = sizeof(SNAPSHOT_STAGING_SUFFIX) - 1;
+    return folder_name.size() > suffix_length && folder_name.compare(folder_name.size() - suffix_length, suffix_length, SNAPSHOT_STAGING_SUFFIX) == 0;
+}
+
+std::string NewSnapshotName(const std::filesystem::path& backup_folder)
+{
+    const std::string base_name = SNAPSHOT_NAME_PREFIX + GetCurrentDateTimeAsString();
+
+    std::string name = base_name;
+    for (int sequence = 2; std::filesystem::exists(backup_folder / std::filesystem::u8path(name)) ||
+                           std::filesystem::exists(backup_folder / std::filesystem::u8path(name + SNAPSHOT_STAGING_SUFFIX)); sequence++)
+    {
+        name = base_name + " (" + std::to_string(sequence) + ")";
+    }
+    return name;
+}
+
+std::time_t ParseBackupTimestamp(const std::string& backup_name)
+{
+    int fields[6];
+    uint32_t sequence = 0;
+    if (!ParseSnapshotName(backup_name, fields, sequence))
+    {
+        return -1;
+    }
+
+    std::tm timestamp = {};
+    timestamp.tm_year = fields[0] - 1900; // Adjust year
+    timestamp.tm_mon = fields[1] - 1;     // Adjust month
+    timestamp.tm_mday = fields[2];
+    timestamp.tm_hour = fields[3];
+    timestamp.tm_min = fields[4];
+    timestamp.tm_sec = fields[5];
+    timestamp.tm_isdst = -1;
+    return std::mktime(&timestamp);
+}
+
+void SortSnapshotNames(std::vector<std::string>& names)
+{
+    //Decorate, sort on the keys, undecorate.
+    std::vector<SnapshotId> ids;
+    ids.reserve(names.size());
+    for (const auto& name : names)
+    {
+        ids.push_back(SnapshotId::FromName(name));
+    }
+
+    std::vector<size_t> order(names.size());
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return ids[a] < ids[b]; });
+
+    std::vector<std::string> sorted_names;
+    sorted_names.reserve(names.size());
+    for (size_t index : order)
+    {
+        sorted_names.push_back(std::move(names[index]));
+    }
+    names = std::move(sorted_names);
+}
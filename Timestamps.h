@@ -0,0 +1,45 @@
+#pragma once
+
+//Helpers for the "Backup - <date time>" names snapshot folders are given.
+
+#include <cstdint>
+#include <ctime>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+//A snapshot is written under its name plus this suffix and only renamed to its real name once it's complete, so anything
+// still carrying the suffix was cut off part way and is never a usable snapshot.
+#define SNAPSHOT_STAGING_SUFFIX ".partial"
+
+//Identity of a snapshot folder: "Backup - YYYY-MM-DD HHhMMmSSs", plus " (N)" when an earlier backup already took that second.
+// The name is parsed once into a key that sorts in time order, so sorting never re-parses names inside the comparison.
+struct SnapshotId
+{
+    std::string name;       //folder name only
+    uint64_t key = 0;       //date and time fields packed most significant first, sequence in the low bits.  0 when the name has no time stamp.
+
+    //Accepts a full path as well, only the last component is parsed.
+    static SnapshotId FromName(const std::string& folder_name);
+
+    bool operator<(const SnapshotId& other) const
+    {
+        return (key != other.key) ? (key < other.key) : (name < other.name);
+    }
+};
+
+//True for a snapshot folder that is still being written or was abandoned, see SNAPSHOT_STAGING_SUFFIX.
+bool IsStagingName(const std::string& folder_name);
+
+//Gets current time as a string
+std::string GetCurrentDateTimeAsString();
+
+//Name for a new snapshot in backup_folder.  Normally just the current time, with a sequence number added if a snapshot was
+// already made this second (or one is still being written) so two backups can never end up in the same folder.
+std::string NewSnapshotName(const std::filesystem::path& backup_folder);
+
+//Time a "Backup - <date time>" folder name stands for (local time), -1 if the name doesn't have one.
+std::time_t ParseBackupTimestamp(const std::string& backup_name);
+
+//Sorts snapshot folder names (or paths) oldest first, parsing each one once.
+void SortSnapshotNames(std::vector<std::string>& names);
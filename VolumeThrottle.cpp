@@ -0,0 +1,204 @@
+#include "VolumeThrottle.h"
+
+#include <algorithm>
+#include <cctype>
+
+#define NOMINMAX
+#include <Windows.h>
+#include <winioctl.h>
+
+VolumeThrottle::VolumeThrottle(const std::unordered_map<std::string, int>& configured_limits, int default_limit)
+    : default_limit(default_limit)
+{
+    for (const auto& limit : configured_limits)
+    {
+        std::string volume_name = limit.first;
+        std::transform(volume_name.begin(), volume_name.end(), volume_name.begin(), [](unsigned char c) { return static_cast<char>(std::toupper(c)); });
+        this->configured_limits[volume_name] = limit.second;
+    }
+}
+
+std::string VolumeThrottle::VolumeOf(const std::filesystem::path& path)
+{
+    std::error_code error;
+    std::filesystem::path absolute_path = std::filesystem::absolute(path, error);
+    std::string volume_name = (error ? path : absolute_path).root_name().string();
+
+    std::transform(volume_name.begin(), volume_name.end(), volume_name.begin(), [](unsigned char c) { return static_cast<char>(std::toupper(c)); });
+    std::replace(volume_name.begin(), volume_name.end(), '/', '\\');
+    return volume_name;
+}
+
+int VolumeThrottle::LimitFor(const std::string& volume_name) const
+{
+    auto configured = configured_limits.find(volume_name);
+    if (configured != configured_limits.end() && configured->second > 0)
+    {
+        return configured->second;
+    }
+
+    if (default_limit > 0)
+    {
+        return default_limit;
+    }
+
+    return DetectVolumeConcurrency(volume_name);
+}
+
+VolumeThrottle::Volume& VolumeThrottle::GetVolume(const std::string& volume_name)
+{
+    std::lock_guard<std::mutex> lock(volumes_mutex);
+
+    auto found = volumes.find(volume_name);
+    if (found != volumes.end())
+    {
+        return *found->second;
+    }
+
+    auto volume = std::make_unique<Volume>();
+    volume->available = LimitFor(volume_name);
+
+    Volume& result = *volume;
+    volumes[volume_name] = std::move(volume);
+    return result;
+}
+
+std::vector<std::string> VolumeThrottle::LockOrder(const std::vector<std::filesystem::path>& paths)
+{
+    std::vector<std::string> volume_names;
+    for (const auto& path : paths)
+    {
+        volume_names.push_back(VolumeOf(path));
+    }
+
+    //Always take volumes in the same order and only once each, so two copies going C: -> D: and D: -> C: can't deadlock.
+    std::sort(volume_names.begin(), volume_names.end());
+    volume_names.erase(std::unique(volume_names.begin(), volume_names.end()), volume_names.end());
+    return volume_names;
+}
+
+VolumeThrottle::Slots VolumeThrottle::Acquire(const std::vector<std::filesystem::path>& paths)
+{
+    Slots slots;
+    slots.owner = this;
+    for (const auto& volume_name : LockOrder(paths))
+    {
+        Volume& volume = GetVolume(volume_name);
+
+        std::unique_lock<std::mutex> lock(volume.mutex);
+        volume.slot_freed.wait(lock, [&volume] { return volume.available > 0; });
+        volume.available--;
+
+        slots.volumes.push_back(volume_name);
+    }
+
+    return slots;
+}
+
+bool VolumeThrottle::TryAcquire(const std::vector<std::filesystem::path>& paths, Slots& slots)
+{
+    Slots taken;
+    taken.owner = this;
+    for (const auto& volume_name : LockOrder(paths))
+    {
+        Volume& volume = GetVolume(volume_name);
+
+        //Giving up hands back the volumes already taken when `taken` goes out of scope.
+        std::lock_guard<std::mutex> lock(volume.mutex);
+        if (volume.available <= 0)
+        {
+            return false;
+        }
+        volume.available--;
+
+        taken.volumes.push_back(volume_name);
+    }
+
+    slots = std::move(taken);
+    return true;
+}
+
+void VolumeThrottle::Release(const std::string& volume_name)
+{
+    Volume& volume = GetVolume(volume_name);
+    {
+        std::lock_guard<std::mutex> lock(volume.mutex);
+        volume.available++;
+    }
+    volume.slot_freed.notify_one();
+}
+
+VolumeThrottle::Slots::Slots(Slots&& other) noexcept
+    : owner(other.owner), volumes(std::move(other.volumes))
+{
+    other.owner = nullptr;
+    other.volumes.clear();
+}
+
+VolumeThrottle::Slots& VolumeThrottle::Slots::operator=(Slots&& other) noexcept
+{
+    if (this != &other)
+    {
+        Release();
+        owner = other.owner;
+        volumes = std::move(other.volumes);
+        other.owner = nullptr;
+        other.volumes.clear();
+    }
+    return *this;
+}
+
+VolumeThrottle::Slots::~Slots()
+{
+    Release();
+}
+
+void VolumeThrottle::Slots::Release()
+{
+    if (owner != nullptr)
+    {
+        for (const auto& volume_name : volumes)
+        {
+            owner->Release(volume_name);
+        }
+    }
+    owner = nullptr;
+    volumes.clear();
+}
+
+int DetectVolumeConcurrency(const std::string& volume_name)
+{
+    //Only drive letters can be opened as a device, network shares and the like get the conservative default.
+    if (volume_name.size() != 2 || volume_name[1] != ':')
+    {
+        return UNKNOWN_VOLUME_CONCURRENCY;
+    }
+
+    std::wstring device_path = L"\\\\.\\";
+    device_path.push_back(static_cast<wchar_t>(volume_name[0]));
+    device_path.push_back(L':');
+
+    //No access rights needed just to query properties, so this works without running as administrator.
+    HANDLE device = CreateFileW(device_path.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+    if (device == INVALID_HANDLE_VALUE)
+    {
+        return UNKNOWN_VOLUME_CONCURRENCY;
+    }
+
+    STORAGE_PROPERTY_QUERY query = {};
+    query.PropertyId = StorageDeviceSeekPenaltyProperty;
+    query.QueryType = PropertyStandardQuery;
+
+    DEVICE_SEEK_PENALTY_DESCRIPTOR seek_penalty = {};
+    DWORD bytes_returned = 0;
+    BOOL succeeded = DeviceIoControl(device, IOCTL_STORAGE_QUERY_PROPERTY, &query, sizeof(query),
+                                     &seek_penalty, sizeof(seek_penalty), &bytes_returned, NULL);
+    CloseHandle(device);
+
+    if (!succeeded || bytes_returned < sizeof(seek_penalty))
+    {
+        return UNKNOWN_VOLUME_CONCURRENCY;
+    }
+
+    return seek_penalty.IncursSeekPenalty ? ROTATIONAL_VOLUME_CONCURRENCY : SOLID_STATE_VOLUME_CONCURRENCY;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+//Caps how many file copies can hit the same drive at once.  An SSD is happy with many streams in flight, a spinning disk
+// just seeks back and forth between them and gets slower than copying one file at a time.
+
+#include <condition_variable>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//Streams per drive when nothing is configured and the drive type can be read.
+#define SOLID_STATE_VOLUME_CONCURRENCY 8
+#define ROTATIONAL_VOLUME_CONCURRENCY 1
+//Used when the drive type can't be determined (network shares, some USB enclosures).
+#define UNKNOWN_VOLUME_CONCURRENCY 2
+
+class VolumeThrottle
+{
+public:
+    //Limits configured for specific volumes ("C:", "D:", ...) win, then default_limit, and when that is 0 the drive is asked
+    // whether it incurs a seek penalty.
+    VolumeThrottle(const std::unordered_map<std::string, int>& configured_limits, int default_limit);
+
+    //Holds a slot on every volume it was acquired for until it goes out of scope.
+    class Slots
+    {
+    public:
+        Slots() = default;
+        Slots(Slots&& other) noexcept;
+        Slots& operator=(Slots&& other) noexcept;
+        ~Slots();
+
+    private:
+        friend class VolumeThrottle;
+        void Release();
+
+        VolumeThrottle* owner = nullptr;
+        std::vector<std::string> volumes;
+    };
+
+    //Blocks until a slot is free on the volume of every path given (the source and destination of a copy, usually).
+    Slots Acquire(const std::vector<std::filesystem::path>& paths);
+
+    //Same, but only if a slot is free on every volume right now, for the extra workers of a copy split between several.
+    // False and no slots taken otherwise, waiting could deadlock copies that already hold one.
+    bool TryAcquire(const std::vector<std::filesystem::path>& paths, Slots& slots);
+
+    //Upper cased root name, "C:" or "\\SERVER\SHARE".
+    static std::string VolumeOf(const std::filesystem::path& path);
+
+private:
+    struct Volume
+    {
+        std::mutex mutex;
+        std::condition_variable slot_freed;
+        int available = 0;
+    };
+
+    Volume& GetVolume(const std::string& volume_name);
+    static std::vector<std::string> LockOrder(const std::vector<std::filesystem::path>& paths);
+    void Release(const std::string& volume_name);
+    int LimitFor(const std::string& volume_name) const;
+
+    std::mutex volumes_mutex;
+    std::unordered_map<std::string, std::unique_ptr<Volume>> volumes;
+    std::unordered_map<std::string, int> configured_limits;
+    int default_limit;
+};
+
+//Asks Windows whether the drive holding the volume incurs a seek penalty and picks a stream count to match.
+int DetectVolumeConcurrency(const std::string& volume_name);